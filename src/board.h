@@ -0,0 +1,116 @@
+#pragma once
+/**
+    board.h - Hardware profiles of the motorcover PCB revisions
+    Author: Jason Chen, 2024
+
+    Pins, the sense resistor and the motor/encoder resolution of each PCB revision are constexpr
+    BoardProfiles, see the schematics in electronics/. BOARD is the profile of the revision the
+    firmware is built for, selected with BOARD_REVISION by the [env:v1_0] and [env:v1_1] targets
+    in platformio.ini; values derived from it are computed at compile time.
+
+    Each profile has MOTORS_MAX motor channels. Channel 0 is the driver and encoder on the PCB,
+    channel 1 is a second TMC2209 and AS5600 wired to free GPIOs:
+        (1) The driver shares the UART (TXD1/RXD1) at address 0b01, MS1 pulled high; its STBY is
+            tied low so standby only disables its coils
+        (2) The encoder has the same fixed I2C address as the first, so it is on the second I2C
+            controller (Wire1); that limits a controller to two motors
+    MOTOR_COUNT sets how many channels are used.
+**/
+#include <Arduino.h>
+
+
+#define BOARD_V1_0 10
+#define BOARD_V1_1 11
+
+#ifndef BOARD_REVISION
+    #define BOARD_REVISION BOARD_V1_1
+#endif
+
+#define MOTORS_MAX 2
+
+#ifndef MOTOR_COUNT
+    #define MOTOR_COUNT 1
+#endif
+
+
+typedef int8_t BoardPin;         // GPIO number
+constexpr BoardPin NO_PIN = -1;  // Not connected to the ESP32
+
+
+struct MotorChannel {
+    // Trinamic TMC2209 stepper motor driver
+    BoardPin   step;
+    BoardPin   dir;
+    BoardPin   diag;         // For StallGuard, high if detect error
+    BoardPin   stby;         // Pull high to disable TMC2209
+    float      r_sense;      // Ohm, sense resistor
+    uint8_t    driver_addr;  // UART address set by MS1/MS2
+
+    // AS5600 rotary encoder
+    BoardPin   scl;
+    BoardPin   sda;
+    uint8_t    i2c_bus;      // 0 = Wire, 1 = Wire1
+};
+
+
+struct BoardProfile {
+    const char *name;
+
+    // Peripherals
+    BoardPin   led;
+    BoardPin   button;
+
+    // UART shared by the TMC2209 drivers
+    BoardPin   txd1;          // For Serial1
+    BoardPin   rxd1;          // For Serial1
+
+    uint8_t    encoder_bits;  // AS5600 absolute position is 12-bit
+    uint16_t   full_steps;    // NEMA motors have 200 full steps/rev
+
+    MotorChannel motors[MOTORS_MAX];
+};
+
+
+constexpr BoardProfile BOARD_PROFILE_V1_0 = {
+    "v1.0",
+    GPIO_NUM_2, GPIO_NUM_0,
+    GPIO_NUM_22, GPIO_NUM_21,
+    12, 200,
+    {
+        {GPIO_NUM_19, GPIO_NUM_18, GPIO_NUM_27, NO_PIN, 0.12f, 0b00, GPIO_NUM_13, GPIO_NUM_14, 0},
+        {GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_32, NO_PIN, 0.12f, 0b01, GPIO_NUM_33, GPIO_NUM_4, 1}
+    }
+};
+
+constexpr BoardProfile BOARD_PROFILE_V1_1 = {
+    "v1.1",
+    GPIO_NUM_2, GPIO_NUM_0,
+    GPIO_NUM_22, GPIO_NUM_21,
+    12, 200,
+    {
+        {GPIO_NUM_16, GPIO_NUM_18, GPIO_NUM_23, GPIO_NUM_19, 0.12f, 0b00, GPIO_NUM_27, GPIO_NUM_14, 0},
+        {GPIO_NUM_25, GPIO_NUM_26, GPIO_NUM_32, NO_PIN, 0.12f, 0b01, GPIO_NUM_33, GPIO_NUM_4, 1}
+    }
+};
+
+
+#if BOARD_REVISION == BOARD_V1_0
+    constexpr BoardProfile BOARD = BOARD_PROFILE_V1_0;
+#elif BOARD_REVISION == BOARD_V1_1
+    constexpr BoardProfile BOARD = BOARD_PROFILE_V1_1;
+#else
+    #error "Unknown BOARD_REVISION"
+#endif
+
+
+constexpr int32_t ENCODER_POSITIONS = static_cast<int32_t>(1) << BOARD.encoder_bits;  // Per rev
+
+
+// Valid microsteps per full step of the TMC2209, powers of 2 up to 256
+constexpr bool isMicrosteps(int microsteps) {
+    return microsteps > 0 && microsteps <= 256 && (microsteps & (microsteps - 1)) == 0;
+}
+
+static_assert(BOARD.full_steps > 0, "Board profile needs the motor's full steps");
+static_assert(BOARD.encoder_bits > 0 && BOARD.encoder_bits < 16, "Encoder resolution out of range");
+static_assert(MOTOR_COUNT > 0 && MOTOR_COUNT <= MOTORS_MAX, "MOTOR_COUNT out of range");
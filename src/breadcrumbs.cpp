@@ -0,0 +1,139 @@
+#include "breadcrumbs.h"
+#include "journal.h"
+#include "logger.h"
+
+
+#define BREADCRUMB_MAGIC 0x42524344  // "BRCD"
+
+
+struct BreadcrumbStore {
+    uint32_t magic;
+    uint32_t next;  // Breadcrumbs recorded, the next one goes to next % BREADCRUMB_COUNT
+    Breadcrumb crumbs[BREADCRUMB_COUNT];
+    uint32_t heap_time;  // ms since boot
+    uint32_t heap_free;
+    uint32_t heap_min;   // Lowest free heap since boot
+};
+
+
+static RTC_NOINIT_ATTR BreadcrumbStore store;
+static portMUX_TYPE store_mux = portMUX_INITIALIZER_UNLOCKED;
+
+// The previous boot, oldest breadcrumb first
+static BreadcrumbStore previous;
+static size_t previous_count = 0;
+static bool   previous_valid = false;
+static esp_reset_reason_t reset_reason = ESP_RST_UNKNOWN;
+
+
+static bool isCrash(esp_reset_reason_t reason) {
+    return reason == ESP_RST_PANIC || reason == ESP_RST_INT_WDT || reason == ESP_RST_TASK_WDT
+        || reason == ESP_RST_WDT || reason == ESP_RST_BROWNOUT;
+}
+
+
+static String crumbTypeToString(uint8_t type) {
+    if (type == CRUMB_INIT) return "init";
+    else if (type == CRUMB_COMMAND) return "command";
+    else if (type == CRUMB_STATE) return "state";
+    return "none";
+}
+
+
+void breadcrumbsInit() {
+    reset_reason = esp_reset_reason();
+
+    // RTC memory holds garbage after a power-on reset
+    if (store.magic == BREADCRUMB_MAGIC && reset_reason != ESP_RST_POWERON) {
+        previous_count = min(store.next, static_cast<uint32_t>(BREADCRUMB_COUNT));
+        for (size_t i = 0; i < previous_count; i++) {
+            previous.crumbs[i] = store.crumbs[(store.next - previous_count + i) % BREADCRUMB_COUNT];
+            previous.crumbs[i].task[BREADCRUMB_TASK_SIZE - 1] = '\0';
+        }
+        previous.heap_time = store.heap_time;
+        previous.heap_free = store.heap_free;
+        previous.heap_min = store.heap_min;
+        previous_valid = true;
+    }
+
+    memset(&store, 0, sizeof(store));
+    store.magic = BREADCRUMB_MAGIC;
+    LOGI("Reset reason: %s, %u breadcrumbs from the previous boot",
+         resetReasonToString(reset_reason).c_str(), previous_count);
+}
+
+
+void breadcrumbsJournal() {
+    if (!previous_valid || !isCrash(reset_reason)) return;
+
+    for (size_t i = previous_count - min(previous_count, static_cast<size_t>(BREADCRUMB_JOURNALED));
+         i < previous_count; i++) {
+        const Breadcrumb &crumb = previous.crumbs[i];
+        if (crumb.type == CRUMB_COMMAND) {
+            journalRecord(EVENT_CRUMB_COMMAND, crumb.value, crumb.detail);
+        } else if (crumb.type == CRUMB_STATE) {
+            journalRecord(EVENT_CRUMB_STATE, crumb.value, crumb.detail);
+        }
+    }
+    journalRecord(EVENT_CRUMB_HEAP, previous.heap_free, previous.heap_min);
+}
+
+
+void breadcrumb(BreadcrumbType type, const char *task, int32_t value, int32_t detail) {
+    Breadcrumb crumb;
+    crumb.time = millis();
+    strncpy(crumb.task, task, BREADCRUMB_TASK_SIZE - 1);
+    crumb.task[BREADCRUMB_TASK_SIZE - 1] = '\0';
+    crumb.type = type;
+    crumb.value = value;
+    crumb.detail = detail;
+
+    portENTER_CRITICAL(&store_mux);
+    store.crumbs[store.next % BREADCRUMB_COUNT] = crumb;
+    store.next++;
+    portEXIT_CRITICAL(&store_mux);
+}
+
+
+void breadcrumbsHeap() {
+    uint32_t now = millis();
+    if (now - store.heap_time < BREADCRUMB_HEAP_PERIOD) return;
+    store.heap_free = ESP.getFreeHeap();
+    store.heap_min = ESP.getMinFreeHeap();
+    store.heap_time = now;
+}
+
+
+void breadcrumbsToJson(JsonObject report) {
+    report["reason"] = resetReasonToString(reset_reason);
+    if (!previous_valid) return;
+
+    report["heap"]["time"] = previous.heap_time;
+    report["heap"]["free"] = previous.heap_free;
+    report["heap"]["min"] = previous.heap_min;
+    JsonArray crumbs = report["breadcrumbs"].to<JsonArray>();
+    for (size_t i = 0; i < previous_count; i++) {
+        const Breadcrumb &crumb = previous.crumbs[i];
+        JsonObject entry = crumbs.add<JsonObject>();
+        entry["time"] = crumb.time;
+        entry["task"] = crumb.task;
+        entry["type"] = crumbTypeToString(crumb.type);
+        entry["value"] = crumb.value;
+        entry["detail"] = crumb.detail;
+    }
+}
+
+
+String resetReasonToString(esp_reset_reason_t reason) {
+    if (reason == ESP_RST_POWERON) return "power-on";
+    else if (reason == ESP_RST_EXT) return "external";
+    else if (reason == ESP_RST_SW) return "software";
+    else if (reason == ESP_RST_PANIC) return "panic";
+    else if (reason == ESP_RST_INT_WDT) return "interrupt-watchdog";
+    else if (reason == ESP_RST_TASK_WDT) return "task-watchdog";
+    else if (reason == ESP_RST_WDT) return "watchdog";
+    else if (reason == ESP_RST_DEEPSLEEP) return "deep-sleep";
+    else if (reason == ESP_RST_BROWNOUT) return "brownout";
+    else if (reason == ESP_RST_SDIO) return "sdio";
+    return "unknown";
+}
@@ -0,0 +1,55 @@
+#pragma once
+/**
+    breadcrumbs.h - Breadcrumbs of what the firmware was doing, kept through resets
+    Author: Jason Chen, 2024
+
+    A small ring of breadcrumbs (task startups, messages between tasks and task states) and the
+    latest heap stats are kept in RTC memory, which is not cleared by watchdog, panic, brownout or
+    software resets. On the next boot they are moved to RAM together with the reset reason, reported
+    in /json, and recorded in the journal if the reset was not intended.
+
+    breadcrumb() only takes a short critical section, so it is safe to call from any task.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+
+#define BREADCRUMB_COUNT       16
+#define BREADCRUMB_TASK_SIZE   12    // Bytes of the task name kept
+#define BREADCRUMB_JOURNALED   4     // Newest breadcrumbs recorded in the journal after a crash
+#define BREADCRUMB_HEAP_PERIOD 1000  // ms
+
+
+enum BreadcrumbType {
+    CRUMB_NONE    = 0,
+    CRUMB_INIT    = 1,  // Task created, value: stack depth, detail: core
+    CRUMB_COMMAND = 2,  // Message sent to the task, value: command, detail: parameter
+    CRUMB_STATE   = 3   // Task changed state, value and detail depend on the task
+};
+
+
+// Task states recorded with CRUMB_STATE, each task has its own range since the journal keeps no
+// task names
+#define CRUMB_MOTOR_IDLE       0x00  // detail: position %
+#define CRUMB_MOTOR_MOVING     0x01  // detail: position %
+#define CRUMB_MOTOR(state, index) ((state) | (index) << 2)  // Up to 4 motors in the range
+#define CRUMB_WIFI_CONNECTING  0x10  // detail: attempts
+#define CRUMB_WIFI_CONNECTED   0x11  // detail: RSSI
+#define CRUMB_WIFI_OTA         0x12  // detail: 0 started, 1 ended, -1 failed
+
+
+struct Breadcrumb {
+    uint32_t time;  // ms since boot
+    char     task[BREADCRUMB_TASK_SIZE];
+    uint8_t  type;
+    int32_t  value;
+    int32_t  detail;
+};
+
+
+void breadcrumbsInit();     // Call before any task is created
+void breadcrumbsJournal();  // Records the previous boot's breadcrumbs if it crashed
+void breadcrumb(BreadcrumbType type, const char *task, int32_t value, int32_t detail = 0);
+void breadcrumbsHeap();     // Keeps the heap stats if due
+void breadcrumbsToJson(JsonObject report);
+String resetReasonToString(esp_reset_reason_t reason);
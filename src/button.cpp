@@ -0,0 +1,101 @@
+#include "button.h"
+
+
+// The board has a single button
+STATIC_BUFFER(uint8_t, edge_queue_storage, BUTTON_QUEUE_LENGTH * sizeof(int64_t));
+STATIC_BUFFER(StaticQueue_t, edge_queue_buffer, 1);
+
+
+Button::Button(const uint8_t pin) : pin_{pin} {
+    edge_queue_ = createQueue(BUTTON_QUEUE_LENGTH, sizeof(int64_t), edge_queue_storage,
+                              edge_queue_buffer);
+    assert(edge_queue_ != NULL);
+}
+
+
+Button::~Button() {
+    detachInterrupt(pin_);
+    vQueueDelete(edge_queue_);
+}
+
+
+void Button::begin() {
+    pinMode(pin_, INPUT);
+    pressed_ = digitalRead(pin_) == LOW;
+    press_start_ = esp_timer_get_time();
+    attachInterrupt(pin_, std::bind(&Button::buttonInterrupt, this), CHANGE);
+}
+
+
+void IRAM_ATTR Button::buttonInterrupt() {
+    int64_t edge_time = esp_timer_get_time();
+    BaseType_t higher_priority_task_woken = pdFALSE;
+    // If the queue is full the edge is dropped, the level is sampled again after debouncing anyway
+    xQueueSendFromISR(edge_queue_, &edge_time, &higher_priority_task_woken);
+    if (higher_priority_task_woken == pdTRUE) {
+        portYIELD_FROM_ISR();
+    }
+}
+
+
+bool Button::getGesture(ButtonGesture &gesture) {
+    gesture = BUTTON_NONE;
+
+    int64_t edge_time;
+    while (xQueueReceive(edge_queue_, &edge_time, 0) == pdTRUE) {
+        if (burst_start_ == 0) {
+            burst_start_ = edge_time;
+        }
+        last_edge_ = edge_time;
+    }
+
+    int64_t now = esp_timer_get_time();
+
+    // Sample the pin once the edges have settled; the transition happened at the first edge
+    if (burst_start_ != 0 && now - last_edge_ >= BUTTON_DEBOUNCE * 1000) {
+        bool pressed = digitalRead(pin_) == LOW;
+        int64_t transition_time = burst_start_;
+        burst_start_ = 0;
+
+        if (pressed && !pressed_) {
+            pressed_ = true;
+            press_start_ = transition_time;
+        } else if (!pressed && pressed_) {
+            pressed_ = false;
+            press_duration_ = (transition_time - press_start_) / 1000;  // us to ms
+            if (press_duration_ >= BUTTON_LONG_PRESS) {
+                short_presses_ = 0;
+                gesture = BUTTON_LONG;
+                return true;
+            }
+            release_time_ = transition_time;
+            if (++short_presses_ == 2) {
+                short_presses_ = 0;
+                gesture = BUTTON_DOUBLE;
+                return true;
+            }
+        }
+    }
+
+    // A short press is only reported after making sure a second one isn't coming
+    if (short_presses_ == 1 && !pressed_ && now - release_time_ >= BUTTON_DOUBLE_PRESS * 1000) {
+        short_presses_ = 0;
+        gesture = BUTTON_SHORT;
+        return true;
+    }
+
+    return false;
+}
+
+
+int Button::getPressDuration() {
+    return press_duration_;
+}
+
+
+int Button::getHeldDuration() {
+    if (!pressed_) {
+        return 0;
+    }
+    return (esp_timer_get_time() - press_start_) / 1000;  // us to ms
+}
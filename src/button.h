@@ -0,0 +1,56 @@
+#pragma once
+/**
+    button.h - An interrupt-driven push button with debouncing and gesture recognition.
+    Author: Jason Chen, 2024
+
+    The GPIO interrupt only timestamps the edges of the button and pushes them into a FreeRTOS
+    queue, so no press is missed no matter how busy the owning task is, and the pin is not polled
+    when the button is idle. The owning task calls getGesture() in its loop, which debounces the
+    edges and recognizes the following gestures:
+        (1) BUTTON_SHORT  - a single press shorter than BUTTON_LONG_PRESS
+        (2) BUTTON_DOUBLE - two short presses within BUTTON_DOUBLE_PRESS of each other
+        (3) BUTTON_LONG   - a press longer than BUTTON_LONG_PRESS, reported on release, use
+                            getPressDuration() to tell how long it was held
+**/
+#include <Arduino.h>
+#include <FunctionalInterrupt.h>  // std:bind()
+#include "static_allocation.h"
+
+
+#define BUTTON_DEBOUNCE     30    // ms, edges closer than this are considered a single bounce
+#define BUTTON_DOUBLE_PRESS 400   // ms, max gap between two short presses
+#define BUTTON_LONG_PRESS   1000  // ms
+#define BUTTON_QUEUE_LENGTH 16
+
+
+enum ButtonGesture {
+    BUTTON_NONE   = 0,
+    BUTTON_SHORT  = 1,
+    BUTTON_DOUBLE = 2,
+    BUTTON_LONG   = 3
+};
+
+
+class Button {
+public:
+    Button(const uint8_t pin);
+    ~Button();
+    void begin();
+    bool getGesture(ButtonGesture &gesture);
+    int  getPressDuration();  // ms, duration of the last recognized press
+    int  getHeldDuration();   // ms, how long the button has been held, 0 if released
+
+private:
+    const uint8_t pin_;
+    QueueHandle_t edge_queue_;
+
+    bool    pressed_        = false;
+    int64_t press_start_    = 0;  // us
+    int64_t burst_start_    = 0;  // us, first edge of a bouncing sequence, 0 if settled
+    int64_t last_edge_      = 0;  // us
+    int64_t release_time_   = 0;  // us
+    int     short_presses_  = 0;
+    int     press_duration_ = 0;  // ms
+
+    void buttonInterrupt();
+};
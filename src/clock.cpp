@@ -0,0 +1,225 @@
+#define LOG_MODULE LOG_WIRELESS
+#include "clock.h"
+#include "logger.h"
+#include <WiFi.h>
+#include <AsyncUDP.h>
+#include <time.h>
+
+
+#define NTP_PACKET_SIZE 48
+#define NTP_TO_UNIX     2208988800UL  // s from 1900 to 1970
+
+
+// The model is guarded by clock_mux, the request state is only used by the wireless task
+static portMUX_TYPE clock_mux = portMUX_INITIALIZER_UNLOCKED;
+static bool    synced      = false;
+static int64_t base_local  = 0;  // us, esp_timer_get_time() the model starts from
+static int64_t base_time   = 0;  // us since epoch at base_local
+static float   rate        = 0;  // ppm, drift plus slewing
+static float   drift       = 0;  // ppm, esp_timer slower than the server if positive
+static int64_t last_now    = 0;  // us, latest time returned
+static int64_t last_error  = 0;  // us, error corrected by the latest sync
+static int64_t drift_local  = 0;  // us, esp_timer_get_time() of the sync drift is measured from
+static int64_t drift_offset = 0;  // us, server time - esp_timer at drift_local
+static uint8_t drift_samples = 0;
+
+static AsyncUDP  udp;
+static char      server_host[CLOCK_SERVER_SIZE] = "";
+static uint16_t  server_port = CLOCK_NTP_PORT;
+static IPAddress server_address;      // Resolved server_host, 0 until resolved
+static uint8_t   unanswered  = 0;     // Requests in a row, the server is resolved again after some
+static uint32_t  requested   = 0;     // ms, millis() of the last request
+static volatile bool answered = false;  // The last request was answered
+static volatile int64_t request_local = 0;  // us, esp_timer_get_time() the request was sent
+
+// A new server, set by whichever task dispatches it and applied by clockPoll()
+static portMUX_TYPE server_mux = portMUX_INITIALIZER_UNLOCKED;
+static char     next_server[CLOCK_SERVER_SIZE] = "";
+static volatile bool server_changed = false;
+
+
+// Time of the model at a time of esp_timer, clock_mux must be held
+static int64_t timeAt(int64_t local) {
+    int64_t elapsed = local - base_local;
+    return base_time + elapsed + static_cast<int64_t>(elapsed * (rate * 1e-6f));
+}
+
+
+static int64_t ntpToMicros(const uint8_t *timestamp) {
+    uint32_t seconds = 0;
+    uint32_t fraction = 0;
+    for (int i = 0; i < 4; i++) {
+        seconds = seconds << 8 | timestamp[i];
+        fraction = fraction << 8 | timestamp[4 + i];
+    }
+    return static_cast<int64_t>(seconds - NTP_TO_UNIX) * 1000000 +
+           ((static_cast<uint64_t>(fraction) * 1000000) >> 32);
+}
+
+
+// Runs in the UDP task
+static void handleAnswer(AsyncUDPPacket &packet) {
+    int64_t received = esp_timer_get_time();
+    const uint8_t *data = packet.data();
+    int64_t sent = request_local;
+    if (packet.length() < NTP_PACKET_SIZE || (data[0] & 0x07) != 4 || (data[0] >> 6) == 3
+        || data[1] == 0 || sent == 0) {
+        return;  // Not a server answer, an unsynchronized server or a kiss-o'-death
+    }
+    // The originate timestamp is a copy of the transmit timestamp of the request
+    for (int i = 0; i < 8; i++) {
+        if (data[24 + i] != static_cast<uint8_t>(sent >> (56 - 8 * i))) return;
+    }
+    request_local = 0;
+
+    int64_t server_received = ntpToMicros(data + 32);
+    int64_t server_sent = ntpToMicros(data + 40);
+    int64_t delay = (received - sent) - (server_sent - server_received);
+    if (server_sent < static_cast<int64_t>(CLOCK_EPOCH_MIN) * 1000000 || delay < 0
+        || delay > CLOCK_DELAY_MAX * 1000) {
+        LOGE("SNTP answer dropped, round trip %lld ms", delay / 1000);
+        return;
+    }
+    int64_t now = server_sent + delay / 2;  // At received
+
+    portENTER_CRITICAL(&clock_mux);
+    int64_t offset = now - received;
+    if (drift_samples == 0 || received - drift_local >= CLOCK_DRIFT_INTERVAL * 1000LL) {
+        if (drift_samples > 0) {
+            float measured = static_cast<float>(offset - drift_offset) * 1e6f /
+                             (received - drift_local);
+            if (fabsf(measured) <= CLOCK_DRIFT_MAX) {
+                drift_samples = min(drift_samples + 1, CLOCK_DRIFT_FILTER + 1);
+                drift += (measured - drift) / (drift_samples - 1);
+            }
+        } else {
+            drift_samples = 1;
+        }
+        drift_local = received;
+        drift_offset = offset;
+    }
+
+    int64_t error = synced ? now - timeAt(received) : 0;
+    if (!synced || llabs(error) > CLOCK_STEP_THRESHOLD * 1000LL) {
+        base_time = now;  // Corrected at once, nothing left to slew
+        rate = drift;
+    } else {
+        base_time = timeAt(received);
+        rate = drift + static_cast<float>(error) * 1e3f / CLOCK_SYNC_PERIOD;
+    }
+    base_local = received;
+    last_error = error;
+    synced = true;
+    portEXIT_CRITICAL(&clock_mux);
+
+    answered = true;
+    LOGI("Clock synchronized, error %lld ms, drift %.1f ppm", error / 1000, drift);
+}
+
+
+void clockSetServer(const String &server) {
+    portENTER_CRITICAL(&server_mux);
+    strlcpy(next_server, server.c_str(), sizeof(next_server));
+    server_changed = true;
+    portEXIT_CRITICAL(&server_mux);
+}
+
+
+// Runs in the wireless task
+static void applyServer() {
+    portENTER_CRITICAL(&server_mux);
+    memcpy(server_host, next_server, sizeof(server_host));
+    server_changed = false;
+    portEXIT_CRITICAL(&server_mux);
+    char *colon = strchr(server_host, ':');
+    server_port = CLOCK_NTP_PORT;
+    if (colon != NULL) {
+        *colon = '\0';
+        server_port = atoi(colon + 1);
+    }
+    server_address = IPAddress();
+    unanswered = 0;
+    requested = 0;
+    answered = false;
+}
+
+
+void clockSetTimezone(const String &timezone) {
+    setenv("TZ", timezone == "" ? "UTC0" : timezone.c_str(), 1);
+    tzset();
+}
+
+
+void clockPoll() {
+    if (server_changed) {
+        applyServer();
+    }
+    uint32_t period = answered ? CLOCK_SYNC_PERIOD : CLOCK_RETRY_PERIOD;
+    if (server_host[0] == '\0' || (requested != 0 && millis() - requested < period)) {
+        return;
+    }
+    unanswered = requested != 0 && !answered ? unanswered + 1 : 0;
+    if (unanswered >= CLOCK_RESOLVE_FAILURES) {
+        server_address = IPAddress();  // The server may have moved, e.g. one of a pool
+        unanswered = 0;
+    }
+    requested = max(millis(), 1UL);
+    answered = false;
+
+    if (!udp.connected()) {
+        if (!udp.listen(0)) {
+            LOGE("Failed to open the SNTP socket");
+            return;
+        }
+        udp.onPacket(handleAnswer);
+    }
+    if (static_cast<uint32_t>(server_address) == 0
+        && !WiFi.hostByName(server_host, server_address)) {
+        server_address = IPAddress();
+        LOGE("Failed to resolve SNTP server %s", server_host);
+        return;
+    }
+
+    // Client mode, version 4; the transmit timestamp is only a cookie the server echoes back
+    uint8_t packet[NTP_PACKET_SIZE] = {0x23};
+    int64_t sent = esp_timer_get_time();
+    for (int i = 0; i < 8; i++) {
+        packet[40 + i] = static_cast<uint8_t>(sent >> (56 - 8 * i));
+    }
+    request_local = sent;
+    udp.writeTo(packet, sizeof(packet), server_address, server_port);
+}
+
+
+bool clockSynced() {
+    return synced;
+}
+
+
+uint64_t clockNow() {
+    if (!synced) {
+        return 0;
+    }
+    portENTER_CRITICAL(&clock_mux);
+    int64_t now = max(timeAt(esp_timer_get_time()), last_now);
+    last_now = now;
+    portEXIT_CRITICAL(&clock_mux);
+    return now / 1000;
+}
+
+
+void clockToJson(JsonObject destination) {
+    char server[CLOCK_SERVER_SIZE];
+    portENTER_CRITICAL(&server_mux);
+    memcpy(server, next_server, sizeof(server));
+    portEXIT_CRITICAL(&server_mux);
+    destination["server"] = server;
+    destination["synced"] = synced;
+    destination["time"] = clockNow();
+    portENTER_CRITICAL(&clock_mux);
+    float drift_ppm = drift;
+    int32_t error = last_error / 1000;
+    portEXIT_CRITICAL(&clock_mux);
+    destination["drift"] = serialized(String(drift_ppm, 1));  // ppm
+    destination["error"] = error;  // ms, of the latest sync
+}
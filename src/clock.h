@@ -0,0 +1,43 @@
+#pragma once
+/**
+    clock.h - Network time from an SNTP server and a synchronized, monotonic clock
+    Author: Jason Chen, 2024
+
+    The wireless task calls clockPoll() in its loop, which sends an SNTP request to the server when
+    due; the answer is handled in the UDP task. The clock is esp_timer's uptime corrected to the
+    server's time. Main features includes:
+      - Each answer gives the server's time at the moment it was received, half of the round trip
+        after the server sent it; answers with a round trip over CLOCK_DELAY_MAX are dropped.
+      - Drift tracking: the rate of esp_timer against the server, filtered over the syncs, is
+        applied between syncs so the clock stays close to the server even if a sync fails.
+      - The first sync and errors over CLOCK_STEP_THRESHOLD step the clock, smaller errors are
+        slewed over the next CLOCK_SYNC_PERIOD so there are no jumps. clockNow() never goes
+        backwards; after a step back it holds until the clock has caught up.
+      - The server is "host" or "host:port", so a local NTP stand-in can be used for testing, see
+        src/scripts/ntp_standin.py. It is resolved once, and again only after
+        CLOCK_RESOLVE_FAILURES requests in a row went unanswered, since a lookup stalls the loop.
+      - The clock is UTC, clockSetTimezone() sets the timezone localtime_r() converts it with.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+
+#define CLOCK_NTP_PORT         123
+#define CLOCK_SYNC_PERIOD      3600000     // ms, between syncs
+#define CLOCK_RETRY_PERIOD     15000       // ms, until synchronized or after a failed sync
+#define CLOCK_DELAY_MAX        500         // ms, round trip of an SNTP request
+#define CLOCK_STEP_THRESHOLD   1000        // ms, larger errors are stepped instead of slewed
+#define CLOCK_DRIFT_INTERVAL   600000      // ms, shortest time between syncs to measure drift
+#define CLOCK_DRIFT_MAX        500         // ppm, larger drifts are measurement errors
+#define CLOCK_DRIFT_FILTER     4           // Syncs the drift is averaged over
+#define CLOCK_EPOCH_MIN        1704067200  // s, 2024-01-01, the server's time is invalid before
+#define CLOCK_SERVER_SIZE      64          // Bytes, longest "host:port"
+#define CLOCK_RESOLVE_FAILURES 4           // Unanswered requests before resolving the server again
+
+
+void clockSetServer(const String &server);      // Empty to disable. From any task, applied by clockPoll()
+void clockSetTimezone(const String &timezone);  // POSIX TZ, e.g. "CET-1CEST,M3.5.0,M10.5.0/3"
+void clockPoll();                               // Sends an SNTP request if due
+bool clockSynced();
+uint64_t clockNow();                            // ms since epoch, 0 if not synchronized
+void clockToJson(JsonObject destination);
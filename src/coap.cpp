@@ -0,0 +1,376 @@
+#include "coap.h"
+
+
+#define OPTION_URI_HOST       3
+#define OPTION_OBSERVE        6
+#define OPTION_URI_PORT       7
+#define OPTION_URI_PATH       11
+#define OPTION_CONTENT_FORMAT 12
+#define OPTION_URI_QUERY      15
+#define OPTION_ACCEPT         17
+#define OPTION_BLOCK2         23  // Only block 0 is sent, so a preferred size is ignored
+#define PAYLOAD_MARKER        0xFF
+
+
+struct CoapExchange {
+    uint32_t address;
+    uint16_t port;
+    uint16_t message_id;
+    uint32_t seen;  // ms, 0 if unused
+    size_t   length;
+    uint8_t  response[COAP_MESSAGE_SIZE];
+};
+
+
+struct CoapObserver {
+    uint32_t address;
+    uint16_t port;
+    uint8_t  token[COAP_TOKEN_SIZE];
+    uint8_t  token_length;
+    bool     used;
+    uint32_t registered;  // ms
+    uint32_t last_con;    // ms, of the last confirmable notification, or the registration
+    bool     pending;     // The last confirmable notification isn't acked yet
+    uint16_t pending_id;
+    uint16_t last_id;     // Of the last notification, which a reset answers
+};
+
+
+// Only used by the wireless task
+static CoapExchange exchanges[COAP_EXCHANGES];
+static CoapObserver observers[COAP_OBSERVERS];
+static uint32_t sequence = 0;  // Observe value of the last notification, 24 bits
+static uint16_t message_id = 0;
+static bool     seeded = false;
+
+// Counted by the wireless task and read by coapToJson() from the web server's task too
+static portMUX_TYPE stats_mux = portMUX_INITIALIZER_UNLOCKED;
+static uint8_t  observed = 0;   // Observers registered
+static uint32_t duplicates = 0;
+static uint32_t notifications = 0;
+static uint32_t forgotten = 0;  // Observers that stopped answering
+
+
+static void countObservers() {
+    uint8_t count = 0;
+    for (CoapObserver &observer : observers) {
+        count += observer.used;
+    }
+    portENTER_CRITICAL(&stats_mux);
+    observed = count;
+    portEXIT_CRITICAL(&stats_mux);
+}
+
+
+// Appends to the request, false if it doesn't fit
+static bool append(CoapRequest &request, size_t &used, const void *text, size_t length) {
+    if (used + length > COAP_REQUEST_SIZE) {
+        return false;
+    }
+    memcpy(request.request + used, text, length);
+    used += length;
+    request.request[used] = '\0';
+    return true;
+}
+
+
+// A path segment or query can't contain the separators of the request it is added to
+static bool hasSeparator(const uint8_t *value, size_t length, bool path) {
+    return memchr(value, '?', length) != NULL || memchr(value, '&', length) != NULL
+           || (path && memchr(value, '/', length) != NULL);
+}
+
+
+bool coapParse(const uint8_t *data, size_t length, CoapRequest &request) {
+    if (length < 4 || data[0] >> 6 != COAP_VERSION || (data[0] & 0x0F) > COAP_TOKEN_SIZE) {
+        return false;
+    }
+    request.type = data[0] >> 4 & 0x03;
+    request.token_length = data[0] & 0x0F;
+    request.code = data[1];
+    request.message_id = data[2] << 8 | data[3];
+    request.observe = -1;
+    request.error = 0;
+    request.request[0] = '\0';
+    if (length < 4U + request.token_length) {
+        return false;
+    }
+    memcpy(request.token, data + 4, request.token_length);
+    if (request.code == COAP_EMPTY) {
+        return length == 4;  // Nothing but the header
+    }
+
+    size_t at = 4 + request.token_length;
+    size_t used = 0;
+    bool has_query = false;
+    uint16_t number = 0;
+    while (at < length && data[at] != PAYLOAD_MARKER) {
+        uint16_t delta = data[at] >> 4;
+        uint16_t option_length = data[at] & 0x0F;
+        at++;
+        // Deltas and lengths of 13 and 14 are followed by 1 or 2 more bytes, 15 is reserved
+        uint16_t *fields[] = {&delta, &option_length};
+        for (uint16_t *field : fields) {
+            if (*field == 13 && at + 1 <= length) {
+                *field = data[at] + 13;
+                at += 1;
+            } else if (*field == 14 && at + 2 <= length) {
+                *field = (data[at] << 8 | data[at + 1]) + 269;
+                at += 2;
+            } else if (*field >= 13) {
+                return false;
+            }
+        }
+        number += delta;
+        if (at + option_length > length) {
+            return false;
+        }
+        const uint8_t *value = data + at;
+        at += option_length;
+
+        // Options are in order of their numbers, so the path is complete before the queries
+        if (number == OPTION_URI_PATH) {
+            if (hasSeparator(value, option_length, true) || !append(request, used, "/", 1)
+                || !append(request, used, value, option_length)) {
+                request.error = COAP_BAD_REQUEST;
+            }
+        } else if (number == OPTION_URI_QUERY) {
+            if (hasSeparator(value, option_length, false)
+                || !append(request, used, has_query ? "&" : "?", 1)
+                || !append(request, used, value, option_length)) {
+                request.error = COAP_BAD_REQUEST;
+            }
+            has_query = true;
+        } else if (number == OPTION_OBSERVE && option_length <= 3) {
+            request.observe = 0;
+            for (int i = 0; i < option_length; i++) {
+                request.observe = request.observe << 8 | value[i];
+            }
+        } else if (number & 1 && number != OPTION_URI_HOST && number != OPTION_URI_PORT
+                   && number != OPTION_ACCEPT && number != OPTION_BLOCK2) {
+            request.error = COAP_BAD_OPTION;  // Critical options can't be ignored
+        }
+    }
+
+    // A payload of POST and PUT is more params, e.g. "percent=50&motor=1"
+    if (at < length) {
+        at++;  // Marker
+        if (at == length) {
+            return false;  // A marker without a payload is a format error
+        }
+        if (request.code == COAP_POST || request.code == COAP_PUT) {
+            if (memchr(data + at, '?', length - at) != NULL
+                || !append(request, used, has_query ? "&" : "?", 1)
+                || !append(request, used, data + at, length - at)) {
+                request.error = COAP_BAD_REQUEST;
+            }
+        }
+    }
+    if (used == 0 && !append(request, used, "/", 1)) {
+        request.error = COAP_BAD_REQUEST;
+    }
+    return true;
+}
+
+
+// Unsigned option values have no leading zero bytes, 0 is empty
+static size_t putOption(uint8_t *at, uint8_t delta, uint32_t value) {
+    uint8_t length = value == 0 ? 0 : value < 0x100 ? 1 : value < 0x10000 ? 2 : 3;
+    at[0] = delta << 4 | length;
+    for (int i = 0; i < length; i++) {
+        at[1 + i] = value >> (8 * (length - 1 - i));
+    }
+    return 1 + length;
+}
+
+
+size_t coapBuild(uint8_t *buffer, uint8_t type, uint8_t code, uint16_t message_id,
+                 const uint8_t *token, uint8_t token_length, int32_t observe, int16_t format,
+                 const char *payload, size_t length) {
+    buffer[0] = COAP_VERSION << 6 | type << 4 | token_length;
+    buffer[1] = code;
+    buffer[2] = message_id >> 8;
+    buffer[3] = message_id & 0xFF;
+    memcpy(buffer + 4, token, token_length);
+    size_t used = 4 + token_length;
+    uint16_t number = 0;
+    if (observe >= 0) {
+        used += putOption(buffer + used, OPTION_OBSERVE - number, observe & 0xFFFFFF);
+        number = OPTION_OBSERVE;
+    }
+    if (format >= 0) {
+        used += putOption(buffer + used, OPTION_CONTENT_FORMAT - number, format);
+    }
+    if (length > 0) {
+        buffer[used++] = PAYLOAD_MARKER;
+        length = min(length, static_cast<size_t>(COAP_MESSAGE_SIZE) - used);
+        memcpy(buffer + used, payload, length);
+        used += length;
+    }
+    return used;
+}
+
+
+uint16_t coapNextMessageId() {
+    if (!seeded) {
+        message_id = esp_random();  // Unlikely to repeat the IDs of before a restart
+        seeded = true;
+    }
+    return ++message_id;
+}
+
+
+const uint8_t *coapFindExchange(uint32_t address, uint16_t port, uint16_t message_id, size_t &length) {
+    for (CoapExchange &exchange : exchanges) {
+        if (exchange.seen != 0 && exchange.address == address && exchange.port == port
+            && exchange.message_id == message_id && millis() - exchange.seen < COAP_EXCHANGE_LIFETIME) {
+            portENTER_CRITICAL(&stats_mux);
+            duplicates++;
+            portEXIT_CRITICAL(&stats_mux);
+            length = exchange.length;
+            return exchange.response;
+        }
+    }
+    return NULL;
+}
+
+
+// Replaces the exchange seen the longest ago when all are taken
+void coapRecordExchange(uint32_t address, uint16_t port, uint16_t message_id, const uint8_t *data,
+                        size_t length) {
+    CoapExchange *exchange = &exchanges[0];
+    for (CoapExchange &other : exchanges) {
+        if (other.seen == 0 || millis() - other.seen > millis() - exchange->seen) {
+            exchange = &other;
+            if (other.seen == 0) break;
+        }
+    }
+    exchange->address = address;
+    exchange->port = port;
+    exchange->message_id = message_id;
+    exchange->length = min(length, sizeof(exchange->response));
+    memcpy(exchange->response, data, exchange->length);
+    exchange->seen = max(millis(), 1UL);
+}
+
+
+static CoapObserver *findObserver(const CoapRequest &request) {
+    for (CoapObserver &observer : observers) {
+        if (observer.used && observer.address == request.address && observer.port == request.port
+            && observer.token_length == request.token_length
+            && memcmp(observer.token, request.token, request.token_length) == 0) {
+            return &observer;
+        }
+    }
+    return NULL;
+}
+
+
+// Registering again with the same token refreshes the registration; when all are taken, the
+// observer registered the longest ago is replaced, a hub that is still there registers again
+int32_t coapObserve(const CoapRequest &request) {
+    CoapObserver *observer = findObserver(request);
+    if (observer == NULL) {
+        observer = &observers[0];
+        for (CoapObserver &other : observers) {
+            if (!other.used || millis() - other.registered > millis() - observer->registered) {
+                observer = &other;
+                if (!other.used) break;
+            }
+        }
+    }
+    observer->address = request.address;
+    observer->port = request.port;
+    memcpy(observer->token, request.token, request.token_length);
+    observer->token_length = request.token_length;
+    observer->used = true;
+    observer->registered = millis();
+    observer->last_con = millis();
+    observer->pending = false;
+    countObservers();
+    return sequence;
+}
+
+
+void coapForget(const CoapRequest &request) {
+    CoapObserver *observer = findObserver(request);
+    if (observer != NULL) {
+        observer->used = false;
+        countObservers();
+    }
+}
+
+
+void coapReply(const CoapRequest &request) {
+    for (CoapObserver &observer : observers) {
+        if (!observer.used || observer.address != request.address || observer.port != request.port) {
+            continue;
+        }
+        if (request.type == COAP_ACK && observer.pending && observer.pending_id == request.message_id) {
+            observer.pending = false;
+        } else if (request.type == COAP_RST && (observer.last_id == request.message_id
+                   || (observer.pending && observer.pending_id == request.message_id))) {
+            observer.used = false;
+        }
+    }
+    countObservers();
+}
+
+
+bool coapObserved() {
+    for (CoapObserver &observer : observers) {
+        if (observer.used) {
+            return true;
+        }
+    }
+    return false;
+}
+
+
+void coapNotify(const char *payload,
+                std::function<void(uint32_t address, uint16_t port, const uint8_t *data, size_t length)> send) {
+    sequence = (sequence + 1) & 0xFFFFFF;
+    uint8_t message[COAP_MESSAGE_SIZE];
+    for (CoapObserver &observer : observers) {
+        if (!observer.used) {
+            continue;
+        }
+        bool confirmable = millis() - observer.last_con >= COAP_CON_PERIOD;
+        if (confirmable && observer.pending) {
+            observer.used = false;  // The last confirmable one wasn't acked in a whole period
+            portENTER_CRITICAL(&stats_mux);
+            forgotten++;
+            portEXIT_CRITICAL(&stats_mux);
+            continue;
+        }
+        uint16_t id = coapNextMessageId();
+        size_t length = coapBuild(message, confirmable ? COAP_CON : COAP_NON, COAP_CONTENT, id,
+                                  observer.token, observer.token_length, sequence, COAP_TEXT,
+                                  payload, strlen(payload));
+        if (confirmable) {
+            observer.pending = true;
+            observer.pending_id = id;
+            observer.last_con = millis();
+        }
+        observer.last_id = id;
+        send(observer.address, observer.port, message, length);
+        portENTER_CRITICAL(&stats_mux);
+        notifications++;
+        portEXIT_CRITICAL(&stats_mux);
+    }
+    countObservers();
+}
+
+
+void coapToJson(JsonObject destination) {
+    portENTER_CRITICAL(&stats_mux);
+    uint8_t observer_count = observed;
+    uint32_t notification_count = notifications;
+    uint32_t forgotten_count = forgotten;
+    uint32_t duplicate_count = duplicates;
+    portEXIT_CRITICAL(&stats_mux);
+    destination["observers"] = observer_count;
+    destination["notifications"] = notification_count;
+    destination["forgotten"] = forgotten_count;
+    destination["duplicates"] = duplicate_count;
+}
@@ -0,0 +1,106 @@
+#pragma once
+/**
+    coap.h - A CoAP server for hubs that are too small for HTTP, with observable positions
+    Author: Jason Chen, 2024
+
+    Every unit listens on COAP_PORT next to HTTP and takes the same requests as CoAP messages
+    (RFC 7252): the Uri-Path is the HTTP path and each Uri-Query option a param, e.g.
+    GET coap://<unit>/motor?percent=50, and is dispatched the same way by the wireless task; the UDP
+    task only parses and queues it, its stack is too small for dispatching. A request fits in one
+    datagram, without TCP setup or headers to parse. Main features includes:
+      - Confirmable requests are answered with a piggybacked ACK, non-confirmable ones with a
+        non-confirmable response. The responses of the last COAP_EXCHANGES requests are kept, so a
+        retransmitted request is answered again but not executed.
+      - /position is observable (RFC 7641): up to COAP_OBSERVERS clients registered with Observe 0
+        are notified of every position, "<percent>[,<percent>...]" of each motor. Notifications
+        are non-confirmable, but at least every COAP_CON_PERIOD one is confirmable; an observer that
+        didn't ack the previous one, or answers with a reset, is forgotten.
+      - /.well-known/core lists the resources.
+    Block-wise transfers aren't supported, the longest response fits in COAP_MESSAGE_SIZE.
+    See src/scripts/bench_coap.py to compare CoAP and HTTP on a unit, or on a simulated one.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "command.h"
+
+
+#define COAP_PORT          5683
+#define COAP_VERSION       1
+#define COAP_TOKEN_SIZE    8                // Bytes, longest token
+#define COAP_REQUEST_SIZE  256              // Bytes, longest "/path?query" of a request
+#define COAP_MESSAGE_SIZE  (COMMAND_RESPONSE_SIZE + 32)  // Bytes, a response with its header
+#define COAP_EXCHANGES     4                // Responses kept for retransmitted requests
+#define COAP_EXCHANGE_LIFETIME 247000       // ms, EXCHANGE_LIFETIME of RFC 7252
+#define COAP_OBSERVERS     4
+#define COAP_CON_PERIOD    30000            // ms, between confirmable notifications
+#define COAP_MOVING_PERIOD 250              // ms, between notifications while moving
+#define COAP_QUEUE         4                // Requests waiting for the wireless task
+
+
+enum CoapType {
+    COAP_CON = 0,  // Confirmable
+    COAP_NON = 1,  // Non-confirmable
+    COAP_ACK = 2,
+    COAP_RST = 3
+};
+
+
+// Class << 5 | detail, e.g. 2.05 is 69
+enum CoapCode {
+    COAP_EMPTY          = 0,
+    COAP_GET            = 1,
+    COAP_POST           = 2,
+    COAP_PUT            = 3,
+    COAP_CHANGED        = 2 << 5 | 4,
+    COAP_CONTENT        = 2 << 5 | 5,
+    COAP_BAD_REQUEST    = 4 << 5 | 0,
+    COAP_BAD_OPTION     = 4 << 5 | 2,
+    COAP_NOT_FOUND      = 4 << 5 | 4,
+    COAP_NOT_ALLOWED    = 4 << 5 | 5,
+    COAP_TOO_LARGE      = 4 << 5 | 13,
+};
+
+
+enum CoapFormat {
+    COAP_TEXT  = 0,   // text/plain
+    COAP_LINKS = 40,  // application/link-format
+    COAP_NO_FORMAT = -1
+};
+
+
+// A message handed from the UDP task to the wireless task
+struct CoapRequest {
+    uint32_t address;  // Of the sender
+    uint16_t port;
+    uint8_t  type;     // CoapType
+    uint8_t  code;     // CoapCode
+    uint16_t message_id;
+    uint8_t  token[COAP_TOKEN_SIZE];
+    uint8_t  token_length;
+    int32_t  observe;     // Observe option, -1 if none
+    uint8_t  error;       // CoapCode to answer with instead of dispatching, 0 if none
+    uint32_t parse_time;  // us, in the UDP task
+    char     request[COAP_REQUEST_SIZE + 1];  // "/path?query&query", null terminated
+};
+
+
+// False if not a CoAP message, which is dropped
+bool coapParse(const uint8_t *data, size_t length, CoapRequest &request);
+size_t coapBuild(uint8_t *buffer, uint8_t type, uint8_t code, uint16_t message_id,
+                 const uint8_t *token, uint8_t token_length, int32_t observe, int16_t format,
+                 const char *payload, size_t length);  // Bytes, at most COAP_MESSAGE_SIZE
+uint16_t coapNextMessageId();
+
+// Responses of recent requests, for retransmissions
+const uint8_t *coapFindExchange(uint32_t address, uint16_t port, uint16_t message_id, size_t &length);
+void coapRecordExchange(uint32_t address, uint16_t port, uint16_t message_id, const uint8_t *data,
+                        size_t length);
+
+// Observers of /position
+int32_t coapObserve(const CoapRequest &request);  // Registers, Observe value of the response
+void coapForget(const CoapRequest &request);      // Deregisters with Observe 1
+void coapReply(const CoapRequest &request);       // ACK or RST from an observer
+bool coapObserved();
+void coapNotify(const char *payload,
+                std::function<void(uint32_t address, uint16_t port, const uint8_t *data, size_t length)> send);
+void coapToJson(JsonObject destination);
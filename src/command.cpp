@@ -1,7 +1,9 @@
 #include "command.h"
+#include "board.h"
+#include "motion.h"
 
 
-Command hash(String command) {
+Command hash(const String &command) {
     if (command == "update-position") return UPDATE_POSITION;
     else if (command == "error") return ERROR_COMMAND;
 
@@ -32,21 +34,36 @@ Command hash(String command) {
     else if (command == "stallguard-threshold") return MOTOR_SGTHRS;
     else if (command == "fastmode") return MOTOR_SPREADCYCL;
     else if (command == "fastmode-threshold") return MOTOR_TPWMTHRS;
+    else if (command == "toggle") return MOTOR_TOGGLE;
+    else if (command == "motor") return MOTOR_INDEX;
+    else if (command == "start") return MOTOR_START;
+    else if (command == "duration") return MOTOR_DURATION;
+    else if (command == "at") return MOTOR_START_AT;
 
     else if (command == "sleep") return SYSTEM_SLEEP;
     else if (command == "restart") return SYSTEM_RESTART;
     else if (command == "reset") return SYSTEM_RESET;
     else if (command == "name") return SYSTEM_RENAME;
+    else if (command == "log-system") return SYSTEM_LOG_SYS;
+    else if (command == "log-motor") return SYSTEM_LOG_MOTOR;
+    else if (command == "log-wireless") return SYSTEM_LOG_WRLSS;
+    else if (command == "log-led") return SYSTEM_LOG_LED;
 
     else if (command == "setup") return WIRELESS_SETUP;
     else if (command == "ssid") return WIRELESS_SSID;
     else if (command == "password") return WIRELESS_PASS;
+    else if (command == "syslog") return WIRELESS_SYSLOG;
+    else if (command == "groups") return WIRELESS_GROUPS;
+    else if (command == "ntp") return WIRELESS_NTP;
+    else if (command == "timezone") return WIRELESS_TZ;
+    else if (command == "location") return WIRELESS_LOCATN;
+    else if (command == "mqtt") return WIRELESS_MQTT;
 
     return ERROR_COMMAND;
 }
 
 
-String hash(Command command) {
+const char *hash(Command command) {
     if (command == UPDATE_POSITION) return "update-position";
     else if (command == ERROR_COMMAND) return "error";
 
@@ -77,21 +94,41 @@ String hash(Command command) {
     else if (command == MOTOR_SGTHRS) return "stallguard-threshold";
     else if (command == MOTOR_SPREADCYCL) return "fastmode";
     else if (command == MOTOR_TPWMTHRS) return "fastmode-threshold";
+    else if (command == MOTOR_TOGGLE) return "toggle";
+    else if (command == MOTOR_INDEX) return "motor";
+    else if (command == MOTOR_START) return "start";
+    else if (command == MOTOR_DURATION) return "duration";
+    else if (command == MOTOR_START_AT) return "at";
 
     else if (command == SYSTEM_SLEEP) return "sleep";
     else if (command == SYSTEM_RESTART) return "restart";
     else if (command == SYSTEM_RESET) return "reset";
     else if (command == SYSTEM_RENAME) return "name";
+    else if (command == SYSTEM_LOG_SYS) return "log-system";
+    else if (command == SYSTEM_LOG_MOTOR) return "log-motor";
+    else if (command == SYSTEM_LOG_WRLSS) return "log-wireless";
+    else if (command == SYSTEM_LOG_LED) return "log-led";
 
     else if (command == WIRELESS_SETUP) return "setup";
     else if (command == WIRELESS_SSID) return "ssid";
     else if (command == WIRELESS_PASS) return "password";
+    else if (command == WIRELESS_SYSLOG) return "syslog";
+    else if (command == WIRELESS_GROUPS) return "groups";
+    else if (command == WIRELESS_NTP) return "ntp";
+    else if (command == WIRELESS_TZ) return "timezone";
+    else if (command == WIRELESS_LOCATN) return "location";
+    else if (command == WIRELESS_MQTT) return "mqtt";
+
+    else if (command == LED_PATTERN) return "led-pattern";
+    else if (command == LED_CLEAR) return "led-clear";
+    else if (command == UPDATE_TRAVEL) return "update-travel";
+    else if (command == UPDATE_MOVING) return "update-moving";
 
     return "error";
 }
 
 
-std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command) {
+std::pair<std::function<bool(int)>, const char*> getCommandEvalFunc(Command command) {
     if (command == MOTOR_STOP) {
         return std::make_pair([=](int val) -> bool { return false; }, "");
     } else if (command == MOTOR_PERECENT) {
@@ -123,8 +160,7 @@ std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command)
     } else if (command == MOTOR_FULL_STEPS) {
         return std::make_pair([=](int val) -> bool { return val <= 0; }, ">0");
     } else if (command == MOTOR_MICROSTEPS) {
-        return std::make_pair([=](int val) -> bool { return val != 0 && val != 2 && val != 4 && val != 8 && val != 16 && val != 32 && val != 64
-                                                                && val != 128 && val != 256; }, "=0 | 2 | 4 | 8 | 16 | 32 | 64 | 128 | 256");
+        return std::make_pair([=](int val) -> bool { return !isMicrosteps(val); }, "=1 | 2 | 4 | 8 | 16 | 32 | 64 | 128 | 256");
     } else if (command == MOTOR_STALLGUARD) {
         return std::make_pair([=](int val) -> bool { return val != 0 && val != 1; }, "=0 | 1; 0 to disable; 1 to enable");
     } else if (command == MOTOR_TCOOLTHRS) {
@@ -135,6 +171,14 @@ std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command)
         return std::make_pair([=](int val) -> bool { return val != 0 && val != 1; }, "=0 | 1; 0 to disable; 1 to enable");
     } else if (command == MOTOR_TPWMTHRS) {
         return std::make_pair([=](int val) -> bool { return val < 0 || val > 1048575; }, "=0~1048575; upper threshold to switch to fastmode");
+    } else if (command == MOTOR_TOGGLE) {
+        return std::make_pair([=](int val) -> bool { return false; }, "");
+    } else if (command == MOTOR_INDEX) {
+        return std::make_pair([=](int val) -> bool { return val < 0 || val >= MOTOR_COUNT; }, "=0~(motors - 1); omit to command all motors");
+    } else if (command == MOTOR_START) {
+        return std::make_pair([=](int val) -> bool { return val < 0 || val > MOTION_START_MAX; }, "=0~60000; ms to wait before the next percent/step move starts");
+    } else if (command == MOTOR_DURATION) {
+        return std::make_pair([=](int val) -> bool { return val < 0 || val > MOTION_DURATION_MAX; }, "=0~600000; ms from start to arrival of the next percent/step move, 0 for the fastest");
     }
 
     else if (command == SYSTEM_SLEEP) {
@@ -143,6 +187,12 @@ std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command)
         return std::make_pair([=](int val) -> bool { return false; }, "");
     } else if (command == SYSTEM_RESET) {
         return std::make_pair([=](int val) -> bool { return false; }, "");
+    } else if (command <= SYSTEM_LOG_SYS && command >= SYSTEM_LOG_LED) {
+        return std::make_pair([=](int val) -> bool { return val < 0 || val > 2; }, "=0 | 1 | 2; 0 for errors; 1 for info; 2 for debug");
+    }
+
+    else if (command == WIRELESS_GROUPS) {
+        return std::make_pair([=](int val) -> bool { return val < 0; }, "=0~2147483647; bit n - 1 set to join group n of the fleet protocol");
     }
 
     // else if (command == WIRELESS_SETUP) {
@@ -150,7 +200,7 @@ std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command)
 }
 
 
-std::pair<std::function<bool(float)>, String> getCommandEvalFuncf(Command command) {
+std::pair<std::function<bool(float)>, const char*> getCommandEvalFuncf(Command command) {
     if (command == MOTOR_VLCTY) {
         return std::make_pair([=](float val) -> bool { return val <= 0.0; }, ">0.0 (Hz)");  // float
     } else if (command == MOTOR_OP_VLCTY) {
@@ -169,7 +219,7 @@ std::pair<std::function<bool(float)>, String> getCommandEvalFuncf(Command comman
 
 String listMotorCommands() {
     String list = "";
-    for (int command = MOTOR_STOP; command <= MOTOR_TPWMTHRS; command++) {
+    for (int command = MOTOR_STOP; command <= MOTOR_START_AT; command++) {
         list = list + hash(Command(command)) + " | ";
     }
     return list.substring(0, list.length() - 3);
@@ -178,7 +228,7 @@ String listMotorCommands() {
 
 String listSystemCommands() {
     String list = "";
-    for (int command = SYSTEM_SLEEP; command >= SYSTEM_RENAME; command--) {
+    for (int command = SYSTEM_SLEEP; command >= SYSTEM_LOG_LED; command--) {
         list = list + hash(Command(command)) + " | ";
     }
     return list.substring(0, list.length() - 3);
@@ -187,7 +237,7 @@ String listSystemCommands() {
 
 String listWirelessCommands() {
     String list = "";
-    for (int command = WIRELESS_SETUP; command >= WIRELESS_PASS; command--) {
+    for (int command = WIRELESS_SETUP; command >= WIRELESS_MQTT; command--) {
         list = list + hash(Command(command)) + " | ";
     }
     return list.substring(0, list.length() - 3);
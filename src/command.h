@@ -2,6 +2,9 @@
 #include <Arduino.h>
 #include <FunctionalInterrupt.h>
 
+#define COMMAND_MAX_PARAMS    10
+#define COMMAND_RESPONSE_SIZE 768  // Bytes, built on the stack
+
 
 enum Command {
     UPDATE_POSITION  = 0,
@@ -35,23 +38,51 @@ enum Command {
     MOTOR_SGTHRS     = 25,
     MOTOR_SPREADCYCL = 26,
     MOTOR_TPWMTHRS   = 27,
+    MOTOR_TOGGLE     = 28,
+    MOTOR_INDEX      = 29,  // Selects the motor of the other commands, not sent to the motor
+    MOTOR_START      = 30,  // Makes the next percent/step move a group move, see motion.h
+    MOTOR_DURATION   = 31,
+    MOTOR_START_AT   = 32,  // "start" as ms since epoch, turned into "start" with the clock
 
     // System commands < 0
     SYSTEM_SLEEP     = -1,
     SYSTEM_RESTART   = -2,
     SYSTEM_RESET     = -3,
     SYSTEM_RENAME    = -4,
+    SYSTEM_LOG_SYS   = -5,
+    SYSTEM_LOG_MOTOR = -6,
+    SYSTEM_LOG_WRLSS = -7,
+    SYSTEM_LOG_LED   = -8,
 
     WIRELESS_SETUP   = -51,
     WIRELESS_SSID    = -52,
-    WIRELESS_PASS    = -53
+    WIRELESS_PASS    = -53,
+    WIRELESS_SYSLOG  = -54,
+    WIRELESS_GROUPS  = -55,
+    WIRELESS_NTP     = -56,
+    WIRELESS_TZ      = -57,
+    WIRELESS_LOCATN  = -58,
+    WIRELESS_MQTT    = -59,
+
+    // Internal commands, not exposed to the APIs
+    LED_PATTERN      = -101,
+    LED_CLEAR        = -102,
+    UPDATE_TRAVEL    = -103, // Fastest move between 0 and 100% of a motor changed, ms
+    UPDATE_MOVING    = -104  // Position % while moving, UPDATE_POSITION once stopped
+};
+
+
+// A param of a request to /motor, /system or /wireless, see WirelessTask::dispatch()
+struct CommandParam {
+    const String *name;
+    const String *value;
 };
 
 
-Command hash (String command);
-String hash (Command command);
-std::pair<std::function<bool(int)>, String> getCommandEvalFunc(Command command);
-std::pair<std::function<bool(float)>, String> getCommandEvalFuncf(Command command);
+Command hash (const String &command);
+const char *hash (Command command);
+std::pair<std::function<bool(int)>, const char*> getCommandEvalFunc(Command command);
+std::pair<std::function<bool(float)>, const char*> getCommandEvalFuncf(Command command);
 String listMotorCommands();
 String listSystemCommands();
 String listWirelessCommands();
\ No newline at end of file
@@ -0,0 +1,72 @@
+#pragma once
+/**
+    fixed_string.h - A fixed-capacity string that never allocates
+    Author: Jason Chen, 2024
+
+    A replacement for Arduino String where strings are built by concatenation in hot paths, i.e.
+    messages, HTTP responses and serial numbers. The buffer lives wherever the FixedString does,
+    usually on the stack, and text that doesn't fit is cut off and flagged by truncated() instead
+    of allocating more.
+
+    Usage:
+        FixedString<64> text;
+        text += "success: ";
+        text.appendf("%s=%d\n", name, value);
+        Serial.println(text.c_str());
+**/
+#include <Arduino.h>
+#include <stdarg.h>
+
+
+template<size_t N>
+class FixedString {
+public:
+    FixedString() { clear(); }
+    FixedString(const char *text) { clear(); append(text); }
+
+    const char *c_str() const { return buffer_; }
+    size_t length() const { return length_; }
+    static constexpr size_t capacity() { return N - 1; }
+    bool truncated() const { return truncated_; }
+
+    void clear() {
+        buffer_[0] = '\0';
+        length_ = 0;
+        truncated_ = false;
+    }
+
+    FixedString &append(const char *text, size_t size) {
+        size_t count = min(size, capacity() - length_);
+        memcpy(buffer_ + length_, text, count);
+        length_ += count;
+        buffer_[length_] = '\0';
+        truncated_ |= count < size;
+        return *this;
+    }
+
+    FixedString &append(const char *text) { return append(text, strlen(text)); }
+    FixedString &append(const String &text) { return append(text.c_str(), text.length()); }
+
+    FixedString &append(char character) { return append(&character, 1); }
+
+    FixedString &appendf(const char *format, ...) __attribute__((format(printf, 2, 3))) {
+        va_list args;
+        va_start(args, format);
+        int written = vsnprintf(buffer_ + length_, N - length_, format, args);
+        va_end(args);
+        if (written < 0) return *this;
+        truncated_ |= static_cast<size_t>(written) > capacity() - length_;
+        length_ = min(length_ + written, capacity());
+        return *this;
+    }
+
+    template<typename T>
+    FixedString &operator+=(const T &text) { return append(text); }
+
+    bool operator==(const char *text) const { return strcmp(buffer_, text) == 0; }
+
+private:
+    char   buffer_[N];
+    size_t length_;
+    bool   truncated_;
+};
@@ -0,0 +1,73 @@
+#include "fleet.h"
+
+
+struct FleetSender {
+    uint32_t address;
+    uint16_t port;
+    uint32_t sequence;  // Of the last request
+    bool     failed;    // The last request was rejected
+    uint32_t seen;      // ms
+};
+
+
+// Only used by the wireless task, which handles the requests the UDP task queues
+static FleetSender senders[FLEET_SENDERS];
+
+
+static FleetSender *findSender(uint32_t address, uint16_t port) {
+    for (FleetSender &sender : senders) {
+        if (sender.seen != 0 && sender.address == address && sender.port == port) {
+            return &sender;
+        }
+    }
+    return NULL;
+}
+
+
+bool fleetParse(const uint8_t *data, size_t length, FleetHeader &header) {
+    if (length < sizeof(FleetHeader) || length > sizeof(FleetHeader) + FLEET_PAYLOAD_SIZE) {
+        return false;
+    }
+    memcpy(&header, data, sizeof(FleetHeader));
+    return header.magic == FLEET_MAGIC && header.version == FLEET_VERSION &&
+           !(header.flags & FLEET_ACK);
+}
+
+
+bool fleetIsMember(uint8_t group, uint32_t groups) {
+    return group == 0 || (group < 32 && (groups >> (group - 1) & 1));
+}
+
+
+FleetSequence fleetCheckSequence(uint32_t address, uint16_t port, uint32_t sequence, bool &failed) {
+    FleetSender *sender = findSender(address, port);
+    if (sender == NULL) {
+        return FLEET_NEW;
+    }
+    int32_t ahead = static_cast<int32_t>(sequence - sender->sequence);
+    if (ahead == 0) {
+        failed = sender->failed;
+        return FLEET_REPEATED;
+    }
+    return ahead > 0 || ahead <= -FLEET_WINDOW ? FLEET_NEW : FLEET_STALE;
+}
+
+
+// Replaces the sender seen the longest ago when all are taken
+void fleetRecord(uint32_t address, uint16_t port, uint32_t sequence, bool failed) {
+    FleetSender *sender = findSender(address, port);
+    if (sender == NULL) {
+        sender = &senders[0];
+        for (FleetSender &other : senders) {
+            if (other.seen == 0 || millis() - other.seen > millis() - sender->seen) {
+                sender = &other;
+                if (other.seen == 0) break;
+            }
+        }
+    }
+    sender->address = address;
+    sender->port = port;
+    sender->sequence = sequence;
+    sender->failed = failed;
+    sender->seen = max(millis(), 1UL);
+}
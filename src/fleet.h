@@ -0,0 +1,67 @@
+#pragma once
+/**
+    fleet.h - A UDP multicast protocol to command many units with one datagram
+    Author: Jason Chen, 2024
+
+    Every unit listens on FLEET_ADDRESS:FLEET_PORT next to HTTP. A datagram is a FleetHeader
+    followed by a request like HTTP's without URL encoding, e.g. "/motor?percent=100&start=500",
+    and is dispatched the same way by the wireless task; the UDP task only queues it, its stack is
+    too small for dispatching. Main features includes:
+      - Group addressing: group 0 is every unit, groups 1~31 are the units that joined them with
+        "groups", so one datagram moves a whole zone.
+      - Sequence numbers per sender: a repeated datagram is acked again but not executed, so a
+        sender can resend to the units that didn't ack; older ones are dropped unless they are
+        far behind, which is a sender that restarted.
+      - Optional acks: with FLEET_ACK_REQUEST each unit answers the sender with the same header,
+        FLEET_ACK (and FLEET_FAILED if rejected) set, its name and the response.
+    See src/scripts/bench_fleet.py for a sender and simulated units.
+**/
+#include <Arduino.h>
+
+
+#define FLEET_ADDRESS      239, 255, 89, 1  // Multicast group of all units
+#define FLEET_PORT         4389
+#define FLEET_MAGIC        0x59             // 'Y'
+#define FLEET_VERSION      1
+#define FLEET_PAYLOAD_SIZE 256              // Bytes, longest request
+#define FLEET_SENDERS      4                // Senders tracked for repeated sequence numbers
+#define FLEET_WINDOW       1024             // Sequence numbers further behind are a new sender
+#define FLEET_QUEUE        4                // Requests waiting for the wireless task
+
+
+enum FleetFlags {
+    FLEET_ACK_REQUEST = 0x01,  // Receivers answer the sender with an ack
+    FLEET_ACK         = 0x02,  // An answer, the payload is "<name>\n<response>"
+    FLEET_FAILED      = 0x04,  // The request was rejected
+};
+
+
+enum FleetSequence {
+    FLEET_NEW,
+    FLEET_REPEATED,  // Same as the last one of the sender
+    FLEET_STALE
+};
+
+
+struct __attribute__((packed)) FleetHeader {
+    uint8_t  magic;
+    uint8_t  version;
+    uint8_t  flags;
+    uint8_t  group;     // 0 for every unit, else 1~31
+    uint32_t sequence;  // Little-endian, incremented by the sender for every request
+};
+
+
+// A request handed from the UDP task to the wireless task
+struct FleetPacket {
+    uint32_t    address;  // Of the sender
+    uint16_t    port;
+    FleetHeader header;
+    char        request[FLEET_PAYLOAD_SIZE + 1];  // Null terminated
+};
+
+
+bool fleetParse(const uint8_t *data, size_t length, FleetHeader &header);  // False if not a request
+bool fleetIsMember(uint8_t group, uint32_t groups);
+FleetSequence fleetCheckSequence(uint32_t address, uint16_t port, uint32_t sequence, bool &failed);
+void fleetRecord(uint32_t address, uint16_t port, uint32_t sequence, bool failed);
@@ -0,0 +1,165 @@
+#include "heap_stats.h"
+#include "journal.h"
+#include "logger.h"
+#include <atomic>
+
+
+static HeapStats snapshot;       // Taken when a threshold was last crossed
+static bool     snapshot_taken = false;
+static bool     below_threshold = false;
+static uint32_t last_check = 0;  // ms
+
+
+#if COMPILEHEAPSTATS
+
+struct HeapTask {
+    std::atomic<TaskHandle_t> handle;
+    char name[HEAP_TASK_NAME_SIZE];
+    std::atomic<uint32_t> allocs;
+    std::atomic<uint32_t> frees;
+    std::atomic<uint32_t> bytes;
+};
+
+
+// The counting runs in IRAM with its data in DRAM, like the heap functions it wraps, since they are
+// called with the flash cache disabled too
+static DRAM_ATTR HeapTask tasks[HEAP_TASK_SLOTS + 1];  // The last slot is "other"
+static DRAM_ATTR portMUX_TYPE tasks_mux = portMUX_INITIALIZER_UNLOCKED;
+
+
+static HeapTask & IRAM_ATTR currentTask() {
+    TaskHandle_t handle = xTaskGetCurrentTaskHandle();
+    if (handle == NULL || xPortInIsrContext()) {
+        return tasks[HEAP_TASK_SLOTS];
+    }
+    for (size_t i = 0; i < HEAP_TASK_SLOTS; i++) {
+        TaskHandle_t slot = tasks[i].handle.load(std::memory_order_acquire);
+        if (slot == handle) return tasks[i];
+        if (slot != NULL) continue;
+
+        // First allocation of this task, claim the slot
+        portENTER_CRITICAL(&tasks_mux);
+        if (tasks[i].handle.load(std::memory_order_relaxed) == NULL) {
+            strncpy(tasks[i].name, pcTaskGetTaskName(handle), HEAP_TASK_NAME_SIZE - 1);
+            tasks[i].handle.store(handle, std::memory_order_release);
+        }
+        portEXIT_CRITICAL(&tasks_mux);
+        if (tasks[i].handle.load(std::memory_order_acquire) == handle) return tasks[i];
+    }
+    return tasks[HEAP_TASK_SLOTS];
+}
+
+
+static void IRAM_ATTR countAlloc(void *pointer, size_t size) {
+    if (pointer == NULL) return;
+    HeapTask &task = currentTask();
+    task.allocs.fetch_add(1, std::memory_order_relaxed);
+    task.bytes.fetch_add(size, std::memory_order_relaxed);
+}
+
+
+static void IRAM_ATTR countFree(void *pointer) {
+    if (pointer == NULL) return;
+    currentTask().frees.fetch_add(1, std::memory_order_relaxed);
+}
+
+
+// Linked in place of the newlib functions with -Wl,--wrap
+extern "C" {
+    void *__real_malloc(size_t size);
+    void *__real_calloc(size_t count, size_t size);
+    void *__real_realloc(void *pointer, size_t size);
+    void __real_free(void *pointer);
+
+    void * IRAM_ATTR __wrap_malloc(size_t size) {
+        void *result = __real_malloc(size);
+        countAlloc(result, size);
+        return result;
+    }
+
+    void * IRAM_ATTR __wrap_calloc(size_t count, size_t size) {
+        void *result = __real_calloc(count, size);
+        countAlloc(result, count * size);
+        return result;
+    }
+
+    void * IRAM_ATTR __wrap_realloc(void *pointer, size_t size) {
+        void *result = __real_realloc(pointer, size);
+        if (result != NULL || size == 0) {
+            countFree(pointer);
+            countAlloc(result, size);
+        }
+        return result;
+    }
+
+    void IRAM_ATTR __wrap_free(void *pointer) {
+        countFree(pointer);
+        __real_free(pointer);
+    }
+}
+
+#endif
+
+
+HeapStats heapGetStats() {
+    HeapStats stats;
+    stats.time = millis();
+    stats.free = heap_caps_get_free_size(MALLOC_CAP_8BIT);
+    stats.largest_block = heap_caps_get_largest_free_block(MALLOC_CAP_8BIT);
+    stats.min_free = heap_caps_get_minimum_free_size(MALLOC_CAP_8BIT);
+    stats.fragmentation = stats.free > 0 ? 100 - stats.largest_block * 100 / stats.free : 0;
+    return stats;
+}
+
+
+void heapCheck() {
+    if (millis() - last_check < HEAP_CHECK_PERIOD) return;
+    last_check = millis();
+
+    HeapStats stats = heapGetStats();
+    if (!below_threshold
+        && (stats.free < HEAP_LOW_THRESHOLD || stats.largest_block < HEAP_BLOCK_THRESHOLD)) {
+        below_threshold = true;
+        snapshot = stats;
+        snapshot_taken = true;
+        LOGE("Heap low, free: %u, largest block: %u, fragmentation: %u%%", stats.free,
+             stats.largest_block, stats.fragmentation);
+        journalRecord(EVENT_HEAP_LOW, stats.free, stats.largest_block);
+    } else if (below_threshold && stats.free >= HEAP_LOW_THRESHOLD + HEAP_THRESHOLD_MARGIN
+               && stats.largest_block >= HEAP_BLOCK_THRESHOLD + HEAP_THRESHOLD_MARGIN) {
+        below_threshold = false;
+    }
+}
+
+
+static void statsToJson(const HeapStats &stats, JsonObject report) {
+    report["time"] = stats.time;
+    report["free"] = stats.free;
+    report["largest_block"] = stats.largest_block;
+    report["min_free"] = stats.min_free;
+    report["fragmentation"] = stats.fragmentation;
+}
+
+
+void heapStatsToJson(JsonObject report) {
+    statsToJson(heapGetStats(), report);
+    if (snapshot_taken) {
+        statsToJson(snapshot, report["low"].to<JsonObject>());
+    }
+
+    #if COMPILEHEAPSTATS
+        JsonObject tasks_report = report["tasks"].to<JsonObject>();
+        for (size_t i = 0; i <= HEAP_TASK_SLOTS; i++) {
+            HeapTask &task = tasks[i];
+            if (i < HEAP_TASK_SLOTS && task.handle.load(std::memory_order_acquire) == NULL) continue;
+            uint32_t allocs = task.allocs.load(std::memory_order_relaxed);
+            if (allocs == 0) continue;
+            // Copied since the task could be gone
+            JsonObject entry = tasks_report[String(i < HEAP_TASK_SLOTS ? task.name : "other")]
+                               .to<JsonObject>();
+            entry["allocs"] = allocs;
+            entry["frees"] = task.frees.load(std::memory_order_relaxed);
+            entry["bytes"] = task.bytes.load(std::memory_order_relaxed);
+        }
+    #endif
+}
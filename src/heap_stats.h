@@ -0,0 +1,42 @@
+#pragma once
+/**
+    heap_stats.h - Heap and fragmentation instrumentation
+    Author: Jason Chen, 2024
+
+    Keeps track of the free heap, the largest free block and the lowest free heap since boot, and
+    takes a snapshot when the free heap or the largest free block falls below a threshold, which is
+    also recorded in the journal. Main features includes:
+      - With COMPILEHEAPSTATS=1 and malloc/calloc/realloc/free wrapped by the linker (see
+        platformio.ini), allocations and frees are counted per FreeRTOS task, so String and
+        JsonDocument heavy paths such as the web server's async_tcp task can be told apart.
+      - A task is looked up by its handle in a small table, its name is only copied the first time
+        it allocates; tasks that don't fit in the table are counted as "other".
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+
+#ifndef COMPILEHEAPSTATS
+    #define COMPILEHEAPSTATS 0
+#endif
+
+#define HEAP_TASK_SLOTS         12
+#define HEAP_TASK_NAME_SIZE     16
+#define HEAP_CHECK_PERIOD       1000   // ms
+#define HEAP_LOW_THRESHOLD      20480  // Bytes of free heap
+#define HEAP_BLOCK_THRESHOLD    8192   // Bytes of the largest free block
+#define HEAP_THRESHOLD_MARGIN   4096   // Bytes above a threshold before it can trigger again
+
+
+struct HeapStats {
+    uint32_t time;           // ms since boot
+    uint32_t free;
+    uint32_t largest_block;
+    uint32_t min_free;       // Since boot
+    uint8_t  fragmentation;  // %, 100 - largest block / free heap
+};
+
+
+void heapCheck();  // Takes a snapshot if a threshold is crossed, if due
+HeapStats heapGetStats();
+void heapStatsToJson(JsonObject report);
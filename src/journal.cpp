@@ -0,0 +1,287 @@
+#include "journal.h"
+#include "logger.h"
+#include "clock.h"
+
+
+#define JOURNAL_RECORDS_PER_SEGMENT (JOURNAL_SEGMENT_SIZE / sizeof(JournalRecord))
+#define JOURNAL_COMPACT_PATH        JOURNAL_DIRECTORY "/compact.tmp"
+
+
+static SemaphoreHandle_t file_mutex = NULL;      // Guards the segment files
+static portMUX_TYPE buffer_mux = portMUX_INITIALIZER_UNLOCKED;
+static JournalRecord buffer[JOURNAL_BUFFER];
+static size_t   buffered       = 0;
+static bool     flush_now      = false;
+static uint32_t dropped        = 0;
+static uint32_t last_flush     = 0;              // ms
+static uint32_t first_segment  = 0;
+static uint32_t last_segment   = 0;
+static uint16_t boot_count     = 0;
+
+
+static void segmentPath(uint32_t index, char *path, size_t size) {
+    snprintf(path, size, JOURNAL_DIRECTORY "/%08u.bin", index);
+}
+
+
+static uint32_t journalTime(uint8_t &flags) {
+    if (clockSynced()) {
+        flags = 0;
+        return static_cast<uint32_t>(clockNow() / 1000);
+    }
+    flags = JOURNAL_UPTIME;
+    return static_cast<uint32_t>(esp_timer_get_time() / 1000000);
+}
+
+
+static bool isImportant(uint8_t type) {
+    return type != EVENT_NONE && type < EVENT_MOVE;
+}
+
+
+// Merges the two oldest segments into one, keeping only the newest important events
+static void compact() {
+    JournalRecord *kept = static_cast<JournalRecord*>(malloc(JOURNAL_SEGMENT_SIZE));
+    if (kept == NULL) {
+        LOGE("Not enough memory to compact the journal");
+        return;
+    }
+
+    char path[32];
+    size_t total = 0;
+    for (uint32_t index = first_segment; index <= first_segment + 1; index++) {
+        segmentPath(index, path, sizeof(path));
+        File file = LITTLEFS.open(path, FILE_READ);
+        if (!file) continue;
+        JournalRecord record;
+        while (file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record)) {
+            if (isImportant(record.type)) {
+                kept[total++ % JOURNAL_RECORDS_PER_SEGMENT] = record;
+            }
+        }
+        file.close();
+    }
+
+    File file = LITTLEFS.open(JOURNAL_COMPACT_PATH, FILE_WRITE);
+    if (file) {
+        size_t count = min(total, JOURNAL_RECORDS_PER_SEGMENT);
+        for (size_t i = total - count; i < total; i++) {
+            file.write(reinterpret_cast<uint8_t*>(&kept[i % JOURNAL_RECORDS_PER_SEGMENT]),
+                       sizeof(JournalRecord));
+        }
+        file.close();
+
+        // The newer segment stays until the rename replaces it, which LittleFS does atomically,
+        // so a power cut leaves either both segments or the compacted one, see journalInit()
+        segmentPath(first_segment, path, sizeof(path));
+        LITTLEFS.remove(path);
+        segmentPath(first_segment + 1, path, sizeof(path));
+        LITTLEFS.rename(JOURNAL_COMPACT_PATH, path);
+        first_segment++;
+        LOGI("Journal compacted, kept %u of the oldest events", count);
+    } else {
+        LOGE("Failed to open %s for compacting", JOURNAL_COMPACT_PATH);
+    }
+    free(kept);
+}
+
+
+static void startSegment() {
+    char path[32];
+    last_segment++;
+    segmentPath(last_segment, path, sizeof(path));
+    File file = LITTLEFS.open(path, FILE_WRITE);
+    file.close();
+    if (last_segment - first_segment + 1 > JOURNAL_SEGMENTS) {
+        compact();
+    }
+}
+
+
+static void appendRecords(const JournalRecord *records, size_t count) {
+    char path[32];
+    segmentPath(last_segment, path, sizeof(path));
+    File file = LITTLEFS.open(path, FILE_APPEND);
+    size_t used = file ? file.size() / sizeof(JournalRecord) : 0;
+
+    size_t i = 0;
+    while (i < count) {
+        if (!file) {
+            LOGE("Failed to open %s for appending", path);
+            return;
+        }
+        if (used >= JOURNAL_RECORDS_PER_SEGMENT) {
+            file.close();
+            startSegment();
+            segmentPath(last_segment, path, sizeof(path));
+            file = LITTLEFS.open(path, FILE_APPEND);
+            used = 0;
+            continue;
+        }
+        size_t n = min(JOURNAL_RECORDS_PER_SEGMENT - used, count - i);
+        file.write(reinterpret_cast<const uint8_t*>(&records[i]), n * sizeof(JournalRecord));
+        used += n;
+        i += n;
+    }
+    file.close();
+}
+
+
+void journalInit() {
+    file_mutex = xSemaphoreCreateMutex();
+    assert(file_mutex != NULL);
+
+    LITTLEFS.mkdir(JOURNAL_DIRECTORY);
+
+    // Find the oldest and newest segments
+    bool found = false;
+    File directory = LITTLEFS.open(JOURNAL_DIRECTORY);
+    File file;
+    while (directory && (file = directory.openNextFile())) {
+        const char *name = strrchr(file.name(), '/');
+        name = name ? name + 1 : file.name();
+        if (isdigit(name[0]) && strstr(name, ".bin")) {
+            uint32_t index = strtoul(name, NULL, 10);
+            first_segment = found ? min(first_segment, index) : index;
+            last_segment = found ? max(last_segment, index) : index;
+            found = true;
+        }
+        file.close();
+    }
+
+    // Leftover of an interrupted compaction: while both of its segments are still there, there is
+    // one segment too many and it is redone; once the older one is removed, only the rename is left
+    if (LITTLEFS.exists(JOURNAL_COMPACT_PATH)) {
+        if (found && last_segment - first_segment + 1 <= JOURNAL_SEGMENTS) {
+            char source[32];
+            segmentPath(first_segment, source, sizeof(source));
+            LITTLEFS.rename(JOURNAL_COMPACT_PATH, source);
+            LOGI("Journal compaction completed");
+        } else {
+            LITTLEFS.remove(JOURNAL_COMPACT_PATH);
+            if (found && last_segment - first_segment + 1 > JOURNAL_SEGMENTS) {
+                compact();
+            }
+        }
+    }
+
+    char path[32];
+    if (!found) {
+        segmentPath(0, path, sizeof(path));
+        file = LITTLEFS.open(path, FILE_WRITE);
+        file.close();
+    }
+
+    // Continue the boot count from the newest record
+    for (uint32_t index = last_segment; found && index >= first_segment; index--) {
+        segmentPath(index, path, sizeof(path));
+        file = LITTLEFS.open(path, FILE_READ);
+        if (file && file.size() >= sizeof(JournalRecord)) {
+            JournalRecord record;
+            file.seek((file.size() / sizeof(JournalRecord) - 1) * sizeof(JournalRecord));
+            file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record));
+            boot_count = record.boot;
+            file.close();
+            break;
+        }
+        file.close();
+        if (index == 0) break;
+    }
+    boot_count++;
+
+    LOGI("Journal loaded, segments %u-%u, boot #%u", first_segment, last_segment, boot_count);
+}
+
+
+void journalRecord(EventType type, int32_t value, int32_t detail) {
+    JournalRecord record;
+    record.time = journalTime(record.flags);
+    record.boot = boot_count;
+    record.type = type;
+    record.value = value;
+    record.detail = detail;
+
+    portENTER_CRITICAL(&buffer_mux);
+    if (buffered < JOURNAL_BUFFER) {
+        buffer[buffered++] = record;
+        flush_now |= isImportant(type) || buffered == JOURNAL_BUFFER;
+    } else {
+        dropped++;
+    }
+    portEXIT_CRITICAL(&buffer_mux);
+}
+
+
+void journalFlush(bool force) {
+    if (!force && !flush_now && (buffered == 0 || millis() - last_flush < JOURNAL_FLUSH_PERIOD)) {
+        return;
+    }
+
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    JournalRecord records[JOURNAL_BUFFER];
+    portENTER_CRITICAL(&buffer_mux);
+    size_t count = buffered;
+    memcpy(records, buffer, count * sizeof(JournalRecord));
+    buffered = 0;
+    flush_now = false;
+    uint32_t dropped_records = dropped;
+    dropped = 0;
+    portEXIT_CRITICAL(&buffer_mux);
+
+    appendRecords(records, count);
+    last_flush = millis();
+    xSemaphoreGive(file_mutex);
+
+    if (dropped_records > 0) {
+        LOGE("Journal buffer full, %u events dropped", dropped_records);
+    }
+}
+
+
+size_t journalQuery(Print &output, uint32_t from, uint32_t to, size_t limit) {
+    journalFlush(true);
+
+    limit = min(limit, static_cast<size_t>(JOURNAL_QUERY_LIMIT));
+    size_t count = 0;
+    char path[32];
+    output.print("[");
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    for (uint32_t index = first_segment; index <= last_segment && count < limit; index++) {
+        segmentPath(index, path, sizeof(path));
+        File file = LITTLEFS.open(path, FILE_READ);
+        if (!file) continue;
+        JournalRecord record;
+        while (count < limit
+               && file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record)) {
+            if (record.time < from || record.time > to) {
+                continue;
+            }
+            output.printf("%s{\"time\":%u,\"uptime\":%s,\"boot\":%u,\"type\":\"%s\",\"value\":%d,"
+                          "\"detail\":%d}", count > 0 ? "," : "", record.time,
+                          record.flags & JOURNAL_UPTIME ? "true" : "false", record.boot,
+                          eventTypeToString(static_cast<EventType>(record.type)).c_str(),
+                          record.value, record.detail);
+            count++;
+        }
+        file.close();
+    }
+    xSemaphoreGive(file_mutex);
+    output.print("]");
+    return count;
+}
+
+
+String eventTypeToString(EventType type) {
+    if (type == EVENT_BOOT) return "boot";
+    else if (type == EVENT_STALL) return "stall";
+    else if (type == EVENT_CRUMB_COMMAND) return "crumb-command";
+    else if (type == EVENT_CRUMB_STATE) return "crumb-state";
+    else if (type == EVENT_CRUMB_HEAP) return "crumb-heap";
+    else if (type == EVENT_HEAP_LOW) return "heap-low";
+    else if (type == EVENT_MOVE) return "move";
+    else if (type == EVENT_WIFI_CONNECT) return "wifi-connect";
+    else if (type == EVENT_WIFI_DROP) return "wifi-drop";
+    else if (type == EVENT_COMMAND) return "command";
+    else if (type == EVENT_SCHEDULE) return "schedule";
+    return "none";
+}
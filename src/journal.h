@@ -0,0 +1,65 @@
+#pragma once
+/**
+    journal.h - A persistent, append-only journal of system events
+    Author: Jason Chen, 2024
+
+    Events such as moves, stalls, reboots, WiFi drops and commands are recorded as fixed-size
+    records into segment files, /journal/<index>.bin, and can be queried by time range to find
+    out what a unit did without a serial console. Main features includes:
+      - journalRecord() only copies the record into a RAM buffer, it never touches the flash, so it
+        is safe to call from the motor task. The system task calls journalFlush() in its loop
+        which appends the buffer in batches, or right away for important events.
+      - A segment is one LittleFS block, so appending to a segment never rewrites more than one
+        block, and the number of segments is fixed.
+      - Once all segments are used, the two oldest segments are compacted into one by dropping
+        routine events (moves, WiFi, commands and schedules); if they still don't fit, the oldest
+        records of them are dropped.
+**/
+#include <Arduino.h>
+#include "FS.h"
+#include <LITTLEFS.h>
+
+
+#define JOURNAL_DIRECTORY     "/journal"
+#define JOURNAL_SEGMENT_SIZE  4096   // Bytes, one LittleFS block
+#define JOURNAL_SEGMENTS      8
+#define JOURNAL_BUFFER        16     // Records buffered in RAM between flushes
+#define JOURNAL_FLUSH_PERIOD  60000  // ms
+#define JOURNAL_QUERY_LIMIT   256    // Max records returned by a query
+
+#define JOURNAL_UPTIME 0x01  // Flag, time is seconds since boot instead of since epoch
+
+
+enum EventType {
+    EVENT_NONE          = 0,
+    // Important events, kept when compacting
+    EVENT_BOOT          = 1,  // value: reset reason
+    EVENT_STALL         = 2,  // value: position %
+    EVENT_CRUMB_COMMAND = 3,  // Before a crash, value: command, detail: parameter
+    EVENT_CRUMB_STATE   = 4,  // Before a crash, value: task state, detail: state detail
+    EVENT_CRUMB_HEAP    = 5,  // Before a crash, value: free heap, detail: lowest free heap
+    EVENT_HEAP_LOW      = 6,  // value: free heap, detail: largest free block
+    // Routine events
+    EVENT_MOVE          = 16, // value: starting position %, detail: ending position %
+    EVENT_WIFI_CONNECT  = 17, // value: RSSI
+    EVENT_WIFI_DROP     = 18, // value: WiFi status
+    EVENT_COMMAND       = 19, // value: command, detail: parameter, float parameters are x10
+    EVENT_SCHEDULE      = 20  // value: schedule id, detail: percent
+};
+
+
+struct JournalRecord {
+    uint32_t time;   // s, see JOURNAL_UPTIME
+    uint16_t boot;   // Boot count
+    uint8_t  type;
+    uint8_t  flags;
+    int32_t  value;
+    int32_t  detail;
+};
+
+
+void journalInit();
+void journalRecord(EventType type, int32_t value, int32_t detail = 0);
+void journalFlush(bool force = false);  // Flushes if due unless forced
+size_t journalQuery(Print &output, uint32_t from, uint32_t to, size_t limit);
+String eventTypeToString(EventType type);
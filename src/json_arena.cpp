@@ -0,0 +1,126 @@
+#include "json_arena.h"
+#include "logger.h"
+
+
+#define JSON_ARENA_ALIGN(size) (((size) + 7) & ~static_cast<size_t>(7))
+
+
+// Used when no arena is free, fails every allocation so the bound holds
+class NullAllocator : public ArduinoJson::Allocator {
+public:
+    void *allocate(size_t) override { return NULL; }
+    void deallocate(void*) override {}
+    void *reallocate(void*, size_t) override { return NULL; }
+};
+
+
+static JsonArena arenas[JSON_ARENAS];
+static bool arena_used[JSON_ARENAS];
+static SemaphoreHandle_t arenas_free = xSemaphoreCreateCounting(JSON_ARENAS, JSON_ARENAS);
+static portMUX_TYPE arenas_mux = portMUX_INITIALIZER_UNLOCKED;
+static NullAllocator null_allocator;
+static uint32_t peak = 0;
+static uint32_t failures = 0;
+
+
+void *JsonArena::allocate(size_t size) {
+    size_t block = sizeof(Header) + JSON_ARENA_ALIGN(size);
+    if (block > JSON_ARENA_SIZE - offset_) {
+        failures++;
+        return NULL;
+    }
+    Header *new_header = reinterpret_cast<Header*>(buffer_ + offset_);
+    new_header->size = size;
+    last_ = offset_;
+    offset_ += block;
+    live_++;
+    peak = max(peak, static_cast<uint32_t>(offset_));
+    return new_header + 1;
+}
+
+
+void JsonArena::deallocate(void *pointer) {
+    if (pointer == NULL) return;
+    if (reinterpret_cast<uint8_t*>(header(pointer)) == buffer_ + last_) {
+        offset_ = last_;  // The newest block can be given back right away
+    }
+    if (--live_ == 0) {
+        offset_ = 0;
+        last_ = 0;
+    }
+}
+
+
+void *JsonArena::reallocate(void *pointer, size_t new_size) {
+    if (pointer == NULL) {
+        return allocate(new_size);
+    }
+
+    Header *old_header = header(pointer);
+    if (reinterpret_cast<uint8_t*>(old_header) == buffer_ + last_) {
+        // The newest block grows or shrinks in place
+        size_t block = sizeof(Header) + JSON_ARENA_ALIGN(new_size);
+        if (block > JSON_ARENA_SIZE - last_) {
+            failures++;
+            return NULL;
+        }
+        old_header->size = new_size;
+        offset_ = last_ + block;
+        peak = max(peak, static_cast<uint32_t>(offset_));
+        return pointer;
+    }
+
+    if (new_size <= old_header->size) {
+        old_header->size = new_size;
+        return pointer;
+    }
+
+    void *result = allocate(new_size);
+    if (result != NULL) {
+        memcpy(result, pointer, old_header->size);
+        deallocate(pointer);
+    }
+    return result;
+}
+
+
+ScopedArena::ScopedArena() : arena_(NULL) {
+    if (xSemaphoreTake(arenas_free, pdMS_TO_TICKS(JSON_ARENA_TIMEOUT)) != pdTRUE) {
+        failures++;
+        LOGE("No JSON arena free after %ums", JSON_ARENA_TIMEOUT);
+        return;
+    }
+    portENTER_CRITICAL(&arenas_mux);
+    for (size_t i = 0; i < JSON_ARENAS && arena_ == NULL; i++) {
+        if (!arena_used[i]) {
+            arena_used[i] = true;
+            arena_ = &arenas[i];
+        }
+    }
+    portEXIT_CRITICAL(&arenas_mux);
+}
+
+
+ScopedArena::~ScopedArena() {
+    if (arena_ == NULL) return;
+    portENTER_CRITICAL(&arenas_mux);
+    arena_used[arena_ - arenas] = false;
+    portEXIT_CRITICAL(&arenas_mux);
+    xSemaphoreGive(arenas_free);
+}
+
+
+ArduinoJson::Allocator *ScopedArena::allocator() {
+    if (arena_ == NULL) {
+        return &null_allocator;
+    }
+    return arena_;
+}
+
+
+JsonArenaStats jsonArenaGetStats() {
+    JsonArenaStats stats;
+    stats.peak = peak;
+    stats.failures = failures;
+    return stats;
+}
@@ -0,0 +1,67 @@
+#pragma once
+/**
+    json_arena.h - A fixed pool of arenas for transient ArduinoJson documents
+    Author: Jason Chen, 2024
+
+    Documents that only live for one request or one serialization, i.e. getJSON(), take an arena
+    from a fixed pool instead of allocating from the general heap:
+
+        ScopedArena arena;
+        JsonDocument doc(arena.allocator());
+
+    An arena hands out memory by bumping an offset and is reset once everything allocated from it
+    has been freed, which happens when the document is destroyed, and the ScopedArena returns it to
+    the pool. JSON memory is bounded by JSON_ARENAS * JSON_ARENA_SIZE; a document that outgrows its
+    arena is reported as overflowed() by ArduinoJson, like any failed allocation.
+
+    Long-lived documents such as Task::settings_ keep the default allocator since an arena never
+    reuses memory freed in the middle of it.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+
+#define JSON_ARENAS        2      // Tasks building documents at the same time
+#define JSON_ARENA_SIZE    8192   // Bytes
+#define JSON_ARENA_TIMEOUT 1000   // ms, waiting for a free arena
+
+
+struct JsonArenaStats {
+    uint32_t peak;      // Bytes, most used of an arena
+    uint32_t failures;  // Allocations that didn't fit, or no arena was free
+};
+
+
+class JsonArena : public ArduinoJson::Allocator {
+public:
+    void *allocate(size_t size) override;
+    void deallocate(void *pointer) override;
+    void *reallocate(void *pointer, size_t new_size) override;
+
+private:
+    struct Header {
+        uint32_t size;
+        uint32_t padding;  // Blocks are 8-byte aligned for doubles
+    };
+
+    alignas(8) uint8_t buffer_[JSON_ARENA_SIZE];
+    size_t offset_ = 0;  // Bytes used
+    size_t last_   = 0;  // Offset of the newest block, can be grown or shrunk in place
+    size_t live_   = 0;  // Blocks not yet freed
+
+    Header *header(void *pointer) { return static_cast<Header*>(pointer) - 1; }
+};
+
+
+class ScopedArena {
+public:
+    ScopedArena();   // Waits for a free arena
+    ~ScopedArena();  // Returns the arena to the pool
+    ArduinoJson::Allocator *allocator();
+
+private:
+    JsonArena *arena_;
+};
+
+
+JsonArenaStats jsonArenaGetStats();
@@ -1 +1,124 @@
-#include "led_task.h"
\ No newline at end of file
+#define LOG_MODULE LOG_LED
+#include "led_task.h"
+
+
+const LedSequence LedTask::patterns_[LED_PATTERN_COUNT] = {
+    {1, {{0, 0, false}}},                                                          // LED_OFF
+    {2, {{LED_MAX_DUTY, 500, false}, {0, 500, false}}},                            // LED_CONNECTING
+    {2, {{LED_MAX_DUTY, 1000, true}, {0, 1000, true}}},                            // LED_SETUP_MODE
+    {2, {{LED_MAX_DUTY, 300, true}, {16, 300, true}}},                             // LED_MOVING
+    {2, {{LED_MAX_DUTY, 100, false}, {0, 100, false}}},                            // LED_STALL
+    {4, {{LED_MAX_DUTY, 50, false}, {0, 50, false}, {LED_MAX_DUTY, 50, false},
+         {0, 350, false}}},                                                        // LED_OTA
+    {1, {{LED_MAX_DUTY, 0, false}}},                                               // LED_HOLD_SETUP
+    {1, {{0, 0, false}}}                                                           // LED_HOLD_RESET
+};
+
+
+TASK_MEMORY(led_task_memory, LED_TASK_STACK, LED_TASK_QUEUE);
+
+
+LedTask::LedTask(const uint8_t task_core) :
+        Task{"LedTask", LED_TASK_STACK, 1, task_core, LED_TASK_QUEUE, led_task_memory} {}
+LedTask::~LedTask() {}
+
+
+void LedTask::run() {
+    ledcSetup(LED_CHANNEL, LED_FREQUENCY, LED_RESOLUTION);
+    ledcAttachPin(BOARD.led, LED_CHANNEL);
+    ledc_fade_func_install(0);
+    playStep();
+
+    while (1) {
+        // Block until either a new message arrives or it's time for the next step
+        if (xQueueReceive(queue_, (void*) &inbox_, ticksToWait()) == pdTRUE) {
+            LOGI("LedTask received message: %s", inbox_.toString().c_str());
+            switch (inbox_.command) {
+                case LED_PATTERN:
+                    setPattern(static_cast<LedPattern>(inbox_.parameter));
+                    break;
+                case LED_CLEAR:
+                    clearPattern(static_cast<LedPattern>(inbox_.parameter));
+                    break;
+            }
+            continue;
+        }
+
+        TickType_t now = xTaskGetTickCount();
+        if (overlay_expires_ && static_cast<int32_t>(now - overlay_expiry_) >= 0) {
+            clearPattern(overlay_pattern_);
+            continue;
+        }
+
+        const LedSequence &sequence = patterns_[overlay_pattern_ != LED_OFF ? overlay_pattern_ : base_pattern_];
+        step_ = (step_ + 1) % sequence.length;
+        playStep();
+    }
+}
+
+
+void LedTask::setPattern(LedPattern pattern) {
+    if (pattern < LED_OFF || pattern >= LED_PATTERN_COUNT) {
+        LOGE("Invalid LED pattern: %d", pattern);
+        return;
+    }
+
+    if (pattern < LED_MOVING) {
+        base_pattern_ = pattern;
+        if (overlay_pattern_ != LED_OFF) {
+            return;  // Base pattern shows up after the overlay is cleared
+        }
+    } else {
+        overlay_pattern_ = pattern;
+        overlay_expires_ = pattern == LED_STALL;
+        overlay_expiry_ = xTaskGetTickCount() + LED_STALL_DURATION / portTICK_PERIOD_MS;
+    }
+    step_ = 0;
+    playStep();
+}
+
+
+void LedTask::clearPattern(LedPattern pattern) {
+    if (pattern != overlay_pattern_ || overlay_pattern_ == LED_OFF) {
+        return;
+    }
+    overlay_pattern_ = LED_OFF;
+    overlay_expires_ = false;
+    step_ = 0;
+    playStep();
+}
+
+
+void LedTask::playStep() {
+    const LedSequence &sequence = patterns_[overlay_pattern_ != LED_OFF ? overlay_pattern_ : base_pattern_];
+    const LedStep &step = sequence.steps[step_];
+
+    // Both calls wait for an unfinished fade to complete, which is at most one step
+    if (step.fade) {
+        ledc_set_fade_with_time(LEDC_HIGH_SPEED_MODE, static_cast<ledc_channel_t>(LED_CHANNEL),
+                                step.duty, step.duration);
+        ledc_fade_start(LEDC_HIGH_SPEED_MODE, static_cast<ledc_channel_t>(LED_CHANNEL),
+                        LEDC_FADE_NO_WAIT);
+    } else {
+        ledc_set_duty(LEDC_HIGH_SPEED_MODE, static_cast<ledc_channel_t>(LED_CHANNEL), step.duty);
+        ledc_update_duty(LEDC_HIGH_SPEED_MODE, static_cast<ledc_channel_t>(LED_CHANNEL));
+    }
+
+    step_holds_ = step.duration == 0 || (sequence.length == 1);
+    step_end_ = xTaskGetTickCount() + step.duration / portTICK_PERIOD_MS;
+}
+
+
+TickType_t LedTask::ticksToWait() {
+    TickType_t now = xTaskGetTickCount();
+    TickType_t wait = portMAX_DELAY;
+    if (!step_holds_) {
+        int32_t remaining = static_cast<int32_t>(step_end_ - now);
+        wait = remaining > 0 ? remaining : 0;
+    }
+    if (overlay_expires_) {
+        int32_t remaining = static_cast<int32_t>(overlay_expiry_ - now);
+        wait = min(wait, static_cast<TickType_t>(remaining > 0 ? remaining : 0));
+    }
+    return wait;
+}
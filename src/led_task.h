@@ -1,15 +1,82 @@
 #pragma once
+/**
+    led_task.h - A class that indicates the state of the system with the status LED.
+    Author: Jason Chen, 2024
+
+    The LED is driven by the LEDC (PWM) peripheral and every pattern is a sequence of steps, each
+    step either sets a brightness or lets the LEDC hardware fade to it over the step's duration.
+    Between steps the task is blocked on its queue, so a playing pattern costs no CPU time. Other
+    tasks change the pattern by sending messages:
+        (1) LED_PATTERN with a base pattern sets the state of the system, i.e. connecting
+        (2) LED_PATTERN with an overlay pattern shows an activity on top of the base pattern until
+            it's cleared with LED_CLEAR, i.e. moving; LED_STALL clears itself
+**/
+#include <driver/ledc.h>
 #include "task.h"
 
-class LedTask: public Task {
+
+#define LED_TASK_STACK     4096  // Bytes, see "stacks" in /json
+#define LED_TASK_QUEUE     8
+#define LED_CHANNEL        0
+#define LED_FREQUENCY      5000  // Hz
+#define LED_RESOLUTION     8     // bits
+#define LED_MAX_DUTY       255
+#define LED_STALL_DURATION 3000  // ms
+#define LED_MAX_STEPS      4
+
+
+enum LedPattern {
+    // Base patterns
+    LED_OFF        = 0,
+    LED_CONNECTING = 1,
+    LED_SETUP_MODE = 2,
+
+    // Overlay patterns
+    LED_MOVING     = 3,
+    LED_STALL      = 4,
+    LED_OTA        = 5,
+    LED_HOLD_SETUP = 6,  // Button held long enough to toggle setup mode
+    LED_HOLD_RESET = 7,  // Button held long enough to factory reset
+
+    LED_PATTERN_COUNT
+};
+
+
+struct LedStep {
+    uint8_t  duty;
+    uint16_t duration;  // ms; 0 holds the step until the pattern changes
+    bool     fade;      // Fade to duty over the duration instead of switching immediately
+};
+
+
+// Steps are played in order and repeated, unless the last step holds
+struct LedSequence {
+    uint8_t length;
+    LedStep steps[LED_MAX_STEPS];
+};
+
+
+class LedTask : public Task {
 public:
-    LedTask();
+    LedTask(const uint8_t task_core);
     ~LedTask();
-    void turnOn();
-    void turnOff();
 
 protected:
     void run();
 
 private:
-};
\ No newline at end of file
+    static const LedSequence patterns_[LED_PATTERN_COUNT];
+
+    LedPattern base_pattern_    = LED_OFF;
+    LedPattern overlay_pattern_ = LED_OFF;  // LED_OFF if there's no overlay
+    bool       overlay_expires_ = false;
+    TickType_t overlay_expiry_  = 0;        // Tick to clear the overlay
+    uint8_t    step_            = 0;
+    bool       step_holds_      = true;
+    TickType_t step_end_        = 0;        // Tick to play the next step
+
+    void setPattern(LedPattern pattern);
+    void clearPattern(LedPattern pattern);
+    void playStep();
+    TickType_t ticksToWait();
+};
@@ -1,59 +1,368 @@
 #if COMPILELOGS  // if defined, exclude Serial.println statements when compiling
 
 #include "logger.h"
+#include <atomic>
+#include <freertos/ringbuf.h>
+#include "static_allocation.h"
 
 
-LogLevel log_level = LogLevel::DEBUG;
+enum LogArgType {
+    LOG_ARG_NONE,
+    LOG_ARG_INT,
+    LOG_ARG_LONG,
+    LOG_ARG_DOUBLE,
+    LOG_ARG_STRING,
+    LOG_ARG_POINTER
+};
 
 
-void Logger(int baud_rate, LogLevel log_level) {
-    Serial.begin(baud_rate);
-    while(!Serial);  // Wait for serial port to connect
-    log_level = log_level;
-}
+struct LogEntry {
+    std::atomic<uint32_t> sequence;  // Handoff between producers and the drain task
+    int64_t     timestamp;           // us
+    const char *file;
+    const char *func;
+    const char *format;
+    uint16_t    line;
+    uint8_t     level;
+    uint8_t     word_count;
+    uint32_t    words[LOG_MAX_WORDS];
+    char        strings[LOG_STRING_SIZE];
+};
+
+
+// Bounded multi-producer ring buffer; every slot carries a sequence number so producers only
+// need a compare-and-swap on the enqueue position to claim a slot, and the drain task knows
+// when a slot has been completely written.
+struct LogRing {
+    LogEntry entries[LOG_BUFFER_ENTRIES];
+    std::atomic<uint32_t> enqueue_position;
+    uint32_t dequeue_position;
+};
 
 
-void print(LogLevel log_level, String s) {
-    if (log_level <= log_level) Serial.println(s);
+volatile uint8_t log_levels[LOG_MODULE_COUNT] = {LogLevel::DEBUG, LogLevel::DEBUG,
+                                                  LogLevel::DEBUG, LogLevel::DEBUG};
+
+static LogRing rings[portNUM_PROCESSORS];
+static std::atomic<uint32_t> recorded_count(0);
+static std::atomic<uint32_t> dropped_count(0);
+static std::atomic<uint32_t> cost_cycles(0);  // Moving average over the last 16 log calls
+static TaskHandle_t drain_task_handle = NULL;
+STATIC_BUFFER(StackType_t, drain_stack, LOG_DRAIN_STACK);
+STATIC_BUFFER(StaticTask_t, drain_task, 1);
+
+// Formatted lines for network consumers, see logStreamRead()
+static RingbufHandle_t stream_buffer = NULL;
+static volatile bool stream_enabled = false;
+static std::atomic<uint32_t> stream_dropped_count(0);
+
+
+// Parses the next conversion specification of a printf format string, returns the position
+// after it and the type of argument it consumes.
+static const char* parseSpec(const char *format, LogArgType &type) {
+    type = LOG_ARG_NONE;
+    if (*format == '%') {
+        return format + 1;
+    }
+    while (*format && strchr("-+ #0123456789.", *format)) {
+        format++;
+    }
+    int longs = 0;
+    while (*format && strchr("hlLqjzt", *format)) {
+        if (*format == 'l' || *format == 'q' || *format == 'j') {
+            longs++;
+        }
+        format++;
+    }
+    switch (*format) {
+        case 'd': case 'i': case 'u': case 'x': case 'X': case 'o': case 'c':
+            type = longs >= 2 ? LOG_ARG_LONG : LOG_ARG_INT;
+            break;
+        case 'f': case 'F': case 'e': case 'E': case 'g': case 'G': case 'a': case 'A':
+            type = LOG_ARG_DOUBLE;
+            break;
+        case 's':
+            type = LOG_ARG_STRING;
+            break;
+        case 'p':
+            type = LOG_ARG_POINTER;
+            break;
+        case '\0':
+            return format;
+    }
+    return format + 1;
 }
 
 
-void printErr(String file, String line, String func, const char* s, ...) {
-    String prefix = "[E][" + file + ":" + line + "] " + func + "(): ";
+void logRecord(LogLevel level, const char *file, uint16_t line, const char *func,
+               const char *format, ...) {
+    uint32_t start = ESP.getCycleCount();
+    LogRing &ring = rings[xPortGetCoreID()];
+
+    // Claim a slot
+    LogEntry *entry;
+    uint32_t position = ring.enqueue_position.load(std::memory_order_relaxed);
+    while (1) {
+        entry = &ring.entries[position & (LOG_BUFFER_ENTRIES - 1)];
+        int32_t difference = static_cast<int32_t>(entry->sequence.load(std::memory_order_acquire)
+                                                  - position);
+        if (difference == 0) {
+            if (ring.enqueue_position.compare_exchange_weak(position, position + 1,
+                                                            std::memory_order_relaxed)) {
+                break;
+            }
+        } else if (difference < 0) {
+            dropped_count.fetch_add(1, std::memory_order_relaxed);
+            return;
+        } else {
+            position = ring.enqueue_position.load(std::memory_order_relaxed);
+        }
+    }
 
-    char buf[128];
+    entry->timestamp = esp_timer_get_time();
+    entry->file = file;
+    entry->func = func;
+    entry->format = format;
+    entry->line = line;
+    entry->level = level;
+
+    // Copy arguments by their types in the format string
+    uint8_t words = 0;
+    uint8_t string_length = 0;
     va_list args;
-	va_start(args, s);
-	vsnprintf(buf, sizeof(buf), s, args);
-	va_end(args);
+    va_start(args, format);
+    for (const char *c = strchr(format, '%'); c != NULL; c = strchr(c, '%')) {
+        LogArgType type;
+        c = parseSpec(c + 1, type);
+        if (type == LOG_ARG_NONE) {
+            continue;
+        } else if (type == LOG_ARG_LONG || type == LOG_ARG_DOUBLE) {
+            if (words + 2 > LOG_MAX_WORDS) break;
+            uint64_t value;
+            if (type == LOG_ARG_LONG) {
+                value = va_arg(args, uint64_t);
+            } else {
+                double d = va_arg(args, double);
+                memcpy(&value, &d, sizeof(value));
+            }
+            memcpy(&entry->words[words], &value, sizeof(value));
+            words += 2;
+        } else {
+            if (words + 1 > LOG_MAX_WORDS) break;
+            if (type == LOG_ARG_STRING) {
+                // Store the offset of the copied string instead of the pointer
+                const char *s = va_arg(args, const char*);
+                entry->words[words++] = string_length;
+                if (s == NULL) s = "(null)";
+                while (*s && string_length < LOG_STRING_SIZE - 1) {
+                    entry->strings[string_length++] = *s++;
+                }
+                entry->strings[string_length] = '\0';
+                if (string_length < LOG_STRING_SIZE - 1) string_length++;
+            } else if (type == LOG_ARG_POINTER) {
+                entry->words[words++] = reinterpret_cast<uintptr_t>(va_arg(args, void*));
+            } else {
+                entry->words[words++] = va_arg(args, uint32_t);
+            }
+        }
+    }
+    va_end(args);
+    entry->word_count = words;
+
+    // Publish the slot to the drain task
+    entry->sequence.store(position + 1, std::memory_order_release);
 
-	print(LogLevel::ERROR, prefix + String(buf));
+    recorded_count.fetch_add(1, std::memory_order_relaxed);
+    uint32_t average = cost_cycles.load(std::memory_order_relaxed);
+    uint32_t cycles = ESP.getCycleCount() - start;
+    cost_cycles.store(average - average / 16 + cycles / 16, std::memory_order_relaxed);
 }
 
 
-void printInf(String file, String line, String func, const char* s, ...) {
-    String prefix = "[I][" + file + ":" + line + "] " + func + "(): ";
+static void formatEntry(const LogEntry &entry, char *line, size_t size) {
+    static const char level_chars[] = {'E', 'I', 'D'};
+    int length = snprintf(line, size, "[%6u][%c][%s:%u] %s(): ",
+                          static_cast<uint32_t>(entry.timestamp / 1000),
+                          level_chars[entry.level], entry.file, entry.line, entry.func);
 
-    char buf[128];
-    va_list args;
-	va_start(args, s);
-	vsnprintf(buf, sizeof(buf), s, args);
-	va_end(args);
+    uint8_t word = 0;
+    char spec[16];
+    const char *c = entry.format;
+    while (*c && length < static_cast<int>(size) - 1) {
+        if (*c != '%') {
+            line[length++] = *c++;
+            continue;
+        }
+        LogArgType type;
+        const char *end = parseSpec(c + 1, type);
+        size_t spec_length = min(static_cast<size_t>(end - c), sizeof(spec) - 1);
+        memcpy(spec, c, spec_length);
+        spec[spec_length] = '\0';
+        c = end;
 
-	print(LogLevel::INFO, prefix + String(buf));
+        char *out = line + length;
+        size_t remaining = size - length;
+        int written = 0;
+        if (type == LOG_ARG_NONE) {
+            written = snprintf(out, remaining, "%s", spec[1] == '%' ? "%" : "");
+        } else if ((type == LOG_ARG_LONG || type == LOG_ARG_DOUBLE) && word + 2 <= entry.word_count) {
+            uint64_t value;
+            memcpy(&value, &entry.words[word], sizeof(value));
+            word += 2;
+            if (type == LOG_ARG_LONG) {
+                written = snprintf(out, remaining, spec, value);
+            } else {
+                double d;
+                memcpy(&d, &value, sizeof(d));
+                written = snprintf(out, remaining, spec, d);
+            }
+        } else if (type != LOG_ARG_LONG && type != LOG_ARG_DOUBLE && word + 1 <= entry.word_count) {
+            uint32_t value = entry.words[word++];
+            if (type == LOG_ARG_STRING) {
+                written = snprintf(out, remaining, spec, &entry.strings[value]);
+            } else if (type == LOG_ARG_POINTER) {
+                written = snprintf(out, remaining, spec, reinterpret_cast<void*>(static_cast<uintptr_t>(value)));
+            } else {
+                written = snprintf(out, remaining, spec, value);
+            }
+        } else {
+            written = snprintf(out, remaining, "?");  // Ran out of argument space
+        }
+        length += min(written, static_cast<int>(remaining) - 1);
+    }
+    line[min(length, static_cast<int>(size) - 1)] = '\0';
 }
 
 
-void printDbg(String file, String line, String func, const char* s, ...) {
-    String prefix = "[D][" + file + ":" + line + "] " + func + "(): ";
+// Returns the oldest published entry across the cores, NULL if all rings are empty
+static LogEntry* peekOldest(int &core) {
+    LogEntry *oldest = NULL;
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        LogRing &ring = rings[i];
+        LogEntry *entry = &ring.entries[ring.dequeue_position & (LOG_BUFFER_ENTRIES - 1)];
+        if (entry->sequence.load(std::memory_order_acquire) != ring.dequeue_position + 1) {
+            continue;
+        }
+        if (oldest == NULL || entry->timestamp < oldest->timestamp) {
+            oldest = entry;
+            core = i;
+        }
+    }
+    return oldest;
+}
+
+
+// Never waits for space in the stream buffer, the line is dropped if consumers are too slow
+static void streamLine(LogLevel level, const char *line) {
+    if (!stream_enabled) {
+        return;
+    }
+    char item[LOG_LINE_SIZE + 1];
+    size_t length = strlen(line);
+    item[0] = static_cast<char>(level);
+    memcpy(item + 1, line, length);
+    if (xRingbufferSend(stream_buffer, item, length + 1, 0) != pdTRUE) {
+        stream_dropped_count.fetch_add(1, std::memory_order_relaxed);
+    }
+}
+
+
+static void drainTask(void *params) {
+    char line[LOG_LINE_SIZE];
+    uint32_t reported_dropped = 0;
+
+    while (1) {
+        int core;
+        LogEntry *entry;
+        while ((entry = peekOldest(core)) != NULL) {
+            formatEntry(*entry, line, sizeof(line));
+
+            // Release the slot before printing so producers aren't held up by the UART
+            LogRing &ring = rings[core];
+            entry->sequence.store(ring.dequeue_position + LOG_BUFFER_ENTRIES,
+                                  std::memory_order_release);
+            ring.dequeue_position++;
+
+            Serial.println(line);
+            streamLine(static_cast<LogLevel>(entry->level), line);
+        }
+
+        uint32_t dropped = dropped_count.load(std::memory_order_relaxed);
+        if (dropped != reported_dropped) {
+            Serial.printf("[%6u][E] %u log entries dropped\n",
+                          static_cast<uint32_t>(esp_timer_get_time() / 1000),
+                          dropped - reported_dropped);
+            reported_dropped = dropped;
+        }
+
+        vTaskDelay(LOG_DRAIN_PERIOD / portTICK_PERIOD_MS);
+    }
+}
+
+
+void Logger(int baud_rate, LogLevel log_level) {
+    Serial.begin(baud_rate);
+    while(!Serial);  // Wait for serial port to connect
+
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        log_levels[i] = log_level;
+    }
+
+    for (int i = 0; i < portNUM_PROCESSORS; i++) {
+        for (uint32_t j = 0; j < LOG_BUFFER_ENTRIES; j++) {
+            rings[i].entries[j].sequence.store(j, std::memory_order_relaxed);
+        }
+        rings[i].enqueue_position.store(0, std::memory_order_relaxed);
+        rings[i].dequeue_position = 0;
+    }
+
+    stream_buffer = xRingbufferCreate(LOG_STREAM_SIZE, RINGBUF_TYPE_NOSPLIT);
+    assert(stream_buffer != NULL);
+
+    drain_task_handle = createTask(drainTask, "LogDrainTask", LOG_DRAIN_STACK, NULL, tskIDLE_PRIORITY,
+                                   LOG_DRAIN_CORE, drain_stack, drain_task);
+    assert(drain_task_handle != NULL);
+}
+
+
+LogStats logGetStats() {
+    LogStats stats;
+    stats.recorded = recorded_count.load(std::memory_order_relaxed);
+    stats.dropped = dropped_count.load(std::memory_order_relaxed);
+    stats.cost_ns = cost_cycles.load(std::memory_order_relaxed) * 1000 / getCpuFrequencyMhz();
+    stats.stream_dropped = stream_dropped_count.load(std::memory_order_relaxed);
+    return stats;
+}
+
+
+void logStreamEnable(bool enable) {
+    if (stream_enabled == enable) {
+        return;
+    }
+    stream_enabled = enable;
+    if (!enable) {
+        // Discard buffered lines so a new consumer doesn't get stale ones
+        size_t size;
+        void *item;
+        while ((item = xRingbufferReceive(stream_buffer, &size, 0)) != NULL) {
+            vRingbufferReturnItem(stream_buffer, item);
+        }
+    }
+}
 
-    char buf[128];
-    va_list args;
-	va_start(args, s);
-	vsnprintf(buf, sizeof(buf), s, args);
-	va_end(args);
 
-	print(LogLevel::DEBUG, prefix + String(buf));
+bool logStreamRead(char *line, size_t size, LogLevel &level) {
+    size_t item_size;
+    char *item = static_cast<char*>(xRingbufferReceive(stream_buffer, &item_size, 0));
+    if (item == NULL) {
+        return false;
+    }
+    level = static_cast<LogLevel>(item[0]);
+    size_t length = min(item_size - 1, size - 1);
+    memcpy(line, item + 1, length);
+    line[length] = '\0';
+    vRingbufferReturnItem(stream_buffer, item);
+    return true;
 }
 
-#endif
\ No newline at end of file
+#endif
@@ -1,26 +1,44 @@
 #pragma once
 /**
-    logger.h - A simple Serial.println wrapper
+    logger.h - A deferred, lock-free logger
     Aurthor: Jason Chen, 2022
 
-    A simple wrapper file for Serial.println statements that imitates the output format of
-    Espressif ESP32 logger library. Main features includes:
-      - Output Serial.println statements based on LogLevel(ERROR, INFO, DEBUG).
-        Logs that are higher level than set level will not be outputted.
-      - Serial.println() statements can be easily omitted during compiling.
+    A logger that imitates the output format of Espressif ESP32 logger library without formatting
+    or printing in the task that logs. Main features includes:
+      - LOGE/LOGI/LOGD only record the format string pointer, timestamp and arguments into a
+        per-core lock-free ring buffer; string arguments are copied since they are usually
+        temporaries. A low priority task formats the entries and prints them with Serial.println.
+      - Entries are dropped instead of blocking the logging task if the ring buffer is full; the
+        number of dropped entries and the average cost of a log call are kept in LogStats.
+      - Formatted lines can also be streamed to network consumers through a bounded buffer, which
+        drops lines instead of waiting for a slow consumer; see logStreamEnable().
+      - Each source file belongs to a LogModule and every module has its own runtime log level,
+        logs that are higher level than the module's level are skipped before their arguments
+        are evaluated.
+      - Serial.println() statements can be easily omitted during compiling, either all of them or
+        only the ones above a compile-time level.
 
     Usage:
       1. #include "logger.h"
       2. LOG_INIT(baudRate, LogLevel) in setup()
       3. Use LOGE(msg), LOGI(msg), LOGD(msg) in-place of Serial.println() for different level of
-        logs.
+        logs. Format strings must be string literals, '*' width and precision are not supported.
       4. #define COMPILELOGS=1 omitts Serial.println() statements when compiling.
+      5. #define COMPILELOGLEVEL=0|1|2 omitts logs above ERROR|INFO|DEBUG when compiling.
+      6. #define LOG_MODULE before including any header in a source file to set its module, and
+        use LOG_SET_LEVEL(module, LogLevel) to change a module's level at runtime.
 **/
-#if COMPILELOGS  // if defined, exclude Serial.println statements when compiling
-
 #include <Arduino.h>
 #include <stdarg.h>
 
+#ifndef COMPILELOGLEVEL
+    #define COMPILELOGLEVEL 2
+#endif
+
+#ifndef LOG_MODULE
+    #define LOG_MODULE LOG_SYSTEM
+#endif
+
 
 enum LogLevel {
     ERROR=0,
@@ -29,21 +47,73 @@ enum LogLevel {
 };
 
 
+enum LogModule {
+    LOG_SYSTEM   = 0,
+    LOG_MOTOR    = 1,
+    LOG_WIRELESS = 2,
+    LOG_LED      = 3,
+    LOG_MODULE_COUNT
+};
+
+
+#if COMPILELOGS  // if defined, exclude Serial.println statements when compiling
+
+#define LOG_BUFFER_ENTRIES 32     // Per core, must be a power of 2
+#define LOG_MAX_WORDS      8      // 32-bit words of arguments per entry, doubles take 2
+#define LOG_STRING_SIZE    48     // Bytes of copied string arguments per entry
+#define LOG_LINE_SIZE      256    // Bytes of a formatted line
+#define LOG_DRAIN_PERIOD   10     // ms
+#define LOG_DRAIN_STACK    4096
+#define LOG_DRAIN_CORE     0
+#define LOG_STREAM_SIZE    4096   // Bytes of formatted lines buffered for network consumers
+
+
+struct LogStats {
+    uint32_t recorded;
+    uint32_t dropped;
+    uint32_t cost_ns;         // Average time spent in the logging task per log call
+    uint32_t stream_dropped;  // Lines network consumers were too slow to take
+};
+
+
+extern volatile uint8_t log_levels[LOG_MODULE_COUNT];
+
 void Logger(int, LogLevel);
-void printErr(String, String, String, const char*, ...);
-void printInf(String, String, String, const char*, ...);
-void printDbg(String, String, String, const char*, ...);
+void logRecord(LogLevel, const char*, uint16_t, const char*, const char*, ...);
+LogStats logGetStats();
+void logStreamEnable(bool enable);
+bool logStreamRead(char *line, size_t size, LogLevel &level);  // Non-blocking
 
 #define LOG_INIT(baud_rate, log_level) Logger(baud_rate, log_level)
-#define LOGE(msg, ...) printErr(String(__FILE__), String(__LINE__), String(__func__), msg, ##__VA_ARGS__)
-#define LOGI(msg, ...) printInf(String(__FILE__), String(__LINE__), String(__func__), msg, ##__VA_ARGS__)
-#define LOGD(msg, ...) printDbg(String(__FILE__), String(__LINE__), String(__func__), msg, ##__VA_ARGS__)
+#define LOG_SET_LEVEL(module, log_level) log_levels[module] = log_level
+#define LOG_GET_LEVEL(module) static_cast<LogLevel>(log_levels[module])
+#define LOG_AT(log_level, msg, ...) \
+    do { \
+        if (log_level <= log_levels[LOG_MODULE]) \
+            logRecord(log_level, __FILE__, __LINE__, __func__, msg, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOGE(msg, ...) LOG_AT(LogLevel::ERROR, msg, ##__VA_ARGS__)
+
+#if COMPILELOGLEVEL >= 1
+    #define LOGI(msg, ...) LOG_AT(LogLevel::INFO, msg, ##__VA_ARGS__)
+#else
+    #define LOGI(msg, ...)
+#endif
+
+#if COMPILELOGLEVEL >= 2
+    #define LOGD(msg, ...) LOG_AT(LogLevel::DEBUG, msg, ##__VA_ARGS__)
+#else
+    #define LOGD(msg, ...)
+#endif
 
 #else
 
 #define LOG_INIT(baud_rate, log_level)
+#define LOG_SET_LEVEL(module, log_level)
+#define LOG_GET_LEVEL(module) LogLevel::ERROR
 #define LOGE(msg, ...)
 #define LOGI(msg, ...)
 #define LOGD(msg, ...)
 
-#endif
\ No newline at end of file
+#endif
@@ -11,35 +11,65 @@
 #include "system_task.h"
 #include "motor_task.h"
 #include "wireless_task.h"
+#include "led_task.h"
 
 
 static WirelessTask wireless_task(0);  // Running on core0
 static SystemTask system_task(0);      // Running on core0
-static MotorTask motor_task(1);        // Running on core1
+static MotorTask motor_task(1, 0);     // Running on core1
+#if MOTOR_COUNT > 1
+    static MotorTask motor1_task(1, 1);
+#endif
+static LedTask led_task(0);            // Running on core0
+
+static MotorTask *const motor_tasks[MOTOR_COUNT] = {
+    &motor_task,
+    #if MOTOR_COUNT > 1
+        &motor1_task,
+    #endif
+};
 
 
 void setup() {
     // Initializing serial output if compiled
     LOG_INIT(115200, LogLevel::INFO);
 
+    breadcrumbsInit();
+
     if (!LITTLEFS.begin(true)) {
         LOGE("Failed to mount filesystem");
     }
 
+    journalInit();
+    timeseriesInit();
+    odometerInit();
+    scheduleInit();
+
     // setCpuFrequencyMhz(80);
 
+    led_task.init();
+
     system_task.init();
-    system_task.addMotorTask(&motor_task);
+    for (MotorTask *motor : motor_tasks) {
+        system_task.addMotorTask(motor);
+    }
     system_task.addWirelessTask(&wireless_task);
+    system_task.addLedTask(&led_task);
 
     wireless_task.init();
-    wireless_task.addMotorTask(&motor_task);
+    for (MotorTask *motor : motor_tasks) {
+        wireless_task.addMotorTask(motor);
+    }
     wireless_task.addSystemTask(&system_task);
+    wireless_task.addLedTask(&led_task);
     wireless_task.addSystemSleepTimer(system_task.getSystemSleepTimer());
 
-    motor_task.init();
-    motor_task.addWirelessTask(&wireless_task);
-    motor_task.addSystemSleepTimer(system_task.getSystemSleepTimer());
+    for (MotorTask *motor : motor_tasks) {
+        motor->init();
+        motor->addWirelessTask(&wireless_task);
+        motor->addLedTask(&led_task);
+        motor->addSystemSleepTimer(system_task.getSystemSleepTimer());
+    }
 
     // Delete setup/loop task
     vTaskDelete(NULL);
@@ -0,0 +1,54 @@
+#include "motion.h"
+#include <math.h>
+
+
+uint32_t motionTime(float distance, float velocity, float acceleration) {
+    if (distance <= 0 || velocity <= 0 || acceleration <= 0) {
+        return 0;
+    }
+    float seconds;
+    if (distance >= velocity * velocity / acceleration) {
+        // Cruises at the velocity between accelerating and braking
+        seconds = distance / velocity + velocity / acceleration;
+    } else {
+        // Starts braking before reaching the velocity
+        seconds = 2 * sqrtf(distance / acceleration);
+    }
+    return static_cast<uint32_t>(seconds * 1000 + 0.5f);
+}
+
+
+// Factor k to scale the velocity by, and the acceleration by k^2, for the move to take the duration
+float motionScale(float distance, float velocity, float acceleration, uint32_t duration) {
+    uint32_t fastest = motionTime(distance, velocity, acceleration);
+    if (fastest == 0 || duration <= fastest) {
+        return 1;
+    }
+    float scale = static_cast<float>(fastest) / duration;
+    return scale > MOTION_SCALE_MIN ? scale : MOTION_SCALE_MIN;
+}
+
+
+// A group move arrives at its duration after the start, even if its message came in late
+uint32_t motionRemaining(uint32_t duration, int32_t late) {
+    if (late <= 0) {
+        return duration;
+    }
+    return static_cast<uint32_t>(late) < duration ? duration - late : 0;
+}
+
+
+// Rounded, the encoder has a power of 2 positions per rev
+int32_t motionPositionToStep(int32_t position, int32_t steps_per_rev, uint8_t encoder_bits) {
+    return (static_cast<int64_t>(position) * steps_per_rev + (1 << encoder_bits) / 2) >> encoder_bits;
+}
+
+
+int motionPercent(int32_t position, int32_t max_position) {
+    return (position * 100 + max_position / 2) / max_position;
+}
+
+
+int32_t motionPercentToPosition(int percent, int32_t max_position) {
+    return (percent * max_position + 50) / 100;
+}
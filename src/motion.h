@@ -0,0 +1,32 @@
+#pragma once
+/**
+    motion.h - Travel time of a move and scaling its velocity profile to a given duration
+    Author: Jason Chen, 2024
+
+    Moves follow a trapezoidal velocity profile: accelerate up to the velocity, cruise, then brake.
+    Short moves never reach the velocity and become a triangle. A group move makes units that
+    travel different distances arrive together: each unit slows its profile down to the same
+    duration, using its velocity and acceleration settings as upper bounds.
+      - Scaling the velocity by k and the acceleration by k^2 keeps the shape of the profile and
+        makes it take 1/k as long, so k = fastest time / duration.
+      - A unit that can't make the duration moves as fast as it can and arrives late.
+
+    Distances are in revolutions, velocities in rev/s and accelerations in rev/s^2. The conversions
+    between encoder positions, motor steps and percents of MotorTaskT are here too; like the rest,
+    they need neither Arduino nor FreeRTOS, so they are unit tested on the host, see test/.
+**/
+#include <stdint.h>
+
+
+#define MOTION_START_MAX    60000   // ms, longest wait before a group move starts
+#define MOTION_DURATION_MAX 600000  // ms, longest duration of a group move
+#define MOTION_SCALE_MIN    0.05    // Slowest profile, keeps the step rate and acceleration > 0
+
+
+uint32_t motionTime(float distance, float velocity, float acceleration);  // ms, fastest
+float motionScale(float distance, float velocity, float acceleration, uint32_t duration);
+uint32_t motionRemaining(uint32_t duration, int32_t late);  // ms left of a move started late
+
+int32_t motionPositionToStep(int32_t position, int32_t steps_per_rev, uint8_t encoder_bits);
+int     motionPercent(int32_t position, int32_t max_position);  // 0 is open, 100 is closed
+int32_t motionPercentToPosition(int percent, int32_t max_position);
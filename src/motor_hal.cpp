@@ -0,0 +1,223 @@
+#define LOG_MODULE LOG_MOTOR
+#include "motor_hal.h"
+#include "logger.h"
+
+
+// Guards the UART shared by the drivers and the stepper engine, each motor runs in its own task
+static SemaphoreHandle_t bus_mutex = xSemaphoreCreateMutex();
+static bool uart_started = false;
+
+
+Tmc2209Driver::Tmc2209Driver(uint8_t motor) :
+        channel_(BOARD.motors[motor]),
+        driver_(&Serial1, BOARD.motors[motor].r_sense, BOARD.motors[motor].driver_addr) {}
+
+
+void Tmc2209Driver::begin() {
+    pinMode(channel_.dir, OUTPUT);
+    pinMode(channel_.step, OUTPUT);
+    if (channel_.stby != NO_PIN) {
+        pinMode(channel_.stby, OUTPUT);
+    }
+    pinMode(channel_.diag, INPUT);
+
+    // Using UART(Serial1) to read/write data to/from TMC2209 stepper motor drivers
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+    if (!uart_started) {
+        Serial1.begin(115200, SERIAL_8N1, BOARD.rxd1, BOARD.txd1);
+        while(!Serial1);
+        uart_started = true;
+    }
+    xSemaphoreGive(bus_mutex);
+}
+
+
+bool Tmc2209Driver::startup(bool stallguard) {
+    // Pull standby pin low to disable driver standby; some channels have no standby pin
+    if (channel_.stby != NO_PIN) {
+        digitalWrite(channel_.stby, LOW);
+    }
+    vTaskDelay(5 / portTICK_PERIOD_MS);  // Wait for driver to startup
+
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+
+    // Sets pdn_disable=1: disables automatic standstill current reduction, needed for UART; also
+    // sets mstep_reg_select=1: use UART to change microstepping settings.
+    driver_.begin();
+
+    // Use voltage reference from internal 5VOut instead of analog VRef for current scaling
+    driver_.I_scale_analog(0);
+
+    // Enable StealthChop voltage PWM mode: automatic scaling current control taking into account
+    // of the motor back EMF and velocity.
+    driver_.pwm_autoscale(true);
+    driver_.pwm_autograd(true);
+
+    // 0=disable driver; 1-15=enable driver in StealthChop
+    // Sets the slow decay time (off time) [1... 15]. This setting also limit the maximum chopper
+    // frequency. For operation with StealthChop, this parameter is not used, but it is required to
+    // enable the motor. In case of operation with StealthChop only, any setting is OK.
+    driver_.toff(0);
+
+    // Comparator blank time to [16, 24, 32, 40] clocks. The time needed to safely cover switching
+    // events and the duration of ringing on sense resistor. For most applications, a setting of 16
+    // or 24 is good. For highly capacitive loads, a setting of 32 or 40 will be required.
+    driver_.blank_time(24);
+    driver_.hstrt(4);
+    driver_.hend(12);
+
+    // StallGuard setup; refer to p29 and p73 of TMC2209's datasheet rev1.09 for tuning SG.
+    if (stallguard) {
+        // 0=disable CoolStep
+        // CoolStep lower threshold [0... 15].
+        // If SG_RESULT goes below this threshold, CoolStep increases the current to both coils.
+        driver_.semin(4);
+
+        // CoolStep upper threshold [0... 15].
+        // If SG is sampled equal to or above this threshold enough times, CoolStep decreases the
+        // current to both coils.
+        driver_.semax(0);
+    }
+
+    vTaskDelay(5 / portTICK_PERIOD_MS);  // Wait for driver to startup
+
+    // Reading back a register confirms the driver is powered and listening on UART
+    bool started = driver_.blank_time() == 24;
+    xSemaphoreGive(bus_mutex);
+    return started;
+}
+
+
+void Tmc2209Driver::standby() {
+    // Need to disable StallGuard or else it will stall the motor when disabling the driver
+    disableStallguard();
+
+    // Pull standby pin high to standby TMC2209 driver, else only the coils are disabled
+    if (channel_.stby != NO_PIN) {
+        digitalWrite(channel_.stby, HIGH);
+    } else {
+        enableCoils(false);
+    }
+}
+
+
+void Tmc2209Driver::enableCoils(bool enable) {
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+    driver_.toff(enable ? 4 : 0);
+    xSemaphoreGive(bus_mutex);
+}
+
+
+void Tmc2209Driver::configure(int current, bool shaft, int microsteps, bool spreadcycle,
+                              uint32_t spreadcycle_threshold) {
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+
+    // Set motor RMS current via UART, higher torque requires more current. The default holding
+    // current (ihold) is 50% of irun but the ratio be adjusted with optional second argument, i.e.
+    // rms_current(1000, 0.3).
+    driver_.rms_current(current);
+
+    // Inverse motor direction
+    driver_.shaft(shaft);
+
+    // Number of microsteps [0, 2, 4, 8, 16, 32, 64, 126, 256] per full step
+    // Set MRES register via UART
+    driver_.microsteps(microsteps);
+
+    // 1=SpreadCycle only; 0=StealthChop PWM mode (below velocity threshold) + SpreadCycle (above
+    // velocity threshold); set register TPWMTHRS to determine the velocity threshold
+    // SpreadCycle for high velocity but is audible; StealthChop is quiet and more torque.
+    driver_.en_spreadCycle(spreadcycle);
+    driver_.TPWMTHRS(spreadcycle_threshold);
+    xSemaphoreGive(bus_mutex);
+}
+
+
+void Tmc2209Driver::enableStallguard(uint32_t coolstep_threshold, uint8_t stallguard_threshold) {
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+
+    // Lower threshold velocity for switching on CoolStep and StallGuard to DIAG output
+    driver_.TCOOLTHRS(coolstep_threshold);
+
+    // StallGuard threshold [0... 255] level for stall detection. It compensates for motor
+    // specific characteristics and controls sensitivity. A higher value makes StallGuard more
+    // sensitive and requires less torque to stall. The double of this value is compared to
+    // SG_RESULT. The stall output becomes active if SG_RESULT fall below this value.
+    driver_.SGTHRS(stallguard_threshold);
+    xSemaphoreGive(bus_mutex);
+
+    // Enable StallGuard or else it will stall the motor when starting the driver
+    attachInterruptArg(channel_.diag, stallInterrupt, this, RISING);
+}
+
+
+void Tmc2209Driver::disableStallguard() {
+    detachInterrupt(channel_.diag);
+}
+
+
+uint16_t Tmc2209Driver::stallguardResult() {
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+    uint16_t result = driver_.SG_RESULT();
+    xSemaphoreGive(bus_mutex);
+    return result;
+}
+
+
+bool Tmc2209Driver::takeStall() {
+    if (!stalled_) {
+        return false;
+    }
+    portENTER_CRITICAL(&stalled_mux_);
+    stalled_ = false;
+    portEXIT_CRITICAL(&stalled_mux_);
+    return true;
+}
+
+
+void IRAM_ATTR Tmc2209Driver::stallInterrupt(void *driver) {
+    Tmc2209Driver *self = static_cast<Tmc2209Driver*>(driver);
+    portENTER_CRITICAL_ISR(&self->stalled_mux_);
+    self->stalled_ = true;
+    portEXIT_CRITICAL_ISR(&self->stalled_mux_);
+}
+
+
+FastAccelStepperEngine FastAccelPulser::engine_ = FastAccelStepperEngine();
+bool FastAccelPulser::engine_started_ = false;
+
+
+FastAccelPulser::FastAccelPulser(uint8_t motor) : channel_(BOARD.motors[motor]) {}
+
+
+void FastAccelPulser::begin(MotorEnableCall enable_call) {
+    xSemaphoreTake(bus_mutex, portMAX_DELAY);
+    if (!engine_started_) {
+        engine_.init(1);
+        engine_started_ = true;
+    }
+    motor_ = engine_.stepperConnectToPin(channel_.step);
+    xSemaphoreGive(bus_mutex);
+    assert(motor_ != NULL);
+    motor_->setEnablePin(100, false);
+    motor_->setExternalEnableCall(enable_call);
+    motor_->setDirectionPin(channel_.dir);
+    motor_->setAutoEnable(true);     // Automatically enable/disable motor output when moving
+    motor_->setDelayToDisable(200);  // 200ms off delay
+}
+
+
+As5600Encoder::As5600Encoder(uint8_t motor) :
+        channel_(BOARD.motors[motor]),
+        wire_(BOARD.motors[motor].i2c_bus == 0 ? &Wire : &Wire1),
+        encoder_(wire_) {}
+
+
+void As5600Encoder::begin() {
+    // AS5600 rotary encoder setup, every encoder has its own I2C controller
+    encoder_.begin(channel_.sda, channel_.scl);
+    // assert(encoder_.isConnected());
+    wire_->setClock(1000000);       // Increase I2C bus speed to 1MHz which is AS5600's max bus speed
+    encoder_.setConfigure(0x2904);  // Hysteresis=1LSB, fast filter=10LSBs, slow filter=8x, WD=ON
+    LOGI("Encoder automatic gain control(56-68 is preferable): %d/128", encoder_.readAGC());
+}
@@ -0,0 +1,97 @@
+#pragma once
+/**
+    motor_hal.h - Hardware policies for MotorTask: stepper driver, pulse generator and encoder
+    Author: Jason Chen, 2024
+
+    MotorTask is a template over three policy types, resolved at compile time so the motor loop
+    calls them directly without virtual dispatch:
+        (1) Driver: the stepper motor driver's standby, coils and current/StallGuard registers
+        (2) Pulser: generates the step/dir pulses with acceleration, positions are in steps
+        (3) Encoder: the absolute rotary encoder, cumulative positions in encoder counts
+
+    The policies below drive the real hardware (TMC2209, FastAccelStepper and AS5600); the
+    simulated ones in motor_hal_sim.h replace them with a model of the motor, selected with
+    MOTOR_SIMULATED=1. Every policy implements the same member functions as these, and is
+    constructed with the index of its motor channel in BOARD.motors.
+
+    Several motors share one UART for the drivers and one FastAccelStepperEngine, both guarded by
+    a mutex since every motor runs in its own task.
+**/
+#include <Arduino.h>
+#include <HardwareSerial.h>  // Hardwareserial for uart
+#include <TMCStepper.h>
+#include <FastAccelStepper.h>
+#include <AS5600.h>
+#include "board.h"
+#include <functional>
+
+
+// Called with HIGH before the pulser moves the motor and with LOW after it stopped
+typedef std::function<bool(uint8_t, uint8_t)> MotorEnableCall;
+
+
+class Tmc2209Driver {
+public:
+    Tmc2209Driver(uint8_t motor);
+    void begin();                                  // Pins and UART, leaves the driver in standby
+    bool startup(bool stallguard);                 // Takes the driver out of standby, false if it doesn't answer
+    void standby();
+    void enableCoils(bool enable);
+    void configure(int current, bool shaft, int microsteps, bool spreadcycle,
+                   uint32_t spreadcycle_threshold);
+    void enableStallguard(uint32_t coolstep_threshold, uint8_t stallguard_threshold);
+    void disableStallguard();
+    bool takeStall();                              // True once after StallGuard detected a stall
+    uint16_t stallguardResult();
+
+private:
+    // TMCStepper library for interfacing with the stepper motor driver hardware, to read/write
+    // registers for setting current, microsteps, StallGuard, etc.
+    const MotorChannel &channel_;
+    TMC2209Stepper driver_;
+    volatile bool stalled_ = false;
+    portMUX_TYPE stalled_mux_ = portMUX_INITIALIZER_UNLOCKED;
+
+    static void IRAM_ATTR stallInterrupt(void *driver);
+};
+
+
+class FastAccelPulser {
+public:
+    FastAccelPulser(uint8_t motor);
+    void begin(MotorEnableCall enable_call);
+    bool isRunning() { return motor_->isRunning(); }
+    int32_t getCurrentPosition() { return motor_->getCurrentPosition(); }
+    void setCurrentPosition(int32_t step) { motor_->setCurrentPosition(step); }
+    void runForward() { motor_->runForward(); }
+    void runBackward() { motor_->runBackward(); }
+    void moveTo(int32_t step) { motor_->moveTo(step); }
+    void forceStop() { motor_->forceStop(); }
+    void setSpeedInHz(uint32_t speed) { motor_->setSpeedInHz(speed); }
+    void setAcceleration(int32_t acceleration) { motor_->setAcceleration(acceleration); }
+
+private:
+    // FastAccelStepper library for generating PWM signal to the stepper driver to move/accelerate
+    // and stop/deccelerate the stepper motor. One engine drives the steppers of all motors.
+    static FastAccelStepperEngine engine_;
+    static bool engine_started_;
+    const MotorChannel &channel_;
+    FastAccelStepper *motor_ = NULL;
+};
+
+
+class As5600Encoder {
+public:
+    As5600Encoder(uint8_t motor);
+    void begin();
+    int32_t getCumulativePosition() { return encoder_.getCumulativePosition(); }
+    void resetCumulativePosition(int32_t position) { encoder_.resetCumulativePosition(position); }
+    uint8_t readAGC() { return encoder_.readAGC(); }
+
+private:
+    // Rotary encoder for keeping track of motor's actual position because motor could slip and
+    // cause the position to be incorrect. A closed-loop system.
+    const MotorChannel &channel_;
+    TwoWire *wire_;
+    AS5600 encoder_;
+};
@@ -0,0 +1,145 @@
+#include "motor_hal_sim.h"
+#include <math.h>
+
+
+SimMotor sim_motors[SIM_MOTORS];
+
+
+void SimMotor::turn(double steps) {
+    if (standby || !coils) {
+        return;
+    }
+    revolutions += steps / (SIM_FULL_STEPS * microsteps);
+    if (revolutions < SIM_LIMIT_LOW || revolutions > SIM_LIMIT_HIGH) {
+        revolutions = revolutions < SIM_LIMIT_LOW ? SIM_LIMIT_LOW : SIM_LIMIT_HIGH;
+        load = 0;
+        stalled = stallguard;
+    } else {
+        load = SIM_STALLGUARD_FREE;
+    }
+}
+
+
+void SimDriver::standby() {
+    disableStallguard();
+    shaft_.standby = true;
+    shaft_.coils = false;
+}
+
+
+bool SimDriver::takeStall() {
+    if (!shaft_.stalled) {
+        return false;
+    }
+    shaft_.stalled = false;
+    return true;
+}
+
+
+void SimPulser::begin(MotorEnableCall enable_call) {
+    enable_call_ = enable_call;
+    last_update_ = Clock::now();
+}
+
+
+int32_t SimPulser::getCurrentPosition() {
+    update();
+    return static_cast<int32_t>(lround(position_));
+}
+
+
+// Like FastAccelStepper, keeps the distance to the target of a move in progress
+void SimPulser::setCurrentPosition(int32_t step) {
+    update();
+    target_ += step - position_;
+    position_ = step;
+}
+
+
+void SimPulser::forceStop() {
+    update();
+    velocity_ = 0;
+    target_ = position_;
+    stop();
+}
+
+
+void SimPulser::start(Mode mode, double target) {
+    update();
+    if (speed_ <= 0 || acceleration_ <= 0 || (mode == MOVE_TO && fabs(target - position_) < 0.5)) {
+        return;
+    }
+    if (!enabled_) {
+        enabled_ = true;
+        enable_call_(0, 1);
+    }
+    mode_ = mode;
+    target_ = target;
+    running_ = true;
+}
+
+
+void SimPulser::stop() {
+    if (running_) {
+        running_ = false;
+        stopped_ = Clock::now();
+    }
+}
+
+
+void SimPulser::update() {
+    Clock::time_point now = Clock::now();
+    double elapsed = std::chrono::duration<double>(now - last_update_).count();
+    last_update_ = now;
+
+    while (running_ && elapsed > 0) {
+        double dt = elapsed < SIM_TIME_STEP ? elapsed : SIM_TIME_STEP;
+        step(dt);
+        elapsed -= dt;
+    }
+
+    if (!running_ && enabled_ && now - stopped_ >= std::chrono::milliseconds(SIM_DELAY_TO_DISABLE)) {
+        enabled_ = false;
+        enable_call_(0, 0);
+    }
+}
+
+
+// Accelerates towards the speed and for a move, starts braking once the remaining distance is
+// the braking distance
+void SimPulser::step(double dt) {
+    double direction = mode_ == RUN_BACKWARD ? -1 : 1;
+    double desired = direction * speed_;
+    if (mode_ == MOVE_TO) {
+        direction = target_ > position_ ? 1 : -1;
+        double braking = velocity_ * velocity_ / (2 * acceleration_);
+        bool approaching = velocity_ * direction > 0;
+        desired = approaching && fabs(target_ - position_) <= braking ? 0 : direction * speed_;
+    }
+
+    double dv = acceleration_ * dt;
+    if (velocity_ < desired) {
+        velocity_ = velocity_ + dv < desired ? velocity_ + dv : desired;
+    } else {
+        velocity_ = velocity_ - dv > desired ? velocity_ - dv : desired;
+    }
+
+    double steps = velocity_ * dt;
+    if (mode_ == MOVE_TO && fabs(steps) >= fabs(target_ - position_) && steps * direction >= 0) {
+        steps = target_ - position_;
+        velocity_ = 0;
+        stop();
+    }
+    position_ += steps;
+    shaft_.turn(steps);
+}
+
+
+int32_t SimEncoder::getCumulativePosition() {
+    return shaftPosition() + offset_;
+}
+
+
+int32_t SimEncoder::shaftPosition() {
+    return static_cast<int32_t>(lround(shaft_.revolutions * SIM_ENCODER_COUNTS));
+}
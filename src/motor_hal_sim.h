@@ -0,0 +1,125 @@
+#pragma once
+/**
+    motor_hal_sim.h - Simulated hardware policies for MotorTask
+    Author: Jason Chen, 2024
+
+    Drop-in replacements for the policies in motor_hal.h, selected with MOTOR_SIMULATED=1, to run
+    MotorTask without a driver, motor or encoder attached. The three policies of a motor share one
+    model of its shaft (sim_motors[motor]):
+        (1) SimPulser integrates a trapezoidal velocity profile, the same way FastAccelStepper
+            moves, and turns the shaft while the driver's coils are enabled
+        (2) SimEncoder reads the shaft like an AS5600, 4096 counts per revolution
+        (3) SimDriver keeps the driver state; the shaft stops at hard limits like the ends of a
+            shade, SG_RESULT drops to 0 there and a stall is reported if StallGuard is enabled
+
+    The policies are plain C++ with std::chrono for time, no Arduino or FreeRTOS, and advance the
+    model lazily whenever MotorTask queries them. The native environment builds them on the host
+    for the unit tests in test/test_motor_hal_sim.
+**/
+#include <stdint.h>
+#include <chrono>
+#include <functional>
+
+
+#define SIM_MOTORS            2        // Simulated motor channels
+#define SIM_FULL_STEPS        200      // Full steps/rev of the simulated motor
+#define SIM_ENCODER_COUNTS    4096     // Encoder counts/rev
+#define SIM_LIMIT_LOW         -0.5     // Revolutions, hard stop below the starting position
+#define SIM_LIMIT_HIGH        12.0     // Revolutions, hard stop above the starting position
+#define SIM_STALLGUARD_FREE   250      // SG_RESULT while the shaft turns freely
+#define SIM_DELAY_TO_DISABLE  200      // ms, like FastAccelPulser's delay to disable
+#define SIM_TIME_STEP         0.001    // s, integration step of the velocity profile
+
+
+// Called with HIGH before the pulser moves the motor and with LOW after it stopped
+typedef std::function<bool(uint8_t, uint8_t)> MotorEnableCall;
+
+
+struct SimMotor {
+    double   revolutions = 0;      // Shaft position, read by the encoder
+    bool     standby     = true;
+    bool     coils       = false;  // Shaft only turns with the coils enabled
+    int      microsteps  = 2;
+    bool     stallguard  = false;
+    bool     stalled     = false;
+    uint16_t load        = SIM_STALLGUARD_FREE;
+
+    void turn(double steps);
+};
+
+extern SimMotor sim_motors[SIM_MOTORS];
+
+
+class SimDriver {
+public:
+    SimDriver(uint8_t motor) : shaft_(sim_motors[motor]) {}
+    void begin() { shaft_.standby = true; }
+    bool startup(bool /* stallguard */) { shaft_.standby = false; return true; }
+    void standby();
+    void enableCoils(bool enable) { shaft_.coils = enable; }
+    void configure(int /* current */, bool /* shaft */, int microsteps, bool /* spreadcycle */,
+                   uint32_t /* spreadcycle_threshold */) { shaft_.microsteps = microsteps; }
+    void enableStallguard(uint32_t /* coolstep_threshold */, uint8_t /* stallguard_threshold */) {
+        shaft_.stallguard = true;
+    }
+    void disableStallguard() { shaft_.stallguard = false; }
+    bool takeStall();
+    uint16_t stallguardResult() { return shaft_.load; }
+
+private:
+    SimMotor &shaft_;
+};
+
+
+class SimPulser {
+public:
+    SimPulser(uint8_t motor) : shaft_(sim_motors[motor]) {}
+    void begin(MotorEnableCall enable_call);
+    bool isRunning() { update(); return running_; }
+    int32_t getCurrentPosition();
+    void setCurrentPosition(int32_t step);
+    void runForward() { start(RUN_FORWARD, target_); }
+    void runBackward() { start(RUN_BACKWARD, target_); }
+    void moveTo(int32_t step) { start(MOVE_TO, step); }
+    void forceStop();
+    void setSpeedInHz(uint32_t speed) { speed_ = speed; }
+    void setAcceleration(int32_t acceleration) { acceleration_ = acceleration; }
+
+private:
+    enum Mode { MOVE_TO, RUN_FORWARD, RUN_BACKWARD };
+    typedef std::chrono::steady_clock Clock;
+
+    SimMotor &shaft_;
+    MotorEnableCall enable_call_;
+    Mode   mode_         = MOVE_TO;
+    bool   running_      = false;
+    bool   enabled_      = false;
+    double position_     = 0;  // Steps
+    double target_       = 0;  // Steps
+    double velocity_     = 0;  // Steps/s, signed
+    double speed_        = 0;  // Steps/s
+    double acceleration_ = 0;  // Steps/s^2
+    Clock::time_point last_update_ = Clock::now();
+    Clock::time_point stopped_     = Clock::now();
+
+    void start(Mode mode, double target);
+    void stop();
+    void update();
+    void step(double dt);
+};
+
+
+class SimEncoder {
+public:
+    SimEncoder(uint8_t motor) : shaft_(sim_motors[motor]) {}
+    void begin() {}
+    int32_t getCumulativePosition();
+    void resetCumulativePosition(int32_t position) { offset_ = position - shaftPosition(); }
+    uint8_t readAGC() { return 64; }
+
+private:
+    SimMotor &shaft_;
+    int32_t offset_ = 0;
+
+    int32_t shaftPosition();
+};
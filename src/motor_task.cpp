@@ -1,49 +1,52 @@
+#define LOG_MODULE LOG_MOTOR
 #include "motor_task.h"
 
 
-MotorTask::MotorTask(const uint8_t task_core) : Task{"MotorTask", 8192, 1, task_core} {}
-MotorTask::~MotorTask() {}
+#define MOTOR_TASK_TEMPLATE template<class Driver, class Pulser, class Encoder>
+#define MOTOR_TASK          MotorTaskT<Driver, Pulser, Encoder>
 
 
-void MotorTask::run() {
-    pinMode(DIR_PIN, OUTPUT);
-    pinMode(STEP_PIN, OUTPUT);
-    pinMode(STBY_PIN, OUTPUT);
-    pinMode(DIAG_PIN, INPUT);
+TASK_MEMORY(motor_task_memory, MOTOR_TASK_STACK, MOTOR_TASK_QUEUE);
+#if MOTOR_COUNT > 1
+    TASK_MEMORY(motor1_task_memory, MOTOR_TASK_STACK, MOTOR_TASK_QUEUE);
+#endif
 
-    // Using UART(Serial1) to read/write data to/from TMC2209 stepper motor driver
-    Serial1.begin(115200, SERIAL_8N1, RXD1, TXD1);
-    while(!Serial1);
+// The first motor keeps the name, and so the settings file, of a single motor controller
+static const char *const motor_task_names[MOTORS_MAX] = {"MotorTask", "MotorTask1"};
+static const TaskMemory *const motor_task_memories[MOTOR_COUNT] = {
+    &motor_task_memory,
+    #if MOTOR_COUNT > 1
+        &motor1_task_memory,
+    #endif
+};
 
-    // FastAccelStepper setup
-    engine_.init(1);
-    motor_ = engine_.stepperConnectToPin(STEP_PIN);
-    assert(motor_ != NULL);
-    motor_->setEnablePin(100, false);
-    motor_->setExternalEnableCall(std::bind(&MotorTask::motorEnable, this,
-                                  std::placeholders::_1, std::placeholders::_2));
-    motor_->setDirectionPin(DIR_PIN);
-    motor_->setAutoEnable(true);     // Automatically enable/disable motor output when moving
-    motor_->setDelayToDisable(200);  // 200ms off delay
 
-    driverStandby();
+MOTOR_TASK_TEMPLATE
+MOTOR_TASK::MotorTaskT(const uint8_t task_core, const uint8_t motor) :
+        Task{motor_task_names[motor], MOTOR_TASK_STACK, 1, task_core, MOTOR_TASK_QUEUE,
+             *motor_task_memories[motor]},
+        index_(motor), driver_(motor), motor_(motor), encoder_(motor) {}
+MOTOR_TASK_TEMPLATE
+MOTOR_TASK::~MotorTaskT() {}
 
-    // AS5600 rotary encoder setup
-    encoder_.begin(SDA_PIN, SCL_PIN);
-    // assert(encoder_.isConnected());
-    Wire.setClock(1000000);         // Increase I2C bus speed to 1MHz which is AS5600's max bus speed
-    encoder_.setConfigure(0x2904);  // Hysteresis=1LSB, fast filter=10LSBs, slow filter=8x, WD=ON
-    LOGI("Encoder automatic gain control(56-68 is preferable): %d/128", encoder_.readAGC());
+
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::run() {
+    driver_.begin();
+    motor_.begin(std::bind(&MotorTaskT::motorEnable, this, std::placeholders::_1,
+                           std::placeholders::_2));
+    driverStandby();
+    encoder_.begin();
 
     loadSettings();
     // int start = 0;
     while (1) {
         // start = micros();
         encod_pos_ = encoder_.getCumulativePosition() - encod_offset_;
-        motor_->setCurrentPosition(positionToStep(encod_pos_));
+        motor_.setCurrentPosition(positionToStep(encod_pos_));
 
         if (xQueueReceive(queue_, (void*) &inbox_, 0) == pdTRUE) {
-            LOGI("MotorTask received message: %s", inbox_.toString().c_str());
+            LOGI("%s received message: %s", name_, inbox_.toString().c_str());
             switch (inbox_.command) {
                 case MOTOR_STOP:
                     stop();
@@ -114,6 +117,10 @@ void MotorTask::run() {
                     calculateTotalSteps();
                     break;
                 case MOTOR_MICROSTEPS:
+                    if (!isMicrosteps(inbox_.parameter)) {
+                        LOGE("Invalid microsteps: %d", inbox_.parameter);
+                        break;
+                    }
                     setAndSave(microsteps_, inbox_.parameter, "microsteps_");
                     calculateTotalSteps();
                     break;
@@ -132,20 +139,79 @@ void MotorTask::run() {
                 case MOTOR_TPWMTHRS:
                     setAndSave(spreadcycl_th_, inbox_.parameter, "spreadcycl_th_");
                     break;
+                case MOTOR_TOGGLE:
+                    toggle();
+                    break;
+                case MOTOR_START:
+                case MOTOR_DURATION:
+                    setGroupMove(inbox_.command, inbox_.parameter);
+                    break;
+            }
+            calculateTravelTime();
+        }
+
+        if (move_pending_) {
+            xTimerStart(system_sleep_timer_, 0);  // Stay awake until the group move starts
+            if (static_cast<int32_t>(millis() - group_start_) >= 0) {
+                move_pending_ = false;
+                motor_.moveTo(pending_step_);
             }
         }
 
-        if (stalled_) {
+        if (travel_time_ != sent_travel_time_) {
+            sent_travel_time_ = travel_time_;
+            sendTo(wireless_task_, Message(UPDATE_TRAVEL, static_cast<int>(travel_time_), index_), 0);
+        }
+
+        if (driver_.takeStall()) {
             stop();
-            stalled_ = false;
-            LOGE("Motor stalled");
+            LOGE("Motor %u stalled", index_);
+            journalRecord(EVENT_STALL, getPercent());
+            odometerAdd(ODOMETER_STALLS);
+            sendTo(led_task_, Message(LED_PATTERN, LED_STALL), 0);
         }
 
-        if (motor_->isRunning()) {
+        if (motor_.isRunning()) {
             xTimerStart(system_sleep_timer_, 0);
+            if (!was_running_) {
+                was_running_ = true;
+                move_start_percent_ = getPercent();
+                move_start_steps_ = motor_.getCurrentPosition();
+                last_sample_step_ = move_start_steps_;
+                breadcrumb(CRUMB_STATE, name_, CRUMB_MOTOR(CRUMB_MOTOR_MOVING, index_),
+                           move_start_percent_);
+                sendTo(led_task_, Message(LED_PATTERN, LED_MOVING), 0);
+            }
+            if (millis() - last_sample_ >= MOTOR_SAMPLE_PERIOD) {
+                last_sample_ = millis();
+                int moving_percent = getPercent();
+                timeseriesSample(SERIES_POSITION, moving_percent);
+                if (moving_percent != last_updated_percent_ && moving_percent >= 0
+                    && moving_percent <= 100) {
+                    last_updated_percent_ = moving_percent;
+                    sendTo(wireless_task_, Message(UPDATE_MOVING, moving_percent, index_), 0);
+                }
+                timeseriesSample(SERIES_TRAVEL, 1);
+                // SG_RESULT is only a load while the shaft turns, e.g. not before the first step
+                int32_t step = motor_.getCurrentPosition();
+                if (stallguard_en_ && step != last_sample_step_) {
+                    timeseriesSample(SERIES_STALLGUARD, driver_.stallguardResult());
+                }
+                last_sample_step_ = step;
+            }
             continue;
         }
 
+        if (was_running_) {
+            was_running_ = false;
+            journalRecord(EVENT_MOVE, move_start_percent_, getPercent());
+            odometerAdd(ODOMETER_MOVES);
+            breadcrumb(CRUMB_STATE, name_, CRUMB_MOTOR(CRUMB_MOTOR_IDLE, index_), getPercent());
+            odometerAdd(ODOMETER_STEPS, abs(motor_.getCurrentPosition() - move_start_steps_));
+            sendTo(led_task_, Message(LED_CLEAR, LED_MOVING), 0);
+            last_updated_percent_ = -1;  // The end of a move is always sent
+        }
+
         if (last_updated_percent_ == getPercent()) {
             // Serial.println(micros() - start);
             continue;
@@ -155,20 +221,15 @@ void MotorTask::run() {
         int current_percent = getPercent();
         if (current_percent >= 0 && current_percent <= 100) {
             last_updated_percent_ = current_percent;
-            sendTo(wireless_task_, Message(UPDATE_POSITION, current_percent), 0);
+            timeseriesSample(SERIES_POSITION, current_percent);
+            sendTo(wireless_task_, Message(UPDATE_POSITION, current_percent, index_), 0);
         }
     }
 }
 
 
-void IRAM_ATTR MotorTask::stallguardInterrupt() {
-    portENTER_CRITICAL(&stalled_mux_);
-    stalled_ = true;
-    portEXIT_CRITICAL(&stalled_mux_);
-}
-
-
-void MotorTask::loadSettings() {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::loadSettings() {
     bool load = readFromDisk();
 
     sync_settings_  = getOrDefault("sync_settings_", sync_settings_);
@@ -190,6 +251,7 @@ void MotorTask::loadSettings() {
     encod_max_pos_  = getOrDefault("encod_max_pos_", encod_max_pos_);
     zeroEncoder();
     calculateTotalSteps();
+    calculateTravelTime();
 
     if (!load) {
         writeToDisk();
@@ -199,8 +261,14 @@ void MotorTask::loadSettings() {
 }
 
 
-bool MotorTask::prepareToMove(bool check, bool direction) {
-    if (motor_->isRunning()) {
+// Steps is the distance of a percent/step move, 0 for running continuously
+MOTOR_TASK_TEMPLATE
+bool MOTOR_TASK::prepareToMove(bool check, bool direction, int32_t steps) {
+    bool group_move = group_move_ && steps != 0;
+    group_move_ = false;  // Only applies to the next move
+    move_pending_ = false;
+
+    if (motor_.isRunning()) {
         stop();
         return false;
     }
@@ -213,58 +281,131 @@ bool MotorTask::prepareToMove(bool check, bool direction) {
         driverStartup();
     }
 
+    last_direction_ = direction;
+
+    float velocity = clos_velocity_;
+    float accel = clos_accel_;
+    int current = clos_current_;
     if (direction && !sync_settings_) {
-        updateMotorSettings(open_velocity_, open_accel_, open_current_);
-    } else {
-        updateMotorSettings(clos_velocity_, clos_accel_, clos_current_);
+        velocity = open_velocity_;
+        accel = open_accel_;
+        current = open_current_;
+    }
+
+    if (group_move) {
+        int32_t late = millis() - group_start_;
+        uint32_t duration = motionRemaining(group_duration_, late);
+        // The acceleration setting is relative to the velocity, so it only scales by k
+        float scale = motionScale(static_cast<float>(abs(steps)) / total_steps_, velocity,
+                                  velocity * accel, duration);
+        velocity *= scale;
+        accel *= scale;
+        move_pending_ = true;
+        LOGI("Group move in %d ms, scaled by %.2f", late < 0 ? -late : 0, scale);
     }
 
+    updateMotorSettings(velocity, accel, current);
     return true;
 }
 
 
-void MotorTask::move(bool direction) {
+// Moves now, or at the start of a group move
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::startMove(int32_t target_step) {
+    if (move_pending_) {
+        pending_step_ = target_step;
+    } else {
+        motor_.moveTo(target_step);
+    }
+}
+
+
+// "start" and "duration" can come in either order; without "start" the move starts right away
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::setGroupMove(Command command, int value) {
+    if (!group_move_) {
+        group_move_ = true;
+        group_start_ = millis();
+        group_duration_ = 0;
+    }
+    if (command == MOTOR_START) {
+        group_start_ = millis() + value;
+    } else {
+        group_duration_ = value;
+    }
+}
+
+
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::move(bool direction) {
     if (!prepareToMove(false, direction)) {
         return;
     }
     if (direction) {
-        motor_->runBackward();
+        motor_.runBackward();
         LOGI("Motor running backward");
     } else {
-        motor_->runForward();
+        motor_.runForward();
         LOGI("Motor running forward");
     }
 }
 
 
-void MotorTask::moveToStep(int target_step) {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::moveToStep(int target_step) {
     int current_step = positionToStep(encod_pos_);
-    if (!prepareToMove(target_step == current_step, target_step < current_step)) {
+    if (!prepareToMove(target_step == current_step, target_step < current_step,
+                       target_step - current_step)) {
         return;
     }
-    motor_->moveTo(target_step);
+    startMove(target_step);
 }
 
 
-void MotorTask::moveToPercent(int target_percent) {
-    if (!prepareToMove(target_percent == getPercent(), target_percent < getPercent())) {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::moveToPercent(int target_percent) {
+    int32_t new_position = motionPercentToPosition(target_percent, encod_max_pos_);
+    int32_t target_step = positionToStep(new_position);
+    if (!prepareToMove(target_percent == getPercent(), target_percent < getPercent(),
+                       target_step - positionToStep(encod_pos_))) {
         return;
     }
-    int32_t new_position = static_cast<int32_t>(target_percent * encod_max_pos_ / 100.0 + 0.5);
-    motor_->moveTo(positionToStep(new_position));
+    startMove(target_step);
     LOGI("Motor moving(curr/max -> tar): %d/%d -> %d", encod_pos_, encod_max_pos_, new_position);
 }
 
 
-void MotorTask::stop() {
-    motor_->forceStop();
+// Stops the motor if it's moving, else moves to the opposite end; if the motor was stopped midway,
+// reverses the direction of the last move.
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::toggle() {
+    if (motor_.isRunning()) {
+        stop();
+        return;
+    }
+    int current_percent = getPercent();
+    if (current_percent <= 0) {
+        moveToPercent(100);
+    } else if (current_percent >= 100) {
+        moveToPercent(0);
+    } else {
+        moveToPercent(last_direction_ ? 100 : 0);
+    }
+}
+
+
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::stop() {
+    move_pending_ = false;
+    motor_.forceStop();
     vTaskDelay(2 / portTICK_PERIOD_MS);
     LOGI("Motor stopped(curr/max): %d/%d", encod_pos_, encod_max_pos_);
 }
 
 
-bool MotorTask::setMin() {
-    if (encod_pos_ >= encod_max_pos_ || motor_->isRunning()) {
+MOTOR_TASK_TEMPLATE
+bool MOTOR_TASK::setMin() {
+    if (encod_pos_ >= encod_max_pos_ || motor_.isRunning()) {
         return false;
     }
     setAndSave(encod_max_pos_, encod_max_pos_ - encod_pos_, "encod_max_pos_");
@@ -274,8 +415,9 @@ bool MotorTask::setMin() {
 }
 
 
-bool MotorTask::setMax() {
-    if (encod_pos_ <= 0 || motor_->isRunning()) {
+MOTOR_TASK_TEMPLATE
+bool MOTOR_TASK::setMax() {
+    if (encod_pos_ <= 0 || motor_.isRunning()) {
         return false;
     }
     setAndSave(encod_max_pos_, encod_pos_, "encod_max_pos_");
@@ -284,8 +426,9 @@ bool MotorTask::setMax() {
 }
 
 
-bool MotorTask::zeroEncoder() {
-    if (motor_->isRunning()) {
+MOTOR_TASK_TEMPLATE
+bool MOTOR_TASK::zeroEncoder() {
+    if (motor_.isRunning()) {
         LOGI("Encoder can't be zeroed while motor is running");
         return false;
     }
@@ -296,125 +439,71 @@ bool MotorTask::zeroEncoder() {
 }
 
 
-void MotorTask::calculateTotalSteps() {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::calculateTotalSteps() {
     total_steps_ = full_steps_ * microsteps_;
-    motor_encoder_ratio_ = total_steps_ / DEFAULT_ENCODER_POSITIONS;
-    encoder_motor_ratio_ = DEFAULT_ENCODER_POSITIONS / total_steps_;
 }
 
 
-// 0 is open; 100 is closed.
-inline int MotorTask::getPercent() {
-    return static_cast<int>(static_cast<float>(encod_pos_) / encod_max_pos_ * 100 + 0.5);
+// Of the slower direction, for picking the duration of a group move
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::calculateTravelTime() {
+    float distance = static_cast<float>(encod_max_pos_) / ENCODER_POSITIONS;
+    travel_time_ = motionTime(distance, clos_velocity_, clos_velocity_ * clos_accel_);
+    if (!sync_settings_) {
+        travel_time_ = max(travel_time_, motionTime(distance, open_velocity_,
+                                                    open_velocity_ * open_accel_));
+    }
 }
 
 
-inline int MotorTask::positionToStep(int encoder_position) {
-    return static_cast<int>(motor_encoder_ratio_ * encoder_position + 0.5);
+// 0 is open; 100 is closed.
+MOTOR_TASK_TEMPLATE
+inline int MOTOR_TASK::getPercent() {
+    return motionPercent(encod_pos_, encod_max_pos_);
 }
 
 
-bool MotorTask::motorEnable(uint8_t enable_pin, uint8_t value) {
-    if (value == HIGH) {
-        driver_.toff(4);
-    } else {
-        driver_.toff(0);
-    }
-    return value;
+MOTOR_TASK_TEMPLATE
+inline int MOTOR_TASK::positionToStep(int encoder_position) {
+    return motionPositionToStep(encoder_position, total_steps_, BOARD.encoder_bits);
 }
 
 
-void MotorTask::updateMotorSettings(float velocity, float acceleration, int current) {
-    motor_->setSpeedInHz(static_cast<int>(total_steps_ * velocity));
-    motor_->setAcceleration(static_cast<int>(total_steps_ * velocity * acceleration));
-
-    // Set motor RMS current via UART, higher torque requires more current. The default holding
-    // current (ihold) is 50% of irun but the ratio be adjusted with optional second argument, i.e.
-    // rms_current(1000, 0.3).
-    driver_.rms_current(current);
+MOTOR_TASK_TEMPLATE
+bool MOTOR_TASK::motorEnable(uint8_t enable_pin, uint8_t value) {
+    driver_.enableCoils(value == HIGH);
+    return value;
+}
 
-    // Inverse motor direction
-    driver_.shaft(direction_);
 
-    // Number of microsteps [0, 2, 4, 8, 16, 32, 64, 126, 256] per full step
-    // Set MRES register via UART
-    driver_.microsteps(microsteps_);
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::updateMotorSettings(float velocity, float acceleration, int current) {
+    motor_.setSpeedInHz(static_cast<int>(total_steps_ * velocity));
+    motor_.setAcceleration(static_cast<int>(total_steps_ * velocity * acceleration));
 
-    // 1=SpreadCycle only; 0=StealthChop PWM mode (below velocity threshold) + SpreadCycle (above
-    // velocity threshold); set register TPWMTHRS to determine the velocity threshold
-    // SpreadCycle for high velocity but is audible; StealthChop is quiet and more torque.
-    driver_.en_spreadCycle(spreadcycl_en_);
-    driver_.TPWMTHRS(spreadcycl_th_);
+    driver_.configure(current, direction_, microsteps_, spreadcycl_en_, spreadcycl_th_);
+    timeseriesSample(SERIES_CURRENT, current);
 
     if (stallguard_en_) {
         // Lower threshold velocity for switching on CoolStep and StallGuard to DIAG output
-        driver_.TCOOLTHRS(3089838.00 * pow(total_steps_ * velocity, -1.00161534));
-
-        // StallGuard threshold [0... 255] level for stall detection. It compensates for motor
-        // specific characteristics and controls sensitivity. A higher value makes StallGuard more
-        // sensitive and requires less torque to stall. The double of this value is compared to
-        // SG_RESULT. The stall output becomes active if SG_RESULT fall below this value.
-        driver_.SGTHRS(stallguard_th_);
-
-        // Enable StallGuard or else it will stall the motor when starting the driver
-        attachInterrupt(DIAG_PIN, std::bind(&MotorTask::stallguardInterrupt, this), RISING);
+        driver_.enableStallguard(3089838.00 * pow(total_steps_ * velocity, -1.00161534),
+                                 stallguard_th_);
     }
     vTaskDelay(5 / portTICK_PERIOD_MS);  // Wait for settings to be updated
 }
 
 
-void MotorTask::driverStartup() {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::driverStartup() {
     if (!driver_stdby_) {
         LOGI("Driver already started");
         return;
     }
 
-    // Pull standby pin low to disable driver standby
-    digitalWrite(STBY_PIN, LOW);
-    vTaskDelay(5 / portTICK_PERIOD_MS);  // Wait for driver to startup
-
-    // Sets pdn_disable=1: disables automatic standstill current reduction, needed for UART; also
-    // sets mstep_reg_select=1: use UART to change microstepping settings.
-    driver_.begin();
-
-    // Use voltage reference from internal 5VOut instead of analog VRef for current scaling
-    driver_.I_scale_analog(0);
-
-    // Enable StealthChop voltage PWM mode: automatic scaling current control taking into account
-    // of the motor back EMF and velocity.
-    driver_.pwm_autoscale(true);
-    driver_.pwm_autograd(true);
-
-    // 0=disable driver; 1-15=enable driver in StealthChop
-    // Sets the slow decay time (off time) [1... 15]. This setting also limit the maximum chopper
-    // frequency. For operation with StealthChop, this parameter is not used, but it is required to
-    // enable the motor. In case of operation with StealthChop only, any setting is OK.
-    driver_.toff(0);
-
-    // Comparator blank time to [16, 24, 32, 40] clocks. The time needed to safely cover switching
-    // events and the duration of ringing on sense resistor. For most applications, a setting of 16
-    // or 24 is good. For highly capacitive loads, a setting of 32 or 40 will be required.
-    driver_.blank_time(24);
-    driver_.hstrt(4);
-    driver_.hend(12);
-
-    // StallGuard setup; refer to p29 and p73 of TMC2209's datasheet rev1.09 for tuning SG.
-    if (stallguard_en_) {
-        // 0=disable CoolStep
-        // CoolStep lower threshold [0... 15].
-        // If SG_RESULT goes below this threshold, CoolStep increases the current to both coils.
-        driver_.semin(4);
-
-        // CoolStep upper threshold [0... 15].
-        // If SG is sampled equal to or above this threshold enough times, CoolStep decreases the
-        // current to both coils.
-        driver_.semax(0);
-    }
-
-    vTaskDelay(5 / portTICK_PERIOD_MS);  // Wait for driver to startup
-
-    if (driver_.blank_time() == 24) {
+    if (driver_.startup(stallguard_en_)) {
         driver_stdby_ = false;
+        odometerAdd(ODOMETER_STARTUPS);
         LOGI("Driver has started");
     } else {
         driver_stdby_ = true;
@@ -422,31 +511,43 @@ void MotorTask::driverStartup() {
 }
 
 
-void MotorTask::driverStandby() {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::driverStandby() {
     if (driver_stdby_) {
         LOGI("Driver already in standby");
         return;
-    } else if (motor_->isRunning()) {
+    } else if (motor_.isRunning()) {
         LOGI("Driver can't be put in standby while motor is running");
         return;
     }
 
     driver_stdby_ = true;
-
-    // Need to disable StallGuard or else it will stall the motor when disabling the driver
-    detachInterrupt(DIAG_PIN);
-
-    // Pull standby pin high to standby TMC2209 driver
-    digitalWrite(STBY_PIN, HIGH);
+    driver_.standby();
     LOGI("Driver in standby");
 }
 
 
-void MotorTask::addWirelessTask(Task *task) {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::addWirelessTask(Task *task) {
     wireless_task_ = task;
 }
 
 
-void MotorTask::addSystemSleepTimer(xTimerHandle timer) {
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::addLedTask(Task *task) {
+    led_task_ = task;
+}
+
+
+MOTOR_TASK_TEMPLATE
+void MOTOR_TASK::addSystemSleepTimer(xTimerHandle timer) {
     system_sleep_timer_ = timer;
-}
\ No newline at end of file
+}
+
+
+// Only the policies selected in motor_task.h are compiled
+#if MOTOR_SIMULATED
+    template class MotorTaskT<SimDriver, SimPulser, SimEncoder>;
+#else
+    template class MotorTaskT<Tmc2209Driver, FastAccelPulser, As5600Encoder>;
+#endif
@@ -12,33 +12,50 @@
         (1) "Position" refers to the encoder's position, used for internal position tracking
         (2) "Steps" refers to the motor's position, used for moving the motor
         (3) "Percentage" refers to the overall percentage, used by UI
+
+    MotorTaskT is a template over the driver, pulse generator and encoder policies described in
+    motor_hal.h; MotorTask is the one selected by MOTOR_SIMULATED. There is one MotorTask for
+    each of the MOTOR_COUNT motors, each with its own settings file and channel in BOARD.motors.
 **/
-#include <HardwareSerial.h>       // Hardwareserial for uart
-#include <FunctionalInterrupt.h>  // std:bind()
-#include <TMCStepper.h>
-#include <FastAccelStepper.h>
-#include <AS5600.h>
 #include "task.h"
+#include "led_task.h"
+#include "motion.h"
+
+#ifndef MOTOR_SIMULATED
+    #define MOTOR_SIMULATED 0
+#endif
+
+#if MOTOR_SIMULATED
+    #include "motor_hal_sim.h"
+    static_assert(MOTOR_COUNT <= SIM_MOTORS, "Not enough simulated motors");
+#else
+    #include "motor_hal.h"
+#endif
 
 
-#define DEFAULT_MOTOR_FULLSTEPS   200      // NEMA motors have 200 full steps/rev
-#define DEFAULT_ENCODER_POSITIONS 4096.0f  // AS5600 absolute position is 12-bit
+#define MOTOR_TASK_STACK          8192     // Bytes, see "stacks" in /json
+#define MOTOR_TASK_QUEUE          1
+#define MOTOR_SAMPLE_PERIOD       100      // ms, time-series samples while moving
 
 
-class MotorTask : public Task {
+template<class Driver, class Pulser, class Encoder>
+class MotorTaskT : public Task {
 public:
-    MotorTask(const uint8_t task_core);
-    ~MotorTask();
+    MotorTaskT(const uint8_t task_core, const uint8_t motor);
+    ~MotorTaskT();
     void addWirelessTask(Task *task);
+    void addLedTask(Task *task);
     void addSystemSleepTimer(xTimerHandle timer);
 
 protected:
     void run();
 
 private:
-    // TMCStepper library for interfacing with the stepper motor driver hardware, to read/write
-    // registers for setting speed, acceleration, current, etc.
-    TMC2209Stepper driver_ = TMC2209Stepper(&Serial1, R_SENSE, DRIVER_ADDR);
+    const uint8_t index_;  // Motor channel
+
+    Driver  driver_;   // Stepper motor driver, its registers are updated with the settings below
+    Pulser  motor_;    // Generates the step pulses to move/accelerate and stop/deccelerate the motor
+    Encoder encoder_;  // Absolute position of the motor, a closed-loop system since it could slip
 
     // User adjustable TMC2209 motor driver settings, updated to driver registers via UART
     bool  driver_stdby_  = false;
@@ -51,54 +68,60 @@ private:
     int   clos_current_  = 75;
     bool  direction_     = false;
     int   microsteps_    = 2;
-    int   full_steps_    = DEFAULT_MOTOR_FULLSTEPS;
+    int   full_steps_    = BOARD.full_steps;
     bool  stallguard_en_ = true;
     int   coolstep_thrs_ = 0;
     int   stallguard_th_ = 10;
     bool  spreadcycl_en_ = false;
     int   spreadcycl_th_ = 33;
 
-    // FastAccelStepper library for generating PWM signal to the stepper driver to move/accelerate
-    // and stop/deccelerate the stepper motor.
-    FastAccelStepperEngine engine_ = FastAccelStepperEngine();
-    FastAccelStepper *motor_       = NULL;
-
     // None user adjustable motor states. Managed by MotorTask.
     int8_t  last_updated_percent_ = -100;
-    volatile bool stalled_        = false;
-    portMUX_TYPE stalled_mux_     = portMUX_INITIALIZER_UNLOCKED;
+    bool    last_direction_       = false;  // Direction of the last move, true if opening
+    bool    was_running_          = false;
+    int     move_start_percent_   = 0;
+    int32_t move_start_steps_     = 0;
+    uint32_t last_sample_         = 0;  // ms, last time-series sample while moving
+    int32_t last_sample_step_     = 0;  // Step of the last time-series sample
+    uint32_t travel_time_         = 0;  // ms, fastest move between 0 and 100%
+    uint32_t sent_travel_time_    = 0;
+
+    // The next percent/step move is a group move after "start" or "duration", see motion.h
+    bool     group_move_     = false;
+    uint32_t group_start_    = 0;      // ms, millis() to start the move at
+    uint32_t group_duration_ = 0;      // ms from start to arrival, 0 for the fastest
+    bool     move_pending_   = false;  // Waiting for group_start_ to move to pending_step_
+    int32_t  pending_step_   = 0;
     // bool motor_opening = false;
     // bool motor_closing = false;
     // bool motor_move_completed = false;
 
-    // Rotary encoder for keeping track of motor's actual position because motor could slip and
-    // cause the position to be incorrect. A closed-loop system.
-    AS5600 encoder_;
-
     // Keeping track of the overall position via encoder's position and then  convert it into
     // motor's position and percentage.
-    int32_t encod_offset_      = 0;
-    int32_t encod_pos_         = 0;
-    int32_t encod_max_pos_     = static_cast<int32_t>(DEFAULT_ENCODER_POSITIONS) * 10;
-    int   total_steps_         = full_steps_ * microsteps_;
-    float motor_encoder_ratio_ = total_steps_ / DEFAULT_ENCODER_POSITIONS;
-    float encoder_motor_ratio_ = DEFAULT_ENCODER_POSITIONS / total_steps_;
+    int32_t encod_offset_  = 0;
+    int32_t encod_pos_     = 0;
+    int32_t encod_max_pos_ = ENCODER_POSITIONS * 10;
+    int     total_steps_   = full_steps_ * microsteps_;  // Per rev
 
     Task *wireless_task_;              // To receive messages from wireless task
+    Task *led_task_;                   // To indicate motor activity
     xTimerHandle system_sleep_timer_;  // To prevent system from sleeping before motor stops
 
-    void stallguardInterrupt();
     void loadSettings();  // Load motor settings from flash
-    bool prepareToMove(bool check, bool direction);
+    bool prepareToMove(bool check, bool direction, int32_t steps = 0);
+    void startMove(int32_t target_step);
+    void setGroupMove(Command command, int value);
     void move(bool direction);
     void moveToStep(int target_step);
     void moveToPercent(int target_percent);
+    void toggle();
     void stop();
     bool setMin();
     bool setMax();
     bool zeroEncoder();
     bool motorEnable(uint8_t enable_pin, uint8_t value);
     void calculateTotalSteps();
+    void calculateTravelTime();
     inline int getPercent();
     inline int positionToStep(int encoder_position);
     // For quick configuration guide, please refer to p70-72 of TMC2209's datasheet rev1.09
@@ -108,4 +131,11 @@ private:
     void updateMotorSettings(float velocity, float acceleration, int current);
     void driverStartup();
     void driverStandby();
-};
\ No newline at end of file
+};
+
+
+#if MOTOR_SIMULATED
+    typedef MotorTaskT<SimDriver, SimPulser, SimEncoder> MotorTask;
+#else
+    typedef MotorTaskT<Tmc2209Driver, FastAccelPulser, As5600Encoder> MotorTask;
+#endif
@@ -0,0 +1,325 @@
+#define LOG_MODULE LOG_WIRELESS
+#include "mqtt.h"
+#include "logger.h"
+#include "json_arena.h"
+#include <AsyncMqttClient.h>
+
+
+struct MotorState {
+    int      position  = -1;  // %, latest from the motor task
+    int      published = -1;  // %, latest published
+    bool     moving    = false;
+    uint8_t  direction = 0;   // The state while moving, opening or closing
+    const char *state  = "";  // Latest published
+    uint32_t last_publish = 0;  // ms
+};
+
+
+// The client keeps pointers to the server, credentials, client id and will, so they live here
+static AsyncMqttClient client;
+static String   server_host = "";
+static uint16_t server_port = MQTT_PORT;
+static String   server_user = "";
+static String   server_password = "";
+static String   base_topic = "";   // MQTT_PREFIX/<hostname>
+static String   will_topic = "";
+static String   device_hostname = "";
+static String   device_name = "";
+static String   device_serial = "";
+static String   device_firmware = "";
+static uint8_t  device_motors = 0;
+static MqttReceiver message_receiver = nullptr;
+static MotorState motors[MOTORS_MAX];
+static bool     registered = false;       // Handlers of the client
+static uint32_t last_attempt = 0;         // ms
+static volatile bool announce = false;    // Connected, discovery and states are due
+static uint32_t published = 0;
+static uint32_t dropped = 0;              // Not accepted by the client, e.g. disconnected
+static uint32_t commands = 0;
+
+// A new server, handed to mqttPoll() since the client can't be reconfigured in its own callbacks
+static portMUX_TYPE server_mux = portMUX_INITIALIZER_UNLOCKED;
+static char     next_server[MQTT_SERVER_SIZE] = "";
+static volatile bool server_changed = false;
+
+
+static const char *stateOf(const MotorState &motor) {
+    if (motor.moving) {
+        return motor.direction ? "closing" : "opening";
+    }
+    if (motor.position == 0) return "open";
+    if (motor.position == 100) return "closed";
+    return "stopped";
+}
+
+
+static void topicOf(char *topic, size_t size, int motor, const char *name) {
+    if (motor < 0) {
+        snprintf(topic, size, "%s/%s", base_topic.c_str(), name);
+    } else {
+        snprintf(topic, size, "%s/%d/%s", base_topic.c_str(), motor, name);
+    }
+}
+
+
+static void publish(const char *topic, uint8_t qos, bool retain, const char *payload, size_t length) {
+    if (client.publish(topic, qos, retain, payload, length) == 0) {
+        dropped++;
+    } else {
+        published++;
+    }
+}
+
+
+static void publishDiscovery(uint8_t motor) {
+    char topic[MQTT_TOPIC_SIZE];
+    ScopedArena arena;
+    JsonDocument config(arena.allocator());
+    if (device_motors > 1) {
+        config["name"] = String("Motor ") + motor;
+    } else {
+        config["name"] = nullptr;  // The device's name
+    }
+    config["unique_id"] = device_serial + "_" + motor;
+    config["device_class"] = "shade";
+    topicOf(topic, sizeof(topic), -1, "availability");
+    config["availability_topic"] = topic;
+    topicOf(topic, sizeof(topic), motor, "set");
+    config["command_topic"] = topic;
+    topicOf(topic, sizeof(topic), motor, "set_position");
+    config["set_position_topic"] = topic;
+    topicOf(topic, sizeof(topic), motor, "position");
+    config["position_topic"] = topic;
+    topicOf(topic, sizeof(topic), motor, "state");
+    config["state_topic"] = topic;
+    config["position_open"] = 0;
+    config["position_closed"] = 100;
+    config["qos"] = 1;
+    JsonObject device = config["device"].to<JsonObject>();
+    device["identifiers"].add(device_serial);
+    device["name"] = device_name;
+    device["model"] = "ESP32 Yun";
+    device["sw_version"] = device_firmware;
+    if (config.overflowed()) {
+        LOGE("JSON arena too small for MQTT discovery");
+        return;
+    }
+    String payload;
+    serializeJson(config, payload);
+    snprintf(topic, sizeof(topic), MQTT_DISCOVERY "/cover/%s_%u/config", device_hostname.c_str(), motor);
+    publish(topic, 1, true, payload.c_str(), payload.length());
+}
+
+
+static void publishMotor(uint8_t index) {
+    MotorState &motor = motors[index];
+    if (motor.position < 0) {
+        return;  // Not known yet
+    }
+    bool changed = motor.position != motor.published;
+    if (changed && (!motor.moving || millis() - motor.last_publish >= MQTT_MOVING_PERIOD)) {
+        char topic[MQTT_TOPIC_SIZE];
+        char payload[8];
+        topicOf(topic, sizeof(topic), index, "position");
+        int length = snprintf(payload, sizeof(payload), "%d", motor.position);
+        publish(topic, motor.moving ? 0 : 1, true, payload, length);
+        motor.published = motor.position;
+        motor.last_publish = millis();
+    }
+    const char *state = stateOf(motor);
+    if (strcmp(state, motor.state) != 0) {
+        char topic[MQTT_TOPIC_SIZE];
+        topicOf(topic, sizeof(topic), index, "state");
+        publish(topic, 1, true, state, strlen(state));
+        motor.state = state;
+    }
+}
+
+
+// Runs in the MQTT client's task; the client isn't thread-safe, so commands are only handed over
+static void handleMessage(char *topic, char *payload, AsyncMqttClientMessageProperties properties,
+                          size_t length, size_t index, size_t total) {
+    if (index != 0 || length != total || length > MQTT_PAYLOAD_SIZE || message_receiver == nullptr
+        || strlen(topic) >= MQTT_TOPIC_SIZE) {
+        return;  // Commands are short and arrive in one piece
+    }
+    MqttMessage message;
+    strcpy(message.topic, topic);
+    memcpy(message.payload, payload, length);
+    message.payload[length] = '\0';
+    message_receiver(message);
+}
+
+
+bool mqttToRequest(const MqttMessage &message, char *request, size_t size) {
+    const char *topic = message.topic;
+    const char *value = message.payload;
+    if (strncmp(topic, base_topic.c_str(), base_topic.length()) != 0) {
+        return false;
+    }
+    request[0] = '\0';
+    const char *name = topic + base_topic.length();
+    unsigned int motor;
+    char action[16];
+    if (strcmp(name, "/command") == 0) {
+        snprintf(request, size, "%s", value);
+    } else if (sscanf(name, "/%u/%15s", &motor, action) == 2 && motor < device_motors) {
+        char *end;
+        long percent = strtol(value, &end, 10);
+        if (strcmp(action, "set") == 0 && strcmp(value, "OPEN") == 0) {
+            snprintf(request, size, "/motor?percent=0&motor=%u", motor);
+        } else if (strcmp(action, "set") == 0 && strcmp(value, "CLOSE") == 0) {
+            snprintf(request, size, "/motor?percent=100&motor=%u", motor);
+        } else if (strcmp(action, "set") == 0 && strcmp(value, "STOP") == 0) {
+            snprintf(request, size, "/motor?stop=1&motor=%u", motor);
+        } else if (strcmp(action, "set_position") == 0 && end != value && *end == '\0') {
+            snprintf(request, size, "/motor?percent=%ld&motor=%u", percent, motor);
+        }
+    }
+    if (request[0] == '\0') {
+        LOGE("MQTT message on %s not accepted: %s", topic, value);
+        return false;
+    }
+    commands++;
+    return true;
+}
+
+
+void mqttPublishResponse(const char *response, size_t length) {
+    char topic[MQTT_TOPIC_SIZE];
+    topicOf(topic, sizeof(topic), -1, "response");
+    publish(topic, 0, false, response, length);
+}
+
+
+void mqttSetServer(const String &server) {
+    portENTER_CRITICAL(&server_mux);
+    strlcpy(next_server, server.c_str(), sizeof(next_server));
+    server_changed = true;
+    portEXIT_CRITICAL(&server_mux);
+}
+
+
+// Runs in the wireless task
+static void applyServer() {
+    char copy[MQTT_SERVER_SIZE];
+    portENTER_CRITICAL(&server_mux);
+    memcpy(copy, next_server, sizeof(copy));
+    server_changed = false;
+    portEXIT_CRITICAL(&server_mux);
+    if (client.connected()) {
+        client.disconnect(true);
+    }
+    // [user[:password]@]host[:port]
+    String server = copy;
+    int at = server.lastIndexOf('@');
+    String credentials = at < 0 ? "" : server.substring(0, at);
+    String address = at < 0 ? server : server.substring(at + 1);
+    int colon = credentials.indexOf(':');
+    server_user = colon < 0 ? credentials : credentials.substring(0, colon);
+    server_password = colon < 0 ? "" : credentials.substring(colon + 1);
+    colon = address.indexOf(':');
+    server_host = colon < 0 ? address : address.substring(0, colon);
+    server_port = colon < 0 ? MQTT_PORT : address.substring(colon + 1).toInt();
+
+    client.setServer(server_host.c_str(), server_port);
+    if (server_user != "") {
+        client.setCredentials(server_user.c_str(), server_password.c_str());
+    } else {
+        client.setCredentials(nullptr, nullptr);
+    }
+    last_attempt = 0;
+}
+
+
+void mqttSetDevice(const String &hostname, const String &name, const String &serial,
+                   const String &firmware, uint8_t motors) {
+    device_hostname = hostname;
+    device_name = name;
+    device_serial = serial;
+    device_firmware = firmware;
+    device_motors = min(motors, static_cast<uint8_t>(MOTORS_MAX));
+    base_topic = String(MQTT_PREFIX "/") + hostname;
+    will_topic = base_topic + "/availability";
+
+    client.setClientId(device_hostname.c_str());
+    client.setKeepAlive(MQTT_KEEP_ALIVE);
+    client.setWill(will_topic.c_str(), 1, true, "offline");
+    if (registered) {
+        return;  // The client adds handlers instead of replacing them, e.g. after WiFi reconnects
+    }
+    registered = true;
+    client.onConnect([](bool session_present) {
+        LOGI("MQTT connected to %s", server_host.c_str());
+        announce = true;
+    });
+    client.onDisconnect([](AsyncMqttClientDisconnectReason reason) {
+        LOGE("MQTT disconnected, reason %d", static_cast<int>(reason));
+    });
+    client.onMessage(handleMessage);
+}
+
+
+void mqttOnMessage(MqttReceiver receiver) {
+    message_receiver = receiver;
+}
+
+
+void mqttPoll() {
+    if (server_changed) {
+        applyServer();
+    }
+    if (server_host == "" || device_hostname == "") {
+        return;
+    }
+    if (!client.connected()) {
+        if (last_attempt == 0 || millis() - last_attempt >= MQTT_RETRY_PERIOD) {
+            last_attempt = max(millis(), 1UL);
+            client.connect();
+        }
+        return;
+    }
+
+    if (announce) {
+        announce = false;
+        char topic[MQTT_TOPIC_SIZE];
+        topicOf(topic, sizeof(topic), -1, "command");
+        client.subscribe(topic, 1);
+        snprintf(topic, sizeof(topic), "%s/+/set", base_topic.c_str());
+        client.subscribe(topic, 1);
+        snprintf(topic, sizeof(topic), "%s/+/set_position", base_topic.c_str());
+        client.subscribe(topic, 1);
+        publish(will_topic.c_str(), 1, true, "online", 6);
+        for (uint8_t i = 0; i < device_motors; i++) {
+            publishDiscovery(i);
+            motors[i].published = -1;  // The broker may have lost the retained ones
+            motors[i].state = "";
+        }
+    }
+
+    for (uint8_t i = 0; i < device_motors; i++) {
+        publishMotor(i);
+    }
+}
+
+
+void mqttUpdatePosition(uint8_t motor, int percent, bool moving) {
+    if (motor >= MOTORS_MAX) {
+        return;
+    }
+    MotorState &state = motors[motor];
+    if (moving && state.position >= 0 && percent != state.position) {
+        state.direction = percent > state.position;  // Towards 100, closing
+    }
+    state.position = percent;
+    state.moving = moving;
+}
+
+
+void mqttToJson(JsonObject destination) {
+    destination["server"] = server_host;
+    destination["connected"] = client.connected();
+    destination["published"] = published;
+    destination["dropped"] = dropped;
+    destination["commands"] = commands;
+}
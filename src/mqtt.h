@@ -0,0 +1,61 @@
+#pragma once
+/**
+    mqtt.h - An MQTT client publishing the motors' state and taking commands, with Home Assistant
+             discovery
+    Author: Jason Chen, 2024
+
+    The wireless task calls mqttPoll() in its loop, which connects to the broker and publishes the
+    positions handed over with mqttUpdatePosition(); commands arrive in the MQTT client's task,
+    which only copies and queues them, and are dispatched and answered by the wireless task like
+    fleet and CoAP requests, since the client isn't thread-safe. Topics of a unit are under
+    MQTT_PREFIX/<hostname>:
+      - availability: "online", or "offline" as the last will when the unit drops off, retained.
+      - <motor>/position and <motor>/state: 0~100 and open | opening | closed | closing | stopped,
+        retained. Only changes are published; while moving, the position at most every
+        MQTT_MOVING_PERIOD at QoS 0 since the next one supersedes it, the final one at QoS 1.
+      - <motor>/set (OPEN | CLOSE | STOP) and <motor>/set_position (0~100) take commands, command
+        takes a request like HTTP's, e.g. "/motor?percent=50&duration=8000"; the response of a
+        command is published to response.
+    Each motor is announced as a cover on MQTT_DISCOVERY for Home Assistant when connected.
+    See src/scripts/mqtt_check.py to check a unit against a broker, or without one.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "board.h"
+
+
+#define MQTT_PORT           1883
+#define MQTT_PREFIX         "yun"            // Topics of a unit are MQTT_PREFIX/<hostname>/...
+#define MQTT_DISCOVERY      "homeassistant"  // Discovery prefix of Home Assistant
+#define MQTT_KEEP_ALIVE     30               // s
+#define MQTT_RETRY_PERIOD   10000            // ms, between connection attempts
+#define MQTT_MOVING_PERIOD  1000             // ms, between positions published while moving
+#define MQTT_TOPIC_SIZE     96               // Bytes
+#define MQTT_PAYLOAD_SIZE   128              // Bytes, longest command
+#define MQTT_SERVER_SIZE    128              // Bytes, longest server with its credentials
+#define MQTT_REQUEST_SIZE   (MQTT_PAYLOAD_SIZE + 32)  // Bytes, longest request built from a command
+#define MQTT_QUEUE          4                // Commands waiting for the wireless task
+
+
+// A command handed from the MQTT client's task to the wireless task
+struct MqttMessage {
+    char topic[MQTT_TOPIC_SIZE];
+    char payload[MQTT_PAYLOAD_SIZE + 1];  // Null terminated
+};
+
+
+typedef std::function<void(const MqttMessage &message)> MqttReceiver;
+
+
+// "[user[:password]@]host[:port]", empty to disable. From any task, applied by mqttPoll()
+void mqttSetServer(const String &server);
+void mqttSetDevice(const String &hostname, const String &name, const String &serial,
+                   const String &firmware, uint8_t motors);
+void mqttOnMessage(MqttReceiver receiver);  // Called in the MQTT client's task, only to queue
+void mqttPoll();
+
+// In the wireless task: the request of a command, false if not one; then publishes its response
+bool mqttToRequest(const MqttMessage &message, char *request, size_t size);
+void mqttPublishResponse(const char *response, size_t length);
+void mqttUpdatePosition(uint8_t motor, int percent, bool moving);
+void mqttToJson(JsonObject destination);
@@ -0,0 +1,161 @@
+#include "odometer.h"
+#include "logger.h"
+#include <rom/crc.h>
+
+
+struct OdometerRecord {
+    uint64_t steps;
+    uint32_t sequence;
+    uint32_t moves;
+    uint32_t stalls;
+    uint32_t startups;
+    uint32_t powered;
+    uint32_t crc;  // Of all fields above
+};
+
+
+static SemaphoreHandle_t file_mutex = NULL;
+static portMUX_TYPE counters_mux = portMUX_INITIALIZER_UNLOCKED;
+static Odometer counters;
+static uint32_t powered_before = 0;  // s, time powered before this boot
+static uint32_t sequence = 0;        // Sequence of the next record
+static bool     changed = false;
+static uint32_t last_flush = 0;      // ms
+
+
+static void filePath(uint32_t record_sequence, char *path, size_t size) {
+    snprintf(path, size, ODOMETER_DIRECTORY "/%u.bin", (record_sequence / ODOMETER_RECORDS) % 2);
+}
+
+
+static uint32_t recordCrc(const OdometerRecord &record) {
+    return crc32_le(0, reinterpret_cast<const uint8_t*>(&record), offsetof(OdometerRecord, crc));
+}
+
+
+static uint32_t uptime() {
+    return static_cast<uint32_t>(esp_timer_get_time() / 1000000);
+}
+
+
+void odometerInit() {
+    file_mutex = xSemaphoreCreateMutex();
+    assert(file_mutex != NULL);
+
+    LITTLEFS.mkdir(ODOMETER_DIRECTORY);
+
+    // The newest valid record of both files
+    OdometerRecord newest;
+    bool found = false;
+    char path[32];
+    for (uint32_t file_index = 0; file_index < 2; file_index++) {
+        filePath(file_index * ODOMETER_RECORDS, path, sizeof(path));
+        File file = LITTLEFS.open(path, FILE_READ);
+        if (!file) continue;
+        OdometerRecord record;
+        for (uint32_t slot = 0;
+             file.read(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record); slot++) {
+            // Slots never written read as zeros and fail the CRC
+            bool valid = record.crc == recordCrc(record) && record.sequence % ODOMETER_RECORDS == slot;
+            if (valid && (!found || record.sequence > newest.sequence)) {
+                newest = record;
+                found = true;
+            }
+        }
+        file.close();
+    }
+
+    if (found) {
+        counters.steps = newest.steps;
+        counters.moves = newest.moves;
+        counters.stalls = newest.stalls;
+        counters.startups = newest.startups;
+        powered_before = newest.powered;
+        sequence = newest.sequence + 1;
+        LOGI("Odometer loaded, record #%u", newest.sequence);
+    } else {
+        LOGI("Odometer not found, starting from zero");
+    }
+}
+
+
+void odometerAdd(OdometerCounter counter, uint32_t amount) {
+    portENTER_CRITICAL(&counters_mux);
+    switch (counter) {
+        case ODOMETER_STEPS:
+            counters.steps += amount;
+            break;
+        case ODOMETER_MOVES:
+            counters.moves += amount;
+            break;
+        case ODOMETER_STALLS:
+            counters.stalls += amount;
+            break;
+        case ODOMETER_STARTUPS:
+            counters.startups += amount;
+            break;
+        default:
+            break;
+    }
+    changed = true;
+    portEXIT_CRITICAL(&counters_mux);
+}
+
+
+void odometerFlush(bool force) {
+    uint32_t since_flush = millis() - last_flush;
+    if (!force && since_flush < (changed ? ODOMETER_FLUSH_PERIOD : ODOMETER_POWERED_PERIOD)) {
+        return;
+    }
+
+    xSemaphoreTake(file_mutex, portMAX_DELAY);
+    Odometer current = odometerGet();
+    portENTER_CRITICAL(&counters_mux);
+    changed = false;
+    portEXIT_CRITICAL(&counters_mux);
+
+    OdometerRecord record;
+    record.steps = current.steps;
+    record.sequence = sequence;
+    record.moves = current.moves;
+    record.stalls = current.stalls;
+    record.startups = current.startups;
+    record.powered = current.powered;
+    record.crc = recordCrc(record);
+
+    // Records are written at fixed offsets, so a torn record is overwritten by the next one
+    char path[32];
+    filePath(sequence, path, sizeof(path));
+    size_t slot = sequence % ODOMETER_RECORDS;
+    File file = slot > 0 && LITTLEFS.exists(path) ? LITTLEFS.open(path, "r+")
+                                                  : LITTLEFS.open(path, FILE_WRITE);  // Starts over
+    if (file && file.seek(slot * sizeof(record))
+        && file.write(reinterpret_cast<uint8_t*>(&record), sizeof(record)) == sizeof(record)) {
+        sequence++;
+    } else {
+        LOGE("Failed to write odometer record #%u", sequence);
+    }
+    file.close();
+    last_flush = millis();
+    xSemaphoreGive(file_mutex);
+}
+
+
+// A format removes the directory, which is only made at boot
+bool odometerRestore() {
+    if (!LITTLEFS.mkdir(ODOMETER_DIRECTORY)) {
+        LOGE("Failed to recreate %s, odometer lost", ODOMETER_DIRECTORY);
+        return false;
+    }
+    odometerFlush(true);
+    return true;
+}
+
+
+Odometer odometerGet() {
+    portENTER_CRITICAL(&counters_mux);
+    Odometer current = counters;
+    portEXIT_CRITICAL(&counters_mux);
+    current.powered = powered_before + uptime();
+    return current;
+}
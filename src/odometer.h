@@ -0,0 +1,49 @@
+#pragma once
+/**
+    odometer.h - Lifetime counters of the motor and the system for predicting wear
+    Author: Jason Chen, 2024
+
+    Counts the steps travelled, moves, stalls, driver startups and the time powered over the life of
+    the unit. Main features includes:
+      - odometerAdd() only adds to the counters in RAM, the system task calls odometerFlush() in its
+        loop which writes all counters as one record when due, so at most ODOMETER_FLUSH_PERIOD of
+        counts are lost on a power loss.
+      - Records are 32 bytes with a CRC and appended to one of two files, each one LittleFS block;
+        once a file is full the other one is started over. A torn record fails its CRC and the
+        previous record is used instead.
+      - The counters are written back after a factory reset.
+**/
+#include <Arduino.h>
+#include "FS.h"
+#include <LITTLEFS.h>
+
+
+#define ODOMETER_DIRECTORY      "/odometer"
+#define ODOMETER_RECORDS        128      // Records per file, one LittleFS block
+#define ODOMETER_FLUSH_PERIOD   900000   // ms, when counters changed
+#define ODOMETER_POWERED_PERIOD 3600000  // ms, when only the time powered changed
+
+
+enum OdometerCounter {
+    ODOMETER_STEPS    = 0,
+    ODOMETER_MOVES    = 1,
+    ODOMETER_STALLS   = 2,
+    ODOMETER_STARTUPS = 3,  // Driver taken out of standby
+    ODOMETER_COUNTERS
+};
+
+
+struct Odometer {
+    uint64_t steps;
+    uint32_t moves;
+    uint32_t stalls;
+    uint32_t startups;
+    uint32_t powered;  // s
+};
+
+
+void odometerInit();
+void odometerAdd(OdometerCounter counter, uint32_t amount = 1);
+void odometerFlush(bool force = false);  // Flushes if due unless forced
+bool odometerRestore();  // Writes the counters back after the file system was formatted
+Odometer odometerGet();
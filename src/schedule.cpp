@@ -0,0 +1,358 @@
+#define LOG_MODULE LOG_SYSTEM
+#include "schedule.h"
+#include "clock.h"
+#include "solar.h"
+#include "logger.h"
+#include <time.h>
+
+
+#define WHEEL_MASK (WHEEL_SLOTS - 1)
+#define NO_ENTRY   -1
+#define SCHEDULE_MAGIC   0x48435353  // "SSCH"
+#define SCHEDULE_VERSION 1           // Of the file
+
+
+struct ScheduleHeader {
+    uint32_t magic;
+    uint8_t  version;
+    uint8_t  record_size;  // sizeof(Schedule)
+    uint16_t count;
+};
+
+
+// Guarded by schedule_mutex, changed by the HTTP handlers and run by the system task
+static SemaphoreHandle_t schedule_mutex = NULL;
+static Schedule schedules[SCHEDULE_MAX];
+static bool     used[SCHEDULE_MAX];
+static uint32_t due[SCHEDULE_MAX];          // min since epoch, next run of each schedule
+static int8_t   next_entry[SCHEDULE_MAX];   // Next schedule in the same slot
+static uint8_t  entry_level[SCHEDULE_MAX];
+static uint8_t  entry_slot[SCHEDULE_MAX];
+static int8_t   slots[WHEEL_LEVELS][WHEEL_SLOTS];  // First schedule in each slot
+static uint64_t occupied[WHEEL_LEVELS];            // Bit n set if slot n is not empty
+static uint32_t wheel_time = 0;                    // min since epoch the wheel has run up to
+static bool     rebuild = true;                    // The wheel needs to be rebuilt
+
+
+// Next run after a minute since epoch, in min since epoch
+static uint32_t nextRun(const Schedule &schedule, uint32_t after) {
+    time_t from = static_cast<time_t>(after + 1) * 60;
+    struct tm local;
+    localtime_r(&from, &local);
+    // From the day before, whose sunset can be after midnight near the poles
+    for (int day = -1; day <= 7; day++) {
+        struct tm run = local;
+        run.tm_mday += day;
+        run.tm_hour = schedule.trigger == SCHEDULE_TIME ? schedule.minute / 60 : 12;
+        run.tm_min = schedule.trigger == SCHEDULE_TIME ? schedule.minute % 60 : 0;
+        run.tm_sec = 0;
+        run.tm_isdst = -1;
+        time_t when = mktime(&run);  // Normalizes the date and sets tm_wday and tm_yday
+        if (!(schedule.weekdays >> run.tm_wday & 1)) {
+            continue;
+        }
+        if (schedule.trigger != SCHEDULE_TIME) {
+            SolarEvent event = schedule.trigger == SCHEDULE_SUNRISE ? SOLAR_SUNRISE : SOLAR_SUNSET;
+            uint32_t sun = solarEventTime(run.tm_year + 1900, run.tm_yday, event);
+            if (sun == UINT32_MAX) {
+                continue;  // No location yet, or no sunrise/sunset that day
+            }
+            when = static_cast<time_t>(sun + schedule.minute) * 60;
+        }
+        if (when >= from) {
+            return static_cast<uint32_t>(when / 60);
+        }
+    }
+    return UINT32_MAX;
+}
+
+
+// The level is the lowest one whose slots span the time until the run
+static void insert(int8_t entry) {
+    if (due[entry] == UINT32_MAX) {
+        entry_level[entry] = 0;
+        entry_slot[entry] = 0;
+        next_entry[entry] = NO_ENTRY;
+        return;  // Never runs, until the wheel is rebuilt
+    }
+    uint32_t delta = due[entry] - wheel_time;
+    uint8_t level = 0;
+    while (level < WHEEL_LEVELS - 1 && delta >= 1UL << (WHEEL_BITS * (level + 1))) {
+        level++;
+    }
+    uint8_t slot = (due[entry] >> (WHEEL_BITS * level)) & WHEEL_MASK;
+    next_entry[entry] = slots[level][slot];
+    slots[level][slot] = entry;
+    occupied[level] |= 1ULL << slot;
+    entry_level[entry] = level;
+    entry_slot[entry] = slot;
+}
+
+
+static void unlink(int8_t entry) {
+    int8_t *link = &slots[entry_level[entry]][entry_slot[entry]];
+    while (*link != NO_ENTRY && *link != entry) {
+        link = &next_entry[*link];
+    }
+    if (*link == entry) {
+        *link = next_entry[entry];
+    }
+    if (slots[entry_level[entry]][entry_slot[entry]] == NO_ENTRY) {
+        occupied[entry_level[entry]] &= ~(1ULL << entry_slot[entry]);
+    }
+}
+
+
+static int8_t takeSlot(uint8_t level, uint8_t slot) {
+    int8_t first = slots[level][slot];
+    slots[level][slot] = NO_ENTRY;
+    occupied[level] &= ~(1ULL << slot);
+    return first;
+}
+
+
+// Starts from the minute before, so runs of the current minute aren't lost at boot
+static void rebuildWheel(uint32_t now) {
+    memset(slots, NO_ENTRY, sizeof(slots));
+    memset(occupied, 0, sizeof(occupied));
+    wheel_time = now - 1;
+    for (int8_t i = 0; i < SCHEDULE_MAX; i++) {
+        if (used[i]) {
+            due[i] = nextRun(schedules[i], wheel_time);
+            insert(i);
+        }
+    }
+    rebuild = false;
+}
+
+
+// Moves the wheel one minute forward and copies the schedules due into runs
+static void advance(Schedule *runs, int &count) {
+    wheel_time++;
+
+    // Slots of the upper levels starting now are spread over the lower levels
+    for (uint8_t level = WHEEL_LEVELS - 1; level > 0; level--) {
+        if (wheel_time & ((1UL << (WHEEL_BITS * level)) - 1)) {
+            continue;
+        }
+        int8_t entry = takeSlot(level, (wheel_time >> (WHEEL_BITS * level)) & WHEEL_MASK);
+        while (entry != NO_ENTRY) {
+            int8_t next = next_entry[entry];
+            insert(entry);
+            entry = next;
+        }
+    }
+
+    int8_t entry = takeSlot(0, wheel_time & WHEEL_MASK);
+    while (entry != NO_ENTRY) {
+        int8_t next = next_entry[entry];
+        if (count < SCHEDULE_MAX) {
+            runs[count++] = schedules[entry];
+        }
+        due[entry] = nextRun(schedules[entry], wheel_time);
+        insert(entry);
+        entry = next;
+    }
+
+    // Schedules without a run in the next week, e.g. in polar night, are tried again daily
+    if (wheel_time % (24 * 60) == 0) {
+        for (int8_t i = 0; i < SCHEDULE_MAX; i++) {
+            if (used[i] && due[i] == UINT32_MAX) {
+                due[i] = nextRun(schedules[i], wheel_time);
+                insert(i);
+            }
+        }
+    }
+}
+
+
+// Minutes from wheel_time until a slot is due, the start of the nearest used slot of each level
+static uint32_t untilNextSlot() {
+    uint32_t nearest = UINT32_MAX;
+    for (uint8_t level = 0; level < WHEEL_LEVELS; level++) {
+        uint64_t bits = occupied[level];
+        if (bits == 0) {
+            continue;
+        }
+        uint8_t shift = WHEEL_BITS * level;
+        uint32_t current = wheel_time >> shift;
+        uint8_t first = (current + 1) & WHEEL_MASK;
+        uint64_t rotated = first ? (bits >> first | bits << (WHEEL_SLOTS - first)) : bits;
+        uint32_t ahead = __builtin_ctzll(rotated) + 1;  // Slots after the current one
+        nearest = min(nearest, ((current + ahead) << shift) - wheel_time);
+    }
+    return nearest;
+}
+
+
+static void save() {
+    File file = LITTLEFS.open(SCHEDULE_PATH, FILE_WRITE);
+    if (!file) {
+        LOGE("Failed to save schedules");
+        return;
+    }
+    ScheduleHeader header = {SCHEDULE_MAGIC, SCHEDULE_VERSION, sizeof(Schedule), 0};
+    for (int i = 0; i < SCHEDULE_MAX; i++) {
+        header.count += used[i];
+    }
+    file.write(reinterpret_cast<const uint8_t*>(&header), sizeof(header));
+    for (int i = 0; i < SCHEDULE_MAX; i++) {
+        if (used[i]) {
+            file.write(reinterpret_cast<const uint8_t*>(&schedules[i]), sizeof(Schedule));
+        }
+    }
+    file.close();
+}
+
+
+static bool isValid(const Schedule &schedule) {
+    bool valid_minute = schedule.trigger == SCHEDULE_TIME
+                        ? schedule.minute >= 0 && schedule.minute < 24 * 60
+                        : abs(schedule.minute) <= SCHEDULE_OFFSET_MAX;
+    return schedule.id < SCHEDULE_MAX && schedule.weekdays != 0 && schedule.weekdays < 128
+           && schedule.trigger <= SCHEDULE_SUNSET && valid_minute;
+}
+
+
+void scheduleInit() {
+    schedule_mutex = xSemaphoreCreateMutex();
+    assert(schedule_mutex != NULL);
+
+    Schedule read[SCHEDULE_MAX];
+    int count = 0;
+    File file = LITTLEFS.open(SCHEDULE_PATH, FILE_READ);
+    if (file) {
+        ScheduleHeader header;
+        if (file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) == sizeof(header)
+            && header.magic == SCHEDULE_MAGIC && header.version == SCHEDULE_VERSION
+            && header.record_size == sizeof(Schedule)) {
+            while (count < SCHEDULE_MAX && count < header.count
+                   && file.read(reinterpret_cast<uint8_t*>(&read[count]),
+                                sizeof(Schedule)) == sizeof(Schedule)) {
+                count++;
+            }
+        } else {
+            LOGE("%s not recognized, schedules discarded", SCHEDULE_PATH);
+        }
+        file.close();
+    }
+
+    int loaded = 0;
+    for (int i = 0; i < count; i++) {
+        if (isValid(read[i]) && !used[read[i].id]) {
+            schedules[read[i].id] = read[i];
+            used[read[i].id] = true;
+            loaded++;
+        }
+    }
+    LOGI("%d schedules loaded", loaded);
+}
+
+
+int scheduleAdd(ScheduleTrigger trigger, uint8_t weekdays, int16_t minute, int8_t percent,
+                int8_t motor) {
+    int id = -1;
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    for (int i = 0; i < SCHEDULE_MAX; i++) {
+        if (!used[i]) {
+            id = i;
+            break;
+        }
+    }
+    if (id >= 0) {
+        schedules[id] = {static_cast<uint8_t>(id), weekdays, minute, percent, motor,
+                         static_cast<uint8_t>(trigger)};
+        used[id] = true;
+        if (!rebuild) {
+            due[id] = nextRun(schedules[id], wheel_time);
+            insert(id);
+        }
+        save();
+    }
+    xSemaphoreGive(schedule_mutex);
+    return id;
+}
+
+
+bool scheduleRemove(uint8_t id) {
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    bool removed = id < SCHEDULE_MAX && used[id];
+    if (removed) {
+        if (!rebuild) {
+            unlink(id);
+        }
+        used[id] = false;
+        save();
+    }
+    xSemaphoreGive(schedule_mutex);
+    return removed;
+}
+
+
+void scheduleRebuild() {
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    rebuild = true;
+    xSemaphoreGive(schedule_mutex);
+}
+
+
+uint32_t scheduleRun(std::function<void(const Schedule&)> action) {
+    uint64_t now_ms = clockNow();
+    if (now_ms == 0) {
+        return UINT32_MAX;  // Local times are unknown until synchronized
+    }
+    uint32_t now = static_cast<uint32_t>(now_ms / 60000);
+
+    Schedule runs[SCHEDULE_MAX];
+    int count = 0;
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    if (rebuild || now < wheel_time || now - wheel_time > SCHEDULE_CATCH_UP) {
+        rebuildWheel(now);
+    }
+    while (wheel_time < now) {
+        advance(runs, count);
+    }
+    uint32_t minutes = untilNextSlot();
+    xSemaphoreGive(schedule_mutex);
+
+    // Run outside of the lock, the action sends messages to other tasks
+    for (int i = 0; i < count; i++) {
+        action(runs[i]);
+    }
+
+    if (minutes == UINT32_MAX) {
+        return UINT32_MAX;
+    }
+    uint64_t until = static_cast<uint64_t>(minutes) * 60000 - now_ms % 60000;
+    return until < UINT32_MAX ? static_cast<uint32_t>(until) : UINT32_MAX - 1;
+}
+
+
+void scheduleToJson(JsonArray destination) {
+    xSemaphoreTake(schedule_mutex, portMAX_DELAY);
+    for (int i = 0; i < SCHEDULE_MAX; i++) {
+        if (!used[i]) {
+            continue;
+        }
+        JsonObject schedule = destination.add<JsonObject>();
+        schedule["id"] = schedules[i].id;
+        if (schedules[i].trigger == SCHEDULE_SUNRISE) {
+            schedule["sunrise"] = schedules[i].minute;  // min, offset
+        } else if (schedules[i].trigger == SCHEDULE_SUNSET) {
+            schedule["sunset"] = schedules[i].minute;
+        } else {
+            char time[6];
+            snprintf(time, sizeof(time), "%02d:%02d", schedules[i].minute / 60, schedules[i].minute % 60);
+            schedule["time"] = time;
+        }
+        schedule["days"] = schedules[i].weekdays;
+        schedule["percent"] = schedules[i].percent;
+        if (schedules[i].motor >= 0) {
+            schedule["motor"] = schedules[i].motor;
+        }
+        if (!rebuild && due[i] != UINT32_MAX) {
+            schedule["next"] = static_cast<uint64_t>(due[i]) * 60000;  // ms since epoch
+        }
+    }
+    xSemaphoreGive(schedule_mutex);
+}
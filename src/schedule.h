@@ -0,0 +1,61 @@
+#pragma once
+/**
+    schedule.h - Moves at a time of day or relative to the sun on given weekdays, kept and run on the unit
+    Author: Jason Chen, 2024
+
+    A schedule moves the motors to a percent at a local time of day, or at an offset from sunrise
+    or sunset, on a set of weekdays, so a unit keeps opening and closing its blinds without a home
+    server. The system task calls scheduleRun() in its loop, which runs the schedules that are due.
+    Main features includes:
+      - Schedules are saved to SCHEDULE_PATH, a few bytes each behind a header with the version of
+        the file, and loaded at boot; a file with any other header is discarded.
+      - The next run of each schedule sits in a hierarchical timer wheel of WHEEL_LEVELS levels of
+        WHEEL_SLOTS slots, counted in minutes since epoch: adding a schedule is O(1), and the time
+        until the wheel next has work to do is found from the bitmaps of used slots without
+        looking at every schedule, so the system can sleep until then.
+      - Runs missed by up to SCHEDULE_CATCH_UP, e.g. while the system slept, are still run; after
+        a longer gap or a clock step back the wheel is rebuilt from the current time instead.
+      - Times of day are local, see clockSetTimezone(); nothing runs until the clock is
+        synchronized. Sunrise and sunset come from the table in solar.h, schedules relative to them
+        don't run until a location is set, nor on days without them.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+#include "FS.h"
+#include <LITTLEFS.h>
+
+
+#define SCHEDULE_PATH       "/schedules.bin"
+#define SCHEDULE_MAX        16
+#define SCHEDULE_OFFSET_MAX 720     // min, from sunrise or sunset
+#define SCHEDULE_CATCH_UP   10      // min, late runs still run within
+#define SCHEDULE_WAKE_AHEAD 60000   // ms, the system stays awake for a run within
+#define WHEEL_BITS          6
+#define WHEEL_SLOTS         64      // 1 << WHEEL_BITS
+#define WHEEL_LEVELS        3       // Slots of 1 min, 64 min and 4096 min, up to 182 days ahead
+
+
+enum ScheduleTrigger {
+    SCHEDULE_TIME    = 0,
+    SCHEDULE_SUNRISE = 1,
+    SCHEDULE_SUNSET  = 2
+};
+
+
+struct Schedule {
+    uint8_t id;        // 0 ~ SCHEDULE_MAX - 1
+    uint8_t weekdays;  // Bit 0 for Sunday ~ bit 6 for Saturday
+    int16_t minute;    // Of the day in local time, or the offset from sunrise/sunset
+    int8_t  percent;
+    int8_t  motor;     // -1 for all motors
+    uint8_t trigger;   // ScheduleTrigger
+};
+
+
+void scheduleInit();
+int scheduleAdd(ScheduleTrigger trigger, uint8_t weekdays, int16_t minute, int8_t percent,
+                int8_t motor);  // id, -1 if full
+bool scheduleRemove(uint8_t id);
+void scheduleRebuild();  // After the timezone or the location changed
+uint32_t scheduleRun(std::function<void(const Schedule&)> action);  // ms until the next run
+void scheduleToJson(JsonArray destination);
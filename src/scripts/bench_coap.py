@@ -0,0 +1,308 @@
+"""
+Compares the CoAP and HTTP request paths of a unit, see src/coap.h.
+
+Sends the same command over both, each HTTP request on a new connection like most hubs do, and
+measures the round trip on this host and the time the unit spent on each request, from the
+"api" counters in /json: parsing and handling for CoAP, the request handler for HTTP (the web
+server's own parsing before the handler isn't included, so HTTP's is a lower bound). The command
+used is rejected by the firmware, so neither moves the motor or writes settings. Then observes
+/position for a while and prints the notifications, acking the confirmable ones.
+
+A simulated unit on this host serves both, so the script can be checked without hardware.
+
+    python src/scripts/bench_coap.py <unit-ip> [--count 100] [--observe 10]
+    python src/scripts/bench_coap.py --sim [--count 100] [--observe 3]
+"""
+import argparse
+import http.server
+import json
+import random
+import socket
+import struct
+import threading
+import time
+import urllib.error
+import urllib.request
+
+COMMAND = "/motor?velocity=0"
+COAP_PORT = 5683
+CON, NON, ACK, RST = range(4)
+GET = 1
+CONTENT = 2 << 5 | 5
+BAD_REQUEST = 4 << 5 | 0
+NOT_FOUND = 4 << 5 | 4
+OBSERVE, URI_PATH, CONTENT_FORMAT, URI_QUERY = 6, 11, 12, 15
+ACK_TIMEOUT = 2.0  # s
+MAX_RETRANSMIT = 4
+
+
+def encode(kind, code, message_id, token=b"", options=(), payload=b""):
+    """A CoAP message, options as (number, bytes) in order of their numbers."""
+    data = bytearray([1 << 6 | kind << 4 | len(token), code]) + struct.pack(">H", message_id)
+    data += token
+    last = 0
+    for number, value in options:
+        fields = []
+        nibbles = []
+        for field in (number - last, len(value)):
+            if field < 13:
+                nibbles.append(field)
+            elif field < 269:
+                nibbles.append(13)
+                fields.append(bytes([field - 13]))
+            else:
+                nibbles.append(14)
+                fields.append(struct.pack(">H", field - 269))
+        data.append(nibbles[0] << 4 | nibbles[1])
+        data += b"".join(fields) + value
+        last = number
+    if payload:
+        data += b"\xff" + payload
+    return bytes(data)
+
+
+def decode(data):
+    """(type, code, message_id, token, {number: [values]}, payload), None if not CoAP."""
+    if len(data) < 4 or data[0] >> 6 != 1:
+        return None
+    kind, token_length, code = data[0] >> 4 & 3, data[0] & 15, data[1]
+    message_id = struct.unpack_from(">H", data, 2)[0]
+    token = data[4:4 + token_length]
+    at, number, options = 4 + token_length, 0, {}
+    while at < len(data) and data[at] != 0xFF:
+        values = [data[at] >> 4, data[at] & 15]
+        at += 1
+        for i in range(2):
+            if values[i] == 13:
+                values[i] = data[at] + 13
+                at += 1
+            elif values[i] == 14:
+                values[i] = struct.unpack_from(">H", data, at)[0] + 269
+                at += 2
+        number += values[0]
+        options.setdefault(number, []).append(data[at:at + values[1]])
+        at += values[1]
+    payload = data[at + 1:] if at < len(data) else b""
+    return kind, code, message_id, token, options, payload
+
+
+def uint(value):
+    return value.to_bytes((value.bit_length() + 7) // 8, "big")
+
+
+def request_options(request, observe=None):
+    path, _, query = request.partition("?")
+    options = [] if observe is None else [(OBSERVE, uint(observe))]
+    options += [(URI_PATH, part.encode()) for part in path.split("/") if part]
+    options += [(URI_QUERY, part.encode()) for part in query.split("&") if part]
+    return options
+
+
+def code_string(code):
+    return "%d.%02d" % (code >> 5, code & 31)
+
+
+class Client:
+    def __init__(self, host, port):
+        self.address = (host, port)
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.message_id = random.randrange(0x10000)
+
+    def next_id(self):
+        self.message_id = (self.message_id + 1) & 0xFFFF
+        return self.message_id
+
+    def request(self, request, observe=None, token=None):
+        """Confirmable GET, retransmitted until acked: (code, payload, observe value)."""
+        message_id = self.next_id()
+        token = token or struct.pack(">I", random.getrandbits(32))
+        message = encode(CON, GET, message_id, token, request_options(request, observe))
+        timeout = ACK_TIMEOUT
+        for _ in range(MAX_RETRANSMIT + 1):
+            self.sock.sendto(message, self.address)
+            deadline = time.monotonic() + timeout
+            while time.monotonic() < deadline:
+                self.sock.settimeout(deadline - time.monotonic())
+                try:
+                    data, _ = self.sock.recvfrom(2048)
+                except socket.timeout:
+                    break
+                reply = decode(data)
+                if reply and reply[0] == ACK and reply[2] == message_id and reply[3] == token:
+                    values = reply[4].get(OBSERVE)
+                    seen = int.from_bytes(values[0], "big") if values else None
+                    return reply[1], reply[5].decode(errors="replace"), seen
+            timeout *= 2
+        raise TimeoutError("no answer to %s" % request)
+
+    def observe(self, request, seconds):
+        """Registers, prints the notifications for a while and deregisters."""
+        token = b"obs1"
+        code, payload, seen = self.request(request, observe=0, token=token)
+        print("  registered: %s %s, observe %s" % (code_string(code), payload, seen))
+        if seen is None:
+            print("  not observable")
+            return 0
+        count = 0
+        end = time.monotonic() + seconds
+        while time.monotonic() < end:
+            self.sock.settimeout(max(end - time.monotonic(), 0.01))
+            try:
+                data, _ = self.sock.recvfrom(2048)
+            except socket.timeout:
+                break
+            reply = decode(data)
+            if not reply or reply[3] != token:
+                continue
+            kind, code, message_id, _, options, payload = reply
+            if kind == CON:
+                self.sock.sendto(encode(ACK, 0, message_id), self.address)
+            count += 1
+            print("  %s %s: %s, observe %d" % ("CON" if kind == CON else "NON", code_string(code),
+                                              payload.decode(), int.from_bytes(options[OBSERVE][0], "big")))
+        self.request(request, observe=1, token=token)
+        return count
+
+
+def http_get(host, port, path):
+    try:
+        with urllib.request.urlopen("http://%s:%d%s" % (host, port, path), timeout=5) as response:
+            return response.read()
+    except urllib.error.HTTPError as error:  # Rejected commands answer 400
+        return error.read()
+
+
+def api_stats(host, port):
+    return json.loads(http_get(host, port, "/json"))["api"]
+
+
+def simulate(http_port, coap_port, ready):
+    """A unit answering both like the firmware, with moves on /position every 0.5 s."""
+    stats = {"http": {"requests": 0, "time_us": 0}, "coap": {"requests": 0, "time_us": 0}}
+    positions = [0]
+    rejected = b"failed: <param>=velocity not accepted\nuse of these <param>=..."
+
+    class Handler(http.server.BaseHTTPRequestHandler):
+        def do_GET(self):
+            start = time.perf_counter()
+            if self.path == "/json":
+                body, status = json.dumps({"api": stats}).encode(), 200
+            else:
+                body, status = rejected, 400
+            self.send_response(status)
+            self.send_header("Content-Length", str(len(body)))
+            self.end_headers()
+            self.wfile.write(body)
+            if self.path != "/json":
+                stats["http"]["requests"] += 1
+                stats["http"]["time_us"] += int(1e6 * (time.perf_counter() - start))
+
+        def log_message(self, *args):
+            pass
+
+    server = http.server.ThreadingHTTPServer(("127.0.0.1", http_port), Handler)
+    threading.Thread(target=server.serve_forever, daemon=True).start()
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("127.0.0.1", coap_port))
+    observers = {}  # address: token
+    exchanges = {}  # (address, message_id): response
+    sequence = [0]
+    message_id = [random.randrange(0x10000)]
+    ready.release()
+
+    def notify():
+        while True:
+            time.sleep(0.5)
+            positions[0] = (positions[0] + 10) % 110
+            sequence[0] += 1
+            for address, token in list(observers.items()):
+                message_id[0] = (message_id[0] + 1) & 0xFFFF
+                kind = CON if sequence[0] % 4 == 0 else NON
+                sock.sendto(encode(kind, CONTENT, message_id[0], token, [
+                    (OBSERVE, uint(sequence[0])), (CONTENT_FORMAT, b"")], str(positions[0]).encode()),
+                    address)
+
+    threading.Thread(target=notify, daemon=True).start()
+    while True:
+        data, address = sock.recvfrom(2048)
+        start = time.perf_counter()
+        message = decode(data)
+        if not message or message[0] in (ACK, RST):
+            if message and message[0] == RST:
+                observers.pop(address, None)
+            continue
+        kind, code, message_id_in, token, options, _ = message
+        if (address, message_id_in) in exchanges:
+            sock.sendto(exchanges[(address, message_id_in)], address)
+            continue
+        path = "/" + "/".join(v.decode() for v in options.get(URI_PATH, []))
+        observe = None
+        if path == "/position":
+            status, payload = CONTENT, str(positions[0]).encode()
+            values = options.get(OBSERVE)
+            if values and int.from_bytes(values[0], "big") == 0:
+                observers[address] = token
+                observe = uint(sequence[0])
+            elif values:
+                observers.pop(address, None)
+        elif path == "/.well-known/core":
+            status, payload = CONTENT, b"</motor>,</system>,</wireless>,</position>;obs"
+        elif path in ("/motor", "/system", "/wireless"):
+            status, payload = BAD_REQUEST, rejected
+        else:
+            status, payload = NOT_FOUND, b""
+        reply_options = ([] if observe is None else [(OBSERVE, observe)]) + [(CONTENT_FORMAT, b"")]
+        reply = encode(ACK if kind == CON else NON, status, message_id_in, token, reply_options, payload)
+        sock.sendto(reply, address)
+        exchanges[(address, message_id_in)] = reply
+        stats["coap"]["requests"] += 1
+        stats["coap"]["time_us"] += int(1e6 * (time.perf_counter() - start))
+
+
+def measure(name, count, send, host, http_port):
+    before = api_stats(host, http_port)[name]
+    latencies = []
+    for _ in range(count):
+        start = time.perf_counter()
+        send()
+        latencies.append(time.perf_counter() - start)
+    after = api_stats(host, http_port)[name]
+    latencies.sort()
+    requests = after["requests"] - before["requests"]
+    device = (after["time_us"] - before["time_us"]) / max(requests, 1)
+    print("%-5s latency: mean %.2f ms, median %.2f ms, p95 %.2f ms; unit: %.0f us per request" % (
+        name.upper(), 1000 * sum(latencies) / count, 1000 * latencies[count // 2],
+        1000 * latencies[int(count * 0.95)], device))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("host", nargs="?", help="IP address of a unit")
+    parser.add_argument("--sim", action="store_true", help="Measure a simulated unit on this host")
+    parser.add_argument("--count", type=int, default=100, help="Requests over each path")
+    parser.add_argument("--observe", type=float, default=10, help="s to observe /position")
+    args = parser.parse_args()
+    if not args.sim and not args.host:
+        parser.error("a unit's IP address or --sim")
+
+    host, http_port, coap_port = args.host, 80, COAP_PORT
+    if args.sim:
+        host, http_port, coap_port = "127.0.0.1", random.randrange(20000, 30000), random.randrange(30000, 40000)
+        ready = threading.Semaphore(0)
+        threading.Thread(target=simulate, args=(http_port, coap_port, ready), daemon=True).start()
+        ready.acquire()
+
+    client = Client(host, coap_port)
+    code, payload, _ = client.request("/.well-known/core")
+    print("%s resources: %s" % (code_string(code), payload))
+    print("%d x %s" % (args.count, COMMAND))
+    measure("http", args.count, lambda: http_get(host, http_port, COMMAND), host, http_port)
+    measure("coap", args.count, lambda: client.request(COMMAND), host, http_port)
+    print("Observing /position for %g s" % args.observe)
+    count = client.observe("/position", args.observe)
+    print("%d notifications" % count)
+
+
+if __name__ == "__main__":
+    main()
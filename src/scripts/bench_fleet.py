@@ -0,0 +1,142 @@
+"""
+Measures the fan-out latency of fleet commands, the UDP multicast protocol in src/fleet.h.
+
+Sends a request with an ack request to every unit of a group and times the ack of each unit from
+the first send. The request is sent again with the same sequence number until every expected unit
+has acked, units ack a repeat again without executing it. Simulated units run on this host, so the
+protocol and the sender can be measured without hardware, optionally with a processing delay and
+lost datagrams like a busy WiFi network.
+
+    python src/scripts/bench_fleet.py [--sim 30] [--group 0] [--count 20] [--expect 30]
+                                      [--delay 5] [--loss 0.1] ["/motor?percent=0"]
+"""
+import argparse
+import random
+import socket
+import struct
+import threading
+import time
+
+ADDRESS = "239.255.89.1"
+PORT = 4389
+MAGIC = 0x59
+VERSION = 1
+ACK_REQUEST = 0x01
+ACK = 0x02
+FAILED = 0x04
+HEADER = struct.Struct("<BBBBI")  # magic, version, flags, group, sequence
+RESEND = 0.05  # s, until every expected unit acked
+TIMEOUT = 2.0  # s, per request
+
+
+def multicast_socket():
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 1)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_LOOP, 1)
+    return sock
+
+
+def simulate(name, groups, delay, loss, ready):
+    """A unit that acks requests like the firmware, without executing them."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", PORT))
+    membership = struct.pack("4s4s", socket.inet_aton(ADDRESS), socket.inet_aton("0.0.0.0"))
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    ready.release()
+
+    last = {}  # Sequence of the last request of each sender
+    while True:
+        data, sender = sock.recvfrom(1024)
+        if len(data) < HEADER.size or random.random() < loss:
+            continue
+        magic, version, flags, group, sequence = HEADER.unpack_from(data)
+        if magic != MAGIC or version != VERSION or flags & ACK:
+            continue
+        if group != 0 and not groups >> (group - 1) & 1:
+            continue
+        if last.get(sender) != sequence:
+            last[sender] = sequence
+            time.sleep(delay / 1000)  # Dispatching
+        if flags & ACK_REQUEST and random.random() >= loss:
+            ack = HEADER.pack(MAGIC, VERSION, ACK, group, sequence)
+            sock.sendto(ack + ("%s\nsuccess\n" % name).encode(), sender)
+
+
+def send(sock, request, group, sequence, expect):
+    """Returns the latency of the ack of each unit in s, and the ones that failed."""
+    packet = HEADER.pack(MAGIC, VERSION, ACK_REQUEST, group, sequence) + request.encode()
+    acks = {}
+    failed = set()
+    start = time.perf_counter()
+    resend = start
+    while len(acks) < expect and time.perf_counter() - start < TIMEOUT:
+        now = time.perf_counter()
+        if now >= resend:
+            sock.sendto(packet, (ADDRESS, PORT))
+            resend = now + RESEND
+        sock.settimeout(max(resend - time.perf_counter(), 0.001))
+        try:
+            data, _ = sock.recvfrom(1024)
+        except socket.timeout:
+            continue
+        magic, version, flags, _, acked = HEADER.unpack_from(data)
+        if magic != MAGIC or not flags & ACK or acked != sequence:
+            continue
+        name = data[HEADER.size:].split(b"\n", 1)[0].decode()
+        if name not in acks:
+            acks[name] = time.perf_counter() - start
+            if flags & FAILED:
+                failed.add(name)
+    return acks, failed
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("request", nargs="?", default="/motor?percent=0")
+    parser.add_argument("--sim", type=int, default=0, help="simulated units to run")
+    parser.add_argument("--group", type=int, default=0, help="0 for every unit")
+    parser.add_argument("--count", type=int, default=20, help="requests to send")
+    parser.add_argument("--expect", type=int, help="units to wait for, default --sim")
+    parser.add_argument("--delay", type=float, default=0, help="ms, dispatch time of simulated units")
+    parser.add_argument("--loss", type=float, default=0, help="datagrams lost by simulated units")
+    args = parser.parse_args()
+    expect = args.expect if args.expect is not None else args.sim
+    if expect <= 0:
+        parser.error("--expect is needed without --sim")
+
+    ready = threading.Semaphore(0)
+    for i in range(args.sim):
+        groups = 1 << (args.group - 1) if args.group else 0
+        threading.Thread(target=simulate, args=("sim-%d" % i, groups, args.delay, args.loss, ready),
+                         daemon=True).start()
+    for _ in range(args.sim):
+        ready.acquire()
+
+    sock = multicast_socket()
+    sequence = random.getrandbits(32)
+    firsts, lasts, missing, failures = [], [], 0, 0
+    for _ in range(args.count):
+        sequence = (sequence + 1) & 0xFFFFFFFF
+        acks, failed = send(sock, args.request, args.group, sequence, expect)
+        missing += expect - len(acks)
+        failures += len(failed)
+        if acks:
+            firsts.append(min(acks.values()))
+            lasts.append(max(acks.values()))
+        time.sleep(RESEND)
+
+    print("%d x %s to group %d, %d units" % (args.count, args.request, args.group, expect))
+    if lasts:
+        firsts.sort()
+        lasts.sort()
+        print("  first ack: median %.1f ms" % (1000 * firsts[len(firsts) // 2]))
+        print("  last ack: median %.1f ms, max %.1f ms" % (1000 * lasts[len(lasts) // 2],
+                                                        1000 * lasts[-1]))
+    print("  missing acks: %d, failed: %d" % (missing, failures))
+
+
+if __name__ == "__main__":
+    main()
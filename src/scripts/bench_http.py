@@ -0,0 +1,63 @@
+"""
+Measures the time and heap allocations per HTTP command on a unit.
+
+Allocations are read from the per-task counters in /json (build with COMPILEHEAPSTATS=1), the
+allocations of reading /json itself are measured first and subtracted. The command used is
+rejected by the firmware, so it goes through parsing and building the response without moving
+the motor or writing settings. Run it against a build before and after a change to compare.
+
+    python src/scripts/bench_http.py <unit-ip> [count]
+"""
+import json
+import sys
+import time
+import urllib.request
+
+COMMAND = "/motor?velocity=0"
+SERVER_TASK = "async_tcp"
+
+
+def get(host, path):
+    start = time.perf_counter()
+    try:
+        with urllib.request.urlopen("http://%s%s" % (host, path), timeout=5) as response:
+            body = response.read()
+    except urllib.error.HTTPError as error:  # Rejected commands answer 400
+        body = error.read()
+    return body, time.perf_counter() - start
+
+
+def server_allocs(host):
+    body, _ = get(host, "/json")
+    tasks = json.loads(body)["heap"].get("tasks", {})
+    if SERVER_TASK not in tasks:
+        sys.exit("No allocation counters for %s, build with COMPILEHEAPSTATS=1" % SERVER_TASK)
+    return tasks[SERVER_TASK]["allocs"]
+
+
+def main():
+    host = sys.argv[1]
+    count = int(sys.argv[2]) if len(sys.argv) > 2 else 100
+
+    # Allocations of one /json read, which brackets the measurement
+    first = server_allocs(host)
+    json_allocs = server_allocs(host) - first
+
+    before = server_allocs(host)
+    latencies = []
+    for _ in range(count):
+        _, latency = get(host, COMMAND)
+        latencies.append(latency)
+    after = server_allocs(host)
+
+    latencies.sort()
+    allocs = (after - before - json_allocs) / count
+    print("%d x %s" % (count, COMMAND))
+    print("  allocations: %.1f per command" % allocs)
+    print("  latency: mean %.1f ms, median %.1f ms, p95 %.1f ms" % (
+        1000 * sum(latencies) / count, 1000 * latencies[count // 2],
+        1000 * latencies[int(count * 0.95)]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,671 @@
+"""
+Manages a fleet of units from one computer: finds them, reads their state, pushes settings and
+firmware to all of them at once.
+
+Units are found with one mDNS query for the _ald._tcp service, whose TXT records carry the name,
+firmware, positions and settings version of each unit, or given with --hosts. The other commands
+run on every unit concurrently, at most --parallel at a time, retrying failed attempts --retries
+times with a growing delay, and report the time and attempts each unit took:
+  - discover: lists the units from their TXT records, without connecting to them.
+  - status: reads /json of each unit.
+  - config: sends requests like HTTP's to each unit in order, e.g. "/motor?velocity=12"; a
+    rejected request isn't retried. Values are URL encoded, so they are written as they are.
+  - ota: uploads a firmware image with the ArduinoOTA protocol (build with COMPILEOTA=1) and
+    waits for each unit to come back.
+With --sim, simulated units on 127.0.0.2 and up answer mDNS, HTTP and OTA like the firmware,
+dropping a share of the requests with --sim-loss, so the tool can be tried without hardware.
+
+    python src/scripts/fleet_manage.py discover
+    python src/scripts/fleet_manage.py [--match kitchen] status [--json]
+    python src/scripts/fleet_manage.py config "/wireless?timezone=CET-1CEST,M3.5.0,M10.5.0/3" ...
+    python src/scripts/fleet_manage.py [--parallel 2] ota .pio/build/esp32dev/firmware.bin
+    python src/scripts/fleet_manage.py --sim 20 --sim-loss 0.1 ota firmware.bin
+"""
+import argparse
+import concurrent.futures
+import hashlib
+import http.server
+import json
+import random
+import socket
+import struct
+import sys
+import threading
+import time
+import urllib.error
+import urllib.parse
+import urllib.request
+import zlib
+
+SERVICE = "_ald._tcp.local"
+MDNS_ADDRESS = ("224.0.0.251", 5353)
+PTR, TXT, A, SRV = 12, 16, 1, 33
+OTA_PORT = 3232
+OTA_FLASH = 0
+OTA_AUTH = 200
+OTA_CHUNK = 1024  # Bytes, acked one by one
+HTTP_PORT = 80
+SIM_HTTP_PORT = 8080  # Simulated units don't need to run as root
+
+
+# mDNS, one-shot queries from a port other than 5353 get unicast answers (RFC 6762 6.7)
+
+def encode_name(name):
+    return b"".join(bytes([len(label)]) + label.encode() for label in name.split(".")) + b"\0"
+
+
+def decode_name(data, at):
+    """(name, offset after it), following compression pointers."""
+    labels, end = [], None
+    for _ in range(128):  # Bounds pointer loops
+        length = data[at]
+        if length & 0xC0 == 0xC0:
+            if end is None:
+                end = at + 2
+            at = (length & 0x3F) << 8 | data[at + 1]
+        elif length == 0:
+            return ".".join(labels), end if end is not None else at + 1
+        else:
+            labels.append(data[at + 1:at + 1 + length].decode(errors="replace"))
+            at += 1 + length
+    raise ValueError("name loop")
+
+
+def encode_query(questions, message_id=0):
+    data = struct.pack(">HHHHHH", message_id, 0, len(questions), 0, 0, 0)
+    for name, kind in questions:
+        data += encode_name(name) + struct.pack(">HH", kind, 1)
+    return data
+
+
+def decode_records(data):
+    """Records of the answer, authority and additional sections: (name, type, value)."""
+    _, flags, questions, *counts = struct.unpack_from(">HHHHHH", data)
+    at = 12
+    for _ in range(questions):
+        _, at = decode_name(data, at)
+        at += 4
+    records = []
+    for _ in range(sum(counts)):
+        name, at = decode_name(data, at)
+        kind, _, _, length = struct.unpack_from(">HHIH", data, at)
+        at += 10
+        value = data[at:at + length]
+        if kind == PTR:
+            value = decode_name(data, at)[0]
+        elif kind == SRV:
+            value = (struct.unpack_from(">H", data, at + 4)[0], decode_name(data, at + 6)[0])
+        elif kind == A:
+            if len(value) != 4:
+                at += length
+                continue  # Malformed or truncated
+            value = socket.inet_ntoa(value)
+        elif kind == TXT:
+            strings, i = {}, 0
+            while i < len(value):
+                text = value[i + 1:i + 1 + value[i]].decode(errors="replace")
+                key, _, item = text.partition("=")
+                if key:
+                    strings[key] = item
+                i += 1 + value[i]
+            value = strings
+        records.append((name, kind, value))
+        at += length
+    return records
+
+
+def encode_record(name, kind, value, ttl=120):
+    if kind == PTR:
+        rdata = encode_name(value)
+    elif kind == SRV:
+        rdata = struct.pack(">HHH", 0, 0, value[0]) + encode_name(value[1])
+    elif kind == A:
+        rdata = socket.inet_aton(value)
+    else:
+        items = [("%s=%s" % item).encode()[:255] for item in value.items()]
+        rdata = b"".join(bytes([len(item)]) + item for item in items)
+    cache_flush = 0x8000 if kind != PTR else 0
+    return encode_name(name) + struct.pack(">HHIH", kind, 1 | cache_flush, ttl, len(rdata)) + rdata
+
+
+class Unit:
+    def __init__(self, address, port=HTTP_PORT, instance="", txt=None):
+        self.address = address
+        self.port = port
+        self.instance = instance or address  # The hostname, the mDNS instance name
+        self.txt = txt or {}
+
+    @property
+    def name(self):
+        return self.txt.get("name") or self.instance
+
+    def url(self, path):
+        return "http://%s:%d%s" % (self.address, self.port, path)
+
+
+def discover(timeout, interface=None):
+    """Units answering a query for the service within the timeout, asking again for missing records."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_TTL, 255)
+    if interface:
+        sock.setsockopt(socket.IPPROTO_IP, socket.IP_MULTICAST_IF, socket.inet_aton(interface))
+    sock.bind((interface or "", 0))
+    instances, services, texts, addresses = set(), {}, {}, {}
+
+    def collect(questions, seconds):
+        for resend in range(3):
+            sock.sendto(encode_query(questions), MDNS_ADDRESS)
+            end = time.monotonic() + seconds / 3
+            while time.monotonic() < end:
+                sock.settimeout(max(end - time.monotonic(), 0.001))
+                try:
+                    data, _ = sock.recvfrom(9000)
+                    records = decode_records(data)
+                except socket.timeout:
+                    break
+                except (ValueError, IndexError, struct.error):
+                    continue  # Not for us, or malformed
+                for name, kind, value in records:
+                    if kind == PTR and name.lower() == SERVICE.lower():
+                        instances.add(value)
+                    elif kind == SRV:
+                        services[name] = value
+                    elif kind == TXT:
+                        texts[name] = value
+                    elif kind == A:
+                        addresses[name.lower()] = value
+
+    collect([(SERVICE, PTR)], timeout)
+    missing = [(instance, kind) for instance in instances for kind, known in ((SRV, services),
+               (TXT, texts)) if instance not in known]
+    if missing:
+        collect(missing, timeout / 2)
+    missing = [(services[instance][1], A) for instance in instances if instance in services
+               and services[instance][1].lower() not in addresses]
+    if missing:
+        collect(missing, timeout / 2)
+
+    units = []
+    for instance in instances:
+        if instance in services and services[instance][1].lower() in addresses:
+            port, target = services[instance]
+            units.append(Unit(addresses[target.lower()], port, instance.split(".")[0],
+                              texts.get(instance, {})))
+    return sorted(units, key=lambda unit: socket.inet_aton(unit.address))
+
+
+# Running a command on every unit
+
+class Result:
+    def __init__(self, unit):
+        self.unit = unit
+        self.ok = False
+        self.attempts = 0
+        self.seconds = 0.0
+        self.detail = ""
+        self.data = None
+
+
+def run_all(units, action, parallel, retries):
+    """Runs action(unit, result) for each unit, at most parallel at a time; an attempt that raises
+    OSError or TimeoutError is retried after 0.5 s, 1 s, 2 s... Results are in the order of units."""
+    def attempt(unit):
+        result = Result(unit)
+        start = time.monotonic()
+        for tries in range(retries + 1):
+            result.attempts = tries + 1
+            try:
+                action(unit, result)
+                break
+            except (OSError, TimeoutError, ValueError) as error:
+                result.ok = False
+                result.detail = str(error) or error.__class__.__name__
+                if tries < retries:
+                    time.sleep(0.5 * 2 ** tries)
+        result.seconds = time.monotonic() - start
+        return result
+
+    with concurrent.futures.ThreadPoolExecutor(max_workers=parallel) as pool:
+        return list(pool.map(attempt, units))
+
+
+def report(results, columns):
+    width = max([len(result.unit.name) for result in results] + [4])
+    for result in results:
+        fields = " ".join(column(result) for column in columns) if result.ok else ""
+        print("%-*s %-15s %-6s %2d %7.2fs  %s%s" % (
+            width, result.unit.name, result.unit.address, "ok" if result.ok else "FAILED",
+            result.attempts, result.seconds, fields, "" if result.ok else result.detail))
+    failed = sum(not result.ok for result in results)
+    if results:
+        times = sorted(result.seconds for result in results)
+        print("%d units, %d failed; per unit: median %.2f s, max %.2f s" % (
+            len(results), failed, times[len(times) // 2], times[-1]))
+    return failed
+
+
+def http_get(unit, path, timeout):
+    """(status, body), raising OSError when the unit doesn't answer."""
+    try:
+        with urllib.request.urlopen(unit.url(path), timeout=timeout) as response:
+            return response.status, response.read().decode(errors="replace")
+    except urllib.error.HTTPError as error:  # Rejected requests answer 400
+        return error.code, error.read().decode(errors="replace")
+
+
+def encode_request(request):
+    """"/path?name=value&..." with URL encoded values, as the unit's web server decodes them."""
+    path, _, query = request.partition("?")
+    pairs = [pair.partition("=") for pair in query.split("&") if pair]
+    return path + ("?" if pairs else "") + "&".join(
+        urllib.parse.quote(name, safe="") + (separator + urllib.parse.quote(value, safe=""))
+        for name, separator, value in pairs)
+
+
+def positions(state):
+    if "motors" in state:
+        return ",".join(str(motor["position"]) for motor in state["motors"])
+    return str(state.get("motor_position", ""))
+
+
+def command_status(units, args):
+    def status(unit, result):
+        code, body = http_get(unit, "/json", args.timeout)
+        if code != 200:
+            raise OSError("HTTP %d" % code)
+        result.data = json.loads(body)
+        result.ok = True
+
+    results = run_all(units, status, args.parallel, args.retries)
+    if args.json:
+        print(json.dumps({result.unit.name: result.data for result in results}, indent=2))
+        return sum(not result.ok for result in results)
+    return report(results, [
+        lambda result: "fw %s" % result.data["system"].get("firmware_", "?"),
+        lambda result: "pos %s" % positions(result.data),
+        lambda result: "heap %s" % result.data.get("heap", {}).get("free", "?"),
+        lambda result: "synced" if result.data.get("clock", {}).get("synced") else "unsynced"])
+
+
+def command_config(units, args):
+    requests = [encode_request(request) for request in args.requests]
+
+    def config(unit, result):
+        # Requests done in an earlier attempt aren't sent again
+        done = result.data or 0
+        for request in requests[done:]:
+            code, body = http_get(unit, request, args.timeout)
+            if code != 200:
+                result.detail = "%s: %s" % (request, body.strip().split("\n")[0])
+                return  # Rejected, retrying won't help
+            done += 1
+            result.data = done
+        result.ok = True
+
+    results = run_all(units, config, args.parallel, args.retries)
+    return report(results, [lambda result: "%d requests" % len(requests)])
+
+
+def ota_upload(unit, image, password, timeout):
+    """Pushes an image like espota.py: an invitation over UDP, then the unit connects back over
+    TCP and acks every chunk."""
+    md5 = hashlib.md5(image).hexdigest()
+    server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+    server.bind(("", 0))
+    server.listen(1)
+    server.settimeout(timeout)
+    invitation = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    invitation.settimeout(timeout)
+    try:
+        target = (unit.address, OTA_PORT)
+        invitation.sendto(("%d %d %d %s\n" % (OTA_FLASH, server.getsockname()[1], len(image), md5))
+                          .encode(), target)
+        answer = invitation.recv(64).decode(errors="replace")
+        if answer.startswith("AUTH"):
+            if not password:
+                raise ValueError("the unit needs an OTA password")
+            nonce = answer.split()[1]
+            cnonce = hashlib.md5(("%s%d%s" % (unit.address, len(image), md5)).encode()).hexdigest()
+            hashed = hashlib.md5(password.encode()).hexdigest()
+            proof = hashlib.md5(("%s:%s:%s" % (hashed, nonce, cnonce)).encode()).hexdigest()
+            invitation.sendto(("%d %s %s\n" % (OTA_AUTH, cnonce, proof)).encode(), target)
+            answer = invitation.recv(64).decode(errors="replace")
+        if answer.strip() != "OK":
+            raise OSError("invitation refused: %s" % answer.strip())
+
+        connection, _ = server.accept()
+        with connection:
+            connection.settimeout(timeout)
+            acked = ""
+            for offset in range(0, len(image), OTA_CHUNK):
+                connection.sendall(image[offset:offset + OTA_CHUNK])
+                acked = connection.recv(32).decode(errors="replace")
+            # The unit checks the image before its final OK
+            connection.settimeout(max(timeout, 30))
+            while "OK" not in acked:
+                data = connection.recv(32).decode(errors="replace")
+                if not data:
+                    raise OSError("connection closed before the image was accepted")
+                acked += data
+    finally:
+        server.close()
+        invitation.close()
+
+
+def command_ota(units, args):
+    with open(args.image, "rb") as file:
+        image = file.read()
+
+    def ota(unit, result):
+        start = time.monotonic()
+        ota_upload(unit, image, args.password, args.timeout)
+        result.detail = "%.0f kB/s" % (len(image) / 1024 / max(time.monotonic() - start, 1e-6))
+        if args.no_wait:
+            result.ok = True
+            return
+        # Back when it answers HTTP again, after restarting with the new image
+        uploaded = time.monotonic()
+        time.sleep(1)
+        while time.monotonic() - uploaded < args.boot_timeout:
+            try:
+                code, body = http_get(unit, "/json", args.timeout)
+                if code == 200:
+                    firmware = json.loads(body)["system"].get("firmware_", "?")
+                    result.detail += ", back after %.1f s, fw %s" % (time.monotonic() - uploaded, firmware)
+                    result.ok = True
+                    return
+            except (OSError, ValueError):
+                pass
+            time.sleep(1)
+        # Not retried, uploading again won't bring it back
+        result.detail += ", not back after %d s" % args.boot_timeout
+
+    results = run_all(units, ota, args.parallel, args.retries)
+    return report(results, [lambda result: result.detail])
+
+
+def command_discover(units, args):
+    width = max([len(unit.name) for unit in units] + [4])
+    for unit in units:
+        print("%-*s %-15s %-20s fw %-10s pos %-8s cfg %s" % (
+            width, unit.name, unit.address, unit.instance, unit.txt.get("fw", "?"),
+            unit.txt.get("pos", "?"), unit.txt.get("cfg", "?")))
+    versions = {unit.txt.get("cfg") for unit in units}
+    print("%d units, %d settings versions" % (len(units), len(versions)))
+    return 0
+
+
+# Simulated units
+
+class SimUnit:
+    def __init__(self, index, loss):
+        self.address = "127.0.0.%d" % (index + 2)
+        self.instance = "esp32-yun-sim%02d" % index
+        self.loss = loss
+        self.online = True
+        self.lock = threading.Lock()
+        serial = "5100000000%02x" % index
+        # The keys of the firmware, including those that differ between units set up the same way
+        self.settings = {
+            "system": {"system_name_": "Sim %d" % index, "serial_": serial, "firmware_": "sim-1",
+                       "log_system_": 1, "log_wireless_": 1},
+            "wireless": {"ap_ssid_": "yun-" + serial[6:], "setup_mode_": False,
+                         "attempts_": random.randrange(1, 4), "sta_ssid_": "home",
+                         "sta_password_": "secret%d" % index, "timezone_": "UTC0",
+                         "fleet_groups_": 0, "mqtt_server_": "sim%d:pass@broker" % index},
+            "motors": [{"open_velocity_": 10, "open_accel_": 10}]}
+        self.position = random.randrange(0, 101)
+
+    def settings_version(self):
+        """Like WirelessTask::getSettingsVersion(), lock held."""
+        system = dict(self.settings["system"])
+        for name in ("system_name_", "serial_", "firmware_"):
+            del system[name]
+        wireless = dict(self.settings["wireless"])
+        for name in ("ap_ssid_", "setup_mode_", "attempts_", "sta_password_"):
+            del wireless[name]
+        wireless["mqtt_server_"] = wireless["mqtt_server_"].rpartition("@")[2]
+        setup = {"system": system, "wireless": wireless, "motors": self.settings["motors"]}
+        return zlib.crc32(json.dumps(setup, separators=(",", ":")).encode())
+
+    def txt(self):
+        with self.lock:
+            cfg = self.settings_version()
+            return {"name": self.settings["system"]["system_name_"],
+                    "serial": self.settings["system"]["serial_"],
+                    "fw": self.settings["system"]["firmware_"], "pos": str(self.position),
+                    "cfg": "%08x" % cfg}
+
+    def request(self, path, query):
+        """(status, body) of an HTTP request, like WirelessTask::dispatch()."""
+        section = {"/motor": "motor", "/system": "system", "/wireless": "wireless"}.get(path)
+        if section is None:
+            return 404, "Not found"
+        params = urllib.parse.parse_qsl(query, keep_blank_values=True)
+        with self.lock:
+            for name, value in params:
+                if name not in KNOWN_PARAMS[section]:
+                    return 400, "failed: <param>=%s not accepted\nuse of these <param>=..." % name
+            for name, value in params:
+                if name == "percent":
+                    self.position = int(value)
+                elif name == "name":
+                    self.settings["system"]["system_name_"] = value
+                elif section == "motor":
+                    self.settings["motors"][0][SETTING_NAMES.get(name, name)] = value
+                else:
+                    self.settings[section][SETTING_NAMES.get(name, name)] = value
+        return 200, "".join("success: %s\n" % name for name, _ in params)
+
+    def state(self):
+        with self.lock:
+            return {"motor_position": self.position, "system": dict(self.settings["system"]),
+                    "heap": {"free": random.randrange(150000, 160000)},
+                    "clock": {"synced": True}}
+
+    def serve_http(self):
+        unit = self
+
+        class Handler(http.server.BaseHTTPRequestHandler):
+            def do_GET(self):
+                if not unit.online or random.random() < unit.loss:
+                    self.close_connection = True  # Dropped, like a unit out of reach
+                    return
+                time.sleep(random.uniform(0.005, 0.03))
+                path, _, query = self.path.partition("?")
+                if path == "/json":
+                    code, body, kind = 200, json.dumps(unit.state()), "application/json"
+                else:
+                    code, body = unit.request(path, query)
+                    kind = "text/plain"
+                data = body.encode()
+                self.send_response(code)
+                self.send_header("Content-Type", kind)
+                self.send_header("Content-Length", str(len(data)))
+                self.end_headers()
+                self.wfile.write(data)
+
+            def log_message(self, *args):
+                pass
+
+        server = http.server.ThreadingHTTPServer((self.address, SIM_HTTP_PORT), Handler)
+        server.daemon_threads = True
+        server.serve_forever()
+
+    def serve_ota(self):
+        """ArduinoOTA: an invitation, then a connection back to the sender, acking each chunk."""
+        sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        sock.bind((self.address, OTA_PORT))
+        while True:
+            data, sender = sock.recvfrom(128)
+            if not self.online or random.random() < self.loss:
+                continue
+            try:
+                command, port, size, md5 = data.decode().split()
+                port, size = int(port), int(size)
+            except ValueError:
+                continue
+            sock.sendto(b"OK", sender)
+            try:
+                connection = socket.create_connection((sender[0], port), timeout=5)
+            except OSError:
+                continue
+            # Some transfers break off in the middle, like on a WiFi hiccup
+            drop_at = random.randrange(size) if random.random() < self.loss else size + 1
+            with connection:
+                received, digest = 0, hashlib.md5()
+                try:
+                    while received < size:
+                        chunk = connection.recv(OTA_CHUNK)
+                        if not chunk:
+                            break
+                        received += len(chunk)
+                        digest.update(chunk)
+                        connection.sendall(str(len(chunk)).encode())
+                        if received >= drop_at:
+                            raise OSError("dropped")
+                    if received != size or digest.hexdigest() != md5:
+                        continue
+                    time.sleep(0.05)
+                    connection.sendall(b"OK")
+                except OSError:
+                    continue
+            # Restart with the new image
+            with self.lock:
+                self.settings["system"]["firmware_"] = "sim-" + md5[:7]
+            self.online = False
+            time.sleep(random.uniform(1.0, 2.0))
+            self.online = True
+
+    def start(self):
+        for target in (self.serve_http, self.serve_ota):
+            threading.Thread(target=target, daemon=True).start()
+
+
+# Params stored under other names, the rest are stored as they are
+SETTING_NAMES = {"groups": "fleet_groups_", "ntp": "ntp_host_", "timezone": "timezone_",
+                 "location": "location_", "mqtt": "mqtt_server_", "syslog": "syslog_host_",
+                 "velocity": "open_velocity_", "acceleration": "open_accel_"}
+
+# The params the simulated units accept, a subset of the names in hash() of src/command.cpp
+KNOWN_PARAMS = {
+    "motor": {"stop", "percent", "step", "forward", "backward", "velocity", "opening-velocity",
+              "closing-velocity", "acceleration", "current", "direction", "microsteps",
+              "stallguard", "stallguard-threshold", "motor", "start", "duration", "at"},
+    "system": {"sleep", "restart", "name", "log-system", "log-motor", "log-wireless", "log-led"},
+    "wireless": {"groups", "ntp", "timezone", "location", "mqtt", "syslog"}}
+
+
+def serve_mdns(sims, ready):
+    """One responder for all simulated units, answering queries sent to the group on loopback."""
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM, socket.IPPROTO_UDP)
+    sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+    if hasattr(socket, "SO_REUSEPORT"):
+        sock.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEPORT, 1)
+    sock.bind(("", MDNS_ADDRESS[1]))
+    membership = socket.inet_aton(MDNS_ADDRESS[0]) + socket.inet_aton("127.0.0.1")
+    sock.setsockopt(socket.IPPROTO_IP, socket.IP_ADD_MEMBERSHIP, membership)
+    ready.release()
+    while True:
+        data, sender = sock.recvfrom(9000)
+        try:
+            message_id, flags, count = struct.unpack_from(">HHH", data)
+            at, questions = 12, []
+            for _ in range(count):
+                name, at = decode_name(data, at)
+                kind = struct.unpack_from(">H", data, at)[0]
+                questions.append((name.lower(), kind))
+                at += 4
+        except (ValueError, IndexError, struct.error):
+            continue
+        if flags & 0x8000:
+            continue  # An answer
+        answers, additionals = [], []
+        for sim in sims:
+            if not sim.online:
+                continue
+            instance = "%s.%s" % (sim.instance, SERVICE)
+            host = "%s.local" % sim.instance
+            records = {SRV: (instance, SRV, (SIM_HTTP_PORT, host)), TXT: (instance, TXT, sim.txt()),
+                       A: (host, A, sim.address)}
+            for name, kind in questions:
+                if name == SERVICE.lower() and kind == PTR:
+                    answers.append((SERVICE, PTR, instance))
+                    additionals += records.values()
+                elif name == instance.lower() and kind in (SRV, TXT):
+                    answers.append(records[kind])
+                elif name == host.lower() and kind == A:
+                    answers.append(records[A])
+        if not answers:
+            continue
+        # Legacy unicast answers repeat the question and go back to the sender
+        reply = struct.pack(">HHHHHH", message_id, 0x8400, count, len(answers), 0, len(additionals))
+        reply += data[12:at]
+        reply += b"".join(encode_record(*record, ttl=10) for record in answers + additionals)
+        sock.sendto(reply, sender)
+
+
+def start_sims(count, loss):
+    sims = [SimUnit(i, loss) for i in range(count)]
+    for sim in sims:
+        sim.start()
+    ready = threading.Semaphore(0)
+    threading.Thread(target=serve_mdns, args=(sims, ready), daemon=True).start()
+    ready.acquire()
+    time.sleep(0.2)  # For the servers to bind
+    return sims
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--hosts", help="Comma separated ip[:port] of units, instead of discovering")
+    parser.add_argument("--match", help="Only units whose name or hostname contains this")
+    parser.add_argument("--parallel", type=int, default=4, help="Units handled at a time")
+    parser.add_argument("--retries", type=int, default=2, help="Attempts after the first")
+    parser.add_argument("--timeout", type=float, default=5, help="s, per network operation")
+    parser.add_argument("--discover-time", type=float, default=1.5, help="s, to wait for answers")
+    parser.add_argument("--interface", help="IP address of the interface to discover on")
+    parser.add_argument("--sim", type=int, default=0, help="Run against simulated units")
+    parser.add_argument("--sim-loss", type=float, default=0, help="Share of requests dropped")
+    commands = parser.add_subparsers(dest="command", required=True)
+    commands.add_parser("discover", help="List the units from their mDNS records")
+    status = commands.add_parser("status", help="Read the state of the units")
+    status.add_argument("--json", action="store_true", help="Print /json of every unit")
+    config = commands.add_parser("config", help="Send requests to the units")
+    config.add_argument("requests", nargs="+", help='e.g. "/motor?velocity=12"')
+    ota = commands.add_parser("ota", help="Upload a firmware image to the units")
+    ota.add_argument("image")
+    ota.add_argument("--password", help="OTA password, if the firmware sets one")
+    ota.add_argument("--no-wait", action="store_true", help="Don't wait for the units to restart")
+    ota.add_argument("--boot-timeout", type=int, default=60, help="s, for a unit to come back")
+    args = parser.parse_args()
+
+    interface = args.interface
+    if args.sim:
+        start_sims(args.sim, args.sim_loss)
+        interface = "127.0.0.1"
+
+    start = time.monotonic()
+    if args.hosts:
+        units = []
+        for host in args.hosts.split(","):
+            address, _, port = host.strip().partition(":")
+            units.append(Unit(address, int(port) if port else HTTP_PORT))
+    else:
+        units = discover(args.discover_time, interface)
+        print("Discovered %d units in %.2f s" % (len(units), time.monotonic() - start))
+    if args.match:
+        units = [unit for unit in units if args.match.lower() in unit.name.lower()
+                 or args.match.lower() in unit.instance.lower()]
+    if not units:
+        sys.exit("No units")
+
+    handlers = {"discover": command_discover, "status": command_status, "config": command_config,
+                "ota": command_ota}
+    failed = handlers[args.command](units, args)
+    print("Done in %.2f s" % (time.monotonic() - start))
+    sys.exit(1 if failed else 0)
+
+
+if __name__ == "__main__":
+    main()
@@ -1,6 +1,12 @@
+Import("env")
+
+# The library is installed per environment, one for each board revision
+LIBRARY = "./.pio/libdeps/%s/FastAccelStepper/src/" % env["PIOENV"]
+
+
 def modify_fastaccelstepper_h():
     result = ""
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/FastAccelStepper.h", 'r') as file:
+    with open(LIBRARY + "FastAccelStepper.h", 'r') as file:
         for line in file:
             if line == "#include <stdint.h>\n":
                 result += line
@@ -12,13 +18,13 @@ def modify_fastaccelstepper_h():
             else:
                 result += line
 
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/FastAccelStepper.h", 'w') as output:
+    with open(LIBRARY + "FastAccelStepper.h", 'w') as output:
         output.write(result)
 
 
 def modify_fastaccelstepper_cpp():
     result = ""
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/FastAccelStepper.cpp", 'r') as file:
+    with open(LIBRARY + "FastAccelStepper.cpp", 'r') as file:
         for line in file:
             if line == "void FastAccelStepper::setExternalEnableCall(bool (*func)(uint8_t enablePin,\n":
                 result += "void FastAccelStepper::setExternalEnableCall(std::function<bool(uint8_t, uint8_t)> func) {\n"
@@ -27,20 +33,20 @@ def modify_fastaccelstepper_cpp():
             else:
                 result += line
 
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/FastAccelStepper.cpp", 'w') as output:
+    with open(LIBRARY + "FastAccelStepper.cpp", 'w') as output:
         output.write(result)
 
 
 def modify_stpperisr_esp32_cpp():
     result = ""
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/StepperISR_esp32.cpp", 'r') as file:
+    with open(LIBRARY + "StepperISR_esp32.cpp", 'r') as file:
         for line in file:
             if line == "#define STACK_SIZE 1000\n":
                 result += "#define STACK_SIZE 2000\n"
             else:
                 result += line
 
-    with open("./.pio/libdeps/esp32dev/FastAccelStepper/src/StepperISR_esp32.cpp", 'w') as output:
+    with open(LIBRARY + "StepperISR_esp32.cpp", 'w') as output:
         output.write(result)
 
 
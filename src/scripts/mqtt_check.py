@@ -0,0 +1,391 @@
+"""
+Checks the MQTT interface of units, see src/mqtt.h: Home Assistant discovery, availability,
+position and state updates, and commands.
+
+Finds the units by their retained discovery configs on the broker, then moves each one to a
+position and back through its set_position topic, timing the state changes and counting the
+positions published while moving. With --standin, a minimal broker (QoS 0/1, retained messages and
+last wills) runs on this host, and --sim adds a simulated unit that publishes like the firmware, so
+the script can be run without a broker or hardware.
+
+    python src/scripts/mqtt_check.py [--broker localhost:1883] [--standin] [--sim]
+                                     [--user name --password secret] [--position 50]
+"""
+import argparse
+import json
+import socket
+import struct
+import threading
+import time
+
+CONNECT, CONNACK, PUBLISH, PUBACK, SUBSCRIBE, SUBACK = 1, 2, 3, 4, 8, 9
+PINGREQ, PINGRESP, DISCONNECT = 12, 13, 14
+DISCOVERY = "homeassistant/cover/+/config"
+MOVING_PERIOD = 1.0  # s, between positions published while moving, MQTT_MOVING_PERIOD
+TIMEOUT = 30  # s, for a move
+
+
+def encode_string(text):
+    data = text.encode() if isinstance(text, str) else text
+    return struct.pack(">H", len(data)) + data
+
+
+def packet(kind, flags, body):
+    length = len(body)
+    header = bytearray([kind << 4 | flags])
+    while True:
+        byte = length & 0x7F
+        length >>= 7
+        header.append(byte | (0x80 if length else 0))
+        if not length:
+            return bytes(header) + body
+
+
+def read_packet(sock):
+    """Returns the type, flags and body of the next packet, None once closed."""
+    first = sock.recv(1)
+    if not first:
+        return None
+    length, shift = 0, 0
+    while True:
+        byte = sock.recv(1)
+        if not byte:
+            return None
+        length |= (byte[0] & 0x7F) << shift
+        shift += 7
+        if not byte[0] & 0x80:
+            break
+    body = b""
+    while len(body) < length:
+        chunk = sock.recv(length - len(body))
+        if not chunk:
+            return None
+        body += chunk
+    return first[0] >> 4, first[0] & 0x0F, body
+
+
+def parse_publish(flags, body):
+    length = struct.unpack_from(">H", body)[0]
+    topic = body[2:2 + length].decode()
+    offset = 2 + length
+    packet_id = None
+    if flags >> 1 & 3:
+        packet_id = struct.unpack_from(">H", body, offset)[0]
+        offset += 2
+    return topic, body[offset:], flags >> 1 & 3, bool(flags & 1), packet_id
+
+
+def matches(pattern, topic):
+    parts, levels = pattern.split("/"), topic.split("/")
+    for i, part in enumerate(parts):
+        if part == "#":
+            return True
+        if i >= len(levels) or (part != "+" and part != levels[i]):
+            return False
+    return len(parts) == len(levels)
+
+
+class Broker:
+    """A minimal MQTT 3.1.1 broker: QoS 0 and 1, retained messages and last wills."""
+
+    def __init__(self, port):
+        self.lock = threading.Lock()
+        self.retained = {}
+        self.sessions = []  # [socket, subscriptions]
+        self.server = socket.socket(socket.AF_INET, socket.SOCK_STREAM)
+        self.server.setsockopt(socket.SOL_SOCKET, socket.SO_REUSEADDR, 1)
+        self.server.bind(("", port))
+        self.server.listen(16)
+        threading.Thread(target=self.accept, daemon=True).start()
+
+    def accept(self):
+        while True:
+            sock, _ = self.server.accept()
+            threading.Thread(target=self.serve, args=(sock,), daemon=True).start()
+
+    def route(self, topic, payload, qos, retain):
+        with self.lock:
+            if retain:
+                if payload:
+                    self.retained[topic] = (payload, qos)
+                else:
+                    self.retained.pop(topic, None)
+            targets = [(sock, min(qos, sub_qos)) for sock, subscriptions in self.sessions
+                       for pattern, sub_qos in subscriptions.items() if matches(pattern, topic)]
+        for sock, out_qos in targets:
+            self.send(sock, topic, payload, out_qos, False)
+
+    def send(self, sock, topic, payload, qos, retain):
+        body = encode_string(topic) + (struct.pack(">H", 1) if qos else b"") + payload
+        try:
+            sock.sendall(packet(PUBLISH, qos << 1 | retain, body))
+        except OSError:
+            pass
+
+    def serve(self, sock):
+        subscriptions = {}
+        will = None
+        session = [sock, subscriptions]
+        clean = False
+        try:
+            kind, _, body = read_packet(sock)
+            if kind != CONNECT:
+                return
+            offset = 2 + struct.unpack_from(">H", body)[0]
+            connect_flags = body[offset + 1]
+            offset += 4
+            fields = []
+            while offset < len(body):
+                length = struct.unpack_from(">H", body, offset)[0]
+                fields.append(body[offset + 2:offset + 2 + length])
+                offset += 2 + length
+            if connect_flags & 0x04:
+                will = (fields[1].decode(), fields[2], connect_flags >> 3 & 3, bool(connect_flags & 0x20))
+            sock.sendall(packet(CONNACK, 0, b"\x00\x00"))
+            with self.lock:
+                self.sessions.append(session)
+            while True:
+                received = read_packet(sock)
+                if received is None:
+                    break
+                kind, flags, body = received
+                if kind == PUBLISH:
+                    topic, payload, qos, retain, packet_id = parse_publish(flags, body)
+                    if qos:
+                        sock.sendall(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+                    self.route(topic, payload, qos, retain)
+                elif kind == SUBSCRIBE:
+                    packet_id = body[:2]
+                    offset, codes, patterns = 2, b"", []
+                    while offset < len(body):
+                        length = struct.unpack_from(">H", body, offset)[0]
+                        pattern = body[offset + 2:offset + 2 + length].decode()
+                        qos = min(body[offset + 2 + length], 1)
+                        offset += 3 + length
+                        with self.lock:
+                            subscriptions[pattern] = qos
+                        codes += bytes([qos])
+                        patterns.append(pattern)
+                    sock.sendall(packet(SUBACK, 0, packet_id + codes))
+                    with self.lock:
+                        retained = [(topic, payload, qos) for topic, (payload, qos) in self.retained.items()
+                                    if any(matches(pattern, topic) for pattern in patterns)]
+                    for topic, payload, qos in retained:
+                        self.send(sock, topic, payload, min(qos, 1), True)
+                elif kind == PINGREQ:
+                    sock.sendall(packet(PINGRESP, 0, b""))
+                elif kind == DISCONNECT:
+                    clean = True
+                    break
+        except (OSError, TypeError):
+            pass
+        finally:
+            with self.lock:
+                if session in self.sessions:
+                    self.sessions.remove(session)
+            sock.close()
+            if will and not clean:
+                self.route(*will)
+
+
+class Client:
+    """A minimal MQTT 3.1.1 client, calls on_message(topic, payload, retain) from its thread."""
+
+    def __init__(self, broker, client_id, on_message, will=None, user=None, password=None):
+        host, _, port = broker.partition(":")
+        self.sock = socket.create_connection((host, int(port or 1883)))
+        self.on_message = on_message
+        self.packet_id = 0
+        self.lock = threading.Lock()
+        flags = 0x02
+        payload = encode_string(client_id)
+        if will:
+            flags |= 0x04 | will[2] << 3 | (0x20 if will[3] else 0)
+            payload += encode_string(will[0]) + encode_string(will[1])
+        if user:
+            flags |= 0x80
+            payload += encode_string(user)
+        if password:
+            flags |= 0x40
+            payload += encode_string(password)
+        body = encode_string("MQTT") + bytes([4, flags]) + struct.pack(">H", 60) + payload
+        self.sock.sendall(packet(CONNECT, 0, body))
+        kind, _, body = read_packet(self.sock)
+        if kind != CONNACK or body[1] != 0:
+            raise ConnectionError("connection refused, code %d" % body[1])
+        threading.Thread(target=self.receive, daemon=True).start()
+
+    def next_id(self):
+        self.packet_id = self.packet_id % 65535 + 1
+        return self.packet_id
+
+    def publish(self, topic, payload, qos=0, retain=False):
+        body = encode_string(topic) + (struct.pack(">H", self.next_id()) if qos else b"")
+        with self.lock:
+            self.sock.sendall(packet(PUBLISH, qos << 1 | retain, body + payload.encode()))
+
+    def subscribe(self, pattern, qos=1):
+        body = struct.pack(">H", self.next_id()) + encode_string(pattern) + bytes([qos])
+        with self.lock:
+            self.sock.sendall(packet(SUBSCRIBE, 2, body))
+
+    def close(self, clean=True):
+        if clean:
+            self.sock.sendall(packet(DISCONNECT, 0, b""))
+        self.sock.shutdown(socket.SHUT_RDWR)  # Wakes up the receiving thread
+        self.sock.close()
+
+    def receive(self):
+        while True:
+            try:
+                received = read_packet(self.sock)
+            except OSError:
+                return
+            if received is None:
+                return
+            kind, flags, body = received
+            if kind == PUBLISH:
+                topic, payload, qos, retain, packet_id = parse_publish(flags, body)
+                if qos:
+                    with self.lock:
+                        self.sock.sendall(packet(PUBACK, 0, struct.pack(">H", packet_id)))
+                self.on_message(topic, payload.decode(errors="replace"), retain)
+
+
+def simulate(broker, hostname, speed=20.0):
+    """A unit publishing like the firmware, moving at speed %/s."""
+    base = "yun/" + hostname
+    state = {"position": 0, "target": 0}
+    wake = threading.Event()
+
+    def on_message(topic, payload, retain):
+        if topic == base + "/0/set_position" and payload.isdigit() and int(payload) <= 100:
+            state["target"] = int(payload)
+        elif topic == base + "/0/set" and payload in ("OPEN", "CLOSE", "STOP"):
+            state["target"] = {"OPEN": 0, "CLOSE": 100, "STOP": state["position"]}[payload]
+        else:
+            return
+        wake.set()
+
+    client = Client(broker, hostname, on_message, will=(base + "/availability", "offline", 1, True))
+    for name in ("set", "set_position"):
+        client.subscribe(base + "/+/" + name)
+    config = {"name": None, "unique_id": hostname + "_0", "device_class": "shade",
+              "availability_topic": base + "/availability", "command_topic": base + "/0/set",
+              "set_position_topic": base + "/0/set_position", "position_topic": base + "/0/position",
+              "state_topic": base + "/0/state", "position_open": 0, "position_closed": 100, "qos": 1,
+              "device": {"identifiers": [hostname], "name": hostname, "model": "ESP32 Yun"}}
+    client.publish("homeassistant/cover/%s_0/config" % hostname, json.dumps(config), 1, True)
+    client.publish(base + "/availability", "online", 1, True)
+    client.publish(base + "/0/position", "0", 1, True)
+    client.publish(base + "/0/state", "open", 1, True)
+    while True:
+        wake.wait()
+        wake.clear()
+        position = float(state["position"])
+        direction = 1 if state["target"] > position else -1
+        client.publish(base + "/0/state", "closing" if direction > 0 else "opening", 1, True)
+        last_publish = 0
+        while round(position) != state["target"] and not wake.is_set():
+            time.sleep(0.1)
+            position += direction * speed * 0.1
+            position = min(max(position, 0), 100)
+            state["position"] = round(position)
+            if time.monotonic() - last_publish >= MOVING_PERIOD:
+                last_publish = time.monotonic()
+                client.publish(base + "/0/position", str(state["position"]), 0, True)
+        if not wake.is_set():
+            client.publish(base + "/0/position", str(state["position"]), 1, True)
+            final = {0: "open", 100: "closed"}.get(state["position"], "stopped")
+            client.publish(base + "/0/state", final, 1, True)
+        else:
+            wake.set()  # A new target while moving
+
+
+def move(client, messages, config, target):
+    """Moves a unit to target, returns the timeline of its state and position messages."""
+    with messages["lock"]:
+        messages["timeline"] = []
+    start = time.monotonic()
+    client.publish(config["set_position_topic"], str(target), 1)
+    while time.monotonic() - start < TIMEOUT:
+        time.sleep(0.05)
+        with messages["lock"]:
+            timeline = list(messages["timeline"])
+        states = [value for _, topic, value in timeline if topic == config["state_topic"]]
+        positions = [value for _, topic, value in timeline if topic == config["position_topic"]]
+        if states and states[-1] not in ("opening", "closing") and positions and positions[-1] == str(target):
+            break
+    return [(at - start, topic, value) for at, topic, value in timeline]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--broker", default="localhost:1883", help="host[:port]")
+    parser.add_argument("--standin", action="store_true", help="run a minimal broker on the port")
+    parser.add_argument("--sim", action="store_true", help="run a simulated unit")
+    parser.add_argument("--user")
+    parser.add_argument("--password")
+    parser.add_argument("--position", type=int, default=50, help="%%, to move each unit to and back")
+    args = parser.parse_args()
+
+    if args.standin:
+        Broker(int(args.broker.partition(":")[2] or 1883))
+    if args.sim:
+        threading.Thread(target=simulate, args=(args.broker, "yun-sim000"), daemon=True).start()
+        time.sleep(0.5)
+
+    configs = {}
+    retained = {}
+    messages = {"lock": threading.Lock(), "timeline": []}
+
+    def on_message(topic, payload, retain):
+        if matches(DISCOVERY, topic):
+            configs[topic] = json.loads(payload)
+        if retain:
+            retained[topic] = payload
+        with messages["lock"]:
+            messages["timeline"].append((time.monotonic(), topic, payload))
+
+    client = Client(args.broker, "mqtt-check", on_message, user=args.user, password=args.password)
+    client.subscribe(DISCOVERY)
+    client.subscribe("yun/#")
+    time.sleep(1.0)  # Retained messages
+    if not configs:
+        print("no units found")
+        return
+
+    failures = 0
+    for topic, config in sorted(configs.items()):
+        name = topic.split("/")[2]
+        availability = retained.get(config["availability_topic"])
+        start = retained.get(config["position_topic"])
+        print("%s: %s, position %s, state %s" % (name, availability, start,
+                                                retained.get(config["state_topic"])))
+        missing = [key for key in ("command_topic", "set_position_topic", "position_topic",
+                                   "state_topic", "availability_topic", "unique_id") if key not in config]
+        if missing or availability != "online" or start is None:
+            print("  failed: discovery without %s or not online" % ", ".join(missing))
+            failures += 1
+            continue
+        for target in (args.position, int(start)):
+            timeline = move(client, messages, config, target)
+            states = [(at, value) for at, topic, value in timeline if topic == config["state_topic"]]
+            positions = [(at, value) for at, topic, value in timeline if topic == config["position_topic"]]
+            moving = [at for at, _ in positions[:-1]]
+            gaps = [later - earlier for earlier, later in zip(moving, moving[1:])]
+            arrived = positions and positions[-1][1] == str(target) and states and \
+                states[-1][1] not in ("opening", "closing")
+            print("  to %d%%: %s, first state %s after %.0f ms, %d positions while moving, "
+                  "shortest gap %.0f ms" % (
+                      target, "arrived after %.1f s" % positions[-1][0] if arrived else "timed out",
+                      states[0][1] if states else "none", 1000 * states[0][0] if states else 0,
+                      len(moving), 1000 * min(gaps) if gaps else 0))
+            if not arrived or (gaps and min(gaps) < MOVING_PERIOD * 0.9):
+                failures += 1
+    client.close()
+    print("%d failed" % failures)
+
+
+if __name__ == "__main__":
+    main()
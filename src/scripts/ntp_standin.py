@@ -0,0 +1,57 @@
+"""
+A local NTP server for testing the SNTP client in src/clock.h.
+
+Answers SNTP requests with the time of this host, shifted by an offset and running fast or slow by
+a drift, with an optional delay before answering. Point a unit at it with /wireless?ntp=<host>:<port>
+and watch "clock" in /json: a large offset is stepped, a small one slewed, and after a few syncs
+"drift" converges on the drift given here. Port 123 needs root, any other port works.
+
+    python src/scripts/ntp_standin.py [--port 1123] [--offset 0.5] [--drift 100] [--delay 20]
+"""
+import argparse
+import socket
+import struct
+import time
+
+NTP_TO_UNIX = 2208988800
+
+
+def to_ntp(seconds):
+    seconds += NTP_TO_UNIX
+    whole = int(seconds)
+    return struct.pack("!II", whole, int((seconds - whole) * 2 ** 32) & 0xFFFFFFFF)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__.split("\n\n")[0])
+    parser.add_argument("--port", type=int, default=1123)
+    parser.add_argument("--offset", type=float, default=0, help="s, added to the time of this host")
+    parser.add_argument("--drift", type=float, default=0, help="ppm, faster than this host if positive")
+    parser.add_argument("--delay", type=float, default=0, help="ms, before answering")
+    args = parser.parse_args()
+
+    start = time.time()
+
+    def now():
+        elapsed = time.time() - start
+        return start + elapsed * (1 + args.drift * 1e-6) + args.offset
+
+    sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+    sock.bind(("", args.port))
+    print("NTP stand-in on port %d, offset %.3f s, drift %.1f ppm" % (args.port, args.offset,
+                                                                       args.drift))
+    while True:
+        request, client = sock.recvfrom(1024)
+        received = now()
+        if len(request) < 48 or request[0] & 0x07 != 3:
+            continue
+        time.sleep(args.delay / 1000)
+        # Server mode, version 4, stratum 1; the originate timestamp echoes the client's transmit
+        header = struct.pack("!BBbb", 0x24, 1, 6, -20) + bytes(8) + b"LOCL"
+        answer = header + to_ntp(received) + request[40:48] + to_ntp(received) + to_ntp(now())
+        sock.sendto(answer, client)
+        print("%s answered, %.6f" % (client[0], received))
+
+
+if __name__ == "__main__":
+    main()
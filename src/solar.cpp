@@ -0,0 +1,82 @@
+#define LOG_MODULE LOG_SYSTEM
+#include "solar.h"
+#include "clock.h"
+#include "logger.h"
+#include <time.h>
+
+
+// Written by the wireless task when the location changes, read by the system task
+static int16_t table[SOLAR_DAYS][2];  // min from midnight UTC, of each day of the year
+static bool    located = false;
+static float   location_latitude = 0;   // deg, north positive
+static float   location_longitude = 0;  // deg, east positive
+
+
+void solarSetLocation(float latitude, float longitude) {
+    float lat = radians(latitude);
+    float cos_zenith = cos(radians(SOLAR_ZENITH));
+    for (int day = 0; day < SOLAR_DAYS; day++) {
+        float gamma = 2 * PI / 365 * day;  // Fractional year at noon UTC
+        float eqtime = 229.18 * (0.000075 + 0.001868 * cos(gamma) - 0.032077 * sin(gamma)
+                                 - 0.014615 * cos(2 * gamma) - 0.040849 * sin(2 * gamma));  // min
+        float decl = 0.006918 - 0.399912 * cos(gamma) + 0.070257 * sin(gamma)
+                     - 0.006758 * cos(2 * gamma) + 0.000907 * sin(2 * gamma)
+                     - 0.002697 * cos(3 * gamma) + 0.00148 * sin(3 * gamma);  // rad
+        float cos_hour_angle = cos_zenith / (cos(lat) * cos(decl)) - tan(lat) * tan(decl);
+        if (cos_hour_angle < -1 || cos_hour_angle > 1) {
+            table[day][SOLAR_SUNRISE] = SOLAR_NONE;  // Polar day or night
+            table[day][SOLAR_SUNSET] = SOLAR_NONE;
+            continue;
+        }
+        float hour_angle = degrees(acos(cos_hour_angle));
+        float noon = 720 - 4 * longitude - eqtime;
+        table[day][SOLAR_SUNRISE] = static_cast<int16_t>(lroundf(noon - 4 * hour_angle));
+        table[day][SOLAR_SUNSET] = static_cast<int16_t>(lroundf(noon + 4 * hour_angle));
+    }
+    location_latitude = latitude;
+    location_longitude = longitude;
+    located = true;
+    LOGI("Solar table computed for %.3f, %.3f", latitude, longitude);
+}
+
+
+void solarClearLocation() {
+    located = false;
+}
+
+
+bool solarLocated() {
+    return located;
+}
+
+
+uint32_t solarEventTime(int year, int yday, SolarEvent event) {
+    if (!located || yday < 0 || yday >= SOLAR_DAYS || table[yday][event] == SOLAR_NONE) {
+        return UINT32_MAX;
+    }
+    // Days from 1970-01-01 to January 1st of the year
+    int32_t days = 365 * (year - 1970) + (year - 1969) / 4 - (year - 1901) / 100 + (year - 1601) / 400;
+    return static_cast<uint32_t>((days + yday) * 1440 + table[yday][event]);
+}
+
+
+void solarToJson(JsonObject destination) {
+    if (!located) {
+        return;
+    }
+    destination["latitude"] = serialized(String(location_latitude, 3));
+    destination["longitude"] = serialized(String(location_longitude, 3));
+    uint64_t now = clockNow();
+    if (now == 0) {
+        return;
+    }
+    time_t seconds = now / 1000;
+    struct tm local;
+    localtime_r(&seconds, &local);
+    uint32_t sunrise = solarEventTime(local.tm_year + 1900, local.tm_yday, SOLAR_SUNRISE);
+    uint32_t sunset = solarEventTime(local.tm_year + 1900, local.tm_yday, SOLAR_SUNSET);
+    if (sunrise != UINT32_MAX) {
+        destination["sunrise"] = static_cast<uint64_t>(sunrise) * 60000;  // ms since epoch, today
+        destination["sunset"] = static_cast<uint64_t>(sunset) * 60000;
+    }
+}
@@ -0,0 +1,33 @@
+#pragma once
+/**
+    solar.h - Sunrise and sunset at the unit's location, for schedules relative to the sun
+    Author: Jason Chen, 2024
+
+    Uses the NOAA approximations of the equation of time and the declination of the sun, which are
+    within a minute or two of the almanac away from the poles. Main features includes:
+      - solarSetLocation() computes a table of sunrise and sunset of every day of the year once,
+        in minutes from midnight UTC, so looking up a day is an array read instead of trig.
+      - Days without a sunrise or a sunset, in polar day or night, are SOLAR_NONE.
+      - Nothing is known until a location is set; the table is in RAM and the location is saved by
+        the wireless task.
+**/
+#include <Arduino.h>
+#include <ArduinoJson.h>
+
+
+#define SOLAR_DAYS   366     // Days of the table, day 365 only in leap years
+#define SOLAR_ZENITH 90.833  // deg, the top of the sun at the horizon, with refraction
+#define SOLAR_NONE   INT16_MIN
+
+
+enum SolarEvent {
+    SOLAR_SUNRISE = 0,
+    SOLAR_SUNSET  = 1
+};
+
+
+void solarSetLocation(float latitude, float longitude);
+void solarClearLocation();
+bool solarLocated();
+uint32_t solarEventTime(int year, int yday, SolarEvent event);  // min since epoch, UINT32_MAX if none
+void solarToJson(JsonObject destination);
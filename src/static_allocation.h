@@ -0,0 +1,75 @@
+#pragma once
+/**
+    static_allocation.h - Creates FreeRTOS tasks, queues and timers with or without the heap
+    Author: Jason Chen, 2024
+
+    With STATIC_ALLOCATION=1 the stacks, control blocks and queue storage are file-static buffers
+    declared with STATIC_BUFFER(), so memory use is fixed at link time and doesn't come out of the
+    heap at boot. With STATIC_ALLOCATION=0 the buffers are NULL pointers and the create functions
+    allocate from the heap as usual, so callers look the same either way:
+
+        STATIC_BUFFER(StackType_t, drain_stack, LOG_DRAIN_STACK);
+        STATIC_BUFFER(StaticTask_t, drain_task, 1);
+        createTask(drainTask, "LogDrainTask", LOG_DRAIN_STACK, NULL, 0, 0, drain_stack, drain_task);
+
+    Stack sizes are in bytes on the ESP32; the unused stack of every task is reported in /json
+    under "stacks" to size them.
+**/
+#include <Arduino.h>
+
+#ifndef STATIC_ALLOCATION
+    #define STATIC_ALLOCATION 0
+#endif
+
+
+#if STATIC_ALLOCATION
+
+#if !configSUPPORT_STATIC_ALLOCATION
+    #error "STATIC_ALLOCATION needs CONFIG_SUPPORT_STATIC_ALLOCATION enabled in the sdkconfig"
+#endif
+
+#define STATIC_BUFFER(type, name, count) static type name[count]
+
+#else
+
+#define STATIC_BUFFER(type, name, count) static type *const name = NULL
+
+#endif
+
+
+inline TaskHandle_t createTask(TaskFunction_t function, const char *name, uint32_t stack_depth,
+                               void *parameter, UBaseType_t priority, BaseType_t core_id,
+                               StackType_t *stack, StaticTask_t *task_buffer) {
+    #if STATIC_ALLOCATION
+        return xTaskCreateStaticPinnedToCore(function, name, stack_depth, parameter, priority, stack,
+                                             task_buffer, core_id);
+    #else
+        TaskHandle_t handle = NULL;
+        if (xTaskCreatePinnedToCore(function, name, stack_depth, parameter, priority, &handle,
+                                    core_id) != pdPASS) {
+            return NULL;
+        }
+        return handle;
+    #endif
+}
+
+
+inline QueueHandle_t createQueue(UBaseType_t length, UBaseType_t item_size, uint8_t *storage,
+                                 StaticQueue_t *queue_buffer) {
+    #if STATIC_ALLOCATION
+        return xQueueCreateStatic(length, item_size, storage, queue_buffer);
+    #else
+        return xQueueCreate(length, item_size);
+    #endif
+}
+
+
+inline TimerHandle_t createTimer(const char *name, TickType_t period, UBaseType_t auto_reload,
+                                 void *id, TimerCallbackFunction_t callback,
+                                 StaticTimer_t *timer_buffer) {
+    #if STATIC_ALLOCATION
+        return xTimerCreateStatic(name, period, auto_reload, id, callback, timer_buffer);
+    #else
+        return xTimerCreate(name, period, auto_reload, id, callback);
+    #endif
+}
@@ -1,17 +1,24 @@
+#define LOG_MODULE LOG_SYSTEM
 #include "system_task.h"
 
 
-SystemTask::SystemTask(const uint8_t task_core) : 
-        Task{"SystemTask", 8192, 1, task_core, 2} {
-    pinMode(BUTTON_PIN, INPUT);
+static const char *log_level_keys[LOG_MODULE_COUNT] = {"log_system_", "log_motor_", "log_wireless_",
+                                                       "log_led_"};
+
+TASK_MEMORY(system_task_memory, SYSTEM_TASK_STACK, SYSTEM_TASK_QUEUE);
+STATIC_BUFFER(StaticTimer_t, sleep_timer_buffer, 1);
+
 
+SystemTask::SystemTask(const uint8_t task_core) : 
+        Task{"SystemTask", SYSTEM_TASK_STACK, 1, task_core, SYSTEM_TASK_QUEUE, system_task_memory} {
     // FreeRTOS implemented in C so can't use std::bind
     auto on_timer = [](TimerHandle_t timer) {
         SystemTask *temp_system_ptr = static_cast<SystemTask*>(pvTimerGetTimerID(timer));
         assert(temp_system_ptr != NULL);
         temp_system_ptr->systemSleep(timer);
     };
-    system_sleep_timer_ = xTimerCreate("System_sleep_timer_", system_wake_time_, pdFALSE, this, on_timer);
+    system_sleep_timer_ = createTimer("System_sleep_timer_", system_wake_time_, pdFALSE, this, on_timer,
+                                      sleep_timer_buffer);
     assert(system_sleep_timer_ != NULL);
 }
 
@@ -23,6 +30,9 @@ SystemTask::~SystemTask() {
 
 void SystemTask::run() {
     loadSettings();
+    button_.begin();
+    journalRecord(EVENT_BOOT, esp_reset_reason());
+    breadcrumbsJournal();
 
     while (1) {
         if (xQueueReceive(queue_, (void*) &inbox_, 0) == pdTRUE) {
@@ -38,6 +48,18 @@ void SystemTask::run() {
                 case SYSTEM_RESTART:
                     systemRestart();
                     break;
+                case SYSTEM_LOG_SYS:
+                    setLogLevel(LOG_SYSTEM, inbox_.parameter);
+                    break;
+                case SYSTEM_LOG_MOTOR:
+                    setLogLevel(LOG_MOTOR, inbox_.parameter);
+                    break;
+                case SYSTEM_LOG_WRLSS:
+                    setLogLevel(LOG_WIRELESS, inbox_.parameter);
+                    break;
+                case SYSTEM_LOG_LED:
+                    setLogLevel(LOG_LED, inbox_.parameter);
+                    break;
                 case SYSTEM_RENAME:
                     int shift[4] = {24, 16, 8, 0};
                     int mask[4] = {2130706432, 8323072, 32512, 127};
@@ -58,6 +80,16 @@ void SystemTask::run() {
 
         checkButtonPress();
 
+        if (millis() - last_schedule_run_ >= SCHEDULE_RUN_PERIOD) {
+            runSchedules();
+        }
+
+        journalFlush();
+        timeseriesFlush();
+        odometerFlush();
+        breadcrumbsHeap();
+        heapCheck();
+
         // if (xTimerIsTimerActive(system_sleep_timer_) == pdFALSE) {
         //     xTimerStart(system_sleep_timer_, portMAX_DELAY);
         // }
@@ -73,12 +105,16 @@ void SystemTask::loadSettings() {
     system_name_ = getOrDefault("system_name_", system_name_);
     serial_ = getOrDefault("serial_", serial_);
     if (serial_ == "") {  // Factory reset
-        serial_ = getSerialNumber();
+        serial_ = getSerialNumber().c_str();
         settings_["serial_"] = serial_;
     }
     firmware_ = getOrDefault("firmware_", firmware_);
     system_wake_time_ = getOrDefault("system_wake_time_", system_wake_time_);
     system_sleep_time_ = getOrDefault("system_sleep_time_", system_sleep_time_);
+    for (int i = 0; i < LOG_MODULE_COUNT; i++) {
+        log_levels_[i] = getOrDefault(log_level_keys[i], static_cast<int>(LOG_GET_LEVEL(i)));
+        LOG_SET_LEVEL(i, static_cast<LogLevel>(log_levels_[i]));
+    }
 
     if (!load) {
         writeToDisk();
@@ -88,50 +124,130 @@ void SystemTask::loadSettings() {
 }
 
 
+void SystemTask::setLogLevel(LogModule module, int level) {
+    setAndSave(log_levels_[module], level, log_level_keys[module]);
+    LOG_SET_LEVEL(module, static_cast<LogLevel>(level));
+    LOGI("Log level of module %d set to %d", module, level);
+}
+
+
 inline void SystemTask::checkButtonPress() {
-    // Check button presses for wireless setup mode and factory reset
-    if (digitalRead(BUTTON_PIN) == LOW && !button_pressed_) {
-        button_pressed_ = true;
-        button_press_start_ = esp_timer_get_time();
-    } else if (digitalRead(BUTTON_PIN) == HIGH && button_pressed_) {
-        button_pressed_ = false;
-        button_press_duration_ = (esp_timer_get_time() - button_press_start_) / 1000;  // us to ms
-        if (button_press_duration_ > FACTORY_RESET_TIMER) {
-            LOGI("Triggered factory reset, button pressed for %dms", button_press_duration_);
-            systemReset();
-        } else if (button_press_duration_ > SETUP_MODE_TIMER) {
-            LOGI("Triggered wireless setup, button pressed for %dms", button_press_duration_);
-            bool toggle_setup_mode = !static_cast<bool>(wireless_task_->getSettings()["setup_mode_"]);
-            sendTo(wireless_task_, Message(WIRELESS_SETUP, toggle_setup_mode), portMAX_DELAY);
-            vTaskDelay(100 / portTICK_PERIOD_MS);
-            systemRestart();
+    ButtonGesture gesture;
+    if (button_.getGesture(gesture)) {
+        handleButtonGesture(gesture);
+        return;
+    }
+
+    // Indicate how long the button has been held for wireless setup mode and factory reset
+    int held_duration = button_.getHeldDuration();
+    LedPattern pattern = LED_OFF;
+    if (held_duration > FACTORY_RESET_TIMER) {
+        pattern = LED_HOLD_RESET;
+    } else if (held_duration > SETUP_MODE_TIMER) {
+        pattern = LED_HOLD_SETUP;
+    }
+    if (pattern != button_led_pattern_) {
+        if (pattern == LED_OFF) {
+            sendTo(led_task_, Message(LED_CLEAR, button_led_pattern_), 0);
         } else {
-            LOGI("No action, button pressed for %dms", button_press_duration_);
+            sendTo(led_task_, Message(LED_PATTERN, pattern), 0);
         }
-    } else if (digitalRead(BUTTON_PIN) == LOW && button_pressed_) {
-        int button_press_elapsed_ = (esp_timer_get_time() - button_press_start_) / 1000;  // us to ms
-        if (button_press_elapsed_ > FACTORY_RESET_TIMER) {
-            digitalWrite(LED_PIN, LOW);
-        } else if (button_press_elapsed_ > SETUP_MODE_TIMER) {
-            digitalWrite(LED_PIN, HIGH);
+        button_led_pattern_ = pattern;
+    }
+}
+
+
+void SystemTask::handleButtonGesture(ButtonGesture gesture) {
+    // Prevent the system from sleeping before the motor task processes the button press
+    xTimerStart(system_sleep_timer_, portMAX_DELAY);
+
+    int press_duration = button_.getPressDuration();
+    switch (gesture) {
+        case BUTTON_SHORT:
+            LOGI("Short press, toggling motor");
+            sendToMotors(Message(MOTOR_TOGGLE, 1), 10);
+            break;
+        case BUTTON_DOUBLE:
+            LOGI("Double press, stopping motor");
+            sendToMotors(Message(MOTOR_STOP, 1), 10);
+            break;
+        case BUTTON_LONG:
+            if (press_duration > FACTORY_RESET_TIMER) {
+                LOGI("Triggered factory reset, button pressed for %dms", press_duration);
+                systemReset();
+            } else if (press_duration > SETUP_MODE_TIMER) {
+                LOGI("Triggered wireless setup, button pressed for %dms", press_duration);
+                bool toggle_setup_mode = !wireless_task_->getSetting<bool>("setup_mode_");
+                sendTo(wireless_task_, Message(WIRELESS_SETUP, toggle_setup_mode), portMAX_DELAY);
+                vTaskDelay(100 / portTICK_PERIOD_MS);
+                systemRestart();
+            } else {
+                LOGI("No action, button pressed for %dms", press_duration);
+            }
+            break;
+        default:
+            break;
+    }
+}
+
+
+void SystemTask::runSchedules() {
+    uint32_t until = scheduleRun([this](const Schedule &schedule) {
+        LOGI("Schedule #%u due, moving to %d%%", schedule.id, schedule.percent);
+        journalRecord(EVENT_SCHEDULE, schedule.id, schedule.percent);
+        xTimerStart(system_sleep_timer_, portMAX_DELAY);
+        Message message(MOTOR_PERECENT, static_cast<int>(schedule.percent));
+        if (schedule.motor < 0) {
+            sendToMotors(message, 10);
+        } else if (schedule.motor < motor_count_) {
+            sendTo(motor_tasks_[schedule.motor], message, 10);
         }
+    });
+    last_schedule_run_ = millis();
+    schedule_until_ = until;
+
+    // Going to sleep right before a schedule is due would only wake up again
+    if (until <= SCHEDULE_WAKE_AHEAD && xTimerIsTimerActive(system_sleep_timer_) == pdTRUE) {
+        xTimerStart(system_sleep_timer_, portMAX_DELAY);
+    }
+}
+
+
+// The button and sleep act on all motors, like one motor
+void SystemTask::sendToMotors(Message message, int timeout) {
+    for (int i = 0; i < motor_count_; i++) {
+        sendTo(motor_tasks_[i], message, timeout);
     }
 }
 
 
 void SystemTask::systemSleep(TimerHandle_t timer) {
+    // Wake up ahead of the next schedule
+    uint64_t sleep_time = system_sleep_time_;  // us
+    uint32_t elapsed = millis() - last_schedule_run_;
+    if (schedule_until_ != UINT32_MAX) {
+        if (schedule_until_ <= elapsed + SCHEDULE_WAKE_AHEAD) {
+            xTimerStart(timer, 0);
+            return;
+        }
+        sleep_time = min(sleep_time, (schedule_until_ - elapsed - SCHEDULE_WAKE_AHEAD) * 1000ULL);
+    }
+    LOGI("System sleep for %llu ms", sleep_time / 1000);
+
     // Standby motor driver
-    sendTo(motor_task_, Message(MOTOR_STANDBY, 1), 10);
-    // gpio_hold_en(STBY_PIN);
+    sendToMotors(Message(MOTOR_STANDBY, 1), 10);
+    // gpio_hold_en(BOARD.stby);
     // gpio_deep_sleep_hold_en();
 
     // ULP I2C
     // Sleep; TODO wait till driver is in sleep
-    // ESP.deepSleep(system_sleep_time_);
+    // ESP.deepSleep(sleep_time);
 }
 
 
 void SystemTask::systemRestart() {
+    journalFlush(true);
+    odometerFlush(true);
     WiFi.disconnect();
     ESP.restart();
 }
@@ -141,13 +257,15 @@ void SystemTask::systemReset() {
     LOGI("System factory reset\n");
     WiFi.disconnect();
     LITTLEFS.format();
+    odometerRestore();  // Lifetime counters outlive a factory reset
     vTaskDelay(10 / portTICK_PERIOD_MS);
     ESP.restart();
 }
 
 
 void SystemTask::addMotorTask(Task *task) {
-    motor_task_ = task;
+    assert(motor_count_ < MOTOR_COUNT);
+    motor_tasks_[motor_count_++] = task;
 }
 
 
@@ -156,6 +274,11 @@ void SystemTask::addWirelessTask(Task *task) {
 }
 
 
+void SystemTask::addLedTask(Task *task) {
+    led_task_ = task;
+}
+
+
 TimerHandle_t SystemTask::getSystemSleepTimer() {
     return system_sleep_timer_;
 }
\ No newline at end of file
@@ -1,11 +1,16 @@
 #pragma once
 #include <WiFi.h>
 #include "task.h"
+#include "button.h"
+#include "led_task.h"
 
+#define SYSTEM_TASK_STACK    8192   // Bytes, see "stacks" in /json
+#define SYSTEM_TASK_QUEUE    2
 #define SYSTEM_WAKE_DURATION 5000   // ms
 #define SYSTEM_SLEEP_DURTION 5000   // ms
 #define SETUP_MODE_TIMER     5000   // ms
 #define FACTORY_RESET_TIMER  15000  // ms
+#define SCHEDULE_RUN_PERIOD  1000   // ms, between checks for due schedules
 
 
 class SystemTask: public Task {
@@ -14,6 +19,7 @@ public:
     ~SystemTask();
     void addMotorTask(Task *task);
     void addWirelessTask(Task *task);
+    void addLedTask(Task *task);
     TimerHandle_t getSystemSleepTimer();
 
 protected:
@@ -27,17 +33,25 @@ private:
     String firmware_ = GIT_REV;
     int system_wake_time_  = SYSTEM_WAKE_DURATION;         // ms
     int system_sleep_time_ = SYSTEM_SLEEP_DURTION * 1000;  // us
+    int log_levels_[LOG_MODULE_COUNT];                    // Runtime log level of each module
 
-    bool button_pressed_        = false;
-    int  button_press_start_    = 0;
-    int  button_press_duration_ = 0;
+    Button button_ = Button(BOARD.button);
+    LedPattern button_led_pattern_ = LED_OFF;  // Button hold feedback, LED_OFF if none
+    uint32_t last_schedule_run_ = 0;           // ms
+    uint32_t schedule_until_ = UINT32_MAX;     // ms from last_schedule_run_ to the next schedule
 
-    Task *motor_task_;
+    Task *motor_tasks_[MOTOR_COUNT];
+    uint8_t motor_count_ = 0;
     Task *wireless_task_;
+    Task *led_task_;
     TimerHandle_t system_sleep_timer_;
 
     void loadSettings();
+    void setLogLevel(LogModule module, int level);
     inline void checkButtonPress();
+    void handleButtonGesture(ButtonGesture gesture);
+    void runSchedules();
+    void sendToMotors(Message message, int timeout);
     void systemSleep(TimerHandle_t timer);
     void systemRestart();
     void systemReset();
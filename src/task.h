@@ -10,31 +10,73 @@
 #include <ArduinoJson.h>
 #include "FS.h"
 #include <LITTLEFS.h>
+#include "board.h"
 #include "logger.h"
+#include "journal.h"
+#include "timeseries.h"
+#include "odometer.h"
+#include "schedule.h"
+#include "solar.h"
+#include "breadcrumbs.h"
+#include "heap_stats.h"
+#include "json_arena.h"
+#include "fixed_string.h"
+#include "static_allocation.h"
 #include "command.h"
+#include <atomic>
+
+
+#define MESSAGE_STRING_SIZE 64
+#define SERIAL_NUMBER_SIZE  13  // 6 bytes of MAC address in hex
 
 
 struct Message {
-    Message(Command command, int parameter) : command(command), parameter(parameter) {}
-    Message(Command command, float parameterf) : command(command), parameterf(parameterf) {}
-    String toString() { return "command=" + hash(command) + ", parameter="
-                               + (parameter != INT_MIN ? String(parameter) : String(parameterf)); }
+    Message(Command command, int parameter, uint8_t motor = 0) :
+            command(command), parameter(parameter), motor(motor) {}
+    Message(Command command, float parameterf, uint8_t motor = 0) :
+            command(command), parameterf(parameterf), motor(motor) {}
+    FixedString<MESSAGE_STRING_SIZE> toString() {
+        FixedString<MESSAGE_STRING_SIZE> text;
+        if (parameter != INT_MIN) text.appendf("command=%s, parameter=%d", hash(command), parameter);
+        else text.appendf("command=%s, parameter=%.2f", hash(command), parameterf);
+        return text;
+    }
     Command command;
     int parameter = INT_MIN;
     float parameterf = 0.0;
+    uint8_t motor = 0;  // Index of the motor an update is from
+};
+
+
+// Buffers of a task and its queue, see TASK_MEMORY()
+struct TaskMemory {
+    StackType_t   *stack;
+    StaticTask_t  *task;
+    uint8_t       *queue_storage;
+    StaticQueue_t *queue;
 };
 
 
+// Declares the buffers of a task in its source file, they are NULL without STATIC_ALLOCATION
+#define TASK_MEMORY(name, stack_depth, queue_length) \
+    STATIC_BUFFER(StackType_t, name##_stack, stack_depth); \
+    STATIC_BUFFER(StaticTask_t, name##_task, 1); \
+    STATIC_BUFFER(uint8_t, name##_queue_storage, (queue_length) * sizeof(Message)); \
+    STATIC_BUFFER(StaticQueue_t, name##_queue, 1); \
+    static const TaskMemory name = {name##_stack, name##_task, name##_queue_storage, name##_queue}
+
+
 class Task {
 public:
     Task(const char* const name, uint32_t stack_depth, UBaseType_t priority,
-         const BaseType_t core_id = tskNO_AFFINITY, int queue_length = 1) :
+         const BaseType_t core_id, int queue_length, const TaskMemory &memory) :
             name_ {name},
             inbox_(ERROR_COMMAND, INT_MIN),
             stack_depth_ {stack_depth},
             priority_ {priority},
-            core_id_ {core_id} {
-        queue_ = xQueueCreate(queue_length, sizeof(Message));
+            core_id_ {core_id},
+            memory_ (memory) {
+        queue_ = createQueue(queue_length, sizeof(Message), memory_.queue_storage, memory_.queue);
         assert(queue_ != NULL);
     }
 
@@ -43,9 +85,10 @@ public:
     }
 
     void init() {
-        BaseType_t result = xTaskCreatePinnedToCore(taskFunction, name_, stack_depth_,
-                                                    this, priority_, &task_handle_, core_id_);
-        assert(result == pdPASS);
+        breadcrumb(CRUMB_INIT, name_, stack_depth_, core_id_);
+        task_handle_ = createTask(taskFunction, name_, stack_depth_, this, priority_, core_id_,
+                                  memory_.stack, memory_.task);
+        assert(task_handle_ != NULL);
     }
 
     TaskHandle_t getTaskHandle() {
@@ -56,8 +99,28 @@ public:
         return queue_;
     }
 
-    JsonDocument getSettings() {
-        return settings_;
+    const char *getName() {
+        return name_;
+    }
+
+    // Bytes of stack never used so far
+    uint32_t getStackHeadroom() {
+        return task_handle_ != NULL ? uxTaskGetStackHighWaterMark(task_handle_) : 0;
+    }
+
+    // Copies the settings into a document of the caller, i.e. one backed by a ScopedArena
+    void getSettings(JsonObject destination) {
+        destination.set(settings_.as<JsonObjectConst>());
+    }
+
+    template<typename T>
+    T getSetting(const char *key) {
+        return settings_[key].as<T>();
+    }
+
+    // Changes whenever a task saves its settings, to find out when they need publishing again
+    static uint32_t getSettingsGeneration() {
+        return settingsGeneration();
     }
 
 protected:
@@ -68,6 +131,8 @@ protected:
 
     bool sendTo(Task *task, Message message, int timeout) {
         LOGI("Sending message from %s to %s", name_, task->name_);
+        breadcrumb(CRUMB_COMMAND, task->name_, message.command, message.parameter != INT_MIN ?
+                   message.parameter : static_cast<int32_t>(message.parameterf * 10));
         if (xQueueSend(task->getQueueHandle(), (void*) &message, timeout) != pdTRUE) {
             LOGE("Failed to send message from %s to %s", name_, task->name_);
             return false;
@@ -107,6 +172,7 @@ protected:
     }
 
     bool writeToDisk() {
+        settingsGeneration()++;
         String path = String("/") + name_ + ".txt";
         LOGI("%s writing file to %s", name_, path.c_str());
         File file = LITTLEFS.open(path, FILE_WRITE);
@@ -138,16 +204,18 @@ protected:
         return true;
     }
 
-    String getSerialNumber() {
+    static std::atomic<uint32_t> &settingsGeneration() {
+        static std::atomic<uint32_t> generation(0);  // One for all tasks
+        return generation;
+    }
+
+    FixedString<SERIAL_NUMBER_SIZE> getSerialNumber() {
         uint8_t mac_address[6];
         esp_read_mac(mac_address, ESP_MAC_WIFI_STA);
-        String serial = "";
+        FixedString<SERIAL_NUMBER_SIZE> serial;
         for (int i = 0; i < 6; i++) {
-            char hexidecimal[2];
-            sprintf(hexidecimal, "%02X", mac_address[i]);
-            serial += hexidecimal;
+            serial.appendf("%02x", mac_address[i]);
         }
-        serial.toLowerCase();
         return serial;
     }
 
@@ -156,8 +224,9 @@ protected:
 private:
     uint32_t stack_depth_;
     UBaseType_t priority_;
-    TaskHandle_t task_handle_;
+    TaskHandle_t task_handle_ = NULL;
     const BaseType_t core_id_;
+    const TaskMemory memory_;
 
     static void taskFunction(void* params) {
         Task *t = static_cast<Task*>(params);
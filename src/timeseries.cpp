@@ -0,0 +1,455 @@
+#include "timeseries.h"
+#include "logger.h"
+#include "static_allocation.h"
+#include "clock.h"
+#include <algorithm>
+
+
+#define TIMESERIES_MAGIC  0x53455254  // "TRES"
+#define TIMESERIES_PERIOD 1000        // ms, sampling timer period
+#define TIMESERIES_UPTIME 0x01        // Flag, buckets are counted from boot instead of from epoch
+#define TIMESERIES_CHUNK  32          // Buckets copied at a time between a ring and its file
+
+
+enum SeriesMode {
+    MODE_GAUGE,  // Average, the last value is held while there are no samples
+    MODE_MIN,
+    MODE_SUM
+};
+
+
+struct Accumulator {
+    int32_t  sum[SERIES_COUNT];
+    int16_t  low[SERIES_COUNT];
+    uint16_t count[SERIES_COUNT];
+};
+
+
+struct Ring {
+    const char *path;        // NULL if not persisted
+    uint32_t resolution;     // s
+    uint16_t capacity;       // Buckets
+    int16_t  (*buckets)[SERIES_COUNT];
+    bool     valid;          // Holds at least one bucket
+    uint32_t last;           // Number of the newest bucket, counted from the start of the timebase
+    uint32_t dirty;          // Number of the oldest bucket not written to flash
+    uint32_t pending;        // Number of the bucket being accumulated
+    Accumulator acc;
+};
+
+
+struct RingHeader {
+    uint32_t magic;
+    uint32_t resolution;
+    uint16_t capacity;
+    uint8_t  series;
+    uint8_t  flags;
+    uint32_t last;
+};
+
+
+static const SeriesMode modes[SERIES_COUNT] = {
+    MODE_GAUGE,  // SERIES_POSITION
+    MODE_SUM,    // SERIES_TRAVEL
+    MODE_GAUGE,  // SERIES_CURRENT
+    MODE_MIN,    // SERIES_STALLGUARD
+    MODE_GAUGE   // SERIES_RSSI
+};
+
+static int16_t second_buckets[TIMESERIES_SECONDS][SERIES_COUNT];
+static int16_t minute_buckets[TIMESERIES_MINUTES][SERIES_COUNT];
+static int16_t hour_buckets[TIMESERIES_HOURS][SERIES_COUNT];
+
+static Ring rings[] = {
+    {NULL, 1, TIMESERIES_SECONDS, second_buckets},
+    {TIMESERIES_DIRECTORY "/minute.bin", 60, TIMESERIES_MINUTES, minute_buckets},
+    {TIMESERIES_DIRECTORY "/hour.bin", 3600, TIMESERIES_HOURS, hour_buckets}
+};
+static const size_t ring_count = sizeof(rings) / sizeof(Ring);
+
+static SemaphoreHandle_t rings_mutex = NULL;  // Guards the rings, the system task owns their files
+static portMUX_TYPE samples_mux = portMUX_INITIALIZER_UNLOCKED;
+static Accumulator samples;                   // Samples of the current second
+static int16_t held[SERIES_COUNT];            // Last value of the gauges
+static volatile bool flush_now = false;
+static volatile bool rebase_now = false;        // The clock got synchronized
+static uint8_t ring_flags = TIMESERIES_UPTIME;  // Time base of the rings in RAM
+STATIC_BUFFER(StaticTimer_t, timer_buffer, 1);
+
+
+// s, in the time base of the rings in RAM, which only changes when they are rebased
+static uint32_t ringTime() {
+    if (ring_flags & TIMESERIES_UPTIME) {
+        return static_cast<uint32_t>(esp_timer_get_time() / 1000000);
+    }
+    return static_cast<uint32_t>(clockNow() / 1000);
+}
+
+
+static void clear(Accumulator &acc) {
+    for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+        acc.sum[i] = 0;
+        acc.low[i] = INT16_MAX;
+        acc.count[i] = 0;
+    }
+}
+
+
+static void accumulate(Accumulator &acc, const int16_t *values) {
+    for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+        if (values[i] == TIMESERIES_MISSING) continue;
+        acc.sum[i] += values[i];
+        acc.low[i] = min(acc.low[i], values[i]);
+        acc.count[i]++;
+    }
+}
+
+
+static void finalize(const Accumulator &acc, int16_t *values) {
+    for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+        if (acc.count[i] == 0) {
+            values[i] = TIMESERIES_MISSING;
+        } else if (modes[i] == MODE_GAUGE) {
+            values[i] = acc.sum[i] / acc.count[i];
+        } else if (modes[i] == MODE_MIN) {
+            values[i] = acc.low[i];
+        } else {
+            values[i] = min(acc.sum[i], static_cast<int32_t>(INT16_MAX));
+        }
+    }
+}
+
+
+static void push(Ring &ring, uint32_t bucket, const int16_t *values) {
+    if (ring.valid && bucket <= ring.last) return;
+
+    // Buckets skipped over are missing
+    uint32_t gap = ring.valid ? ring.last + 1 : bucket;
+    if (bucket - gap >= ring.capacity) {
+        gap = bucket - ring.capacity + 1;
+    }
+    for (; gap < bucket; gap++) {
+        for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+            ring.buckets[gap % ring.capacity][i] = TIMESERIES_MISSING;
+        }
+    }
+
+    memcpy(ring.buckets[bucket % ring.capacity], values, sizeof(int16_t) * SERIES_COUNT);
+    if (!ring.valid) {
+        ring.dirty = bucket;
+    }
+    ring.valid = true;
+    ring.last = bucket;
+}
+
+
+// Adds the values of a finer bucket starting at time, and closes the pending bucket if time is
+// past it, which cascades to the coarser rings
+static void add(size_t index, uint32_t time, const int16_t *values) {
+    Ring &ring = rings[index];
+    uint32_t bucket = time / ring.resolution;
+    if (bucket != ring.pending) {
+        int16_t closed[SERIES_COUNT];
+        finalize(ring.acc, closed);
+        push(ring, ring.pending, closed);
+        if (index + 1 < ring_count) {
+            add(index + 1, ring.pending * ring.resolution, closed);
+        } else {
+            flush_now = true;  // Once an hour
+        }
+        clear(ring.acc);
+        ring.pending = bucket;
+    }
+    accumulate(ring.acc, values);
+}
+
+
+static void sample(TimerHandle_t timer) {
+    if (xSemaphoreTake(rings_mutex, 0) != pdTRUE) {
+        return;  // The timer daemon doesn't wait, samples keep accumulating until the next period
+    }
+
+    Accumulator second;
+    portENTER_CRITICAL(&samples_mux);
+    second = samples;
+    clear(samples);
+    portEXIT_CRITICAL(&samples_mux);
+
+    int16_t values[SERIES_COUNT];
+    finalize(second, values);
+    for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+        if (modes[i] == MODE_GAUGE) {
+            if (values[i] == TIMESERIES_MISSING) values[i] = held[i];
+            held[i] = values[i];
+        } else if (modes[i] == MODE_SUM && values[i] == TIMESERIES_MISSING) {
+            values[i] = 0;
+        }
+    }
+
+    if (ring_flags & TIMESERIES_UPTIME && clockSynced()) {
+        rebase_now = true;  // By the system task, samples are counted from boot until then
+    }
+    add(0, ringTime(), values);
+    xSemaphoreGive(rings_mutex);
+}
+
+
+// Writes buckets from..to to their slots in the file. They are copied a chunk at a time under the
+// mutex and written after releasing it, so sample() never waits for flash writes.
+static void writeBuckets(File &file, Ring &ring, uint32_t from, uint32_t to) {
+    const size_t bucket_size = sizeof(int16_t) * SERIES_COUNT;
+    int16_t chunk[TIMESERIES_CHUNK][SERIES_COUNT];
+    while (from <= to) {
+        size_t slot = from % ring.capacity;
+        size_t count = min(min(static_cast<size_t>(to - from + 1), ring.capacity - slot),
+                           static_cast<size_t>(TIMESERIES_CHUNK));
+        xSemaphoreTake(rings_mutex, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++) {
+            if (from + i + ring.capacity > ring.last) {
+                memcpy(chunk[i], ring.buckets[slot + i], bucket_size);
+            } else {
+                for (uint8_t j = 0; j < SERIES_COUNT; j++) {
+                    chunk[i][j] = TIMESERIES_MISSING;  // Pushed out by newer buckets meanwhile
+                }
+            }
+        }
+        xSemaphoreGive(rings_mutex);
+        file.seek(sizeof(RingHeader) + slot * bucket_size);
+        file.write(reinterpret_cast<uint8_t*>(chunk), count * bucket_size);
+        from += count;
+    }
+}
+
+
+// Writes the header and the buckets that changed since the last write, runs in the system task
+static void writeRing(Ring &ring) {
+    xSemaphoreTake(rings_mutex, portMAX_DELAY);
+    // Buckets counted from boot are never loaded again
+    bool due = ring.path != NULL && ring.valid && ring.dirty <= ring.last
+               && !(ring_flags & TIMESERIES_UPTIME);
+    RingHeader header = {TIMESERIES_MAGIC, ring.resolution, ring.capacity, SERIES_COUNT, ring_flags,
+                         ring.last};
+    uint32_t dirty = ring.dirty;
+    xSemaphoreGive(rings_mutex);
+    if (!due) return;
+
+    const size_t file_size = sizeof(header) + ring.capacity * sizeof(int16_t) * SERIES_COUNT;
+    uint32_t oldest = header.last + 1 > ring.capacity ? header.last + 1 - ring.capacity : 0;
+    File file = LITTLEFS.exists(ring.path) ? LITTLEFS.open(ring.path, "r+") : File();
+    if (!file || file.size() != file_size) {
+        // First write, or an incompatible file, writes the whole ring once in the order of its slots
+        file.close();
+        file = LITTLEFS.open(ring.path, FILE_WRITE);
+        if (!file) {
+            LOGE("Failed to open %s for writing", ring.path);
+            return;
+        }
+        file.write(reinterpret_cast<uint8_t*>(&header), sizeof(header));
+        uint32_t at_slot_0 = oldest + (ring.capacity - oldest % ring.capacity) % ring.capacity;
+        if (at_slot_0 <= header.last) {
+            writeBuckets(file, ring, at_slot_0, header.last);
+        }
+        if (at_slot_0 > oldest) {
+            writeBuckets(file, ring, oldest, at_slot_0 - 1);
+        }
+    } else {
+        file.write(reinterpret_cast<uint8_t*>(&header), sizeof(header));
+        writeBuckets(file, ring, max(dirty, oldest), header.last);
+    }
+    file.close();
+
+    xSemaphoreTake(rings_mutex, portMAX_DELAY);
+    ring.dirty = header.last + 1;  // Buckets pushed meanwhile are written next time
+    xSemaphoreGive(rings_mutex);
+}
+
+
+static void fillMissing(Ring &ring, uint32_t from, uint32_t to) {
+    for (uint32_t bucket = from; bucket < to; bucket++) {
+        for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+            ring.buckets[bucket % ring.capacity][i] = TIMESERIES_MISSING;
+        }
+    }
+}
+
+
+// Fills in the buckets before the first one counted since boot from the stored ring, a chunk at a
+// time so sample() only waits for copies
+static void mergeRing(Ring &ring, uint32_t first, uint32_t now) {
+    File file = LITTLEFS.open(ring.path, FILE_READ);
+    RingHeader header;
+    bool loaded = file
+        && file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)) == sizeof(header)
+        && header.magic == TIMESERIES_MAGIC && header.resolution == ring.resolution
+        && header.capacity == ring.capacity && header.series == SERIES_COUNT
+        && !(header.flags & TIMESERIES_UPTIME) && header.last < min(first, now / ring.resolution);
+
+    xSemaphoreTake(rings_mutex, portMAX_DELAY);
+    if (!loaded) {
+        ring.dirty = 0;  // The whole ring is written at the next flush
+    } else if (!ring.valid) {
+        ring.valid = true;
+        ring.last = header.last;
+        ring.dirty = header.last + 1;
+        fillMissing(ring, header.last + 1 > ring.capacity ? header.last + 1 - ring.capacity : 0,
+                    header.last + 1);
+    } else {
+        ring.dirty = header.last + 1;  // With the missing buckets up to the first one since boot
+    }
+    xSemaphoreGive(rings_mutex);
+    if (!loaded) {
+        file.close();
+        return;
+    }
+
+    const size_t bucket_size = sizeof(int16_t) * SERIES_COUNT;
+    int16_t chunk[TIMESERIES_CHUNK][SERIES_COUNT];
+    uint32_t bucket = header.last + 1 > ring.capacity ? header.last + 1 - ring.capacity : 0;
+    while (bucket <= header.last) {
+        size_t slot = bucket % ring.capacity;
+        size_t count = min(min(static_cast<size_t>(header.last - bucket + 1), ring.capacity - slot),
+                           static_cast<size_t>(TIMESERIES_CHUNK));
+        file.seek(sizeof(header) + slot * bucket_size);
+        if (file.read(reinterpret_cast<uint8_t*>(chunk), count * bucket_size) != count * bucket_size) {
+            break;
+        }
+        xSemaphoreTake(rings_mutex, portMAX_DELAY);
+        for (size_t i = 0; i < count; i++) {
+            if (bucket + i + ring.capacity > ring.last) {  // Not pushed out by newer buckets meanwhile
+                memcpy(ring.buckets[slot + i], chunk[i], bucket_size);
+            }
+        }
+        xSemaphoreGive(rings_mutex);
+        bucket += count;
+    }
+    file.close();
+    LOGI("Loaded %s up to bucket %u", ring.path, header.last);
+}
+
+
+// Runs in the system task once the clock got synchronized: the buckets counted from boot are moved
+// to their buckets since epoch, and the stored rings fill in the buckets before them
+static void rebaseRings() {
+    uint32_t first[ring_count];
+    xSemaphoreTake(rings_mutex, portMAX_DELAY);
+    uint32_t uptime = ringTime();
+    ring_flags = 0;
+    uint32_t now = ringTime();
+    for (size_t i = 0; i < ring_count; i++) {
+        Ring &ring = rings[i];
+        uint32_t shift = now / ring.resolution - uptime / ring.resolution;
+        ring.pending += shift;
+        first[i] = ring.pending;
+        if (!ring.valid) continue;
+
+        // A bucket's slot is its number modulo the capacity, so the slots rotate by the shift
+        int16_t *buckets = ring.buckets[0];
+        size_t rotation = shift % ring.capacity;
+        std::rotate(buckets, buckets + (ring.capacity - rotation) * SERIES_COUNT,
+                    buckets + ring.capacity * SERIES_COUNT);
+        uint32_t oldest = ring.last + 1 > ring.capacity ? ring.last + 1 - ring.capacity : 0;
+        first[i] = max(ring.dirty, oldest) + shift;  // Rings counted from boot are never written
+        ring.last += shift;
+        fillMissing(ring, ring.last + 1 - ring.capacity, first[i]);
+    }
+    xSemaphoreGive(rings_mutex);
+
+    for (size_t i = 0; i < ring_count; i++) {
+        if (rings[i].path != NULL) {
+            mergeRing(rings[i], first[i], now);
+        }
+    }
+}
+
+
+void timeseriesInit() {
+    rings_mutex = xSemaphoreCreateMutex();
+    assert(rings_mutex != NULL);
+
+    LITTLEFS.mkdir(TIMESERIES_DIRECTORY);
+
+    // Counted from boot until the clock is synchronized, the stored rings are loaded then
+    uint32_t now = ringTime();
+    clear(samples);
+    for (uint8_t i = 0; i < SERIES_COUNT; i++) {
+        held[i] = TIMESERIES_MISSING;
+    }
+    for (size_t i = 0; i < ring_count; i++) {
+        clear(rings[i].acc);
+        rings[i].pending = now / rings[i].resolution;
+    }
+
+    TimerHandle_t timer = createTimer("Timeseries_timer", pdMS_TO_TICKS(TIMESERIES_PERIOD), pdTRUE,
+                                      NULL, sample, timer_buffer);
+    assert(timer != NULL);
+    xTimerStart(timer, portMAX_DELAY);
+}
+
+
+void timeseriesSample(TimeSeries series, int16_t value) {
+    if (series >= SERIES_COUNT || value == TIMESERIES_MISSING) return;
+    portENTER_CRITICAL(&samples_mux);
+    samples.sum[series] += value;
+    samples.low[series] = min(samples.low[series], value);
+    samples.count[series]++;
+    portEXIT_CRITICAL(&samples_mux);
+}
+
+
+void timeseriesFlush() {
+    if (rebase_now) {
+        rebase_now = false;
+        rebaseRings();
+    }
+    if (!flush_now) return;
+
+    flush_now = false;
+    for (size_t i = 0; i < ring_count; i++) {
+        writeRing(rings[i]);
+    }
+}
+
+
+size_t timeseriesQuery(Print &output, TimeSeries series, uint32_t resolution, uint32_t from,
+                       uint32_t to) {
+    Ring *ring = NULL;
+    for (size_t i = 0; i < ring_count; i++) {
+        if (rings[i].resolution == resolution) ring = &rings[i];
+    }
+
+    size_t count = 0;
+    xSemaphoreTake(rings_mutex, portMAX_DELAY);
+    uint8_t flags = ring_flags;
+    uint32_t first = 0;
+    uint32_t last = 0;
+    if (ring != NULL && ring->valid && series < SERIES_COUNT) {
+        uint32_t oldest = ring->last + 1 > ring->capacity ? ring->last + 1 - ring->capacity : 0;
+        first = max(from / resolution, oldest);
+        last = min(to / resolution, ring->last);
+    }
+
+    output.printf("{\"resolution\":%u,\"uptime\":%s,\"from\":%u,\"values\":[", resolution,
+                  flags & TIMESERIES_UPTIME ? "true" : "false", first * resolution);
+    for (uint32_t bucket = first; ring != NULL && ring->valid && bucket <= last; bucket++) {
+        int16_t value = ring->buckets[bucket % ring->capacity][series];
+        if (count++ > 0) output.print(",");
+        if (value == TIMESERIES_MISSING) {
+            output.print("null");
+        } else {
+            output.print(value);
+        }
+    }
+    xSemaphoreGive(rings_mutex);
+    output.print("]}");
+    return count;
+}
+
+
+TimeSeries timeseriesFromString(const String &series) {
+    if (series == "position") return SERIES_POSITION;
+    else if (series == "travel") return SERIES_TRAVEL;
+    else if (series == "current") return SERIES_CURRENT;
+    else if (series == "stallguard") return SERIES_STALLGUARD;
+    else if (series == "rssi") return SERIES_RSSI;
+    return SERIES_COUNT;
+}
@@ -0,0 +1,47 @@
+#pragma once
+/**
+    timeseries.h - A small downsampled time-series store for position and telemetry
+    Author: Jason Chen, 2024
+
+    Tasks feed samples with timeseriesSample() and a 1 second software timer turns them into
+    buckets of three resolutions, each kept in a fixed-size ring in RAM:
+        (1) 1 second for the last 5 minutes
+        (2) 1 minute for the last day
+        (3) 1 hour for the last 30 days
+    Every bucket is downsampled from the finer resolution according to the series' mode: gauges
+    are averaged (and held while no new samples arrive), MIN series keep the lowest sample and
+    SUM series add up. Buckets without samples are missing (TIMESERIES_MISSING).
+
+    The minute and hour rings are written to LittleFS once an hour, only the buckets that changed,
+    so there are no per-sample flash writes. Buckets are counted from boot until the clock is
+    synchronized (clock.h); the system task then moves them to their times since epoch and fills in
+    the older ones from the stored rings. Only rings counted from the epoch are written.
+**/
+#include <Arduino.h>
+#include "FS.h"
+#include <LITTLEFS.h>
+
+
+#define TIMESERIES_DIRECTORY "/timeseries"
+#define TIMESERIES_SECONDS   300   // Buckets of the 1s ring
+#define TIMESERIES_MINUTES   1440  // Buckets of the 1min ring
+#define TIMESERIES_HOURS     720   // Buckets of the 1h ring
+#define TIMESERIES_MISSING   INT16_MIN
+
+
+enum TimeSeries {
+    SERIES_POSITION   = 0,  // %, gauge
+    SERIES_TRAVEL     = 1,  // Time the motor was moving, 100ms, sum
+    SERIES_CURRENT    = 2,  // Motor current setting, mA, gauge
+    SERIES_STALLGUARD = 3,  // Lowest SG_RESULT while moving, min
+    SERIES_RSSI       = 4,  // WiFi RSSI, dBm, gauge
+    SERIES_COUNT
+};
+
+
+void timeseriesInit();
+void timeseriesSample(TimeSeries series, int16_t value);
+void timeseriesFlush();  // Writes changed buckets to flash if due
+size_t timeseriesQuery(Print &output, TimeSeries series, uint32_t resolution, uint32_t from,
+                       uint32_t to);
+TimeSeries timeseriesFromString(const String &series);
@@ -1,9 +1,28 @@
+#define LOG_MODULE LOG_WIRELESS
 #include "wireless_task.h"
 
 
+TASK_MEMORY(wireless_task_memory, WIRELESS_TASK_STACK, WIRELESS_TASK_QUEUE);
+STATIC_BUFFER(uint8_t, fleet_queue_storage, FLEET_QUEUE * sizeof(FleetPacket));
+STATIC_BUFFER(StaticQueue_t, fleet_queue_buffer, 1);
+STATIC_BUFFER(uint8_t, coap_queue_storage, COAP_QUEUE * sizeof(CoapRequest));
+STATIC_BUFFER(StaticQueue_t, coap_queue_buffer, 1);
+STATIC_BUFFER(uint8_t, mqtt_queue_storage, MQTT_QUEUE * sizeof(MqttMessage));
+STATIC_BUFFER(StaticQueue_t, mqtt_queue_buffer, 1);
+
+
 WirelessTask::WirelessTask(const uint8_t task_core) : 
-        Task{"WirelessTask", 8192, 1, task_core, 99}, webserver(80), websocket("/ws") {
-    pinMode(LED_PIN, OUTPUT);
+        Task{"WirelessTask", WIRELESS_TASK_STACK, 1, task_core, WIRELESS_TASK_QUEUE,
+             wireless_task_memory}, webserver(80), websocket("/ws"), log_websocket("/logs") {
+    fleet_queue_ = createQueue(FLEET_QUEUE, sizeof(FleetPacket), fleet_queue_storage,
+                               fleet_queue_buffer);
+    assert(fleet_queue_ != NULL);
+    coap_queue_ = createQueue(COAP_QUEUE, sizeof(CoapRequest), coap_queue_storage,
+                              coap_queue_buffer);
+    assert(coap_queue_ != NULL);
+    mqtt_queue_ = createQueue(MQTT_QUEUE, sizeof(MqttMessage), mqtt_queue_storage,
+                              mqtt_queue_buffer);
+    assert(mqtt_queue_ != NULL);
     esp_task_wdt_init(WDT_DURATION, true);  // Restart system if watchdog hasn't been fed
 }
 
@@ -16,6 +35,10 @@ void WirelessTask::run() {
 
     while (1) {
         if (initialized_ && WiFi.status() != WL_CONNECTED) {
+            if (connected_) {
+                journalRecord(EVENT_WIFI_DROP, WiFi.status());
+                connected_ = false;
+            }
             connectWifi();
         }
 
@@ -23,17 +46,65 @@ void WirelessTask::run() {
             LOGI("WirelessTask received message: %s", inbox_.toString().c_str());
             switch (inbox_.command) {
                 case UPDATE_POSITION:
-                    // If motor has changed position(%), broadcast it to all WS clients
-                    motor_position_ = inbox_.parameter;
+                    // If a motor has changed position(%), broadcast it to all WS clients
+                    if (inbox_.motor < motor_count_) {
+                        motor_positions_[inbox_.motor] = inbox_.parameter;
+                        final_positions_[inbox_.motor] = inbox_.parameter;
+                    }
+                    mqttUpdatePosition(inbox_.motor, inbox_.parameter, false);
+                    coapNotifyPositions();
                     websocket.textAll(getJSON());
                     break;
+                case UPDATE_MOVING:
+                    if (inbox_.motor < motor_count_) {
+                        motor_positions_[inbox_.motor] = inbox_.parameter;
+                    }
+                    mqttUpdatePosition(inbox_.motor, inbox_.parameter, true);
+                    if (millis() - last_coap_notify_ >= COAP_MOVING_PERIOD) {
+                        coapNotifyPositions();
+                    }
+                    break;
+                case UPDATE_TRAVEL:
+                    if (inbox_.motor < motor_count_) {
+                        motor_travel_times_[inbox_.motor] = inbox_.parameter;
+                    }
+                    break;
                 case WIRELESS_SETUP:
                     setAndSave(setup_mode_, static_cast<bool>(inbox_.parameter), "setup_mode_");
                     break;
+                case WIRELESS_GROUPS:
+                    setAndSave(fleet_groups_, inbox_.parameter, "fleet_groups_");
+                    break;
             }
         }
 
+        if (xQueueReceive(fleet_queue_, &fleet_inbox_, 0) == pdTRUE) {
+            fleetRequestHandler(fleet_inbox_);
+        }
+
+        if (xQueueReceive(coap_queue_, &coap_inbox_, 0) == pdTRUE) {
+            coapRequestHandler(coap_inbox_);
+        }
+
+        if (xQueueReceive(mqtt_queue_, &mqtt_inbox_, 0) == pdTRUE) {
+            mqttRequestHandler(mqtt_inbox_);
+        }
+
         websocket.cleanupClients();  // Remove disconnected WS clients
+        log_websocket.cleanupClients();
+
+        streamLogs();
+
+        if (connected_) {
+            clockPoll();
+            mqttPoll();
+            updateServiceTxt();
+        }
+
+        if (connected_ && millis() - last_rssi_sample_ >= RSSI_SAMPLE_PERIOD) {
+            last_rssi_sample_ = millis();
+            timeseriesSample(SERIES_RSSI, WiFi.RSSI());
+        }
 
         #if COMPILEOTA
             ArduinoOTA.handle();
@@ -49,12 +120,30 @@ void WirelessTask::loadSettings() {
 
     ap_ssid_ = getOrDefault("ap_ssid_", ap_ssid_);
     if (ap_ssid_ == "") {  // Factory reset
-        ap_ssid_ = "yun-" + getSerialNumber().substring(6, 12);
+        ap_ssid_ = String("yun-") + (getSerialNumber().c_str() + 6);
         settings_["ap_ssid_"] = ap_ssid_;
     }
     sta_ssid_ = getOrDefault("sta_ssid_", sta_ssid_);
     sta_password_ = getOrDefault("sta_password_", sta_password_);
     attempts_ = getOrDefault("attempts_", attempts_);
+    syslog_host_ = getOrDefault("syslog_host_", syslog_host_);
+    setSyslogHost(syslog_host_);
+    ntp_host_ = getOrDefault("ntp_host_", ntp_host_);
+    clockSetServer(ntp_host_);
+    timezone_ = getOrDefault("timezone_", timezone_);
+    clockSetTimezone(timezone_);
+    location_ = getOrDefault("location_", location_);
+    setLocation(location_);
+    mqtt_server_ = getOrDefault("mqtt_server_", mqtt_server_);
+    mqttSetServer(mqtt_server_);
+    mqttOnMessage([this](const MqttMessage &message) {  // In the MQTT client's task
+        // Prevent the system task from sleeping before finishing processing MQTT commands
+        xTimerStart(system_sleep_timer_, portMAX_DELAY);
+        if (xQueueSend(mqtt_queue_, &message, 0) != pdTRUE) {
+            LOGE("MQTT message on %s dropped, queue full", message.topic);
+        }
+    });
+    fleet_groups_ = getOrDefault("fleet_groups_", fleet_groups_);
     if (sta_ssid_ == "" || attempts_ > MAX_ATTEMPTS) {
         setup_mode_ = true;
         setAndSave(setup_mode_, true, "setup_mode_");
@@ -71,13 +160,14 @@ void WirelessTask::loadSettings() {
 
 
 void WirelessTask::connectWifi() {
-    // Turn on LED to indicate not connected
-    digitalWrite(LED_PIN, HIGH);
+    // Blink LED to indicate not connected
+    sendTo(led_task_, Message(LED_PATTERN, setup_mode_ ? LED_SETUP_MODE : LED_CONNECTING), 0);
 
     if (!setup_mode_) {
         // ESP32 in STA mode
         LOGI("Attempting to connect to WiFi, SSID=%s, password=%s", sta_ssid_.c_str(), sta_password_.c_str());
         setAndSave(attempts_, attempts_ + 1, "attempts_");
+        breadcrumb(CRUMB_STATE, name_, CRUMB_WIFI_CONNECTING, attempts_);
         esp_task_wdt_add(getTaskHandle());
         WiFi.begin(sta_ssid_.c_str(), sta_password_.c_str());
         while (WiFi.status() != WL_CONNECTED) {
@@ -86,6 +176,9 @@ void WirelessTask::connectWifi() {
         // Remove wireless task from watchdog timer to avoid manually feeding WDT
         esp_task_wdt_delete(getTaskHandle());
         LOGI("Connected to the WiFi, IP: %s", WiFi.localIP().toString().c_str());
+        journalRecord(EVENT_WIFI_CONNECT, WiFi.RSSI());
+        breadcrumb(CRUMB_STATE, name_, CRUMB_WIFI_CONNECTED, WiFi.RSSI());
+        connected_ = true;
     } else {
         // ESP32 in AP mode which acts as an router
         LOGI("Starting AP, SSID: %s", ap_ssid_.c_str());
@@ -97,25 +190,68 @@ void WirelessTask::connectWifi() {
         LOGE("Failed to set mDNS responder");
     }
     MDNS.addService("_ald", "_tcp", 80);
+    for (String &value : txt_values_) {
+        value = "";  // The responder starts over without them
+    }
+    last_txt_update_ = 0;
 
     websocket.onEvent(std::bind(&WirelessTask::wsEventHandler, this, std::placeholders::_1,
                       std::placeholders::_2, std::placeholders::_3, std::placeholders::_4,
                       std::placeholders::_5, std::placeholders::_6));
 
     webserver.addHandler(&websocket);
+    webserver.addHandler(&log_websocket);
 
     routing();
 
     webserver.begin();
 
+    if (!setup_mode_) {
+        fleet_udp_.onPacket(std::bind(&WirelessTask::fleetPacketHandler, this,
+                                      std::placeholders::_1));
+        if (!fleet_udp_.listenMulticast(IPAddress(FLEET_ADDRESS), FLEET_PORT)) {
+            LOGE("Failed to listen for fleet commands");
+        }
+        coap_udp_.onPacket(std::bind(&WirelessTask::coapPacketHandler, this,
+                                     std::placeholders::_1));
+        if (!coap_udp_.listen(COAP_PORT)) {
+            LOGE("Failed to listen for CoAP requests");
+        }
+        mqttSetDevice(ap_ssid_, system_task_->getSetting<String>("system_name_"),
+                      system_task_->getSetting<String>("serial_"),
+                      system_task_->getSetting<String>("firmware_"), motor_count_);
+    }
+
     #if COMPILEOTA
         ArduinoOTA.setHostname(ap_ssid_.c_str());
+        ArduinoOTA.onStart([=]() {
+            breadcrumb(CRUMB_STATE, name_, CRUMB_WIFI_OTA, 0);
+            sendTo(led_task_, Message(LED_PATTERN, LED_OTA), 0);
+        });
+        ArduinoOTA.onEnd([=]() {
+            breadcrumb(CRUMB_STATE, name_, CRUMB_WIFI_OTA, 1);
+            sendTo(led_task_, Message(LED_CLEAR, LED_OTA), 0);
+        });
+        ArduinoOTA.onError([=](ota_error_t error) {
+            breadcrumb(CRUMB_STATE, name_, CRUMB_WIFI_OTA, -1);
+            sendTo(led_task_, Message(LED_CLEAR, LED_OTA), 0);
+        });
         ArduinoOTA.begin();
     #endif
 
     setAndSave(attempts_, 1, "attempts_");
 
-    digitalWrite(LED_PIN, LOW);
+    if (!setup_mode_) {
+        sendTo(led_task_, Message(LED_PATTERN, LED_OFF), 0);
+    }
+}
+
+
+// A param that is a whole number, false if it has anything else
+static bool parseNumber(const String &value, long &number) {
+    char *end;
+    number = strtol(value.c_str(), &end, 10);
+    return value.length() > 0 && *end == '\0';
 }
 
 
@@ -154,14 +290,145 @@ void WirelessTask::routing() {
         request->send(200, "application/json", getJSON());
     });
 
+    // Events recorded in the journal, optionally within a time range
+    webserver.on("/journal", HTTP_GET, [=](AsyncWebServerRequest *request) {
+        uint32_t from = 0;
+        uint32_t to = UINT32_MAX;
+        size_t limit = JOURNAL_QUERY_LIMIT;
+        if (request->hasParam("from")) {
+            from = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+        }
+        if (request->hasParam("to")) {
+            to = strtoul(request->getParam("to")->value().c_str(), NULL, 10);
+        }
+        if (request->hasParam("limit")) {
+            limit = request->getParam("limit")->value().toInt();
+        }
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        journalQuery(*response, from, to, limit);
+        request->send(response);
+    });
+
+    // Downsampled telemetry of one series at a resolution of 1, 60 or 3600 seconds
+    webserver.on("/timeseries", HTTP_GET, [=](AsyncWebServerRequest *request) {
+        TimeSeries series = SERIES_COUNT;
+        uint32_t resolution = 60;
+        uint32_t from = 0;
+        uint32_t to = UINT32_MAX;
+        if (request->hasParam("series")) {
+            series = timeseriesFromString(request->getParam("series")->value());
+        }
+        if (request->hasParam("resolution")) {
+            resolution = strtoul(request->getParam("resolution")->value().c_str(), NULL, 10);
+        }
+        if (request->hasParam("from")) {
+            from = strtoul(request->getParam("from")->value().c_str(), NULL, 10);
+        }
+        if (request->hasParam("to")) {
+            to = strtoul(request->getParam("to")->value().c_str(), NULL, 10);
+        }
+        if (series == SERIES_COUNT || (resolution != 1 && resolution != 60 && resolution != 3600)) {
+            request->send(400, "text/plain", "failed: series=position|travel|current|stallguard|rssi, resolution=1|60|3600");
+            return;
+        }
+        AsyncResponseStream *response = request->beginResponseStream("application/json");
+        timeseriesQuery(*response, series, resolution, from, to);
+        request->send(response);
+    });
+
+    // Moves run by the unit at a time of day, listed as a Json array without params
+    webserver.on("/schedules", HTTP_GET, [=](AsyncWebServerRequest *request) {
+        if (isPrefetch(request)) {
+            return;
+        }
+        if (request->hasParam("remove")) {
+            long id;
+            if (!parseNumber(request->getParam("remove")->value(), id) || id < 0
+                || id >= SCHEDULE_MAX || !scheduleRemove(id)) {
+                request->send(400, "text/plain", "failed: remove=<id of a schedule>");
+                return;
+            }
+            request->send(200, "text/plain", "success: remove\n");
+            return;
+        }
+        const char *triggers[] = {"time", "sunrise", "sunset"};
+        for (int trigger = SCHEDULE_TIME; trigger <= SCHEDULE_SUNSET; trigger++) {
+            if (!request->hasParam(triggers[trigger])) {
+                continue;
+            }
+            const String &value = request->getParam(triggers[trigger])->value();
+            int minute = INT_MIN;  // Of the day, or the offset from sunrise/sunset
+            if (trigger == SCHEDULE_TIME) {
+                unsigned int hour = 24;
+                unsigned int minutes = 60;
+                char extra;
+                if (sscanf(value.c_str(), "%u:%u%c", &hour, &minutes, &extra) == 2 && hour < 24 && minutes < 60) {
+                    minute = hour * 60 + minutes;
+                }
+            } else {
+                long offset;
+                if (parseNumber(value, offset) && labs(offset) <= SCHEDULE_OFFSET_MAX) {
+                    minute = offset;
+                }
+            }
+            long days = 127;
+            long percent = -1;
+            long motor = -1;  // All motors
+            bool numbers = request->hasParam("percent")
+                           && parseNumber(request->getParam("percent")->value(), percent)
+                           && (!request->hasParam("days")
+                               || parseNumber(request->getParam("days")->value(), days))
+                           && (!request->hasParam("motor")
+                               || parseNumber(request->getParam("motor")->value(), motor));
+            if (minute == INT_MIN || !numbers || days < 1 || days > 127 || percent < 0
+                || percent > 100 || motor < -1 || motor >= motor_count_) {
+                request->send(400, "text/plain", "failed: time=HH:MM or sunrise/sunset=-720~720 (min), "
+                                                 "percent=0~100, optional days=1~127 (bit 0 for Sunday ~ "
+                                                 "bit 6 for Saturday) and motor");
+                return;
+            }
+            int id = scheduleAdd(static_cast<ScheduleTrigger>(trigger), days, minute, percent, motor);
+            if (id < 0) {
+                request->send(400, "text/plain", "failed: no more than 16 schedules");
+                return;
+            }
+            request->send(200, "text/plain", String("success: ") + triggers[trigger] + ", id=" + id + "\n");
+            return;
+        }
+        ScopedArena arena;
+        JsonDocument schedules(arena.allocator());
+        scheduleToJson(schedules.to<JsonArray>());
+        String result;
+        serializeJson(schedules, result);
+        request->send(200, "application/json", result);
+    });
+
     webserver.onNotFound([=](AsyncWebServerRequest *request) {
         if(request->method() == HTTP_GET) {
-            request->send(404, "text/plain", "failed: use /motor? or /system? or /wireless? or /json" );
+            request->send(404, "text/plain", "failed: use /motor? or /system? or /wireless? or /json or /journal? or /timeseries? or /schedules?" );
         }
     });
 }
 
 
+// Computes the sunrise/sunset table, false if not "latitude,longitude" or empty
+bool WirelessTask::setLocation(const String &location) {
+    if (location == "") {
+        solarClearLocation();
+        return true;
+    }
+    float latitude;
+    float longitude;
+    char extra;
+    if (sscanf(location.c_str(), "%f,%f%c", &latitude, &longitude, &extra) != 2
+        || fabs(latitude) > 90 || fabs(longitude) > 180) {
+        return false;
+    }
+    solarSetLocation(latitude, longitude);
+    return true;
+}
+
+
 bool WirelessTask::isPrefetch(AsyncWebServerRequest *request) {
     for(int i = 0; i < request->headers(); i++){
         AsyncWebHeader *header = request->getHeader(i);
@@ -176,77 +443,495 @@ bool WirelessTask::isPrefetch(AsyncWebServerRequest *request) {
 
 
 void WirelessTask::httpRequestHandler(AsyncWebServerRequest *request) {
+    int64_t start = esp_timer_get_time();
     // Prevent the system task from sleeping before finishing processing HTTP requests
     xTimerStart(system_sleep_timer_, portMAX_DELAY);
 
-    if (request->params() > 10) {
+    if (request->params() > COMMAND_MAX_PARAMS) {
         request->send(400, "text/plain", "too many parameters");
         return;
     }
 
+    CommandParam params[COMMAND_MAX_PARAMS];
     for (int i = 0; i < request->params(); i++) {
-        String param = request->getParam(i)->name();
+        params[i].name = &request->getParam(i)->name();
+        params[i].value = &request->getParam(i)->value();
+    }
+
+    // The web server keeps its own copy of the body since it is sent after returning
+    FixedString<COMMAND_RESPONSE_SIZE> response;
+    if (dispatch(request->url(), params, request->params(), response)) {
+        request->send(200, "text/plain", response.c_str());
+    } else {
+        request->send(400, "text/plain", response.c_str());
+    }
+    int64_t elapsed = esp_timer_get_time() - start;
+    portENTER_CRITICAL(&api_mux_);
+    http_stats_.requests++;
+    http_stats_.time += elapsed;
+    portEXIT_CRITICAL(&api_mux_);
+
+    delay(100 / portTICK_PERIOD_MS);
+    websocket.textAll(getJSON());
+}
+
+
+// Runs in the UDP task, hands requests to this task
+void WirelessTask::fleetPacketHandler(AsyncUDPPacket &packet) {
+    FleetPacket request;
+    if (!fleetParse(packet.data(), packet.length(), request.header) ||
+        !fleetIsMember(request.header.group, fleet_groups_)) {
+        return;
+    }
+    // Prevent the system task from sleeping before finishing processing fleet commands
+    xTimerStart(system_sleep_timer_, portMAX_DELAY);
+
+    request.address = packet.remoteIP();
+    request.port = packet.remotePort();
+    size_t length = packet.length() - sizeof(FleetHeader);
+    memcpy(request.request, packet.data() + sizeof(FleetHeader), length);
+    request.request[length] = '\0';
+    if (xQueueSend(fleet_queue_, &request, 0) != pdTRUE) {
+        LOGE("Fleet command #%u dropped, queue full", request.header.sequence);
+    }
+}
+
+
+void WirelessTask::fleetRequestHandler(FleetPacket &request) {
+    bool failed = false;
+    FleetSequence sequence = fleetCheckSequence(request.address, request.port,
+                                                request.header.sequence, failed);
+    if (sequence == FLEET_STALE) {
+        return;
+    }
+
+    FixedString<COMMAND_RESPONSE_SIZE> response;
+    if (sequence == FLEET_NEW) {
+        failed = !dispatchRequest(request.request, response);
+        fleetRecord(request.address, request.port, request.header.sequence, failed);
+        LOGI("Fleet command #%u: %s", request.header.sequence, failed ? "failed" : "success");
+    }
+
+    // Moves reach WS clients with the position updates, unlike HTTP there is no wait for settings
+    if (request.header.flags & FLEET_ACK_REQUEST) {
+        FleetHeader header = request.header;
+        header.flags = FLEET_ACK | (failed ? FLEET_FAILED : 0);
+        FixedString<sizeof(FleetHeader) + FLEET_PAYLOAD_SIZE> ack;
+        ack.append(reinterpret_cast<const char*>(&header), sizeof(FleetHeader));
+        ack.appendf("%s\n%s", ap_ssid_.c_str(), response.c_str());
+        fleet_udp_.writeTo(reinterpret_cast<const uint8_t*>(ack.c_str()), ack.length(),
+                           IPAddress(request.address), request.port);
+    }
+}
+
+
+// Runs in the UDP task, hands requests to this task
+void WirelessTask::coapPacketHandler(AsyncUDPPacket &packet) {
+    int64_t start = esp_timer_get_time();
+    CoapRequest request;
+    if (!coapParse(packet.data(), packet.length(), request)) {
+        return;
+    }
+    if (request.code != COAP_EMPTY) {
+        // Prevent the system task from sleeping before finishing processing CoAP requests
+        xTimerStart(system_sleep_timer_, portMAX_DELAY);
+    }
+    request.address = packet.remoteIP();
+    request.port = packet.remotePort();
+    request.parse_time = esp_timer_get_time() - start;
+    if (xQueueSend(coap_queue_, &request, 0) != pdTRUE) {
+        LOGE("CoAP message #%u dropped, queue full", request.message_id);
+    }
+}
+
+
+void WirelessTask::coapRequestHandler(CoapRequest &request) {
+    int64_t start = esp_timer_get_time();
+    IPAddress address(request.address);
+    uint8_t message[COAP_MESSAGE_SIZE];
+    size_t length;
+    if (request.type == COAP_ACK || request.type == COAP_RST) {
+        coapReply(request);  // To a notification
+        return;
+    }
+    if (request.code == COAP_EMPTY || request.code >> 5 != 0) {
+        // A ping, or a response while this unit is no client: a confirmable one is reset
+        if (request.type == COAP_CON) {
+            length = coapBuild(message, COAP_RST, COAP_EMPTY, request.message_id, request.token, 0,
+                               -1, COAP_NO_FORMAT, NULL, 0);
+            coap_udp_.writeTo(message, length, address, request.port);
+        }
+        return;
+    }
+    const uint8_t *repeated = coapFindExchange(request.address, request.port, request.message_id, length);
+    if (repeated != NULL) {
+        coap_udp_.writeTo(repeated, length, address, request.port);
+        return;
+    }
+
+    FixedString<COMMAND_RESPONSE_SIZE> response;
+    uint8_t code;
+    int16_t format = COAP_TEXT;
+    int32_t observe = -1;
+    const char *query = strchr(request.request, '?');
+    size_t path_length = query != NULL ? query - request.request : strlen(request.request);
+    auto is = [&](const char *path) {
+        return strlen(path) == path_length && strncmp(request.request, path, path_length) == 0;
+    };
+    if (request.error != 0) {
+        code = request.error;
+    } else if (is("/.well-known/core") || is("/position")) {
+        if (request.code != COAP_GET) {
+            code = COAP_NOT_ALLOWED;
+        } else if (is("/position")) {
+            positionsToString(motor_positions_, response);
+            if (request.observe == 0) {
+                observe = coapObserve(request);
+            } else if (request.observe == 1) {
+                coapForget(request);
+            }
+            code = COAP_CONTENT;
+        } else {
+            response.append("</motor>,</system>,</wireless>,</position>;obs");
+            format = COAP_LINKS;
+            code = COAP_CONTENT;
+        }
+    } else if (!is("/motor") && !is("/system") && !is("/wireless")) {
+        code = COAP_NOT_FOUND;
+    } else if (request.code != COAP_GET && request.code != COAP_POST && request.code != COAP_PUT) {
+        code = COAP_NOT_ALLOWED;
+    } else {
+        bool success = dispatchRequest(request.request, response);
+        LOGI("CoAP request #%u: %s", request.message_id, success ? "success" : "failed");
+        code = !success ? COAP_BAD_REQUEST : request.code == COAP_GET ? COAP_CONTENT : COAP_CHANGED;
+    }
+
+    // Confirmable requests are answered with a piggybacked ACK
+    bool confirmable = request.type == COAP_CON;
+    length = coapBuild(message, confirmable ? COAP_ACK : COAP_NON, code,
+                       confirmable ? request.message_id : coapNextMessageId(), request.token,
+                       request.token_length, observe, response.length() > 0 ? format : COAP_NO_FORMAT,
+                       response.c_str(), response.length());
+    coap_udp_.writeTo(message, length, address, request.port);
+    coapRecordExchange(request.address, request.port, request.message_id, message, length);
+    int64_t elapsed = request.parse_time + (esp_timer_get_time() - start);
+    portENTER_CRITICAL(&api_mux_);
+    coap_stats_.requests++;
+    coap_stats_.time += elapsed;
+    portEXIT_CRITICAL(&api_mux_);
+}
+
+
+void WirelessTask::mqttRequestHandler(MqttMessage &message) {
+    char request[MQTT_REQUEST_SIZE];
+    if (!mqttToRequest(message, request, sizeof(request))) {
+        return;
+    }
+    FixedString<COMMAND_RESPONSE_SIZE> response;
+    bool success = dispatchRequest(request, response);
+    LOGI("MQTT command %s: %s", message.payload, success ? "success" : "failed");
+    mqttPublishResponse(response.c_str(), response.length());
+}
+
+
+void WirelessTask::coapNotifyPositions() {
+    if (!coapObserved()) {
+        return;
+    }
+    last_coap_notify_ = millis();
+    FixedString<COMMAND_RESPONSE_SIZE> positions;
+    positionsToString(motor_positions_, positions);
+    coapNotify(positions.c_str(), [this](uint32_t address, uint16_t port, const uint8_t *data,
+                                         size_t length) {
+        coap_udp_.writeTo(data, length, IPAddress(address), port);
+    });
+}
+
+
+// "<percent>[,<percent>...]" of each motor
+void WirelessTask::positionsToString(const String *positions,
+                                     FixedString<COMMAND_RESPONSE_SIZE> &destination) {
+    for (int i = 0; i < motor_count_; i++) {
+        destination.appendf(i == 0 ? "%s" : ",%s", positions[i].c_str());
+    }
+}
+
+
+// Publishes the state in the TXT records of the mDNS service, so one query inventories all units.
+// Each update is announced to the whole network, hence at most every MDNS_TXT_PERIOD, and only
+// the final positions of moves.
+void WirelessTask::updateServiceTxt() {
+    if (last_txt_update_ != 0 && millis() - last_txt_update_ < MDNS_TXT_PERIOD) {
+        return;
+    }
+    last_txt_update_ = max(millis(), 1UL);
+    uint32_t generation = getSettingsGeneration();
+    if (settings_version_[0] == '\0' || generation != txt_generation_) {
+        txt_generation_ = generation;
+        snprintf(settings_version_, sizeof(settings_version_), "%08x", getSettingsVersion());
+    }
+    FixedString<COMMAND_RESPONSE_SIZE> positions;
+    positionsToString(final_positions_, positions);
+    const char *keys[MDNS_TXT_KEYS] = {"name", "serial", "fw", "pos", "cfg"};
+    String values[MDNS_TXT_KEYS] = {system_task_->getSetting<String>("system_name_"),
+                                    system_task_->getSetting<String>("serial_"),
+                                    system_task_->getSetting<String>("firmware_"),
+                                    positions.c_str(), settings_version_};
+    for (int i = 0; i < MDNS_TXT_KEYS; i++) {
+        if (values[i] != txt_values_[i]) {
+            MDNS.addServiceTxt("_ald", "_tcp", keys[i], values[i].c_str());  // Replaces the old value
+            txt_values_[i] = values[i];
+        }
+    }
+}
+
+
+// Feeds serializeJson() into a CRC without building the string
+struct CrcWriter {
+    uint32_t crc = 0;
+
+    size_t write(uint8_t c) {
+        crc = crc32_le(crc, &c, 1);
+        return 1;
+    }
+
+    size_t write(const uint8_t *buffer, size_t length) {
+        crc = crc32_le(crc, buffer, length);
+        return length;
+    }
+};
+
+
+// CRC32 of the settings of all tasks, the same on units set up the same way. Leaves out what
+// tells units apart: the name, serial, firmware and AP SSID, which derives from the serial; and
+// runtime state: setup mode and the connection attempts; and the credentials.
+uint32_t WirelessTask::getSettingsVersion() {
+    ScopedArena arena;
+    JsonDocument settings(arena.allocator());
+    system_task_->getSettings(settings["system"].to<JsonObject>());
+    JsonObject system = settings["system"];
+    system.remove("system_name_");
+    system.remove("serial_");
+    system.remove("firmware_");
+    getSettings(settings["wireless"].to<JsonObject>());
+    for (int i = 0; i < motor_count_; i++) {
+        motor_tasks_[i]->getSettings(settings["motors"].add<JsonObject>());
+    }
+    JsonObject wireless = settings["wireless"];
+    wireless.remove("ap_ssid_");
+    wireless.remove("setup_mode_");
+    wireless.remove("attempts_");
+    wireless.remove("sta_password_");
+    String mqtt = wireless["mqtt_server_"] | "";
+    wireless["mqtt_server_"] = mqtt.substring(mqtt.lastIndexOf('@') + 1);  // Without user:password@
+    if (settings.overflowed()) {
+        LOGE("JSON arena too small for the settings version");
+    }
+    CrcWriter writer;
+    serializeJson(settings, writer);
+    return writer.crc;
+}
+
+
+// Splits "/uri?name=value&name=value" in place and dispatches it, for requests that aren't HTTP
+// and aren't URL encoded: fleet commands, CoAP and MQTT
+bool WirelessTask::dispatchRequest(char *request, FixedString<COMMAND_RESPONSE_SIZE> &response) {
+    String names[COMMAND_MAX_PARAMS];
+    String values[COMMAND_MAX_PARAMS];
+    CommandParam params[COMMAND_MAX_PARAMS];
+    int count = 0;
+    char *query = strchr(request, '?');
+    if (query != NULL) {
+        *query++ = '\0';
+    }
+    char *saveptr;
+    for (char *pair = query ? strtok_r(query, "&", &saveptr) : NULL; pair != NULL;
+         pair = strtok_r(NULL, "&", &saveptr)) {
+        if (count == COMMAND_MAX_PARAMS) {
+            response.append("too many parameters");
+            return false;
+        }
+        char *value = strchr(pair, '=');
+        if (value != NULL) {
+            *value++ = '\0';
+        }
+        names[count] = pair;
+        values[count] = value != NULL ? value : "";
+        params[count].name = &names[count];
+        params[count].value = &values[count];
+        count++;
+    }
+    return dispatch(request, params, count, response);
+}
+
+
+// Validates the params of a request to /motor, /system or /wireless and sends them to the tasks,
+// shared by HTTP and the fleet protocol. Stops at the first invalid param.
+bool WirelessTask::dispatch(const String &uri, const CommandParam *params, int count,
+                            FixedString<COMMAND_RESPONSE_SIZE> &response) {
+    const String *motor_value = NULL;
+    for (int i = 0; i < count; i++) {
+        const String &param = *params[i].name;
         Command command = hash(param);
         if (command == ERROR_COMMAND) {
             String list_of_commands;
-            if (request->url() == "/motor") {
+            if (uri == "/motor") {
                 list_of_commands =  listMotorCommands();
-            } else if (request->url() == "/system") {
+            } else if (uri == "/system") {
                 list_of_commands =  listSystemCommands();
             } else {
                 list_of_commands =  listWirelessCommands();
             }
-            request->send(400, "text/plain", "failed: <param>=" + param 
-                             + " not accepted\nuse of these <param>=" + list_of_commands);
-            return;
+            response.appendf("failed: <param>=%s not accepted\nuse of these <param>=%s",
+                             param.c_str(), list_of_commands.c_str());
+            return false;
+        } else if (command == MOTOR_INDEX) {
+            motor_value = params[i].value;
         }
     }
 
-    String response = "";
-    bool success = true;
-    Task *task = motor_task_;
-    if (request->url() == "/system") {
-        task = system_task_;
-    } else if (request->url() == "/wireless") {
-        task = this;
+    // Motor commands go to the motor selected with "motor", or to all motors as a gang
+    Task *tasks[MOTOR_COUNT];
+    int task_count = 0;
+    if (uri == "/system") {
+        tasks[task_count++] = system_task_;
+    } else if (uri == "/wireless") {
+        tasks[task_count++] = this;
+    } else if (motor_value != NULL) {
+        int motor = motor_value->toInt();
+        if (motor < 0 || motor >= motor_count_ || (motor == 0 && *motor_value != "0")) {
+            response.append("failed: motor=0~(motors - 1); omit to command all motors");
+            return false;
+        }
+        tasks[task_count++] = motor_tasks_[motor];
+    } else {
+        for (int i = 0; i < motor_count_; i++) {
+            tasks[task_count++] = motor_tasks_[i];
+        }
     }
+    auto send = [&](Message message) {
+        for (int i = 0; i < task_count; i++) {
+            sendTo(tasks[i], message, portMAX_DELAY);
+        }
+    };
 
-    for (int i = 0; i < request->params(); i++) {
-        String param = request->getParam(i)->name();
-        String value_str = request->getParam(param)->value();
+    // "start", "at" and "duration" are sent first so they apply to a move anywhere in the request
+    int order[COMMAND_MAX_PARAMS];
+    int param_count = 0;
+    for (int i = 0; i < count; i++) {
+        Command command = hash(*params[i].name);
+        if (command == MOTOR_START || command == MOTOR_DURATION || command == MOTOR_START_AT) {
+            order[param_count++] = i;
+        }
+    }
+    for (int i = 0; i < count; i++) {
+        Command command = hash(*params[i].name);
+        if (command != MOTOR_START && command != MOTOR_DURATION && command != MOTOR_START_AT) {
+            order[param_count++] = i;
+        }
+    }
+
+    for (int n = 0; n < param_count; n++) {
+        const String &param = *params[order[n]].name;
+        const String &value_str = *params[order[n]].value;
         Command command = hash(param);
-        if (command >= MOTOR_VLCTY && command <= MOTOR_CL_ACCEL) {
-            std::pair<std::function<bool(float)>, String> eval = getCommandEvalFuncf(command);
+        if (command == MOTOR_INDEX) {
+            continue;
+        } else if (command >= MOTOR_VLCTY && command <= MOTOR_CL_ACCEL) {
+            std::pair<std::function<bool(float)>, const char*> eval = getCommandEvalFuncf(command);
             float value = value_str.toFloat();
             if (eval.first(value)) {
-                response += "failed: " + param + eval.second + "\n";
-                success = false;
-                break;
+                response.appendf("failed: %s%s\n", param.c_str(), eval.second);
+                return false;
             }
-            LOGI("Parsed HTTP request: param=%s, value=%.1f", param.c_str(), value);
-            response += "success: " + param + "\n";
-            sendTo(task, Message(command, value), portMAX_DELAY);
+            LOGI("Parsed request: param=%s, value=%.1f", param.c_str(), value);
+            response.appendf("success: %s\n", param.c_str());
+            send(Message(command, value));
+            journalRecord(EVENT_COMMAND, command, static_cast<int32_t>(value * 10));
         } else if (command == WIRELESS_SSID) {
             if (value_str == "") {
-                response += "failed: " + param + " needs to be a non-empty string\n";
-                success = false;
-                break;
+                response.appendf("failed: %s needs to be a non-empty string\n", param.c_str());
+                return false;
             }
-            LOGI("Parsed HTTP request: param=%s, value=%s", param.c_str(), value_str);
-            response += "success: " + param + "\n";
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
             setAndSave(sta_ssid_, value_str, "sta_ssid_");
         } else if (command == WIRELESS_PASS) {
-            LOGI("Parsed HTTP request: param=%s, value=%s", param.c_str(), value_str);
-            response += "success: " + param + "\n";
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
             setAndSave(sta_password_, value_str, "sta_password_");
+        } else if (command == WIRELESS_SYSLOG) {
+            if (value_str.length() >= SYSLOG_HOST_SIZE) {
+                response.appendf("failed: %s=host; at most %d characters, empty to disable\n",
+                                 param.c_str(), SYSLOG_HOST_SIZE - 1);
+                return false;
+            }
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
+            setAndSave(syslog_host_, value_str, "syslog_host_");
+            setSyslogHost(syslog_host_);
+        } else if (command == WIRELESS_NTP) {
+            if (value_str.length() >= CLOCK_SERVER_SIZE) {
+                response.appendf("failed: %s=host[:port]; at most %d characters, empty to disable\n",
+                                 param.c_str(), CLOCK_SERVER_SIZE - 1);
+                return false;
+            }
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
+            setAndSave(ntp_host_, value_str, "ntp_host_");
+            clockSetServer(ntp_host_);
+        } else if (command == WIRELESS_TZ) {
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
+            setAndSave(timezone_, value_str, "timezone_");
+            clockSetTimezone(timezone_);
+            scheduleRebuild();
+        } else if (command == WIRELESS_LOCATN) {
+            if (!setLocation(value_str)) {
+                response.appendf("failed: %s=<latitude>,<longitude>; degrees, north and east positive; "
+                                 "empty to clear\n", param.c_str());
+                return false;
+            }
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
+            setAndSave(location_, value_str, "location_");
+            scheduleRebuild();
+        } else if (command == WIRELESS_MQTT) {
+            if (value_str.length() >= MQTT_SERVER_SIZE) {
+                response.appendf("failed: %s=[user[:password]@]host[:port]; at most %d characters, "
+                                 "empty to disable\n", param.c_str(), MQTT_SERVER_SIZE - 1);
+                return false;
+            }
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
+            setAndSave(mqtt_server_, value_str, "mqtt_server_");
+            mqttSetServer(mqtt_server_);
+        } else if (command == MOTOR_START_AT) {
+            // Sent as "start", late ones still arrive at the end of the duration
+            int64_t wait = static_cast<int64_t>(strtoull(value_str.c_str(), NULL, 10) - clockNow());
+            if (!clockSynced() || wait < -MOTION_START_MAX || wait > MOTION_START_MAX) {
+                response.appendf("failed: %s=<ms since epoch>; within 60 s, needs the clock to be "
+                                 "synchronized\n", param.c_str());
+                return false;
+            }
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            send(Message(MOTOR_START, static_cast<int>(wait)));
         } else if (command == SYSTEM_RENAME) {
             if (value_str.length() > 30) {
-                response += "failed: " + param + " needs less than 30 characters long\n";
-                success = false;
-                break;
+                response.appendf("failed: %s needs less than 30 characters long\n", param.c_str());
+                return false;
             }
-            LOGI("Parsed HTTP request: param=%s, value=%s", param.c_str(), value_str);
-            response += "success: " + param + "\n";
+            LOGI("Parsed request: param=%s, value=%s", param.c_str(), value_str.c_str());
+            response.appendf("success: %s\n", param.c_str());
+            journalRecord(EVENT_COMMAND, command);
             int shift[4] = {24, 16, 8, 0};
             int temp_value = 2147483648;
             for (int i = 0; i < value_str.length(); i += 4) {
@@ -254,34 +939,27 @@ void WirelessTask::httpRequestHandler(AsyncWebServerRequest *request) {
                     int shifted = static_cast<int>(value_str.charAt(j)) << shift[j % 4];
                     temp_value |= shifted;
                 }
-                sendTo(task, Message(command, temp_value), portMAX_DELAY);
+                send(Message(command, temp_value));
                 temp_value = 0;
             }
             if (value_str.length() % 4 == 0) {
-                sendTo(task, Message(command, 0), portMAX_DELAY);
+                send(Message(command, 0));
             }
         } else {
-            std::pair<std::function<bool(int)>, String> eval = getCommandEvalFunc(command);
+            std::pair<std::function<bool(int)>, const char*> eval = getCommandEvalFunc(command);
             int value = value_str.toInt();
-            if (eval.first(value) || (eval.second != "" && value == 0 && value_str != "0")) {
-                response += "failed: " + param + eval.second + "\n";
-                success = false;
-                break;
+            if (eval.first(value) || (eval.second[0] != '\0' && value == 0 && value_str != "0")) {
+                response.appendf("failed: %s%s\n", param.c_str(), eval.second);
+                return false;
             }
-            LOGI("Parsed HTTP request: param=%s, value=%u", param.c_str(), value);
-            response += "success: " + param + "\n";
-            sendTo(task, Message(command, value), portMAX_DELAY);
+            LOGI("Parsed request: param=%s, value=%u", param.c_str(), value);
+            response.appendf("success: %s\n", param.c_str());
+            send(Message(command, value));
+            journalRecord(EVENT_COMMAND, command, value);
         }
     }
 
-    if (success) {
-        request->send(200, "text/plain", response);
-    } else {
-        request->send(400, "text/plain", response);
-    }
-
-    delay(100 / portTICK_PERIOD_MS);
-    websocket.textAll(getJSON());
+    return true;
 }
 
 
@@ -311,11 +989,11 @@ void WirelessTask::wsEventHandler(AsyncWebSocket *server, AsyncWebSocketClient *
 
 String WirelessTask::htmlStringProcessor(const String& var) {
     if (var == "SLIDER") {
-        return motor_position_;
+        return motor_positions_[0];
     } else if (var == "AP_SSID") {
         return ap_ssid_;
     } else if (var == "NAME") {
-        return system_task_->getSettings()["system_name_"];
+        return system_task_->getSetting<String>("system_name_");
     } else if (var == "AP_SSID") {
         return ap_ssid_;
     }
@@ -324,19 +1002,143 @@ String WirelessTask::htmlStringProcessor(const String& var) {
 
 
 String WirelessTask::getJSON() {
-    JsonDocument all_settings;
-    all_settings["motor_position"] = motor_position_;
-    all_settings["system"] = system_task_->getSettings();
-    all_settings["wireless"] = getSettings();
-    all_settings["motor"] = motor_task_->getSettings();
+    ScopedArena arena;
+    JsonDocument all_settings(arena.allocator());
+    all_settings["motor_position"] = motor_positions_[0];
+    all_settings["travel_time"] = motor_travel_times_[0];
+    system_task_->getSettings(all_settings["system"].to<JsonObject>());
+    getSettings(all_settings["wireless"].to<JsonObject>());
+    motor_tasks_[0]->getSettings(all_settings["motor"].to<JsonObject>());
+    if (motor_count_ > 1) {
+        // The first motor is also "motor" and "motor_position" of a single motor controller
+        JsonArray motors = all_settings["motors"].to<JsonArray>();
+        for (int i = 0; i < motor_count_; i++) {
+            JsonObject motor = motors.add<JsonObject>();
+            motor["position"] = motor_positions_[i];
+            motor["travel_time"] = motor_travel_times_[i];
+            motor_tasks_[i]->getSettings(motor["settings"].to<JsonObject>());
+        }
+    }
+    breadcrumbsToJson(all_settings["reset"].to<JsonObject>());
+    heapStatsToJson(all_settings["heap"].to<JsonObject>());
+    clockToJson(all_settings["clock"].to<JsonObject>());
+    solarToJson(all_settings["sun"].to<JsonObject>());
+    mqttToJson(all_settings["mqtt"].to<JsonObject>());
+    portENTER_CRITICAL(&api_mux_);
+    ApiStats http = http_stats_;
+    ApiStats coap = coap_stats_;
+    portEXIT_CRITICAL(&api_mux_);
+    JsonObject api = all_settings["api"].to<JsonObject>();
+    api["http"]["requests"] = http.requests;
+    api["http"]["time_us"] = http.time;
+    coapToJson(api["coap"].to<JsonObject>());
+    api["coap"]["requests"] = coap.requests;
+    api["coap"]["time_us"] = coap.time;
+    Task *tasks[] = {system_task_, this, led_task_};
+    for (Task *task : tasks) {
+        all_settings["stacks"][task->getName()] = task->getStackHeadroom();
+    }
+    for (int i = 0; i < motor_count_; i++) {
+        all_settings["stacks"][motor_tasks_[i]->getName()] = motor_tasks_[i]->getStackHeadroom();
+    }
+    JsonArenaStats arena_stats = jsonArenaGetStats();
+    all_settings["heap"]["json_arena"]["peak"] = arena_stats.peak;
+    all_settings["heap"]["json_arena"]["failures"] = arena_stats.failures;
+    Odometer odometer = odometerGet();
+    all_settings["odometer"]["steps"] = odometer.steps;
+    all_settings["odometer"]["moves"] = odometer.moves;
+    all_settings["odometer"]["stalls"] = odometer.stalls;
+    all_settings["odometer"]["startups"] = odometer.startups;
+    all_settings["odometer"]["powered_s"] = odometer.powered;
+    #if COMPILELOGS
+        LogStats log_stats = logGetStats();
+        all_settings["logger"]["recorded"] = log_stats.recorded;
+        all_settings["logger"]["dropped"] = log_stats.dropped;
+        all_settings["logger"]["cost_ns"] = log_stats.cost_ns;
+        all_settings["logger"]["stream_dropped"] = log_stats.stream_dropped;
+    #endif
+    if (all_settings.overflowed()) {
+        LOGE("JSON arena too small for all settings");
+    }
     String result;
     serializeJson(all_settings, result);
     return result;
 }
 
 
+// From any task, resolved by streamLogs()
+void WirelessTask::setSyslogHost(const String &host) {
+    portENTER_CRITICAL(&syslog_mux_);
+    strlcpy(syslog_next_host_, host.c_str(), sizeof(syslog_next_host_));
+    syslog_resolved_ = false;
+    portEXIT_CRITICAL(&syslog_mux_);
+}
+
+
+void WirelessTask::streamLogs() {
+    #if COMPILELOGS
+        if (!syslog_resolved_ && WiFi.status() == WL_CONNECTED) {
+            // A copy, a server set while resolving is resolved again
+            char host[SYSLOG_HOST_SIZE];
+            portENTER_CRITICAL(&syslog_mux_);
+            memcpy(host, syslog_next_host_, sizeof(host));
+            syslog_resolved_ = true;
+            portEXIT_CRITICAL(&syslog_mux_);
+            syslog_ip_ = IPAddress();
+            if (host[0] != '\0' && !WiFi.hostByName(host, syslog_ip_)) {
+                LOGE("Failed to resolve syslog server %s", host);
+            }
+        }
+
+        bool syslog_enabled = static_cast<uint32_t>(syslog_ip_) != 0 && WiFi.status() == WL_CONNECTED;
+        bool websocket_enabled = log_websocket.count() > 0;
+        logStreamEnable(syslog_enabled || websocket_enabled);
+
+        // Lines that can't be sent right away are dropped, the consumers only get best effort
+        char line[LOG_LINE_SIZE];
+        LogLevel level;
+        for (int i = 0; i < LOG_STREAM_BATCH && logStreamRead(line, sizeof(line), level); i++) {
+            if (websocket_enabled && log_websocket.availableForWriteAll()) {
+                log_websocket.textAll(line);
+            }
+            if (syslog_enabled) {
+                sendSyslog(level, line);
+            }
+        }
+    #endif
+}
+
+
+void WirelessTask::sendSyslog(LogLevel level, const char *line) {
+    #if COMPILELOGS
+        // RFC 5424 without structured data and message ID, and timestamp until synchronized
+        static const uint8_t severities[] = {3, 6, 7};  // ERROR, INFO, DEBUG
+        char timestamp[32] = "-";
+        uint64_t now = clockNow();
+        if (now != 0) {
+            time_t seconds = now / 1000;
+            struct tm utc;
+            gmtime_r(&seconds, &utc);
+            size_t length = strftime(timestamp, sizeof(timestamp), "%Y-%m-%dT%H:%M:%S", &utc);
+            snprintf(timestamp + length, sizeof(timestamp) - length, ".%03uZ",
+                     static_cast<unsigned>(now % 1000));
+        }
+        char packet[LOG_LINE_SIZE + 96];
+        int length = snprintf(packet, sizeof(packet), "<%u>1 %s %s yun - - - %s",
+                              SYSLOG_FACILITY * 8 + severities[level], timestamp,
+                              ap_ssid_.c_str(), line);
+        length = min(length, static_cast<int>(sizeof(packet)) - 1);
+        syslog_udp_.writeTo(reinterpret_cast<uint8_t*>(packet), length, syslog_ip_, SYSLOG_PORT);
+    #endif
+}
+
+
 void WirelessTask::addMotorTask(Task *task) {
-    motor_task_ = task;
+    assert(motor_count_ < MOTOR_COUNT);
+    motor_positions_[motor_count_] = "0";
+    final_positions_[motor_count_] = "0";
+    motor_travel_times_[motor_count_] = 0;
+    motor_tasks_[motor_count_++] = task;
 }
 
 
@@ -345,6 +1147,11 @@ void WirelessTask::addSystemTask(Task *task) {
 }
 
 
+void WirelessTask::addLedTask(Task *task) {
+    led_task_ = task;
+}
+
+
 void WirelessTask::addSystemSleepTimer(TimerHandle_t timer) {
     system_sleep_timer_ = timer;
 }
\ No newline at end of file
@@ -8,19 +8,46 @@
 **/
 #include <WiFi.h>
 #include <AsyncTCP.h>
+#include <AsyncUDP.h>
 #include <ESPAsyncWebServer.h>
 #include <ESPmDNS.h>
 #include <FunctionalInterrupt.h>  // std:bind()
 #include <esp_task_wdt.h>
+#include <rom/crc.h>  // crc32_le()
 #include "task.h"
 #include "index.h"  // Index HTML webpage
+#include "led_task.h"
+#include "fleet.h"
+#include "coap.h"
+#include "clock.h"
+#include "mqtt.h"
+#include "motion.h"
 
 #if COMPILEOTA
     #include <ArduinoOTA.h>
 #endif
 
+// Bytes, see "stacks" in /json. Not yet measured on a unit; the deepest path is a queued MQTT,
+// CoAP or fleet command, about 1 KB of request and response buffers plus dispatchRequest()
+#define WIRELESS_TASK_STACK 8192
+#define WIRELESS_TASK_QUEUE 99
 #define MAX_ATTEMPTS 9
 #define WDT_DURATION 9  // Sec
+#define SYSLOG_PORT     514
+#define SYSLOG_FACILITY 16  // local0
+#define SYSLOG_HOST_SIZE 64  // Bytes, longest syslog server
+#define LOG_STREAM_BATCH 8  // Max lines streamed per loop
+#define RSSI_SAMPLE_PERIOD 1000  // ms
+#define MDNS_TXT_PERIOD 10000    // ms, between updates of the TXT records, each is multicast
+#define MDNS_TXT_KEYS   5
+
+
+// Requests handled and the time spent handling them, to compare the request paths. Counted in the
+// web server's task and the wireless task and read by either, so guarded by api_mux_
+struct ApiStats {
+    uint32_t requests = 0;
+    uint64_t time     = 0;  // us
+};
 
 
 class WirelessTask : public Task {
@@ -29,6 +56,7 @@ public:
     ~WirelessTask();
     void addMotorTask(Task *task);
     void addSystemTask(Task *task);
+    void addLedTask(Task *task);
     void addSystemSleepTimer(TimerHandle_t timer);
 
 protected:
@@ -37,25 +65,76 @@ protected:
 private:
     AsyncWebServer webserver;   // Create AsyncWebServer object on port 80
     AsyncWebSocket websocket;
+    AsyncWebSocket log_websocket;  // Streams log output to clients of /logs
+    AsyncUDP syslog_udp_;
+    String    syslog_host_     = "";  // Syslog server, empty to disable
+    String    ntp_host_        = "pool.ntp.org";  // SNTP server, empty to disable
+    String    timezone_        = "UTC0";          // POSIX TZ of the schedules
+    String    location_        = "";              // "latitude,longitude" for sunrise/sunset
+    String    mqtt_server_     = "";              // MQTT broker, empty to disable
+    IPAddress syslog_ip_;
+    // A new syslog server, set by whichever task dispatches it and resolved by this one
+    portMUX_TYPE syslog_mux_ = portMUX_INITIALIZER_UNLOCKED;
+    char      syslog_next_host_[SYSLOG_HOST_SIZE] = "";
+    volatile bool syslog_resolved_ = false;
     String ap_ssid_      = "";  // SSID (hostname) for AP
     String sta_ssid_     = "";  // SSID (hostname) for WiFi
     String sta_password_ = "";  // Password for WiFi
     bool   setup_mode_   = false;
     bool   initialized_  = true;
+    bool   connected_    = false;
+    uint32_t last_rssi_sample_ = 0;  // ms
+    AsyncUDP      fleet_udp_;
+    QueueHandle_t fleet_queue_;       // Requests from the UDP task
+    FleetPacket   fleet_inbox_;
+    int           fleet_groups_ = 0;  // Bit n - 1 set if a member of group n
+    AsyncUDP      coap_udp_;
+    QueueHandle_t coap_queue_;        // Requests from the UDP task
+    CoapRequest   coap_inbox_;
+    uint32_t      last_coap_notify_ = 0;  // ms
+    QueueHandle_t mqtt_queue_;        // Commands from the MQTT client's task
+    MqttMessage   mqtt_inbox_;
+    ApiStats      http_stats_;
+    ApiStats      coap_stats_;
+    portMUX_TYPE  api_mux_ = portMUX_INITIALIZER_UNLOCKED;
+    String   txt_values_[MDNS_TXT_KEYS];  // Published in the TXT records of the mDNS service
+    uint32_t txt_generation_ = 0;         // Of the settings the version was computed from
+    uint32_t last_txt_update_ = 0;        // ms, 0 to update right away
+    char     settings_version_[9] = "";
     int    attempts_     = 1;
 
-    Task *motor_task_;    // To send messages to motor task
+    Task *motor_tasks_[MOTOR_COUNT];  // To send messages to motor tasks
+    uint8_t motor_count_ = 0;
     Task *system_task_;   // To send messages to system task
+    Task *led_task_;      // To indicate connection status
     TimerHandle_t system_sleep_timer_;  // Prevent system sleep before processing incoming messages
-    String motor_position_ = "0";
+    String motor_positions_[MOTOR_COUNT];
+    String final_positions_[MOTOR_COUNT];  // Of finished moves, for the TXT records
+    uint32_t motor_travel_times_[MOTOR_COUNT];  // ms, fastest move between 0 and 100%
 
     void loadSettings();
     void connectWifi();
     void routing();
     bool isPrefetch(AsyncWebServerRequest *request);
     void httpRequestHandler(AsyncWebServerRequest *request);
+    void fleetPacketHandler(AsyncUDPPacket &packet);
+    void fleetRequestHandler(FleetPacket &request);
+    void coapPacketHandler(AsyncUDPPacket &packet);
+    void coapRequestHandler(CoapRequest &request);
+    void coapNotifyPositions();
+    void mqttRequestHandler(MqttMessage &message);
+    void positionsToString(const String *positions, FixedString<COMMAND_RESPONSE_SIZE> &destination);
+    void updateServiceTxt();
+    uint32_t getSettingsVersion();
+    bool dispatchRequest(char *request, FixedString<COMMAND_RESPONSE_SIZE> &response);
+    bool setLocation(const String &location);
+    bool dispatch(const String &uri, const CommandParam *params, int count,
+                  FixedString<COMMAND_RESPONSE_SIZE> &response);
     void wsEventHandler(AsyncWebSocket *server, AsyncWebSocketClient *client,
                         AwsEventType type, void *arg, uint8_t *data, size_t len);
     String htmlStringProcessor(const String& var);
     String getJSON();
+    void setSyslogHost(const String &host);
+    void streamLogs();
+    void sendSyslog(LogLevel level, const char *line);
 };
\ No newline at end of file
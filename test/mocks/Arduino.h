@@ -0,0 +1,167 @@
+#pragma once
+/**
+    Arduino.h - Host stand-ins for the parts of Arduino-ESP32 and FreeRTOS the tested modules use
+    Author: Jason Chen, 2024
+
+    Tests include the module's .cpp to reach its state, with test/mocks ahead of the frameworks on
+    the include path. Time only moves when a test advances mockMicros(), and the tests run in one
+    thread, so critical sections do nothing.
+**/
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <stdarg.h>
+#include <assert.h>
+#include <algorithm>
+#include <functional>
+#include <string>
+
+using std::min;
+using std::max;
+
+
+// Of newlib, missing from glibc before 2.38
+inline size_t mockStrlcpy(char *destination, const char *source, size_t size) {
+    size_t length = strlen(source);
+    if (size > 0) {
+        size_t copied = length < size - 1 ? length : size - 1;
+        memcpy(destination, source, copied);
+        destination[copied] = '\0';
+    }
+    return length;
+}
+#define strlcpy mockStrlcpy
+
+
+#define PI 3.1415926535897932384626433832795
+#define radians(deg) ((deg) * PI / 180.0)
+#define degrees(rad) ((rad) * 180.0 / PI)
+#define HIGH 1
+#define LOW  0
+#define IRAM_ATTR
+#define DRAM_ATTR
+
+
+// us since boot, esp_timer_get_time() and millis() of the tested modules
+inline int64_t &mockMicros() {
+    static int64_t micros = 0;
+    return micros;
+}
+
+inline int64_t esp_timer_get_time() { return mockMicros(); }
+inline unsigned long millis() { return static_cast<unsigned long>(mockMicros() / 1000); }
+
+
+typedef int portMUX_TYPE;
+#define portMUX_INITIALIZER_UNLOCKED 0
+#define portENTER_CRITICAL(mux) (void)(mux)
+#define portEXIT_CRITICAL(mux)  (void)(mux)
+
+
+// FreeRTOS: tasks and queues are never created, mutexes count how many are held and timers keep
+// their callback for the test to call
+typedef int BaseType_t;
+typedef unsigned UBaseType_t;
+typedef uint32_t TickType_t;
+typedef uint8_t StackType_t;
+typedef void *TaskHandle_t;
+typedef void *QueueHandle_t;
+typedef void *SemaphoreHandle_t;
+typedef void *TimerHandle_t;
+typedef void (*TaskFunction_t)(void *parameter);
+typedef void (*TimerCallbackFunction_t)(TimerHandle_t timer);
+struct StaticTask_t {};
+struct StaticQueue_t {};
+struct StaticTimer_t {};
+
+#define pdFALSE 0
+#define pdTRUE  1
+#define pdPASS  1
+#define portMAX_DELAY 0xffffffff
+#define pdMS_TO_TICKS(ms) (ms)
+
+inline BaseType_t xTaskCreatePinnedToCore(TaskFunction_t, const char*, uint32_t, void*, UBaseType_t,
+                                          TaskHandle_t*, BaseType_t) { return pdFALSE; }
+inline QueueHandle_t xQueueCreate(UBaseType_t, UBaseType_t) { return NULL; }
+
+inline int &mockMutexesHeld() {
+    static int held = 0;
+    return held;
+}
+
+inline SemaphoreHandle_t xSemaphoreCreateMutex() {
+    static int mutex;
+    return &mutex;
+}
+
+inline BaseType_t xSemaphoreTake(SemaphoreHandle_t, TickType_t) {
+    mockMutexesHeld()++;
+    return pdTRUE;
+}
+
+inline BaseType_t xSemaphoreGive(SemaphoreHandle_t) {
+    mockMutexesHeld()--;
+    return pdTRUE;
+}
+
+inline TimerCallbackFunction_t &mockTimerCallback() {
+    static TimerCallbackFunction_t callback = NULL;
+    return callback;
+}
+
+inline TimerHandle_t xTimerCreate(const char*, TickType_t, UBaseType_t, void*,
+                                  TimerCallbackFunction_t callback) {
+    mockTimerCallback() = callback;
+    return &mockTimerCallback();
+}
+
+inline BaseType_t xTimerStart(TimerHandle_t, TickType_t) { return pdPASS; }
+
+
+class IPAddress {
+public:
+    IPAddress() : address_(0) {}
+    IPAddress(uint32_t address) : address_(address) {}
+    IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d) : address_(a | b << 8 | c << 16 | d << 24) {}
+    operator uint32_t() const { return address_; }
+
+private:
+    uint32_t address_;
+};
+
+
+class Print {
+public:
+    std::string text;
+    void print(const char *value) { text += value; }
+    void print(int value) { text += std::to_string(value); }
+    void printf(const char *format, ...) {
+        char line[256];
+        va_list args;
+        va_start(args, format);
+        vsnprintf(line, sizeof(line), format, args);
+        va_end(args);
+        text += line;
+    }
+};
+
+
+class String : public std::string {
+public:
+    String(const char *text = "") : std::string(text) {}
+    String(const std::string &text) : std::string(text) {}
+    String(int value) : std::string(std::to_string(value)) {}
+    String(float value, int decimals) {
+        char text[32];
+        snprintf(text, sizeof(text), "%.*f", decimals, value);
+        assign(text);
+    }
+    int indexOf(char c) const { size_t at = find(c); return at == npos ? -1 : static_cast<int>(at); }
+    int lastIndexOf(char c) const { size_t at = rfind(c); return at == npos ? -1 : static_cast<int>(at); }
+    String substring(int from, int to = -1) const {
+        return to < 0 ? substr(from) : substr(from, to - from);
+    }
+    long toInt() const { return atol(c_str()); }
+};
@@ -0,0 +1,62 @@
+#pragma once
+// Stand-in of the ArduinoJson 7 the tested modules use: an object keeps its members as text, an
+// array its objects
+#include <Arduino.h>
+#include <map>
+#include <memory>
+#include <vector>
+
+
+struct RawJson {
+    std::string text;
+};
+
+template<class T>
+RawJson serialized(const T &text) {
+    return RawJson{text};
+}
+
+
+class JsonObject {
+public:
+    class Member {
+    public:
+        Member(std::string &text) : text_(text) {}
+        Member &operator=(const char *value) { text_ = std::string("\"") + value + "\""; return *this; }
+        Member &operator=(char *value) { return *this = const_cast<const char*>(value); }
+        Member &operator=(const String &value) { return *this = value.c_str(); }
+        Member &operator=(const RawJson &value) { text_ = value.text; return *this; }
+        Member &operator=(bool value) { text_ = value ? "true" : "false"; return *this; }
+        template<class T>
+        Member &operator=(T value) { text_ = std::to_string(value); return *this; }
+
+    private:
+        std::string &text_;
+    };
+
+    JsonObject() : members_(new std::map<std::string, std::string>()) {}
+    Member operator[](const char *key) { return Member((*members_)[key]); }
+    std::string get(const char *key) const {
+        auto member = members_->find(key);
+        return member == members_->end() ? "" : member->second;
+    }
+
+private:
+    std::shared_ptr<std::map<std::string, std::string>> members_;
+};
+
+
+class JsonArray {
+public:
+    JsonArray() : elements_(new std::vector<JsonObject>()) {}
+    template<class T>
+    T add() {
+        elements_->push_back(T());
+        return elements_->back();
+    }
+    size_t size() const { return elements_->size(); }
+    JsonObject operator[](size_t index) const { return (*elements_)[index]; }
+
+private:
+    std::shared_ptr<std::vector<JsonObject>> elements_;
+};
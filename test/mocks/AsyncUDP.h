@@ -0,0 +1,43 @@
+#pragma once
+// Stand-in of AsyncUDP: keeps the last datagram written, and a test hands datagrams to the handler
+#include <Arduino.h>
+#include <vector>
+
+
+class AsyncUDPPacket {
+public:
+    AsyncUDPPacket(const uint8_t *data, size_t length) : data_(data), length_(length) {}
+    const uint8_t *data() { return data_; }
+    size_t length() { return length_; }
+
+private:
+    const uint8_t *data_;
+    size_t length_;
+};
+
+
+typedef std::function<void(AsyncUDPPacket &packet)> AuPacketHandlerFunction;
+
+
+class AsyncUDP {
+public:
+    AuPacketHandlerFunction handler;
+    std::vector<uint8_t> sent;  // Last datagram written
+    IPAddress sent_address;
+    uint16_t  sent_port = 0;
+    int       writes = 0;
+
+    bool connected() { return listening_; }
+    bool listen(uint16_t) { listening_ = true; return true; }
+    void onPacket(AuPacketHandlerFunction packet_handler) { handler = packet_handler; }
+    size_t writeTo(const uint8_t *data, size_t length, const IPAddress &address, uint16_t port) {
+        sent.assign(data, data + length);
+        sent_address = address;
+        sent_port = port;
+        writes++;
+        return length;
+    }
+
+private:
+    bool listening_ = false;
+};
@@ -0,0 +1,96 @@
+#pragma once
+// Stand-in of the Arduino-ESP32 file system API, on files of a host directory. Counts the file
+// operations done while a mutex is held, which the tested modules avoid.
+#include <Arduino.h>
+#include <sys/stat.h>
+
+
+#define FILE_READ   "r"
+#define FILE_WRITE  "w"
+#define FILE_APPEND "a"
+
+
+inline int &mockFileOpsLocked() {
+    static int count = 0;
+    return count;
+}
+
+inline void mockFileOp() {
+    if (mockMutexesHeld() > 0) {
+        mockFileOpsLocked()++;
+    }
+}
+
+
+class File {
+public:
+    File(FILE *file = NULL) : file_(file) {}
+    explicit operator bool() const { return file_ != NULL; }
+    size_t size() {
+        mockFileOp();
+        long at = ftell(file_);
+        fseek(file_, 0, SEEK_END);
+        long size = ftell(file_);
+        fseek(file_, at, SEEK_SET);
+        return size;
+    }
+    size_t read(uint8_t *buffer, size_t size) {
+        mockFileOp();
+        return file_ == NULL ? 0 : fread(buffer, 1, size, file_);
+    }
+    size_t write(const uint8_t *buffer, size_t size) {
+        mockFileOp();
+        return file_ == NULL ? 0 : fwrite(buffer, 1, size, file_);
+    }
+    bool seek(uint32_t position) {
+        mockFileOp();
+        return file_ != NULL && fseek(file_, position, SEEK_SET) == 0;
+    }
+    void close() {
+        if (file_ != NULL) {
+            mockFileOp();
+            fclose(file_);
+        }
+        file_ = NULL;
+    }
+
+private:
+    FILE *file_;
+};
+
+
+namespace fs {
+
+class FS {
+public:
+    FS() {
+        char root[] = "/tmp/littlefs.XXXXXX";
+        root_ = mkdtemp(root);
+    }
+    File open(const char *path, const char *mode) {
+        mockFileOp();
+        return File(fopen((root_ + path).c_str(), mode));
+    }
+    bool exists(const char *path) {
+        mockFileOp();
+        struct stat status;
+        return stat((root_ + path).c_str(), &status) == 0;
+    }
+    bool mkdir(const char *path) {
+        mockFileOp();
+        return ::mkdir((root_ + path).c_str(), 0777) == 0;
+    }
+    bool remove(const char *path) {
+        mockFileOp();
+        return ::remove((root_ + path).c_str()) == 0;
+    }
+    bool rename(const char *from, const char *to) {
+        mockFileOp();
+        return ::rename((root_ + from).c_str(), (root_ + to).c_str()) == 0;
+    }
+
+private:
+    std::string root_;
+};
+
+}  // namespace fs
@@ -0,0 +1,6 @@
+#pragma once
+// Stand-in of the LittleFS partition: an empty temporary directory for each test run
+#include "FS.h"
+
+
+static fs::FS LITTLEFS;
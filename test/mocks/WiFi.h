@@ -0,0 +1,21 @@
+#pragma once
+// Stand-in of the WiFi of Arduino-ESP32: every host resolves to 127.0.0.1 unless a test fails the
+// lookups, and the lookups are counted
+#include <Arduino.h>
+
+
+struct MockWiFi {
+    int  lookups  = 0;
+    bool resolves = true;
+
+    bool hostByName(const char *host, IPAddress &address) {
+        lookups++;
+        if (!resolves || host[0] == '\0') {
+            return false;
+        }
+        address = IPAddress(127, 0, 0, 1);
+        return true;
+    }
+};
+
+static MockWiFi WiFi;
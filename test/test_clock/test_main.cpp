@@ -0,0 +1,188 @@
+// SNTP syncs of the clock, see src/clock.h: requests go out through clockPoll() and the answers of
+// a simulated server come back through the UDP handler, on the fake time of test/mocks
+#include <unity.h>
+#include "clock.cpp"
+
+
+#define UNIX_START 1750000000LL  // s since epoch of the server at boot
+
+
+// The server's clock: the unit's timer since UNIX_START, offset and running fast by ppm
+static int64_t server_offset;  // us
+static double  server_ppm;
+
+static int64_t serverAt(int64_t local) {
+    return UNIX_START * 1000000 + local + server_offset + static_cast<int64_t>(local * server_ppm * 1e-6);
+}
+
+
+static void putNtp(uint8_t *at, int64_t us) {
+    uint32_t seconds = us / 1000000 + NTP_TO_UNIX;
+    uint32_t fraction = static_cast<uint32_t>((static_cast<uint64_t>(us % 1000000) << 32) / 1000000);
+    for (int i = 0; i < 4; i++) {
+        at[i] = seconds >> (24 - 8 * i);
+        at[4 + i] = fraction >> (24 - 8 * i);
+    }
+}
+
+
+// Answers the request clockPoll() sent, after a round trip of 20 ms
+static void answer() {
+    TEST_ASSERT_EQUAL(NTP_PACKET_SIZE, udp.sent.size());
+    uint8_t packet[NTP_PACKET_SIZE] = {0x24, 2};  // Server mode, stratum 2
+    memcpy(packet + 24, udp.sent.data() + 40, 8);  // Originate is the transmit of the request
+    mockMicros() += 10000;
+    putNtp(packet + 32, serverAt(mockMicros()));
+    putNtp(packet + 40, serverAt(mockMicros()));
+    mockMicros() += 10000;
+    AsyncUDPPacket received(packet, sizeof(packet));
+    udp.handler(received);
+}
+
+
+// A sync a period after the last one
+static void sync() {
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL;
+    clockPoll();
+    answer();
+}
+
+
+// A sync right after the last one, too soon for the drift to be measured again
+static void syncAgain() {
+    requested = 0;
+    clockPoll();
+    answer();
+}
+
+
+static int64_t error() {  // us, of the clock against the server
+    return timeAt(mockMicros()) - serverAt(mockMicros());
+}
+
+
+void setUp() {}
+
+
+void tearDown() {}
+
+
+// The tests build on each other, like the syncs of a unit that stays up
+void test_first_sync_steps() {
+    mockMicros() = 5000000;
+    clockSetServer("pool.ntp.org");
+    TEST_ASSERT_FALSE(clockSynced());
+    clockPoll();
+    TEST_ASSERT_EQUAL(1, WiFi.lookups);
+    TEST_ASSERT_EQUAL(CLOCK_NTP_PORT, udp.sent_port);
+    answer();
+    TEST_ASSERT_TRUE(clockSynced());
+    TEST_ASSERT_INT64_WITHIN(1000, 0, error());
+}
+
+
+void test_step_isnt_slewed_again() {
+    server_offset = 5000000;
+    sync();
+    TEST_ASSERT_INT64_WITHIN(1000, 0, error());
+    TEST_ASSERT_FLOAT_WITHIN(0.01, drift, rate);
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL / 2;
+    TEST_ASSERT_INT64_WITHIN(1000, 0, error());
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL / 2;
+    TEST_ASSERT_INT64_WITHIN(1000, 0, error());
+}
+
+
+void test_small_error_is_slewed() {
+    server_offset = 5000000;
+    sync();
+    server_offset += 400000;
+    TEST_ASSERT_INT64_WITHIN(2000, -400000, error());
+    syncAgain();
+    TEST_ASSERT_INT64_WITHIN(2000, -400000, error());  // No jump
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL / 2;
+    TEST_ASSERT_INT64_WITHIN(2000, -200000, error());
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL / 2;
+    TEST_ASSERT_INT64_WITHIN(2000, 0, error());
+}
+
+
+void test_drift_is_tracked() {
+    // The server runs 50 ppm fast from now on
+    server_offset = 5400000 - static_cast<int64_t>(mockMicros() * 50e-6);
+    server_ppm = 50;
+    for (int i = 0; i < 8; i++) {
+        sync();
+    }
+    TEST_ASSERT_FLOAT_WITHIN(5, 50, drift);
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL;
+    TEST_ASSERT_INT64_WITHIN(30000, 0, error());
+}
+
+
+void test_never_goes_backwards() {
+    uint64_t shown = clockNow();
+    server_offset -= 3000000;
+    sync();
+    TEST_ASSERT_TRUE(clockNow() >= shown);
+}
+
+
+void test_server_resolved_once() {
+    int lookups = WiFi.lookups;
+    for (int i = 0; i < 3; i++) {
+        sync();
+    }
+    TEST_ASSERT_EQUAL(lookups, WiFi.lookups);
+}
+
+
+void test_server_resolved_again_when_unanswered() {
+    int lookups = WiFi.lookups;
+    for (int i = 0; i <= CLOCK_RESOLVE_FAILURES; i++) {
+        mockMicros() += CLOCK_SYNC_PERIOD * 1000LL;
+        clockPoll();
+    }
+    TEST_ASSERT_EQUAL(lookups + 1, WiFi.lookups);
+    answer();
+}
+
+
+void test_new_server() {
+    clockSetServer("192.168.1.2:1123");
+    JsonObject json;
+    clockToJson(json);
+    std::string server = json.get("server");
+    TEST_ASSERT_EQUAL_STRING("\"192.168.1.2:1123\"", server.c_str());
+    int writes = udp.writes;
+    int lookups = WiFi.lookups;
+    clockPoll();  // Applied and requested right away
+    TEST_ASSERT_EQUAL(writes + 1, udp.writes);
+    TEST_ASSERT_EQUAL(lookups + 1, WiFi.lookups);
+    TEST_ASSERT_EQUAL(1123, udp.sent_port);
+    TEST_ASSERT_EQUAL_STRING("192.168.1.2", server_host);
+}
+
+
+void test_disabled() {
+    clockSetServer("");
+    int writes = udp.writes;
+    mockMicros() += CLOCK_SYNC_PERIOD * 1000LL;
+    clockPoll();
+    TEST_ASSERT_EQUAL(writes, udp.writes);
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_sync_steps);
+    RUN_TEST(test_step_isnt_slewed_again);
+    RUN_TEST(test_small_error_is_slewed);
+    RUN_TEST(test_drift_is_tracked);
+    RUN_TEST(test_never_goes_backwards);
+    RUN_TEST(test_server_resolved_once);
+    RUN_TEST(test_server_resolved_again_when_unanswered);
+    RUN_TEST(test_new_server);
+    RUN_TEST(test_disabled);
+    return UNITY_END();
+}
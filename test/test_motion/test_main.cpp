@@ -0,0 +1,70 @@
+// Velocity profiles and the position conversions of MotorTaskT, see src/motion.h
+#include <unity.h>
+#include "motion.h"
+
+
+void setUp() {}
+void tearDown() {}
+
+
+void test_motion_time() {
+    TEST_ASSERT_EQUAL_UINT32(0, motionTime(0, 1, 1));
+    TEST_ASSERT_EQUAL_UINT32(0, motionTime(1, 0, 1));
+    // Cruises: 10 rev at 2 rev/s, 1 s accelerating and 1 s braking at 2 rev/s^2
+    TEST_ASSERT_EQUAL_UINT32(6000, motionTime(10, 2, 2));
+    // A triangle: 1 rev never reaches 2 rev/s at 1 rev/s^2
+    TEST_ASSERT_EQUAL_UINT32(2000, motionTime(1, 2, 1));
+}
+
+
+void test_motion_scale() {
+    TEST_ASSERT_EQUAL_FLOAT(1, motionScale(10, 2, 2, 0));     // As fast as possible
+    TEST_ASSERT_EQUAL_FLOAT(1, motionScale(10, 2, 2, 3000));  // Can't make it, arrives late
+    TEST_ASSERT_FLOAT_WITHIN(1e-4, 0.5, motionScale(10, 2, 2, 12000));
+    TEST_ASSERT_EQUAL_FLOAT(MOTION_SCALE_MIN, motionScale(10, 2, 2, MOTION_DURATION_MAX));
+    // The scaled profile takes the duration
+    float k = motionScale(3, 1.5, 0.75, 9000);
+    TEST_ASSERT_UINT32_WITHIN(2, 9000, motionTime(3, 1.5 * k, 0.75 * k * k));
+}
+
+
+void test_motion_remaining() {
+    TEST_ASSERT_EQUAL_UINT32(5000, motionRemaining(5000, -200));  // Starts later
+    TEST_ASSERT_EQUAL_UINT32(5000, motionRemaining(5000, 0));
+    TEST_ASSERT_EQUAL_UINT32(4800, motionRemaining(5000, 200));
+    TEST_ASSERT_EQUAL_UINT32(0, motionRemaining(5000, 6000));
+}
+
+
+void test_position_to_step() {
+    // 4096 positions and 400 steps per rev, rounded to the nearest step
+    TEST_ASSERT_EQUAL_INT32(0, motionPositionToStep(0, 400, 12));
+    TEST_ASSERT_EQUAL_INT32(400, motionPositionToStep(4096, 400, 12));
+    TEST_ASSERT_EQUAL_INT32(1, motionPositionToStep(6, 400, 12));
+    TEST_ASSERT_EQUAL_INT32(0, motionPositionToStep(5, 400, 12));
+    TEST_ASSERT_EQUAL_INT32(-400, motionPositionToStep(-4096, 400, 12));
+    // No overflow over many revolutions at high microsteps
+    TEST_ASSERT_EQUAL_INT32(100 * 51200, motionPositionToStep(100 * 4096, 51200, 12));
+}
+
+
+void test_percent() {
+    TEST_ASSERT_EQUAL_INT(0, motionPercent(0, 40960));
+    TEST_ASSERT_EQUAL_INT(100, motionPercent(40960, 40960));
+    TEST_ASSERT_EQUAL_INT(50, motionPercent(20480, 40960));
+    TEST_ASSERT_EQUAL_INT(1, motionPercent(205, 40960));  // Rounded
+    for (int percent = 0; percent <= 100; percent++) {
+        TEST_ASSERT_EQUAL_INT(percent, motionPercent(motionPercentToPosition(percent, 40960), 40960));
+    }
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_motion_time);
+    RUN_TEST(test_motion_scale);
+    RUN_TEST(test_motion_remaining);
+    RUN_TEST(test_position_to_step);
+    RUN_TEST(test_percent);
+    return UNITY_END();
+}
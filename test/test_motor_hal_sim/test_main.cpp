@@ -0,0 +1,159 @@
+// Moves and stalls of the simulated motor policies, see src/motor_hal_sim.h. The model runs on the
+// host's clock, so each test waits for its move like MotorTask would.
+#include <unity.h>
+#include <chrono>
+#include <thread>
+#include "motor_hal_sim.h"
+
+
+#define STEPS_PER_REV (SIM_FULL_STEPS * 2)  // At the default 2 microsteps
+
+
+static SimDriver  *driver;
+static SimPulser  *pulser;
+static SimEncoder *encoder;
+
+
+// Waits until the move has finished, false if it takes longer than the timeout
+static bool waitForStop(int timeout_ms) {
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(timeout_ms);
+    while (pulser->isRunning()) {
+        if (std::chrono::steady_clock::now() > end) {
+            return false;
+        }
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    return true;
+}
+
+
+void setUp() {
+    sim_motors[0] = SimMotor();
+    driver = new SimDriver(0);
+    pulser = new SimPulser(0);
+    encoder = new SimEncoder(0);
+    driver->begin();
+    driver->startup(false);
+    pulser->begin([](uint8_t, uint8_t value) {
+        driver->enableCoils(value == 1);
+        return value == 1;
+    });
+    encoder->begin();
+    encoder->resetCumulativePosition(0);
+    pulser->setSpeedInHz(8 * STEPS_PER_REV);
+    pulser->setAcceleration(80 * STEPS_PER_REV);
+}
+
+
+void tearDown() {
+    delete encoder;
+    delete pulser;
+    delete driver;
+}
+
+
+void test_move_reaches_target() {
+    pulser->moveTo(2 * STEPS_PER_REV);
+    TEST_ASSERT_TRUE(pulser->isRunning());
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    TEST_ASSERT_EQUAL_INT32(2 * STEPS_PER_REV, pulser->getCurrentPosition());
+    TEST_ASSERT_INT32_WITHIN(1, 2 * SIM_ENCODER_COUNTS, encoder->getCumulativePosition());
+}
+
+
+void test_move_back_and_forth() {
+    pulser->moveTo(STEPS_PER_REV);
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    pulser->moveTo(-STEPS_PER_REV / 4);
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    TEST_ASSERT_EQUAL_INT32(-STEPS_PER_REV / 4, pulser->getCurrentPosition());
+    TEST_ASSERT_INT32_WITHIN(1, -SIM_ENCODER_COUNTS / 4, encoder->getCumulativePosition());
+}
+
+
+void test_coils_disabled_after_stop() {
+    pulser->moveTo(STEPS_PER_REV / 2);
+    TEST_ASSERT_TRUE(sim_motors[0].coils);
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    std::this_thread::sleep_for(std::chrono::milliseconds(SIM_DELAY_TO_DISABLE + 50));
+    pulser->isRunning();
+    TEST_ASSERT_FALSE(sim_motors[0].coils);
+}
+
+
+void test_shaft_doesnt_turn_in_standby() {
+    driver->standby();
+    pulser->moveTo(STEPS_PER_REV);
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    TEST_ASSERT_EQUAL_INT32(STEPS_PER_REV, pulser->getCurrentPosition());
+    TEST_ASSERT_EQUAL_INT32(0, encoder->getCumulativePosition());
+}
+
+
+void test_force_stop() {
+    pulser->runForward();
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    pulser->forceStop();
+    int32_t stopped = pulser->getCurrentPosition();
+    TEST_ASSERT_FALSE(pulser->isRunning());
+    TEST_ASSERT_TRUE(stopped > 0);
+    std::this_thread::sleep_for(std::chrono::milliseconds(20));
+    TEST_ASSERT_EQUAL_INT32(stopped, pulser->getCurrentPosition());
+}
+
+
+// Like FastAccelStepper, correcting the position keeps the distance left to the target
+void test_set_current_position_keeps_distance() {
+    pulser->setSpeedInHz(STEPS_PER_REV);
+    pulser->moveTo(4 * STEPS_PER_REV);
+    std::this_thread::sleep_for(std::chrono::milliseconds(50));
+    int32_t position = pulser->getCurrentPosition();
+    pulser->setCurrentPosition(position + 100);
+    pulser->forceStop();
+    TEST_ASSERT_INT32_WITHIN(2, position + 100, pulser->getCurrentPosition());
+}
+
+
+void test_stall_at_limit_with_stallguard() {
+    pulser->setSpeedInHz(40 * STEPS_PER_REV);
+    pulser->setAcceleration(400 * STEPS_PER_REV);
+    driver->enableStallguard(0, 10);
+    TEST_ASSERT_FALSE(driver->takeStall());
+    TEST_ASSERT_EQUAL_UINT16(SIM_STALLGUARD_FREE, driver->stallguardResult());
+    pulser->runForward();
+    auto end = std::chrono::steady_clock::now() + std::chrono::milliseconds(3000);
+    while (!sim_motors[0].stalled && std::chrono::steady_clock::now() < end) {
+        pulser->isRunning();
+        std::this_thread::sleep_for(std::chrono::milliseconds(1));
+    }
+    pulser->forceStop();
+    TEST_ASSERT_TRUE(driver->takeStall());
+    TEST_ASSERT_FALSE(driver->takeStall());  // Reported once
+    TEST_ASSERT_EQUAL_UINT16(0, driver->stallguardResult());
+    TEST_ASSERT_INT32_WITHIN(1, SIM_LIMIT_HIGH * SIM_ENCODER_COUNTS, encoder->getCumulativePosition());
+}
+
+
+void test_no_stall_without_stallguard() {
+    pulser->setSpeedInHz(40 * STEPS_PER_REV);
+    pulser->setAcceleration(400 * STEPS_PER_REV);
+    pulser->moveTo(-STEPS_PER_REV);  // Past the low limit
+    TEST_ASSERT_TRUE(waitForStop(2000));
+    TEST_ASSERT_FALSE(driver->takeStall());
+    TEST_ASSERT_EQUAL_UINT16(0, driver->stallguardResult());
+    TEST_ASSERT_INT32_WITHIN(1, SIM_LIMIT_LOW * SIM_ENCODER_COUNTS, encoder->getCumulativePosition());
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_move_reaches_target);
+    RUN_TEST(test_move_back_and_forth);
+    RUN_TEST(test_coils_disabled_after_stop);
+    RUN_TEST(test_shaft_doesnt_turn_in_standby);
+    RUN_TEST(test_force_stop);
+    RUN_TEST(test_set_current_position_keeps_distance);
+    RUN_TEST(test_stall_at_limit_with_stallguard);
+    RUN_TEST(test_no_stall_without_stallguard);
+    return UNITY_END();
+}
@@ -0,0 +1,222 @@
+// Schedules of src/schedule.h: the file they are kept in, and the timer wheel against a brute
+// force search of the next run, in Berlin over the change to summer time
+#include <unity.h>
+#include "schedule.cpp"
+#include "solar.cpp"
+
+
+#define START 1711600000  // s since epoch, 2024-03-28, 3 days before the change to summer time
+
+
+static uint64_t now_ms = 0;
+
+bool clockSynced() { return now_ms != 0; }
+uint64_t clockNow() { return now_ms; }
+
+
+// The next run strictly after a minute since epoch, looking at every minute or day
+static uint32_t nextRunOf(const Schedule &schedule, uint32_t after) {
+    if (schedule.trigger != SCHEDULE_TIME) {
+        uint32_t next = UINT32_MAX;
+        for (int day = -2; day < 10; day++) {
+            time_t at = static_cast<time_t>(after + 1) * 60 + day * 86400;
+            struct tm local;
+            localtime_r(&at, &local);
+            if (!(schedule.weekdays >> local.tm_wday & 1)) continue;
+            uint32_t sun = solarEventTime(local.tm_year + 1900, local.tm_yday,
+                                          schedule.trigger == SCHEDULE_SUNRISE ? SOLAR_SUNRISE
+                                                                               : SOLAR_SUNSET);
+            if (sun == UINT32_MAX) continue;
+            sun += schedule.minute;
+            if (sun > after && sun < next) next = sun;
+        }
+        return next;
+    }
+    for (uint32_t minute = after + 1; minute < after + 9 * 1440; minute++) {
+        time_t at = static_cast<time_t>(minute) * 60;
+        struct tm local;
+        localtime_r(&at, &local);
+        if (local.tm_hour * 60 + local.tm_min == schedule.minute
+            && schedule.weekdays >> local.tm_wday & 1) {
+            return minute;
+        }
+    }
+    return UINT32_MAX;
+}
+
+
+static void writeFile(const void *data, size_t size) {
+    File file = LITTLEFS.open(SCHEDULE_PATH, FILE_WRITE);
+    file.write(reinterpret_cast<const uint8_t*>(data), size);
+    file.close();
+}
+
+
+static int loaded() {
+    int count = 0;
+    for (int i = 0; i < SCHEDULE_MAX; i++) {
+        count += used[i];
+    }
+    return count;
+}
+
+
+// A boot: only the file is left
+static void reboot() {
+    memset(used, 0, sizeof(used));
+    rebuild = true;
+    scheduleInit();
+}
+
+
+void setUp() {
+    LITTLEFS.remove(SCHEDULE_PATH);
+    reboot();
+    now_ms = static_cast<uint64_t>(START) * 1000;
+}
+
+
+void tearDown() {}
+
+
+void test_saved_behind_a_header() {
+    scheduleAdd(SCHEDULE_TIME, 0x3e, 7 * 60 + 30, 100, -1);
+    scheduleAdd(SCHEDULE_SUNSET, 0x7f, -15, 0, 1);
+    File file = LITTLEFS.open(SCHEDULE_PATH, FILE_READ);
+    ScheduleHeader header;
+    TEST_ASSERT_EQUAL(sizeof(header), file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)));
+    TEST_ASSERT_EQUAL(sizeof(header) + 2 * sizeof(Schedule), file.size());
+    file.close();
+    TEST_ASSERT_EQUAL_UINT32(SCHEDULE_MAGIC, header.magic);
+    TEST_ASSERT_EQUAL(SCHEDULE_VERSION, header.version);
+    TEST_ASSERT_EQUAL(sizeof(Schedule), header.record_size);
+    TEST_ASSERT_EQUAL(2, header.count);
+
+    reboot();
+    TEST_ASSERT_EQUAL(2, loaded());
+    TEST_ASSERT_EQUAL(7 * 60 + 30, schedules[0].minute);
+    TEST_ASSERT_EQUAL(SCHEDULE_SUNSET, schedules[1].trigger);
+    TEST_ASSERT_EQUAL(-15, schedules[1].minute);
+    TEST_ASSERT_EQUAL(1, schedules[1].motor);
+}
+
+
+// Files of the firmware before the header was added
+void test_headerless_file_discarded() {
+    Schedule records[2] = {{0, 0x7f, 480, 100, -1, SCHEDULE_TIME}, {1, 0x7f, 1200, 0, -1, SCHEDULE_TIME}};
+    writeFile(records, sizeof(records));
+    reboot();
+    TEST_ASSERT_EQUAL(0, loaded());
+}
+
+
+void test_other_version_discarded() {
+    struct {
+        ScheduleHeader header;
+        Schedule record;
+    } file = {{SCHEDULE_MAGIC, SCHEDULE_VERSION + 1, sizeof(Schedule), 1},
+              {0, 0x7f, 480, 100, -1, SCHEDULE_TIME}};
+    writeFile(&file, sizeof(file));
+    reboot();
+    TEST_ASSERT_EQUAL(0, loaded());
+
+    file.header.version = SCHEDULE_VERSION;
+    file.header.record_size = sizeof(Schedule) + 2;
+    writeFile(&file, sizeof(file));
+    reboot();
+    TEST_ASSERT_EQUAL(0, loaded());
+}
+
+
+// A truncated file loads the records that are there, invalid records are skipped
+void test_truncated_file_loads_what_is_there() {
+    struct {
+        ScheduleHeader header;
+        Schedule records[2];
+    } file = {{SCHEDULE_MAGIC, SCHEDULE_VERSION, sizeof(Schedule), 5},
+              {{3, 0x7f, 480, 100, -1, SCHEDULE_TIME}, {4, 0, 480, 100, -1, SCHEDULE_TIME}}};
+    writeFile(&file, sizeof(file));
+    reboot();
+    TEST_ASSERT_EQUAL(1, loaded());
+    TEST_ASSERT_TRUE(used[3]);
+}
+
+
+// Runs while the system sleeps until the time scheduleRun() returns, for 40 days
+void test_runs_when_due() {
+    setenv("TZ", "CET-1CEST,M3.5.0,M10.5.0/3", 1);
+    tzset();
+    solarSetLocation(52.52, 13.4);
+    srand(1);
+    for (int i = 0; i < 12; i++) {
+        uint8_t weekdays = 1 + rand() % 127;
+        if (i % 3 == 0) {
+            scheduleAdd(SCHEDULE_TIME, weekdays, rand() % 1440, rand() % 101, -1);
+        } else {
+            scheduleAdd(i % 3 == 1 ? SCHEDULE_SUNRISE : SCHEDULE_SUNSET, weekdays, rand() % 241 - 120,
+                        rand() % 101, -1);
+        }
+    }
+    now_ms += 12345;
+    uint32_t expected[SCHEDULE_MAX];
+    for (int i = 0; i < 12; i++) {
+        expected[i] = nextRunOf(schedules[i], START / 60 - 1);
+    }
+
+    int runs = 0;
+    int wrong = 0;
+    std::function<void(const Schedule&)> action = [&](const Schedule &schedule) {
+        uint32_t minute = now_ms / 60000;
+        wrong += expected[schedule.id] != minute;
+        expected[schedule.id] = nextRunOf(schedule, minute);
+        runs++;
+    };
+    while (now_ms < (START + 40 * 86400ULL) * 1000) {
+        uint32_t until = scheduleRun(action);
+        uint32_t next = UINT32_MAX;
+        for (int i = 0; i < 12; i++) {
+            next = min(next, expected[i]);
+        }
+        TEST_ASSERT_TRUE(now_ms + until <= static_cast<uint64_t>(next) * 60000);  // Not slept past
+        now_ms += max(until, 1000U);
+    }
+    TEST_ASSERT_EQUAL(0, wrong);
+    TEST_ASSERT_TRUE(runs > 200);
+    solarClearLocation();
+}
+
+
+void test_to_json() {
+    scheduleAdd(SCHEDULE_TIME, 0x3e, 7 * 60 + 5, 100, -1);
+    scheduleAdd(SCHEDULE_SUNRISE, 0x41, 30, 0, 1);
+    scheduleRun([](const Schedule&) {});
+    JsonArray json;
+    scheduleToJson(json);
+    TEST_ASSERT_EQUAL(2, json.size());
+    std::string time = json[0].get("time");
+    TEST_ASSERT_EQUAL_STRING("\"07:05\"", time.c_str());
+    std::string days = json[0].get("days");
+    TEST_ASSERT_EQUAL_STRING("62", days.c_str());
+    std::string motor = json[0].get("motor");
+    TEST_ASSERT_EQUAL_STRING("", motor.c_str());
+    std::string next = json[0].get("next");
+    TEST_ASSERT_TRUE(next != "");
+    std::string sunrise = json[1].get("sunrise");
+    TEST_ASSERT_EQUAL_STRING("30", sunrise.c_str());
+    motor = json[1].get("motor");
+    TEST_ASSERT_EQUAL_STRING("1", motor.c_str());
+    next = json[1].get("next");
+    TEST_ASSERT_EQUAL_STRING("", next.c_str());  // Not without a location
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_saved_behind_a_header);
+    RUN_TEST(test_headerless_file_discarded);
+    RUN_TEST(test_other_version_discarded);
+    RUN_TEST(test_truncated_file_loads_what_is_there);
+    RUN_TEST(test_runs_when_due);
+    RUN_TEST(test_to_json);
+    return UNITY_END();
+}
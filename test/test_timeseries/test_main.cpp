@@ -0,0 +1,215 @@
+// The rings of src/timeseries.h over two boots of a unit: the first synchronized right away, the
+// second counted from boot until the clock is synchronized, then rebased onto the stored rings
+#include <unity.h>
+#include <vector>
+#include "timeseries.cpp"
+
+
+#define START 1750000000  // s since epoch the first boot is synchronized at
+
+
+static bool synced = false;
+static int64_t boot_epoch = START;  // s, of esp_timer 0
+
+bool clockSynced() { return synced; }
+uint64_t clockNow() { return synced ? (boot_epoch * 1000000 + mockMicros()) / 1000 : 0; }
+
+
+static int16_t valueAt(uint32_t epoch) { return epoch / 60 % 100; }
+
+
+// A second of the unit: a sample of the epoch's value, the timer and the system task's loop
+static void second() {
+    mockMicros() += 1000000;
+    timeseriesSample(SERIES_POSITION, valueAt(boot_epoch + mockMicros() / 1000000));
+    mockTimerCallback()(NULL);
+    timeseriesFlush();
+}
+
+
+static void run(int seconds) {
+    for (int i = 0; i < seconds; i++) {
+        second();
+    }
+}
+
+
+static uint32_t now() { return boot_epoch + mockMicros() / 1000000; }
+
+
+// The values of a query, "null" for missing buckets, and the time of the first one
+static std::vector<std::string> query(uint32_t resolution, uint32_t from, uint32_t to,
+                                      uint32_t &first) {
+    Print output;
+    timeseriesQuery(output, SERIES_POSITION, resolution, from, to);
+    sscanf(output.text.c_str() + output.text.find("\"from\":") + 7, "%u", &first);
+    std::string list = output.text.substr(output.text.find('[') + 1);
+    list = list.substr(0, list.find(']'));
+    std::vector<std::string> values;
+    for (size_t at = 0; at < list.size();) {
+        size_t comma = list.find(',', at);
+        if (comma == std::string::npos) comma = list.size();
+        values.push_back(list.substr(at, comma - at));
+        at = comma + 1;
+    }
+    return values;
+}
+
+
+static int wrong(const std::vector<std::string> &values, uint32_t first, uint32_t resolution,
+                 size_t from, size_t to) {
+    int count = 0;
+    for (size_t i = from; i < to && i < values.size(); i++) {
+        count += values[i] != std::to_string(valueAt(first + resolution * i));
+    }
+    return count;
+}
+
+
+// What a reboot leaves of the state: the files
+static void reboot(int64_t epoch) {
+    for (size_t i = 0; i < ring_count; i++) {
+        rings[i].valid = false;
+        rings[i].last = 0;
+        rings[i].dirty = 0;
+    }
+    ring_flags = TIMESERIES_UPTIME;
+    flush_now = false;
+    rebase_now = false;
+    synced = false;
+    boot_epoch = epoch;
+    mockMicros() = 0;
+    timeseriesInit();
+}
+
+
+static const uint32_t first_end = START + 3 * 3600 + 30;  // Of the first boot
+static const uint32_t stored_to = first_end / 3600 * 3600;  // Last flush of the first boot
+static const int64_t second_boot = first_end + 600;
+
+
+void setUp() {
+    mockFileOpsLocked() = 0;
+}
+
+
+void tearDown() {
+    TEST_ASSERT_EQUAL(0, mockMutexesHeld());
+    TEST_ASSERT_EQUAL_MESSAGE(0, mockFileOpsLocked(), "file operations under the mutex");
+}
+
+
+// Synchronized right away, runs 3 hours so both stored rings are written
+void test_first_boot() {
+    synced = true;
+    timeseriesInit();
+    run(first_end - START);
+    uint32_t first;
+    std::vector<std::string> minutes = query(60, START + 3600, START + 7200, first);
+    TEST_ASSERT_EQUAL(61, minutes.size());
+    TEST_ASSERT_EQUAL(0, wrong(minutes, first, 60, 0, minutes.size()));
+    TEST_ASSERT_TRUE(LITTLEFS.exists(TIMESERIES_DIRECTORY "/minute.bin"));
+    TEST_ASSERT_TRUE(LITTLEFS.exists(TIMESERIES_DIRECTORY "/hour.bin"));
+}
+
+
+// Boots 10 minutes after the first one ended, counted from boot for 2 minutes
+void test_counted_from_boot() {
+    reboot(second_boot);
+    run(120);
+    uint32_t first;
+    std::vector<std::string> seconds = query(1, 0, 1000, first);
+    TEST_ASSERT_TRUE(first < 200);
+    TEST_ASSERT_TRUE(seconds.size() > 100);
+}
+
+
+void test_rebased_on_sync() {
+    synced = true;
+    run(5);
+    uint32_t first;
+    std::vector<std::string> kept = query(1, now() - 299, now(), first);
+    TEST_ASSERT_EQUAL(299, kept.size());  // The current second is still accumulated
+    size_t booted = second_boot - first;  // Missing before
+    TEST_ASSERT_EQUAL_STRING("null", kept[booted - 1].c_str());
+    TEST_ASSERT_EQUAL(0, wrong(kept, first, 1, booted + 1, kept.size() - 1));
+}
+
+
+void test_seconds_line_up() {
+    run(295);
+    uint32_t first;
+    std::vector<std::string> seconds = query(1, now() - 299, now(), first);
+    TEST_ASSERT_TRUE(seconds.size() >= 299);
+    TEST_ASSERT_EQUAL(0, wrong(seconds, first, 1, 0, seconds.size() - 1));
+}
+
+
+// The stored minutes, the missing ones while the unit was off, then the ones since boot
+void test_stored_minutes_filled_in() {
+    uint32_t first;
+    std::vector<std::string> minutes = query(60, START, now(), first);
+    TEST_ASSERT_EQUAL(START / 60 * 60, first);
+    int stored = 0;
+    int off = 0;
+    int booted = 0;
+    for (size_t i = 0; i < minutes.size(); i++) {
+        uint32_t at = first + 60 * i;
+        if (at <= stored_to) {
+            stored++;
+            TEST_ASSERT_EQUAL_STRING(std::to_string(valueAt(at)).c_str(), minutes[i].c_str());
+        } else if (at < second_boot - 60) {
+            off++;
+            TEST_ASSERT_EQUAL_STRING("null", minutes[i].c_str());
+        } else if (at >= second_boot && at + 60 <= now()) {
+            booted++;
+            TEST_ASSERT_EQUAL_STRING(std::to_string(valueAt(at)).c_str(), minutes[i].c_str());
+        }
+    }
+    TEST_ASSERT_TRUE(stored >= 170);
+    TEST_ASSERT_TRUE(off >= 9);
+    TEST_ASSERT_TRUE(booted >= 6);
+
+    std::vector<std::string> hours = query(3600, START, now(), first);
+    TEST_ASSERT_TRUE(hours.size() >= 3);
+    TEST_ASSERT_TRUE(hours[1] != "null");
+}
+
+
+// The next flush writes what was rebased, from the epoch
+void test_written_after_rebase() {
+    run(3600);
+    File file = LITTLEFS.open(TIMESERIES_DIRECTORY "/minute.bin", FILE_READ);
+    RingHeader header;
+    TEST_ASSERT_EQUAL(sizeof(header), file.read(reinterpret_cast<uint8_t*>(&header), sizeof(header)));
+    file.close();
+    TEST_ASSERT_EQUAL_UINT32(TIMESERIES_MAGIC, header.magic);
+    TEST_ASSERT_EQUAL(0, header.flags);
+    TEST_ASSERT_EQUAL_UINT32(now() / 3600 * 60, header.last);
+}
+
+
+// And loads again at the next boot
+void test_loaded_at_next_boot() {
+    uint32_t written = now() / 3600 * 3600;
+    reboot(now() + 60);
+    synced = true;
+    run(5);
+    uint32_t first;
+    std::vector<std::string> minutes = query(60, START, written, first);
+    TEST_ASSERT_EQUAL(START / 60 * 60, first);
+    TEST_ASSERT_EQUAL(0, wrong(minutes, first, 60, 0, (stored_to - first) / 60));
+}
+
+
+int main() {
+    UNITY_BEGIN();
+    RUN_TEST(test_first_boot);
+    RUN_TEST(test_counted_from_boot);
+    RUN_TEST(test_rebased_on_sync);
+    RUN_TEST(test_seconds_line_up);
+    RUN_TEST(test_stored_minutes_filled_in);
+    RUN_TEST(test_written_after_rebase);
+    RUN_TEST(test_loaded_at_next_boot);
+    return UNITY_END();
+}